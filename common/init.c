@@ -43,6 +43,7 @@
 #include <gcrypt.h>
 #include "util.h"
 #include "i18n.h"
+#include "radix64.h"
 #include "w32help.h"
 
 /* This object is used to register memory cleanup functions.
@@ -188,6 +189,9 @@ _init_common_subsystems (gpg_err_source_t errsource, int *argcp, char ***argvp)
   gpgrt_init ();
   gpgrt_set_alloc_func (gcry_realloc);
 
+  /* Set up the radix64 tables while we are still single threaded.  */
+  radix64_init ();
+
 
 #ifdef HAVE_W32_SYSTEM
   /* We want gettext to always output UTF-8 and we put the console in
@@ -31,6 +31,12 @@
  */
 
 #include <config.h>
+
+#ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
+# undef HAVE_NPTH
+# undef USE_NPTH
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +46,21 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#if !defined(HAVE_W32_SYSTEM) && (defined(HAVE_COPY_FILE_RANGE)  \
+                                  || defined(HAVE_SPLICE)          \
+                                  || defined(HAVE_SENDFILE))
+# define USE_KERNEL_COPY 1
+#endif
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_MMAP_INPUT 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -50,6 +71,9 @@
 # include <kernel.h>
 # include <swis.h>
 #endif /* __riscos__ */
+#ifdef HAVE_NPTH
+# include <npth.h>
+#endif
 
 #include <assuan.h>
 
@@ -70,6 +94,15 @@
    instead of the internal buffers. */
 #define IOBUF_ZEROCOPY_THRESHOLD_SIZE 1024
 
+/* The default and the maximum number of buffers used by the thread
+   filter to hand over data between its threads.  */
+#define DEFAULT_THREAD_FILTER_SLOTS 4
+#define MAX_THREAD_FILTER_SLOTS     64
+
+/* The maximum number of bytes to hand to the kernel with one call to
+   copy_file_range, splice or sendfile.  */
+#define MAX_KERNEL_COPY_SIZE (1024*1024*1024)
+
 /*-- End configurable part.  --*/
 
 /* The size of the iobuffers.  This can be changed using the
@@ -98,6 +131,11 @@ typedef struct
   char peeked[32];     /* Read ahead buffer.  */
   byte npeeked;        /* Number of bytes valid in peeked.  */
   byte upeeked;        /* Number of bytes used from peeked.  */
+#ifdef USE_MMAP_INPUT
+  byte *map;           /* Read-only mapping of the file or NULL.  */
+  size_t maplen;       /* Length of the mapping.  */
+  size_t mapoff;       /* Offset of the next byte to read from it.  */
+#endif
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -162,11 +200,49 @@ typedef struct
 }
 block_filter_ctx_t;
 
+/* The context we use for the thread filter.  The SLOTS form a ring
+ * which is filled by a producer and drained by a consumer.  For an
+ * output pipeline the producer is the caller and the consumer the
+ * worker thread, which writes the data to CHAIN; for an input
+ * pipeline the worker reads ahead from CHAIN and the caller consumes
+ * the data.  HEAD is only changed by the producer, TAIL and OFFSET
+ * only by the consumer; all other fields but USE, CHAIN and the
+ * flags STARTED and RUNNING are protected by MUTEX.  */
+typedef struct
+{
+  int use;             /* IOBUF_INPUT or IOBUF_OUTPUT.  */
+  iobuf_t chain;       /* The part of the pipeline run by the worker.  */
+  unsigned int started:1;  /* Start of the worker has been tried.  */
+  unsigned int running:1;  /* The worker thread needs to be joined.  */
+#ifdef HAVE_NPTH
+  npth_t thd;
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+#endif
+  int eof;             /* The producer won't put more data into the ring.  */
+  int stop;            /* Ask the worker to terminate.  */
+  int err;             /* The first error seen by the worker.  */
+  unsigned int nslots; /* Number of slots in the ring.  */
+  unsigned int head;   /* Index of the next slot to fill.  */
+  unsigned int tail;   /* Index of the next slot to drain.  */
+  unsigned int count;  /* Number of filled slots.  */
+  size_t offset;       /* Bytes already consumed from the tail slot.  */
+  size_t slotsize;     /* Allocated size of each slot's buffer.  */
+  struct {
+    size_t len;
+    byte *buf;
+  } *slots;
+}
+thread_filter_ctx_t;
+
 
 /* Local prototypes.  */
 static int underflow (iobuf_t a, int clear_pending_eof);
 static int underflow_target (iobuf_t a, int clear_pending_eof, size_t target);
 static iobuf_t do_iobuf_fdopen (gnupg_fd_t fp, const char *mode, int keep_open);
+#ifdef USE_MMAP_INPUT
+static void file_filter_unmap (file_filter_ctx_t *a);
+#endif
 
 
 /* Sends any pending data to the filter's FILTER function.  Note: this
@@ -468,6 +544,24 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
   if (control == IOBUFCTRL_UNDERFLOW)
     {
       log_assert (size); /* We need a buffer.  */
+#ifdef USE_MMAP_INPUT
+      if (a->map)
+        {
+          nbytes = a->maplen - a->mapoff;
+          if (nbytes > size)
+            nbytes = size;
+          if (nbytes)
+            {
+              memcpy (buf, a->map + a->mapoff, nbytes);
+              a->mapoff += nbytes;
+              *ret_len = nbytes;
+              return 0;
+            }
+          /* Continue with read(2) so that data appended after
+           * mapping the file is not lost.  */
+          file_filter_unmap (a);
+        }
+#endif /*USE_MMAP_INPUT*/
       if (a->npeeked > a->upeeked)
         {
           nbytes = a->npeeked - a->upeeked;
@@ -522,11 +616,13 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 
 	  nbytes = 0;
         read_more:
+          iobuf_unprotect ();
           do
             {
               n = read (f, buf + nbytes, size - nbytes);
             }
           while (n == -1 && errno == EINTR);
+          iobuf_protect ();
           if (n > 0)
             {
               nbytes += n;
@@ -589,11 +685,13 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	  nbytes = size;
 	  do
 	    {
+	      iobuf_unprotect ();
 	      do
 		{
 		  n = write (f, p, nbytes);
 		}
 	      while (n == -1 && errno == EINTR);
+	      iobuf_protect ();
 	      if (n > 0)
 		{
 		  p += n;
@@ -619,10 +717,30 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->no_cache = 0;
       a->npeeked = 0;
       a->upeeked = 0;
+#ifdef USE_MMAP_INPUT
+      a->map = NULL;
+      a->maplen = 0;
+      a->mapoff = 0;
+#endif
     }
   else if (control == IOBUFCTRL_PEEK)
     {
       /* Peek on the input.  */
+#ifdef USE_MMAP_INPUT
+      if (a->map)
+        {
+          nbytes = a->maplen - a->mapoff;
+          if (nbytes > size)
+            nbytes = size;
+          if (nbytes)
+            {
+              memcpy (buf, a->map + a->mapoff, nbytes);
+              *ret_len = nbytes;
+              return 0;
+            }
+          file_filter_unmap (a);
+        }
+#endif /*USE_MMAP_INPUT*/
 #ifdef HAVE_W32_SYSTEM
       unsigned long nread;
 
@@ -692,6 +810,9 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_MMAP_INPUT
+      file_filter_unmap (a);
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -706,6 +827,64 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 }
 
 
+#ifdef USE_MMAP_INPUT
+/* Map the file of the file filter A into memory if it is a regular
+ * file larger than our buffers.  The file filter then takes the data
+ * from the current file position on from the mapping instead of
+ * using read.  Returns 0 if the file has been mapped.  */
+static int
+file_filter_map (file_filter_ctx_t *a)
+{
+  struct stat st;
+  off_t pos;
+  void *p;
+
+  if (a->map)
+    return 0;
+  if (a->npeeked > a->upeeked || a->eof_seen || a->delayed_rc)
+    return -1;
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode)
+      || st.st_size <= iobuf_buffer_size
+      || (uint64_t)st.st_size > (SIZE_MAX >> 2))
+    return -1;
+  pos = lseek (a->fp, 0, SEEK_CUR);
+  if (pos == (off_t)(-1) || pos >= st.st_size)
+    return -1;
+
+  p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, a->fp, 0);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", a->fname, strerror (errno));
+      return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, st.st_size, MADV_SEQUENTIAL);
+#endif
+  a->map = p;
+  a->maplen = st.st_size;
+  a->mapoff = pos;
+  return 0;
+}
+
+
+/* Release the mapping of the file filter A and move the file position
+ * to the first byte not yet taken from the mapping.  */
+static void
+file_filter_unmap (file_filter_ctx_t *a)
+{
+  if (!a->map)
+    return;
+  if (lseek (a->fp, a->mapoff, SEEK_SET) == (off_t)(-1))
+    log_error ("%s: can't lseek: %s\n", a->fname, strerror (errno));
+  munmap (a->map, a->maplen);
+  a->map = NULL;
+  a->maplen = 0;
+  a->mapoff = 0;
+}
+#endif /*USE_MMAP_INPUT*/
+
+
 /* Similar to file_filter but using the estream system.  */
 static int
 file_es_filter (void *opaque, int control, iobuf_t chain, byte * buf,
@@ -1203,6 +1382,332 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 }
 
 
+#ifdef HAVE_NPTH
+static void
+thread_filter_lock (thread_filter_ctx_t *a)
+{
+  int rc = npth_mutex_lock (&a->mutex);
+  if (rc)
+    log_fatal ("thread_filter: failed to acquire mutex: %s\n",
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+thread_filter_unlock (thread_filter_ctx_t *a)
+{
+  int rc = npth_mutex_unlock (&a->mutex);
+  if (rc)
+    log_fatal ("thread_filter: failed to release mutex: %s\n",
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The worker thread of an output thread filter.  It drains the ring
+ * into the rest of the pipeline until the producer signals EOF.  */
+static void *
+thread_filter_writer (void *arg)
+{
+  thread_filter_ctx_t *a = arg;
+  int rc;
+
+  thread_filter_lock (a);
+  for (;;)
+    {
+      while (!a->count && !a->eof && !a->stop)
+        npth_cond_wait (&a->cond, &a->mutex);
+      if (a->stop || !a->count)
+        break;
+      thread_filter_unlock (a);
+
+      rc = iobuf_write (a->chain, a->slots[a->tail].buf,
+                        a->slots[a->tail].len);
+
+      thread_filter_lock (a);
+      if (rc)
+        {
+          a->err = rc;
+          break;
+        }
+      a->tail = (a->tail + 1) % a->nslots;
+      a->count--;
+      npth_cond_broadcast (&a->cond);
+    }
+  npth_cond_broadcast (&a->cond);
+  thread_filter_unlock (a);
+  return NULL;
+}
+
+
+/* The worker thread of an input thread filter.  It reads ahead from
+ * the rest of the pipeline as long as there are free slots.  */
+static void *
+thread_filter_reader (void *arg)
+{
+  thread_filter_ctx_t *a = arg;
+  int n;
+
+  thread_filter_lock (a);
+  for (;;)
+    {
+      while (a->count == a->nslots && !a->stop)
+        npth_cond_wait (&a->cond, &a->mutex);
+      if (a->stop)
+        break;
+      thread_filter_unlock (a);
+
+      n = iobuf_read (a->chain, a->slots[a->head].buf, a->slotsize);
+
+      thread_filter_lock (a);
+      if (n == -1)
+        {
+          a->err = iobuf_error (a->chain);
+          break;
+        }
+      if (!n)
+        continue;
+      a->slots[a->head].len = n;
+      a->head = (a->head + 1) % a->nslots;
+      a->count++;
+      npth_cond_broadcast (&a->cond);
+    }
+  a->eof = 1;
+  npth_cond_broadcast (&a->cond);
+  thread_filter_unlock (a);
+  return NULL;
+}
+#endif /*HAVE_NPTH*/
+
+
+/* Start the worker thread of the thread filter A for the pipeline
+ * CHAIN.  If that is not possible, the filter silently falls back to
+ * passing the data through in the caller's thread.  */
+static void
+thread_filter_start (thread_filter_ctx_t *a, iobuf_t chain)
+{
+#ifdef HAVE_NPTH
+  void (*pre_syscall)(void);
+  void (*post_syscall)(void);
+  npth_attr_t tattr;
+  unsigned int i;
+  int rc;
+
+  a->started = 1;
+  a->chain = chain;
+
+  /* nPth can only be used if the application initialized it; we take
+   * the installed syscall clamp as an indication for that.  */
+  gpgrt_get_syscall_clamp (&pre_syscall, &post_syscall);
+  if (!pre_syscall)
+    return;
+
+  a->slots = xtrycalloc (a->nslots, sizeof *a->slots);
+  if (!a->slots)
+    return;
+  for (i = 0; i < a->nslots; i++)
+    if (!(a->slots[i].buf = xtrymalloc (a->slotsize)))
+      return;
+
+  if (npth_mutex_init (&a->mutex, NULL))
+    return;
+  if (npth_cond_init (&a->cond, NULL))
+    {
+      npth_mutex_destroy (&a->mutex);
+      return;
+    }
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      rc = npth_create (&a->thd, &tattr,
+                        a->use == IOBUF_OUTPUT? thread_filter_writer
+                        /**/                  : thread_filter_reader, a);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      log_error ("thread_filter: error spawning thread: %s\n",
+                 gpg_strerror (gpg_error_from_errno (rc)));
+      npth_cond_destroy (&a->cond);
+      npth_mutex_destroy (&a->mutex);
+      return;
+    }
+  a->running = 1;
+#else /*!HAVE_NPTH*/
+  a->started = 1;
+  a->chain = chain;
+#endif /*!HAVE_NPTH*/
+}
+
+
+/* Terminate the worker thread of the thread filter A.  For an output
+ * pipeline all queued data is written unless CANCEL is set.  */
+static void
+thread_filter_stop (thread_filter_ctx_t *a, int cancel)
+{
+#ifdef HAVE_NPTH
+  if (!a->running)
+    return;
+
+  thread_filter_lock (a);
+  if (cancel || a->use == IOBUF_INPUT)
+    a->stop = 1;
+  else
+    a->eof = 1;
+  npth_cond_broadcast (&a->cond);
+  thread_filter_unlock (a);
+
+  npth_join (a->thd, NULL);
+  npth_cond_destroy (&a->cond);
+  npth_mutex_destroy (&a->mutex);
+  a->running = 0;
+#else
+  (void)a;
+  (void)cancel;
+#endif
+}
+
+
+/****************
+ * This filter runs the filters below it on a separate thread and
+ * connects both threads using a ring of buffers.
+ */
+static int
+thread_filter (void *opaque, int control, iobuf_t chain, byte * buf,
+               size_t * ret_len)
+{
+  thread_filter_ctx_t *a = opaque;
+  size_t size = *ret_len;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!a->started)
+        thread_filter_start (a, chain);
+
+      if (!a->running)
+        {
+          int nread = iobuf_read (chain, buf, size);
+
+          if (nread == -1)
+            {
+              rc = iobuf_error (chain);
+              if (!rc)
+                rc = -1;
+              nread = 0;
+            }
+          *ret_len = nread;
+        }
+#ifdef HAVE_NPTH
+      else
+        {
+          thread_filter_lock (a);
+          while (!a->count && !a->eof)
+            npth_cond_wait (&a->cond, &a->mutex);
+          if (!a->count)
+            {
+              rc = a->err? a->err : -1;
+              thread_filter_unlock (a);
+              thread_filter_stop (a, 0);
+              *ret_len = 0;
+            }
+          else
+            {
+              size_t n;
+
+              thread_filter_unlock (a);
+              n = a->slots[a->tail].len - a->offset;
+              if (n > size)
+                n = size;
+              memcpy (buf, a->slots[a->tail].buf + a->offset, n);
+              a->offset += n;
+              if (a->offset == a->slots[a->tail].len)
+                {
+                  a->offset = 0;
+                  thread_filter_lock (a);
+                  a->tail = (a->tail + 1) % a->nslots;
+                  a->count--;
+                  npth_cond_broadcast (&a->cond);
+                  thread_filter_unlock (a);
+                }
+              *ret_len = n;
+            }
+        }
+#endif /*HAVE_NPTH*/
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    {
+      if (!a->started && size)
+        thread_filter_start (a, chain);
+
+      if (!a->running)
+        rc = iobuf_write (chain, buf, size);
+#ifdef HAVE_NPTH
+      else
+        {
+          while (size)
+            {
+              size_t n;
+
+              thread_filter_lock (a);
+              while (a->count == a->nslots && !a->err)
+                npth_cond_wait (&a->cond, &a->mutex);
+              rc = a->err;
+              thread_filter_unlock (a);
+              if (rc)
+                break;
+
+              n = size < a->slotsize? size : a->slotsize;
+              memcpy (a->slots[a->head].buf, buf, n);
+              a->slots[a->head].len = n;
+              buf += n;
+              size -= n;
+
+              thread_filter_lock (a);
+              a->head = (a->head + 1) % a->nslots;
+              a->count++;
+              npth_cond_broadcast (&a->cond);
+              thread_filter_unlock (a);
+            }
+        }
+#endif /*HAVE_NPTH*/
+    }
+  else if (control == IOBUFCTRL_CANCEL)
+    {
+      /* Make sure the worker does not touch the pipeline anymore
+       * while it is being canceled.  */
+      thread_filter_stop (a, 1);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    {
+      mem2str (buf, "thread_filter", *ret_len);
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      unsigned int i;
+
+      thread_filter_stop (a, 0);
+      if (a->use == IOBUF_OUTPUT)
+        rc = a->err;
+      if (a->slots)
+        {
+          for (i = 0; i < a->nslots; i++)
+            if (a->slots[i].buf)
+              {
+                wipememory (a->slots[i].buf, a->slotsize);
+                xfree (a->slots[i].buf);
+              }
+          xfree (a->slots);
+        }
+      if (DBG_IOBUF)
+        log_debug ("free thread_filter %p\n", a);
+      xfree (a);		/* we can free our context now */
+    }
+
+  return rc;
+}
+
+
 /* Change the default size for all IOBUFs to KILOBYTE.  This needs to
  * be called before any iobufs are used and can only be used once.
  * Returns the current value.  Using 0 has no effect except for
@@ -1305,12 +1810,13 @@ iobuf_close (iobuf_t a)
   for (; a; a = a_chain)
     {
       byte desc[MAX_IOBUF_DESC];
+      int rc1 = 0;
       int rc2 = 0;
 
       a_chain = a->chain;
 
-      if (a->use == IOBUF_OUTPUT && (rc = filter_flush (a)))
-	log_error ("filter_flush failed on close: %s\n", gpg_strerror (rc));
+      if (a->use == IOBUF_OUTPUT && (rc1 = filter_flush (a)))
+	log_error ("filter_flush failed on close: %s\n", gpg_strerror (rc1));
 
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: close '%s'\n",
@@ -1318,11 +1824,11 @@ iobuf_close (iobuf_t a)
 
       if (a->filter && (rc2 = a->filter (a->filter_ov, IOBUFCTRL_FREE,
 					 a->chain, NULL, &dummy_len)))
-	log_error ("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror (rc));
-      if (! rc && rc2)
+	log_error ("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror (rc2));
+      if (! rc)
 	/* Whoops!  An error occurred.  Save it in RC if we haven't
 	   already recorded an error.  */
-	rc = rc2;
+	rc = rc1? rc1 : rc2;
 
       xfree (a->real_fname);
       if (a->d.buf)
@@ -1682,6 +2188,24 @@ iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval)
             return (int)len;
         }
     }
+  else if (cmd == IOBUF_IOCTL_MMAP)
+    {
+      /* Read the rest of the file from a memory mapping.  Returns 0
+       * if the file could be mapped.  */
+      if (DBG_IOBUF)
+	log_debug ("iobuf-%d.%d: ioctl '%s' mmap\n",
+		   a ? a->no : -1, a ? a->subno : -1, iobuf_desc (a, desc));
+#ifdef USE_MMAP_INPUT
+      if (a && a->use == IOBUF_INPUT && !a->chain && a->filter == file_filter
+          && !a->filter_eof)
+        {
+          file_filter_ctx_t *fcx = a->filter_ov;
+
+          if (!fcx->print_only_name)
+            return file_filter_map (fcx);
+        }
+#endif
+    }
 
 
   return -1;
@@ -1843,6 +2367,64 @@ iobuf_push_filter2 (iobuf_t a,
 }
 
 
+/* Push a thread filter onto the pipeline A.  See iobuf.h.  */
+int
+iobuf_push_thread_filter (iobuf_t a, unsigned int nslots)
+{
+  thread_filter_ctx_t *tfx;
+  int rc;
+
+  if (!nslots)
+    nslots = DEFAULT_THREAD_FILTER_SLOTS;
+  else if (nslots < 2)
+    nslots = 2;
+  else if (nslots > MAX_THREAD_FILTER_SLOTS)
+    nslots = MAX_THREAD_FILTER_SLOTS;
+
+  tfx = xtrycalloc (1, sizeof *tfx);
+  if (!tfx)
+    return gpg_error_from_syserror ();
+  tfx->use = (a->use == IOBUF_INPUT || a->use == IOBUF_INPUT_TEMP)
+             ? IOBUF_INPUT : IOBUF_OUTPUT;
+  tfx->nslots = nslots;
+  tfx->slotsize = iobuf_buffer_size;
+
+  rc = iobuf_push_filter (a, thread_filter, tfx);
+  if (rc)
+    xfree (tfx);
+  return rc;
+}
+
+
+/* Release the nPth lock while a filter runs CPU bound code.  See
+ * iobuf.h.  */
+void
+iobuf_unprotect (void)
+{
+  void (*pre_syscall)(void);
+  void (*post_syscall)(void);
+
+  gpgrt_get_syscall_clamp (&pre_syscall, &post_syscall);
+  if (pre_syscall)
+    pre_syscall ();
+}
+
+
+/* Re-acquire the nPth lock released by iobuf_unprotect.  */
+void
+iobuf_protect (void)
+{
+  void (*pre_syscall)(void);
+  void (*post_syscall)(void);
+  int saved_errno = errno;
+
+  gpgrt_get_syscall_clamp (&pre_syscall, &post_syscall);
+  if (post_syscall)
+    post_syscall ();
+  gpg_err_set_errno (saved_errno);
+}
+
+
 /****************
  * Remove an i/o filter.
  */
@@ -2355,6 +2937,73 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 }
 
 
+/* Return a pointer to up to MAXLEN bytes of the next data from the
+   input pipeline A without copying it.  See iobuf.h.  */
+const void *
+iobuf_read_ptr (iobuf_t a, size_t maxlen, size_t *r_len)
+{
+  const byte *p;
+  size_t n;
+
+  *r_len = 0;
+  if (a->use == IOBUF_OUTPUT || a->use == IOBUF_OUTPUT_TEMP)
+    {
+      log_bug ("iobuf_read_ptr called on a non-INPUT pipeline!\n");
+      return NULL;
+    }
+
+  if (a->nlimit)
+    {
+      if (a->nbytes >= a->nlimit)
+        return NULL;  /* forced EOF */
+      if (maxlen > a->nlimit - a->nbytes)
+        maxlen = a->nlimit - a->nbytes;
+    }
+  if (!maxlen)
+    return NULL;
+
+  if (a->d.start == a->d.len)
+    {
+#ifdef USE_MMAP_INPUT
+      if (!a->chain && a->filter == file_filter && !a->filter_eof)
+        {
+          file_filter_ctx_t *fcx = a->filter_ov;
+
+          if (fcx->map && fcx->mapoff < fcx->maplen)
+            {
+              n = fcx->maplen - fcx->mapoff;
+              if (n > maxlen)
+                n = maxlen;
+              p = fcx->map + fcx->mapoff;
+              fcx->mapoff += n;
+              a->nbytes += n;
+              *r_len = n;
+              return p;
+            }
+        }
+#endif /*USE_MMAP_INPUT*/
+
+      /* Fill our own buffer; do not use an external drain.  */
+      a->e_d.buf = NULL;
+      a->e_d.len = 0;
+      a->e_d.preferred = 0;
+      if (underflow (a, 1) == -1)
+        return NULL;  /* EOF */
+      /* Underflow returned the first byte; put it back.  */
+      a->d.start--;
+    }
+
+  n = a->d.len - a->d.start;
+  if (n > maxlen)
+    n = maxlen;
+  p = a->d.buf + a->d.start;
+  a->d.start += n;
+  a->nbytes += n;
+  *r_len = n;
+  return p;
+}
+
+
 
 int
 iobuf_peek (iobuf_t a, byte * buf, unsigned buflen)
@@ -2545,6 +3194,120 @@ iobuf_temp_to_buffer (iobuf_t a, byte * buffer, size_t buflen)
   return n;
 }
 
+#ifdef USE_KERNEL_COPY
+/* Helper for iobuf_copy.  If SOURCE and DEST are both plain file
+ * pipelines without any other filters, copy the data using the
+ * kernel's copy_file_range, splice or sendfile so that it does not
+ * need to pass through our buffers.  Returns the number of bytes
+ * copied; the caller continues with the regular copy loop which then
+ * either sees EOF or handles the remaining data and any errors.  */
+static size_t
+kernel_copy (iobuf_t dest, iobuf_t source)
+{
+  file_filter_ctx_t *fcx;
+  size_t nwrote = 0;
+  size_t ncopied = 0;
+  size_t n;
+  ssize_t nn;
+  int infd, outfd;
+  int method = 0;
+
+  if (source->use != IOBUF_INPUT || source->chain
+      || source->filter != file_filter || source->nlimit
+      || source->filter_eof || source->error
+      || dest->use != IOBUF_OUTPUT || dest->chain
+      || dest->filter != file_filter || dest->error)
+    return 0;
+
+  fcx = source->filter_ov;
+  if (fcx->eof_seen || fcx->delayed_rc)
+    return 0;
+  infd = fcx->fp;
+  outfd = ((file_filter_ctx_t *)dest->filter_ov)->fp;
+
+  /* First pass on what has already been read into our buffers.  */
+  n = source->d.len - source->d.start;
+  if (n)
+    {
+      if (iobuf_write (dest, source->d.buf + source->d.start, n))
+        return nwrote;
+      source->d.start += n;
+      source->nbytes += n;
+      nwrote += n;
+    }
+  n = fcx->npeeked - fcx->upeeked;
+  if (n)
+    {
+      if (iobuf_write (dest, fcx->peeked + fcx->upeeked, n))
+        return nwrote;
+      fcx->upeeked += n;
+      source->nbytes += n;
+      nwrote += n;
+    }
+  if (dest->d.len && filter_flush (dest))
+    return nwrote;
+#ifdef USE_MMAP_INPUT
+  /* Continue where reading from the mapping stopped.  */
+  file_filter_unmap (fcx);
+#endif
+
+  for (;;)
+    {
+      nn = -1;
+      iobuf_unprotect ();
+      do
+        {
+          switch (method)
+            {
+#ifdef HAVE_COPY_FILE_RANGE
+            case 0: /* Regular file to regular file.  */
+              nn = copy_file_range (infd, NULL, outfd, NULL,
+                                    MAX_KERNEL_COPY_SIZE, 0);
+              break;
+#endif
+#ifdef HAVE_SPLICE
+            case 1: /* One of the descriptors is a pipe.  */
+              nn = splice (infd, NULL, outfd, NULL,
+                           MAX_KERNEL_COPY_SIZE, SPLICE_F_MOVE);
+              break;
+#endif
+#ifdef HAVE_SENDFILE
+            case 2: /* Source is a regular file.  */
+              nn = sendfile (outfd, infd, NULL, MAX_KERNEL_COPY_SIZE);
+              break;
+#endif
+            default:
+              gpg_err_set_errno (ENOSYS);
+              break;
+            }
+        }
+      while (nn == -1 && errno == EINTR);
+      iobuf_protect ();
+
+      if (nn > 0)
+        {
+          ncopied += nn;
+          source->nbytes += nn;
+        }
+      else if (!nn)
+        break;  /* EOF */
+      else if (!ncopied && method < 2
+               && (errno == EINVAL || errno == EXDEV || errno == ENOSYS
+                   || errno == EBADF || errno == EOPNOTSUPP))
+        method++;  /* Not supported for these descriptors.  */
+      else
+        break;  /* Let the regular loop handle this.  */
+    }
+
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: kernel copy to iobuf-%d.%d: %lu bytes\n",
+               source->no, source->subno, dest->no, dest->subno,
+               (ulong)ncopied);
+  return nwrote + ncopied;
+}
+#endif /*USE_KERNEL_COPY*/
+
+
 /* Copies the data from the input iobuf SOURCE to the output iobuf
    DEST until either an error is encountered or EOF is reached.
    Returns the number of bytes copies or (size_t)(-1) on error.  */
@@ -2564,6 +3327,10 @@ iobuf_copy (iobuf_t dest, iobuf_t source)
   if (iobuf_error (dest))
     return (size_t)(-1);
 
+#ifdef USE_KERNEL_COPY
+  nwrote = kernel_copy (dest, source);
+#endif
+
   /* Use iobuf buffer size for temporary buffer. */
   temp_size = iobuf_set_buffer_size(0) * 1024;
 
@@ -2722,6 +3489,9 @@ iobuf_seek (iobuf_t a, off_t newpos)
 
       b = a->filter_ov;
 
+#ifdef USE_MMAP_INPUT
+      file_filter_unmap (b);
+#endif
 #ifdef HAVE_W32_SYSTEM
       if (SetFilePointer (b->fp, newpos, NULL, FILE_BEGIN) == 0xffffffff)
 	{
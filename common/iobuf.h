@@ -118,7 +118,8 @@ typedef enum
     IOBUF_IOCTL_INVALIDATE_CACHE = 2, /* Uses ptrval.  */
     IOBUF_IOCTL_NO_CACHE         = 3, /* Uses intval.  */
     IOBUF_IOCTL_FSYNC            = 4, /* Uses ptrval.  */
-    IOBUF_IOCTL_PEEK             = 5  /* Uses intval and ptrval.  */
+    IOBUF_IOCTL_PEEK             = 5, /* Uses intval and ptrval.  */
+    IOBUF_IOCTL_MMAP             = 6  /* No args.  */
   } iobuf_ioctl_t;
 
 enum iobuf_use
@@ -354,7 +355,14 @@ iobuf_t iobuf_esopen (estream_t estream, const char *mode, int keep_open,
 iobuf_t iobuf_sockopen (int fd, const char *mode);
 
 /* Set various options / perform different actions on a PIPELINE.  See
-   the IOBUF_IOCTL_* macros above.  */
+   the IOBUF_IOCTL_* macros above.
+
+   IOBUF_IOCTL_MMAP maps the rest of a regular file into memory if
+   the pipeline consists only of the file filter of a file larger
+   than the buffer size.  It returns 0 if the file has been mapped.
+   Data appended to the file later is still read, but truncating the
+   file while it is mapped raises SIGBUS; thus this should only be
+   used by callers which read the file in one go.  */
 int iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval);
 
 /* Close a pipeline.  The filters in the pipeline are first flushed
@@ -445,6 +453,32 @@ int iobuf_pop_filter (iobuf_t a,
                                 iobuf_t chain, byte * buf, size_t * len),
                       void *ov);
 
+/* Push a filter on the pipeline A which runs the rest of the pipeline
+   (that is all filters below it) on a separate thread.  The threads
+   hand over the data using a ring of NSLOTS buffers of the standard
+   iobuf size; 0 selects a default.  For an output pipeline the worker
+   writes the queued data to the rest of the pipeline, for an input
+   pipeline it reads ahead.  The thread is started on the first read
+   or write and terminated when the filter is freed; a write error is
+   returned by the next write or when the pipeline is closed.  The
+   rest of the pipeline may not be accessed directly while the thread
+   filter is in place; in particular use iobuf_flush_temp and not
+   iobuf_temp_to_buffer on a temp pipeline.
+
+   The thread filter requires that nPth has been initialized and a
+   syscall clamp has been installed; otherwise, or if the thread
+   can't be created, it merely passes the data through.  Filters
+   below it should use iobuf_unprotect and iobuf_protect around CPU
+   bound code so that both threads can actually run in parallel.  */
+int iobuf_push_thread_filter (iobuf_t a, unsigned int nslots);
+
+/* Release and re-acquire the nPth lock around CPU bound code of a
+   filter.  These are no-ops unless the application installed a
+   syscall clamp.  The calls may not be nested and the code between
+   them may neither use nPth nor estream functions.  */
+void iobuf_unprotect (void);
+void iobuf_protect (void);
+
 /* Used for debugging.  Prints out the chain using log_debug if
    IOBUF_DEBUG_MODE is not 0.  */
 int iobuf_print_chain (iobuf_t a);
@@ -508,6 +542,15 @@ int iobuf_readbyte (iobuf_t a);
    bytes read.  */
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
 
+/* Like iobuf_read but instead of copying the data return a pointer to
+   up to MAXLEN bytes of it and store their number at R_LEN.  If the
+   pipeline consists only of a file filter reading a memory mapped
+   file (see IOBUF_IOCTL_MMAP), the pointer points directly into the mapping; otherwise it
+   points into the internal buffer.  The data is considered read and
+   the pointer is only valid until the next operation on A.  Returns
+   NULL on EOF.  */
+const void *iobuf_read_ptr (iobuf_t a, size_t maxlen, size_t *r_len);
+
 /* Read a line of input (including the '\n') from the pipeline.
 
    The semantics are the same as for fgets(), but if the buffer is too
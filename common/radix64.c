@@ -0,0 +1,912 @@
+/* radix64.c - Bulk radix64 encoding and decoding
+ * Copyright (C) 2026  g10 Code GmbH.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+/* The vector implementations follow the algorithms described by
+ * Wojciech Muła and Daniel Lemire in "Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions" (ACM TOW, 2018).  They are only
+ * used for the bulk of the data; the remainder and any block with an
+ * invalid character is handed to the scalar code.  Only the x86
+ * variants require a runtime check because NEON is part of the
+ * AArch64 base architecture.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "host2net.h"
+#include "radix64.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+     && (__GNUC__ >= 5 || defined(__clang__))
+# define USE_RADIX64_X86 1
+# include <immintrin.h>
+# define ATTR_TARGET_SSSE3 __attribute__ ((target ("ssse3")))
+# define ATTR_TARGET_AVX2  __attribute__ ((target ("avx2")))
+# define ATTR_TARGET_PCLMUL __attribute__ ((target ("pclmul,ssse3")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+# define USE_RADIX64_NEON 1
+# include <arm_neon.h>
+#endif
+
+
+static const char bintoasc[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "abcdefghijklmnopqrstuvwxyz"
+                                 "0123456789+/";
+
+/* Reverse mapping of BINTOASC; invalid characters map to 0xff.  */
+static const byte asctobin[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+  0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+  0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+  0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+  0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+  0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/* ASCTOBIN with the values already shifted to their position in a
+ * group of 4 characters; invalid characters map to 0xffffffff.  This
+ * is initialized at runtime by init_tables.  */
+static u32 asctobin4[4][256];
+
+/* The tables for the slice-by-8 CRC-24 computation.  The CRC is
+ * kept in the high 24 bits of a 32 bit word.  This is initialized at
+ * runtime by init_tables.  */
+static u32 crc24_table[8][256];
+
+/* The folding constants for the carry-less multiplication based
+ * CRC-24: x^n mod P for n = 128, 192, 512, and 576.  */
+static u32 crc24_fold_consts[4];
+
+/* Set by init_tables.  */
+static int tables_initialized;
+
+
+/* The implementation descriptor.  */
+struct radix64_impl_s
+{
+  const char *name;
+  int (*supported) (void);
+  void (*encode) (char *out, const byte *in, size_t len);
+  size_t (*decode) (byte *out, const byte *in, size_t inlen,
+                    size_t *r_nused);
+};
+
+/* The implementation in use; set by radix64_init.  */
+static const struct radix64_impl_s *current_impl;
+
+/* The CRC-24 implementation descriptor.  */
+struct crc24_impl_s
+{
+  const char *name;
+  int (*supported) (void);
+  u32 (*crc24) (u32 crc, const byte *buf, size_t len);
+};
+
+/* The CRC-24 implementation in use; set by radix64_init.  */
+static const struct crc24_impl_s *current_crc24_impl;
+
+
+
+/*
+ * Scalar implementation.
+ */
+
+static int
+scalar_supported (void)
+{
+  return 1;
+}
+
+
+static void
+scalar_encode (char *out, const byte *in, size_t len)
+{
+  u32 v;
+
+  for (; len >= 3; len -= 3, in += 3, out += 4)
+    {
+      v = ((u32)in[0] << 16) | ((u32)in[1] << 8) | in[2];
+      out[0] = bintoasc[(v >> 18) & 077];
+      out[1] = bintoasc[(v >> 12) & 077];
+      out[2] = bintoasc[(v >>  6) & 077];
+      out[3] = bintoasc[v & 077];
+    }
+}
+
+
+static size_t
+scalar_decode (byte *out, const byte *in, size_t inlen, size_t *r_nused)
+{
+  size_t nused = 0;
+  size_t n = 0;
+  u32 b0, b1, b2, b3;
+  byte c0, c1, c2, c3;
+
+  /* Fast path using pre-shifted tables for 16 characters.  */
+  for (; inlen - nused >= 16; nused += 16, n += 12)
+    {
+      b0  = asctobin4[3][in[nused +  0]];
+      b0 |= asctobin4[2][in[nused +  1]];
+      b0 |= asctobin4[1][in[nused +  2]];
+      b0 |= asctobin4[0][in[nused +  3]];
+      b1  = asctobin4[3][in[nused +  4]];
+      b1 |= asctobin4[2][in[nused +  5]];
+      b1 |= asctobin4[1][in[nused +  6]];
+      b1 |= asctobin4[0][in[nused +  7]];
+      b2  = asctobin4[3][in[nused +  8]];
+      b2 |= asctobin4[2][in[nused +  9]];
+      b2 |= asctobin4[1][in[nused + 10]];
+      b2 |= asctobin4[0][in[nused + 11]];
+      b3  = asctobin4[3][in[nused + 12]];
+      b3 |= asctobin4[2][in[nused + 13]];
+      b3 |= asctobin4[1][in[nused + 14]];
+      b3 |= asctobin4[0][in[nused + 15]];
+      /* Invalid characters map to 0xffffffff.  */
+      if ((b0 | b1 | b2 | b3) == 0xffffffff)
+        break;
+      out[n +  0] = b0 >> 16; out[n +  1] = b0 >> 8; out[n +  2] = b0;
+      out[n +  3] = b1 >> 16; out[n +  4] = b1 >> 8; out[n +  5] = b1;
+      out[n +  6] = b2 >> 16; out[n +  7] = b2 >> 8; out[n +  8] = b2;
+      out[n +  9] = b3 >> 16; out[n + 10] = b3 >> 8; out[n + 11] = b3;
+    }
+
+  for (; inlen - nused >= 4; nused += 4, n += 3)
+    {
+      c0 = asctobin[in[nused + 0]];
+      c1 = asctobin[in[nused + 1]];
+      c2 = asctobin[in[nused + 2]];
+      c3 = asctobin[in[nused + 3]];
+      if (((c0 | c1 | c2 | c3) & 0xc0))
+        break;
+      out[n + 0] = (c0 << 2) | (c1 >> 4);
+      out[n + 1] = (c1 << 4) | (c2 >> 2);
+      out[n + 2] = (c2 << 6) | c3;
+    }
+
+  *r_nused = nused;
+  return n;
+}
+
+
+
+/*
+ * SSSE3 and AVX2 implementations.
+ */
+#ifdef USE_RADIX64_X86
+
+static int
+ssse3_supported (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("ssse3");
+}
+
+
+static int
+avx2_supported (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+/* Load exactly 12 bytes from P into the low part of a vector.  */
+static inline __m128i ATTR_TARGET_SSSE3
+load12_sse (const byte *p)
+{
+  u32 tmp;
+
+  memcpy (&tmp, p + 8, 4);
+  return _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *)p),
+                             _mm_cvtsi32_si128 (tmp));
+}
+
+
+/* Store the low 12 bytes of V at P.  */
+static inline void ATTR_TARGET_SSSE3
+store12_sse (byte *p, __m128i v)
+{
+  u32 tmp;
+
+  _mm_storel_epi64 ((__m128i *)p, v);
+  tmp = _mm_cvtsi128_si32 (_mm_srli_si128 (v, 8));
+  memcpy (p + 8, &tmp, 4);
+}
+
+
+/* Spread the 12 bytes in the low part of IN to 16 six bit values and
+ * map them to the radix64 alphabet.  */
+static inline __m128i ATTR_TARGET_SSSE3
+encode_block_ssse3 (__m128i in)
+{
+  __m128i t0, t1, t2, t3, idx, mask;
+
+  in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10, 11,  9, 10,  7,  8,  6,  7,
+                                            4,  5,  3,  4,  1,  2,  0,  1));
+  t0 = _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00));
+  t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+  t2 = _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0));
+  t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+  in = _mm_or_si128 (t1, t3);
+
+  /* 0..25 -> 0, 26..51 -> 1, 52..61 -> 2..11, 62 -> 12, 63 -> 13.  */
+  idx = _mm_subs_epu8 (in, _mm_set1_epi8 (51));
+  mask = _mm_cmpgt_epi8 (in, _mm_set1_epi8 (25));
+  idx = _mm_sub_epi8 (idx, mask);
+  return _mm_add_epi8 (in, _mm_shuffle_epi8
+                       (_mm_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+                                       -4, -4, -4, -4, -19, -16, 0, 0),
+                        idx));
+}
+
+
+/* Translate the 16 characters in STR to six bit values.  Returns
+ * false if any of them is not in the radix64 alphabet.  */
+static inline int ATTR_TARGET_SSSE3
+translate_block_ssse3 (__m128i *str)
+{
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  __m128i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+  hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+  lo_nibbles = _mm_and_si128 (*str, mask_2f);
+  hi = _mm_shuffle_epi8 (_mm_setr_epi8 (0x10, 0x10, 0x01, 0x02,
+                                        0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10,
+                                        0x10, 0x10, 0x10, 0x10),
+                         hi_nibbles);
+  lo = _mm_shuffle_epi8 (_mm_setr_epi8 (0x15, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a,
+                                        0x1b, 0x1b, 0x1b, 0x1a),
+                         lo_nibbles);
+  if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_and_si128 (lo, hi),
+                                         _mm_setzero_si128 ())) != 0xffff)
+    return 0;
+
+  roll = _mm_shuffle_epi8 (_mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0),
+                           _mm_add_epi8 (_mm_cmpeq_epi8 (*str, mask_2f),
+                                         hi_nibbles));
+  *str = _mm_add_epi8 (*str, roll);
+  return 1;
+}
+
+
+/* Pack the 16 six bit values in IN into 12 bytes.  */
+static inline __m128i ATTR_TARGET_SSSE3
+decode_pack_ssse3 (__m128i in)
+{
+  in = _mm_maddubs_epi16 (in, _mm_set1_epi32 (0x01400140));
+  in = _mm_madd_epi16 (in, _mm_set1_epi32 (0x00011000));
+  return _mm_shuffle_epi8 (in, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+                                              8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+
+static void ATTR_TARGET_SSSE3
+ssse3_encode (char *out, const byte *in, size_t len)
+{
+  for (; len >= 12; len -= 12, in += 12, out += 16)
+    _mm_storeu_si128 ((__m128i *)out, encode_block_ssse3 (load12_sse (in)));
+
+  scalar_encode (out, in, len);
+}
+
+
+static size_t ATTR_TARGET_SSSE3
+ssse3_decode (byte *out, const byte *in, size_t inlen, size_t *r_nused)
+{
+  size_t nused = 0;
+  size_t n = 0;
+  size_t tailused;
+  __m128i str;
+
+  for (; inlen - nused >= 16; nused += 16, n += 12)
+    {
+      str = _mm_loadu_si128 ((const __m128i *)(in + nused));
+      if (!translate_block_ssse3 (&str))
+        break;
+      store12_sse (out + n, decode_pack_ssse3 (str));
+    }
+
+  n += scalar_decode (out + n, in + nused, inlen - nused, &tailused);
+  *r_nused = nused + tailused;
+  return n;
+}
+
+
+static void ATTR_TARGET_AVX2
+avx2_encode (char *out, const byte *in, size_t len)
+{
+  __m256i v, t0, t1, t2, t3, idx, mask;
+
+  for (; len >= 24; len -= 24, in += 24, out += 32)
+    {
+      v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (load12_sse (in)),
+                                   load12_sse (in + 12), 1);
+      v = _mm256_shuffle_epi8
+        (v, _mm256_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4,
+                              7, 6, 8, 7, 10, 9, 11, 10,
+                              1, 0, 2, 1, 4, 3, 5, 4,
+                              7, 6, 8, 7, 10, 9, 11, 10));
+      t0 = _mm256_and_si256 (v, _mm256_set1_epi32 (0x0fc0fc00));
+      t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+      t2 = _mm256_and_si256 (v, _mm256_set1_epi32 (0x003f03f0));
+      t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+      v = _mm256_or_si256 (t1, t3);
+
+      idx = _mm256_subs_epu8 (v, _mm256_set1_epi8 (51));
+      mask = _mm256_cmpgt_epi8 (v, _mm256_set1_epi8 (25));
+      idx = _mm256_sub_epi8 (idx, mask);
+      v = _mm256_add_epi8
+        (v, _mm256_shuffle_epi8
+         (_mm256_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+                            -4, -4, -4, -4, -19, -16, 0, 0,
+                            65, 71, -4, -4, -4, -4, -4, -4,
+                            -4, -4, -4, -4, -19, -16, 0, 0),
+          idx));
+      _mm256_storeu_si256 ((__m256i *)out, v);
+    }
+
+  ssse3_encode (out, in, len);
+}
+
+
+static size_t ATTR_TARGET_AVX2
+avx2_decode (byte *out, const byte *in, size_t inlen, size_t *r_nused)
+{
+  const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+  size_t nused = 0;
+  size_t n = 0;
+  size_t tailused;
+  __m256i str, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+  for (; inlen - nused >= 32; nused += 32, n += 24)
+    {
+      str = _mm256_loadu_si256 ((const __m256i *)(in + nused));
+      hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (str, 4), mask_2f);
+      lo_nibbles = _mm256_and_si256 (str, mask_2f);
+      hi = _mm256_shuffle_epi8
+        (_mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+         hi_nibbles);
+      lo = _mm256_shuffle_epi8
+        (_mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),
+         lo_nibbles);
+      if (!_mm256_testz_si256 (lo, hi))
+        break;
+
+      roll = _mm256_shuffle_epi8
+        (_mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                           0, 0, 0, 0, 0, 0, 0, 0,
+                           0, 16, 19, 4, -65, -65, -71, -71,
+                           0, 0, 0, 0, 0, 0, 0, 0),
+         _mm256_add_epi8 (_mm256_cmpeq_epi8 (str, mask_2f), hi_nibbles));
+      str = _mm256_add_epi8 (str, roll);
+
+      str = _mm256_maddubs_epi16 (str, _mm256_set1_epi32 (0x01400140));
+      str = _mm256_madd_epi16 (str, _mm256_set1_epi32 (0x00011000));
+      str = _mm256_shuffle_epi8
+        (str, _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+                                8, 14, 13, 12, -1, -1, -1, -1,
+                                2, 1, 0, 6, 5, 4, 10, 9,
+                                8, 14, 13, 12, -1, -1, -1, -1));
+      str = _mm256_permutevar8x32_epi32 (str, _mm256_setr_epi32 (0, 1, 2, 4,
+                                                                 5, 6, 7, 7));
+      _mm_storeu_si128 ((__m128i *)(out + n), _mm256_castsi256_si128 (str));
+      _mm_storel_epi64 ((__m128i *)(out + n + 16),
+                        _mm256_extracti128_si256 (str, 1));
+    }
+
+  n += ssse3_decode (out + n, in + nused, inlen - nused, &tailused);
+  *r_nused = nused + tailused;
+  return n;
+}
+
+#endif /*USE_RADIX64_X86*/
+
+
+
+/*
+ * NEON implementation for AArch64.
+ */
+#ifdef USE_RADIX64_NEON
+
+static int
+neon_supported (void)
+{
+  return 1;
+}
+
+
+static void
+neon_encode (char *out, const byte *in, size_t len)
+{
+  uint8x16x4_t tbl, res;
+  uint8x16x3_t src;
+  const uint8x16_t mask = vdupq_n_u8 (077);
+
+  tbl.val[0] = vld1q_u8 ((const byte *)bintoasc);
+  tbl.val[1] = vld1q_u8 ((const byte *)bintoasc + 16);
+  tbl.val[2] = vld1q_u8 ((const byte *)bintoasc + 32);
+  tbl.val[3] = vld1q_u8 ((const byte *)bintoasc + 48);
+
+  for (; len >= 48; len -= 48, in += 48, out += 64)
+    {
+      src = vld3q_u8 (in);
+      res.val[0] = vshrq_n_u8 (src.val[0], 2);
+      res.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[0], 4),
+                                       vshrq_n_u8 (src.val[1], 4)), mask);
+      res.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (src.val[1], 2),
+                                       vshrq_n_u8 (src.val[2], 6)), mask);
+      res.val[3] = vandq_u8 (src.val[2], mask);
+      res.val[0] = vqtbl4q_u8 (tbl, res.val[0]);
+      res.val[1] = vqtbl4q_u8 (tbl, res.val[1]);
+      res.val[2] = vqtbl4q_u8 (tbl, res.val[2]);
+      res.val[3] = vqtbl4q_u8 (tbl, res.val[3]);
+      vst4q_u8 ((byte *)out, res);
+    }
+
+  scalar_encode (out, in, len);
+}
+
+
+static size_t
+neon_decode (byte *out, const byte *in, size_t inlen, size_t *r_nused)
+{
+  uint8x16x4_t tbl1, tbl2, str;
+  uint8x16x3_t res;
+  uint8x16_t chk, off;
+  size_t nused = 0;
+  size_t n = 0;
+  size_t tailused;
+  int i;
+
+  /* Characters below 0x40 are looked up in TBL1, those from 0x40 to
+   * 0x7f in TBL2; out of range indices yield 0.  */
+  for (i = 0; i < 4; i++)
+    {
+      tbl1.val[i] = vld1q_u8 (asctobin + i * 16);
+      tbl2.val[i] = vld1q_u8 (asctobin + 64 + i * 16);
+    }
+  off = vdupq_n_u8 (0x40);
+
+  for (; inlen - nused >= 64; nused += 64, n += 48)
+    {
+      str = vld4q_u8 (in + nused);
+      chk = vdupq_n_u8 (0);
+      for (i = 0; i < 4; i++)
+        {
+          chk = vorrq_u8 (chk, vandq_u8 (str.val[i], vdupq_n_u8 (0x80)));
+          str.val[i] = vorrq_u8 (vqtbl4q_u8 (tbl1, str.val[i]),
+                                 vqtbl4q_u8 (tbl2, vsubq_u8 (str.val[i],
+                                                             off)));
+          chk = vorrq_u8 (chk, str.val[i]);
+        }
+      if (vmaxvq_u8 (chk) > 077)
+        break;
+
+      res.val[0] = vorrq_u8 (vshlq_n_u8 (str.val[0], 2),
+                             vshrq_n_u8 (str.val[1], 4));
+      res.val[1] = vorrq_u8 (vshlq_n_u8 (str.val[1], 4),
+                             vshrq_n_u8 (str.val[2], 2));
+      res.val[2] = vorrq_u8 (vshlq_n_u8 (str.val[2], 6), str.val[3]);
+      vst3q_u8 (out + n, res);
+    }
+
+  n += scalar_decode (out + n, in + nused, inlen - nused, &tailused);
+  *r_nused = nused + tailused;
+  return n;
+}
+
+#endif /*USE_RADIX64_NEON*/
+
+
+
+/*
+ * CRC-24 as used by the OpenPGP armor.
+ */
+
+#define CRC24_POLY 0x864cfb  /* Without the x^24 term.  */
+
+
+/* Compute x^N mod P.  */
+static u32
+crc24_xpow_mod (unsigned int n)
+{
+  u32 r = 1;
+
+  while (n--)
+    {
+      r <<= 1;
+      if ((r & 0x1000000))
+        r ^= 0x1000000 | CRC24_POLY;
+    }
+  return r;
+}
+
+
+static int
+slice8_supported (void)
+{
+  return 1;
+}
+
+
+/* The classic table driven CRC, processing 8 bytes at once.  */
+static u32
+slice8_crc24 (u32 crc, const byte *buf, size_t len)
+{
+  u32 one, two;
+
+  crc <<= 8;
+  for (; len >= 8; len -= 8, buf += 8)
+    {
+      one = crc ^ buf32_to_u32 (buf);
+      two = buf32_to_u32 (buf + 4);
+      crc = (crc24_table[7][one >> 24]
+             ^ crc24_table[6][(one >> 16) & 0xff]
+             ^ crc24_table[5][(one >> 8) & 0xff]
+             ^ crc24_table[4][one & 0xff]
+             ^ crc24_table[3][two >> 24]
+             ^ crc24_table[2][(two >> 16) & 0xff]
+             ^ crc24_table[1][(two >> 8) & 0xff]
+             ^ crc24_table[0][two & 0xff]);
+    }
+  for (; len; len--, buf++)
+    crc = (crc << 8) ^ crc24_table[0][(crc >> 24) ^ *buf];
+
+  return crc >> 8;
+}
+
+
+#ifdef USE_RADIX64_X86
+
+static int
+pclmul_supported (void)
+{
+  __builtin_cpu_init ();
+  return (__builtin_cpu_supports ("pclmul")
+          && __builtin_cpu_supports ("ssse3"));
+}
+
+
+/* Return A * x^128 mod P + D where A is reduced to less than 128 bits
+ * using the constants in K.  */
+static inline __m128i ATTR_TARGET_PCLMUL
+pclmul_fold (__m128i a, __m128i k, __m128i d)
+{
+  return _mm_xor_si128 (_mm_xor_si128 (_mm_clmulepi64_si128 (a, k, 0x00),
+                                       _mm_clmulepi64_si128 (a, k, 0x11)),
+                        d);
+}
+
+
+/* Load 16 bytes from P as a polynomial with the first bit as the
+ * highest coefficient.  */
+static inline __m128i ATTR_TARGET_PCLMUL
+pclmul_load (const byte *p)
+{
+  return _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)p),
+                           _mm_setr_epi8 (15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+
+/* The message is folded into 128 bit remainders which have the same
+ * CRC as the original data; up to four of them are processed in
+ * parallel.  This does not need a Barrett reduction because P has
+ * only a degree of 24 and thus each product fits into 128 bits; the
+ * final remainder is instead run through the table code.  */
+static u32 ATTR_TARGET_PCLMUL
+pclmul_crc24 (u32 crc, const byte *buf, size_t len)
+{
+  __m128i k128, k512, a0, a1, a2, a3;
+  byte tmp[16];
+
+  if (len < 16)
+    return slice8_crc24 (crc, buf, len);
+
+  k128 = _mm_set_epi64x (crc24_fold_consts[1], crc24_fold_consts[0]);
+  k512 = _mm_set_epi64x (crc24_fold_consts[3], crc24_fold_consts[2]);
+
+  /* Adding the CRC to the first 24 bits of the message is the same as
+   * continuing the computation.  */
+  a0 = _mm_xor_si128 (pclmul_load (buf),
+                      _mm_set_epi64x ((long long)crc << 40, 0));
+  buf += 16;
+  len -= 16;
+
+  if (len >= 48)
+    {
+      a1 = pclmul_load (buf);
+      a2 = pclmul_load (buf + 16);
+      a3 = pclmul_load (buf + 32);
+      buf += 48;
+      len -= 48;
+      for (; len >= 64; len -= 64, buf += 64)
+        {
+          a0 = pclmul_fold (a0, k512, pclmul_load (buf));
+          a1 = pclmul_fold (a1, k512, pclmul_load (buf + 16));
+          a2 = pclmul_fold (a2, k512, pclmul_load (buf + 32));
+          a3 = pclmul_fold (a3, k512, pclmul_load (buf + 48));
+        }
+      a0 = pclmul_fold (a0, k128, a1);
+      a0 = pclmul_fold (a0, k128, a2);
+      a0 = pclmul_fold (a0, k128, a3);
+    }
+
+  for (; len >= 16; len -= 16, buf += 16)
+    a0 = pclmul_fold (a0, k128, pclmul_load (buf));
+
+  /* The reversed load is its own inverse.  */
+  a0 = _mm_shuffle_epi8 (a0, _mm_setr_epi8 (15, 14, 13, 12, 11, 10, 9, 8,
+                                            7, 6, 5, 4, 3, 2, 1, 0));
+  _mm_storeu_si128 ((__m128i *)tmp, a0);
+  crc = slice8_crc24 (0, tmp, 16);
+  return slice8_crc24 (crc, buf, len);
+}
+
+#endif /*USE_RADIX64_X86*/
+
+
+/* The available implementations, best first.  */
+static const struct radix64_impl_s impl_list[] =
+  {
+#ifdef USE_RADIX64_X86
+    { "avx2",   avx2_supported,   avx2_encode,   avx2_decode   },
+    { "ssse3",  ssse3_supported,  ssse3_encode,  ssse3_decode  },
+#endif
+#ifdef USE_RADIX64_NEON
+    { "neon",   neon_supported,   neon_encode,   neon_decode   },
+#endif
+    { "scalar", scalar_supported, scalar_encode, scalar_decode }
+  };
+
+static const struct crc24_impl_s crc24_impl_list[] =
+  {
+#ifdef USE_RADIX64_X86
+    { "pclmul", pclmul_supported, pclmul_crc24 },
+#endif
+    { "slice8", slice8_supported, slice8_crc24 }
+  };
+
+
+/* Initialize the runtime computed tables.  */
+static void
+init_tables (void)
+{
+  int i, c;
+  u32 r;
+
+  if (tables_initialized)
+    return;
+
+  for (c = 0; c < 256; c++)
+    for (i = 0; i < 4; i++)
+      asctobin4[i][c] = (asctobin[c] == 0xff? 0xffffffff
+                         : (u32)asctobin[c] << (i * 6));
+
+  for (c = 0; c < 256; c++)
+    {
+      r = (u32)c << 24;
+      for (i = 0; i < 8; i++)
+        r = (r << 1) ^ ((r & 0x80000000)? (CRC24_POLY << 8) : 0);
+      crc24_table[0][c] = r;
+    }
+  for (c = 0; c < 256; c++)
+    for (i = 1; i < 8; i++)
+      crc24_table[i][c] = ((crc24_table[i-1][c] << 8)
+                           ^ crc24_table[0][crc24_table[i-1][c] >> 24]);
+
+  crc24_fold_consts[0] = crc24_xpow_mod (128);
+  crc24_fold_consts[1] = crc24_xpow_mod (192);
+  crc24_fold_consts[2] = crc24_xpow_mod (512);
+  crc24_fold_consts[3] = crc24_xpow_mod (576);
+
+  tables_initialized = 1;
+}
+
+
+/* Return the best implementation supported by the CPU.  */
+static const struct radix64_impl_s *
+best_impl (void)
+{
+  unsigned int i;
+
+  for (i = 0; !impl_list[i].supported (); i++)
+    ;
+  return impl_list + i;
+}
+
+
+/* Return the best CRC-24 implementation supported by the CPU.  */
+static const struct crc24_impl_s *
+best_crc24_impl (void)
+{
+  unsigned int i;
+
+  for (i = 0; !crc24_impl_list[i].supported (); i++)
+    ;
+  return crc24_impl_list + i;
+}
+
+
+void
+radix64_init (void)
+{
+  init_tables ();
+  if (!current_impl)
+    current_impl = best_impl ();
+  if (!current_crc24_impl)
+    current_crc24_impl = best_crc24_impl ();
+}
+
+
+/* Return the implementation in use.  Programs which do not call
+ * init_common_subsystems get the initialization on first use; they
+ * must do this before starting threads.  */
+static inline const struct radix64_impl_s *
+get_impl (void)
+{
+  if (!current_impl)
+    radix64_init ();
+  return current_impl;
+}
+
+
+static inline const struct crc24_impl_s *
+get_crc24_impl (void)
+{
+  if (!current_crc24_impl)
+    radix64_init ();
+  return current_crc24_impl;
+}
+
+
+void
+radix64_encode (char *out, const void *in, size_t len)
+{
+  get_impl ()->encode (out, in, len);
+}
+
+
+size_t
+radix64_decode (void *out, const void *in, size_t inlen, size_t *r_nused)
+{
+  return get_impl ()->decode (out, in, inlen, r_nused);
+}
+
+
+unsigned int
+radix64_crc24 (unsigned int crc, const void *buf, size_t len)
+{
+  return get_crc24_impl ()->crc24 (crc, buf, len);
+}
+
+
+const char *
+radix64_get_impl (void)
+{
+  return get_impl ()->name;
+}
+
+
+gpg_error_t
+radix64_set_impl (const char *name)
+{
+  unsigned int i;
+
+  radix64_init ();
+  if (!name)
+    {
+      current_impl = best_impl ();
+      return 0;
+    }
+
+  for (i = 0; i < DIM (impl_list); i++)
+    if (!strcmp (impl_list[i].name, name))
+      {
+        if (!impl_list[i].supported ())
+          break;
+        current_impl = impl_list + i;
+        return 0;
+      }
+
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+
+const char *
+radix64_get_crc24_impl (void)
+{
+  return get_crc24_impl ()->name;
+}
+
+
+gpg_error_t
+radix64_set_crc24_impl (const char *name)
+{
+  unsigned int i;
+
+  radix64_init ();
+  if (!name)
+    {
+      current_crc24_impl = best_crc24_impl ();
+      return 0;
+    }
+
+  for (i = 0; i < DIM (crc24_impl_list); i++)
+    if (!strcmp (crc24_impl_list[i].name, name))
+      {
+        if (!crc24_impl_list[i].supported ())
+          break;
+        current_crc24_impl = crc24_impl_list + i;
+        return 0;
+      }
+
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
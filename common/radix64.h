@@ -0,0 +1,80 @@
+/* radix64.h - Bulk radix64 encoding and decoding
+ * Copyright (C) 2026  g10 Code GmbH.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#ifndef GNUPG_COMMON_RADIX64_H
+#define GNUPG_COMMON_RADIX64_H
+
+/* Initialize the tables and select the best implementations.  This
+ * is called by init_common_subsystems before any threads are
+ * started; further calls have no effect.  */
+void radix64_init (void);
+
+/* Encode LEN bytes from IN into 4*LEN/3 radix64 characters stored
+ * at OUT.  LEN must be a multiple of 3.  Neither padding, line
+ * endings, nor a terminating Nul are written.  */
+void radix64_encode (char *out, const void *in, size_t len);
+
+/* Decode radix64 characters from IN, which has a length of INLEN, in
+ * groups of 4 to OUT.  Decoding stops at the end of IN or at the
+ * first group which contains a character not in the radix64
+ * alphabet; this includes the pad character and white space.  The
+ * number of consumed characters is stored at R_NUSED and the number
+ * of bytes written to OUT, which is always 3/4 of that, is
+ * returned.  */
+size_t radix64_decode (void *out, const void *in, size_t inlen,
+                       size_t *r_nused);
+
+/* The initial value for radix64_crc24.  */
+#define RADIX64_CRC24_INIT 0xb704ce
+
+/* Update the CRC-24 as used by the OpenPGP armor with LEN bytes from
+ * BUF and return the new CRC.  Start with RADIX64_CRC24_INIT.  */
+unsigned int radix64_crc24 (unsigned int crc, const void *buf, size_t len);
+
+/* Return the name of the implementation used by the above coding
+ * functions.  */
+const char *radix64_get_impl (void);
+
+/* Switch to the implementation NAME which is one of "scalar",
+ * "ssse3", "avx2", or "neon".  NAME may be NULL to select the best
+ * implementation supported by the CPU.  This is meant for tests and
+ * benchmarks.  Returns 0 on success or GPG_ERR_NOT_SUPPORTED.  */
+gpg_error_t radix64_set_impl (const char *name);
+
+/* Return the name of the implementation used by radix64_crc24.  */
+const char *radix64_get_crc24_impl (void);
+
+/* Switch to the CRC-24 implementation NAME which is one of "slice8"
+ * or "pclmul".  NAME may be NULL to select the best implementation.
+ * Returns 0 on success or GPG_ERR_NOT_SUPPORTED.  */
+gpg_error_t radix64_set_crc24_impl (const char *name);
+
+#endif /*GNUPG_COMMON_RADIX64_H*/
@@ -130,6 +130,7 @@ enum
 
     STATUS_PLAINTEXT,
     STATUS_PLAINTEXT_LENGTH,
+    STATUS_COMPRESSION_INFO,
     STATUS_KEY_NOT_CREATED,
     STATUS_NEED_PASSPHRASE_PIN,
 
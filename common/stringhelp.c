@@ -50,6 +50,11 @@
 # include <windows.h>
 #endif
 #include <limits.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
 
 #include "util.h"
 #include "common-defs.h"
@@ -957,6 +962,94 @@ ascii_strcmp( const char *a, const char *b )
 }
 
 
+#if defined(__SSE2__) && defined(__GNUC__)
+/* Helper for ascii_memcasemem to find the first position in
+ * HAYSTACK, which has a length of NHAYSTACK, where NEEDLE with
+ * NNEEDLE (at least 2) bytes matches.  The first and the last byte of
+ * the needle are compared for 16 positions at once and only for
+ * candidates the remaining bytes are compared.  The number of
+ * positions which have been checked is stored at R_NDONE.  */
+static const char *
+memcasemem_simd (const char *haystack, size_t nhaystack,
+                 const char *needle, size_t nneedle, size_t *r_ndone)
+{
+  const __m128i upper_a = _mm_set1_epi8 ('A' - 1);
+  const __m128i upper_z = _mm_set1_epi8 ('Z' + 1);
+  const __m128i bit5    = _mm_set1_epi8 (0x20);
+  const __m128i first   = _mm_set1_epi8 (ascii_tolower (needle[0]));
+  const __m128i last    = _mm_set1_epi8 (ascii_tolower (needle[nneedle-1]));
+  __m128i a, b;
+  unsigned int mask, bit;
+  size_t i;
+
+  for (i = 0; i + nneedle - 1 + 16 <= nhaystack; i += 16)
+    {
+      a = _mm_loadu_si128 ((const __m128i *)(haystack + i));
+      b = _mm_loadu_si128 ((const __m128i *)(haystack + i + nneedle - 1));
+      /* Map 'A'..'Z' to lowercase; the signed compare keeps bytes
+       * with the high bit set unchanged.  */
+      a = _mm_or_si128 (a, _mm_and_si128 (bit5, _mm_and_si128
+                                          (_mm_cmpgt_epi8 (a, upper_a),
+                                           _mm_cmplt_epi8 (a, upper_z))));
+      b = _mm_or_si128 (b, _mm_and_si128 (bit5, _mm_and_si128
+                                          (_mm_cmpgt_epi8 (b, upper_a),
+                                           _mm_cmplt_epi8 (b, upper_z))));
+      mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (a, first),
+                                               _mm_cmpeq_epi8 (b, last)));
+      while (mask)
+        {
+          bit = __builtin_ctz (mask);
+          if (!ascii_memcasecmp (haystack + i + bit + 1, needle + 1,
+                                 nneedle - 2))
+            return haystack + i + bit;
+          mask &= mask - 1;
+        }
+    }
+  *r_ndone = i;
+  return NULL;
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static const char *
+memcasemem_simd (const char *haystack, size_t nhaystack,
+                 const char *needle, size_t nneedle, size_t *r_ndone)
+{
+  const uint8x16_t upper_a = vdupq_n_u8 ('A');
+  const uint8x16_t range   = vdupq_n_u8 ('Z' - 'A');
+  const uint8x16_t bit5    = vdupq_n_u8 (0x20);
+  const uint8x16_t first   = vdupq_n_u8 (ascii_tolower (needle[0]));
+  const uint8x16_t last    = vdupq_n_u8 (ascii_tolower (needle[nneedle-1]));
+  uint8x16_t a, b, eq;
+  uint64_t mask;
+  unsigned int bit;
+  size_t i;
+
+  for (i = 0; i + nneedle - 1 + 16 <= nhaystack; i += 16)
+    {
+      a = vld1q_u8 ((const uint8_t *)haystack + i);
+      b = vld1q_u8 ((const uint8_t *)haystack + i + nneedle - 1);
+      a = vorrq_u8 (a, vandq_u8 (bit5, vcleq_u8 (vsubq_u8 (a, upper_a),
+                                                 range)));
+      b = vorrq_u8 (b, vandq_u8 (bit5, vcleq_u8 (vsubq_u8 (b, upper_a),
+                                                 range)));
+      eq = vandq_u8 (vceqq_u8 (a, first), vceqq_u8 (b, last));
+      /* Narrow to 4 bits per byte to get a scalar mask.  */
+      mask = vget_lane_u64 (vreinterpret_u64_u8
+                            (vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+      while (mask)
+        {
+          bit = __builtin_ctzll (mask) / 4;
+          if (!ascii_memcasecmp (haystack + i + bit + 1, needle + 1,
+                                 nneedle - 2))
+            return haystack + i + bit;
+          mask &= ~((uint64_t)0xf << (bit * 4));
+        }
+    }
+  *r_ndone = i;
+  return NULL;
+}
+#endif
+
+
 void *
 ascii_memcasemem (const void *haystack, size_t nhaystack,
                   const void *needle, size_t nneedle)
@@ -969,6 +1062,20 @@ ascii_memcasemem (const void *haystack, size_t nhaystack,
       const char *a = haystack;
       const char *b = a + nhaystack - nneedle;
 
+#if (defined(__SSE2__) && defined(__GNUC__)) \
+     || (defined(__aarch64__) && defined(__ARM_NEON))
+      if (nneedle > 1)
+        {
+          const char *found;
+          size_t ndone;
+
+          found = memcasemem_simd (a, nhaystack, needle, nneedle, &ndone);
+          if (found)
+            return (void *)found;
+          a += ndone;
+        }
+#endif
+
       for (; a <= b; a++)
         {
           if ( !ascii_memcasecmp (a, needle, nneedle) )
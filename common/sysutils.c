@@ -391,6 +391,32 @@ get_uint_nonce (void)
 
 
 
+/* Return the number of online processors.  This is used to size
+ * worker pools; it never returns 0.  */
+unsigned int
+gnupg_get_ncpus (void)
+{
+  static unsigned int ncpus;
+
+  if (!ncpus)
+    {
+#ifdef HAVE_W32_SYSTEM
+      SYSTEM_INFO si;
+
+      GetSystemInfo (&si);
+      ncpus = si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+      long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+      ncpus = n > 0? (unsigned int)n : 1;
+#endif
+      if (!ncpus)
+        ncpus = 1;
+    }
+  return ncpus;
+}
+
+
 #if 0 /* not yet needed - Note that this will require inclusion of
          cmacros.am in Makefile.am */
 int
@@ -79,6 +79,7 @@ void disable_translate_sys2libc_fd (void);
 
 const unsigned char *get_session_marker (size_t *rlen);
 unsigned int get_uint_nonce (void);
+unsigned int gnupg_get_ncpus (void);
 /*int check_permissions (const char *path,int extension,int checkonly);*/
 void gnupg_sleep (unsigned int seconds);
 void gnupg_usleep (unsigned int usecs);
@@ -36,6 +36,10 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
+#ifdef HAVE_NPTH
+# include <npth.h>
+#endif
 
 #include "iobuf.h"
 #include "stringhelp.h"
@@ -173,6 +177,131 @@ content_filter (void *opaque, int control,
   return 0;
 }
 
+/* Check reading a memory mapped file including data appended to it
+   after it has been mapped.  */
+static void
+test_mmap_input (void)
+{
+  char fname[64];
+  size_t datalen = 300000;
+  size_t appendlen = 1234;
+  char *data, *buffer;
+  const char *p;
+  iobuf_t iobuf;
+  FILE *fp;
+  size_t i, n, total;
+
+  data = xmalloc (datalen + appendlen);
+  buffer = xmalloc (datalen + appendlen + 1);
+  for (i = 0; i < datalen + appendlen; i++)
+    data[i] = (i * 13 + i / 512) & 0xff;
+
+  snprintf (fname, sizeof fname, "t-iobuf-m%d.tmp", (int)getpid ());
+  fp = fopen (fname, "wb");
+  assert (fp);
+  assert (fwrite (data, datalen, 1, fp) == 1);
+  assert (!fclose (fp));
+
+  iobuf = iobuf_open (fname);
+  assert (iobuf);
+  iobuf_ioctl (iobuf, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_MMAP)
+  assert (!iobuf_ioctl (iobuf, IOBUF_IOCTL_MMAP, 0, NULL));
+#endif
+
+  for (total = 0; total < datalen / 2; total += n)
+    {
+      p = iobuf_read_ptr (iobuf, 1000, &n);
+      assert (p && n && n <= 1000);
+      memcpy (buffer + total, p, n);
+    }
+
+  fp = fopen (fname, "ab");
+  assert (fp);
+  assert (fwrite (data + datalen, appendlen, 1, fp) == 1);
+  assert (!fclose (fp));
+
+  while ((p = iobuf_read_ptr (iobuf, datalen, &n)))
+    {
+      assert (total + n <= datalen + appendlen);
+      memcpy (buffer + total, p, n);
+      total += n;
+    }
+  assert (total == datalen + appendlen);
+  assert (!memcmp (buffer, data, total));
+  iobuf_close (iobuf);
+
+  remove (fname);
+  free (buffer);
+  free (data);
+}
+
+
+#ifdef HAVE_NPTH
+/* Check the thread filter with a running worker thread.  The data is
+   larger than a slot so that the ring fills up and wraps around.  */
+static void
+test_thread_filter_threaded (void)
+{
+  char fname[64];
+  size_t datalen = 300000;
+  char *data, *buffer;
+  iobuf_t iobuf;
+  size_t i;
+  int rc;
+  int n;
+
+  iobuf_unprotect ();
+  iobuf_protect ();
+  assert (npth_is_protected ());
+
+  data = xmalloc (datalen);
+  buffer = xmalloc (datalen + 1);
+  for (i = 0; i < datalen; i++)
+    data[i] = (i * 7 + i / 256) & 0xff;
+
+  snprintf (fname, sizeof fname, "t-iobuf-%d.tmp", (int)getpid ());
+
+  iobuf = iobuf_create (fname, 0);
+  assert (iobuf);
+  iobuf_ioctl (iobuf, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  rc = iobuf_push_thread_filter (iobuf, 3);
+  assert (rc == 0);
+  for (i = 0; i < datalen; i += 1000)
+    {
+      rc = iobuf_write (iobuf, data + i, 1000);
+      assert (rc == 0);
+    }
+  rc = iobuf_close (iobuf);
+  assert (rc == 0);
+
+  iobuf = iobuf_open (fname);
+  assert (iobuf);
+  rc = iobuf_push_thread_filter (iobuf, 2);
+  assert (rc == 0);
+  n = iobuf_read (iobuf, buffer, datalen + 1);
+  assert (n == datalen);
+  assert (memcmp (buffer, data, datalen) == 0);
+  assert (iobuf_read (iobuf, buffer, 1) == -1);
+  iobuf_close (iobuf);
+
+  /* Stop the pipeline while the worker still has data to read.  */
+  iobuf = iobuf_open (fname);
+  assert (iobuf);
+  rc = iobuf_push_thread_filter (iobuf, 2);
+  assert (rc == 0);
+  n = iobuf_read (iobuf, buffer, 10);
+  assert (n == 10);
+  assert (memcmp (buffer, data, 10) == 0);
+  iobuf_close (iobuf);
+
+  remove (fname);
+  free (buffer);
+  free (data);
+}
+#endif /*HAVE_NPTH*/
+
+
 int
 main (int argc, char *argv[])
 {
@@ -436,5 +565,57 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that the thread filter passes the data through unchanged
+     in both directions.  */
+  {
+    iobuf_t iobuf;
+    int rc;
+    char content[] = "0123456789";
+    int n;
+    int c;
+    char buffer[20];
+
+    iobuf = iobuf_temp ();
+    assert (iobuf);
+
+    rc = iobuf_push_filter (iobuf, double_filter, NULL);
+    assert (rc == 0);
+    rc = iobuf_push_thread_filter (iobuf, 2);
+    assert (rc == 0);
+
+    rc = iobuf_write (iobuf, content, 5);
+    assert (rc == 0);
+
+    iobuf_flush_temp (iobuf);
+    assert (iobuf_get_temp_length (iobuf) == 10);
+    assert (memcmp (iobuf_get_temp_buffer (iobuf), "0011223344", 10) == 0);
+
+    iobuf_close (iobuf);
+
+    iobuf = iobuf_temp_with_content (content, strlen (content));
+    assert (iobuf);
+
+    rc = iobuf_push_filter (iobuf, every_other_filter, NULL);
+    assert (rc == 0);
+    rc = iobuf_push_thread_filter (iobuf, 0);
+    assert (rc == 0);
+
+    for (n = 0; (c = iobuf_get (iobuf)) != -1; n ++)
+      buffer[n] = c;
+
+    assert (n == 5);
+    assert (memcmp (buffer, "13579", 5) == 0);
+
+    iobuf_close (iobuf);
+  }
+
+  test_mmap_input ();
+
+#ifdef HAVE_NPTH
+  npth_init ();
+  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  test_thread_filter_threaded ();
+#endif
+
   return 0;
 }
@@ -0,0 +1,475 @@
+/* t-radix64.c - Module tests for radix64.c
+ * Copyright (C) 2026  g10 Code GmbH.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "t-support.h"
+#include "radix64.h"
+
+#define PGM "t-radix64"
+
+static int verbose;
+
+static const char *impl_names[] = { "scalar", "ssse3", "avx2", "neon" };
+static const char *crc24_impl_names[] = { "slice8", "pclmul" };
+
+static const unsigned char bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "abcdefghijklmnopqrstuvwxyz"
+                               "0123456789+/";
+static unsigned int asctobin[4][256];
+
+
+
+/* Reference implementation modelled after the code formerly used
+ * by the armor filter of gpg.  This is used to check the results and
+ * as the baseline for the benchmark.  */
+static void
+ref_init (void)
+{
+  const unsigned char *s;
+  unsigned int i;
+
+  memset (asctobin, 0xff, sizeof asctobin);
+  for (s = bintoasc, i = 0; *s; s++, i++)
+    {
+      asctobin[0][*s] = i << (0 * 6);
+      asctobin[1][*s] = i << (1 * 6);
+      asctobin[2][*s] = i << (2 * 6);
+      asctobin[3][*s] = i << (3 * 6);
+    }
+}
+
+
+static void
+ref_encode (char *out, const unsigned char *in, size_t len)
+{
+  unsigned int v, v2;
+
+  for (; len >= 6; len -= 6, in += 6, out += 8)
+    {
+      v  = ((unsigned int)in[0] << 16) | ((unsigned int)in[1] << 8) | in[2];
+      v2 = ((unsigned int)in[3] << 16) | ((unsigned int)in[4] << 8) | in[5];
+      out[0] = bintoasc[(v >> 18) & 077];
+      out[1] = bintoasc[(v >> 12) & 077];
+      out[2] = bintoasc[(v >> 6) & 077];
+      out[3] = bintoasc[(v >> 0) & 077];
+      out[4] = bintoasc[(v2 >> 18) & 077];
+      out[5] = bintoasc[(v2 >> 12) & 077];
+      out[6] = bintoasc[(v2 >> 6) & 077];
+      out[7] = bintoasc[(v2 >> 0) & 077];
+    }
+  if (len)
+    {
+      v = ((unsigned int)in[0] << 16) | ((unsigned int)in[1] << 8) | in[2];
+      out[0] = bintoasc[(v >> 18) & 077];
+      out[1] = bintoasc[(v >> 12) & 077];
+      out[2] = bintoasc[(v >> 6) & 077];
+      out[3] = bintoasc[(v >> 0) & 077];
+    }
+}
+
+
+static size_t
+ref_decode (unsigned char *out, const unsigned char *in, size_t inlen, size_t *r_nused)
+{
+  size_t nused, n;
+  unsigned int b0, b1, b2, b3;
+
+  for (nused = n = 0; inlen - nused >= 16; nused += 16, n += 12)
+    {
+      b0  = asctobin[3][in[nused + 0]];
+      b0 |= asctobin[2][in[nused + 1]];
+      b0 |= asctobin[1][in[nused + 2]];
+      b0 |= asctobin[0][in[nused + 3]];
+      b1  = asctobin[3][in[nused + 4]];
+      b1 |= asctobin[2][in[nused + 5]];
+      b1 |= asctobin[1][in[nused + 6]];
+      b1 |= asctobin[0][in[nused + 7]];
+      b2  = asctobin[3][in[nused + 8]];
+      b2 |= asctobin[2][in[nused + 9]];
+      b2 |= asctobin[1][in[nused + 10]];
+      b2 |= asctobin[0][in[nused + 11]];
+      b3  = asctobin[3][in[nused + 12]];
+      b3 |= asctobin[2][in[nused + 13]];
+      b3 |= asctobin[1][in[nused + 14]];
+      b3 |= asctobin[0][in[nused + 15]];
+      if ((b0 | b1 | b2 | b3) == 0xffffffff)
+        break;
+      out[n + 0] = b0 >> 16; out[n + 1] = b0 >> 8; out[n + 2] = b0;
+      out[n + 3] = b1 >> 16; out[n + 4] = b1 >> 8; out[n + 5] = b1;
+      out[n + 6] = b2 >> 16; out[n + 7] = b2 >> 8; out[n + 8] = b2;
+      out[n + 9] = b3 >> 16; out[n + 10] = b3 >> 8; out[n + 11] = b3;
+    }
+  for (; inlen - nused >= 4; nused += 4, n += 3)
+    {
+      b0  = asctobin[3][in[nused + 0]];
+      b0 |= asctobin[2][in[nused + 1]];
+      b0 |= asctobin[1][in[nused + 2]];
+      b0 |= asctobin[0][in[nused + 3]];
+      if (b0 == 0xffffffff)
+        break;
+      out[n + 0] = b0 >> 16; out[n + 1] = b0 >> 8; out[n + 2] = b0;
+    }
+
+  *r_nused = nused;
+  return n;
+}
+
+
+/* Bitwise reference implementation of the CRC-24.  */
+static unsigned int
+ref_crc24 (unsigned int crc, const unsigned char *buf, size_t len)
+{
+  int i;
+
+  for (; len; len--, buf++)
+    {
+      crc ^= (unsigned int)*buf << 16;
+      for (i = 0; i < 8; i++)
+        {
+          crc <<= 1;
+          if ((crc & 0x1000000))
+            crc ^= 0x1864cfb;
+        }
+    }
+  return crc & 0xffffff;
+}
+
+
+
+static void
+fill_random (unsigned char *buf, size_t len)
+{
+  for (; len; len--)
+    *buf++ = rand ();
+}
+
+
+static void
+test_vectors (void)
+{
+  static struct {
+    size_t datalen;
+    const char *data;
+    const char *expected;
+  } tests[] = {
+    {  0, "", "" },
+    {  3, "foo", "Zm9v" },
+    {  6, "foobar", "Zm9vYmFy" },
+    {  6, "\xff\xfe\xfd\x00\x01\x02", "//79AAEC" },
+    { 45, "The quick brown fox jumps over the lazy dog!!",
+      "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZyEh" }
+  };
+  char out[100];
+  unsigned char bin[100];
+  size_t len, n, nused;
+  int tidx;
+
+  for (tidx = 0; tidx < DIM (tests); tidx++)
+    {
+      len = tests[tidx].datalen;
+      radix64_encode (out, tests[tidx].data, len);
+      if (strncmp (out, tests[tidx].expected, len / 3 * 4))
+        {
+          fail (tidx);
+          continue;
+        }
+      n = radix64_decode (bin, out, len / 3 * 4, &nused);
+      if (n != len || nused != len / 3 * 4
+          || memcmp (bin, tests[tidx].data, len))
+        fail (tidx);
+    }
+}
+
+
+/* Compare the current implementation against the reference code.  */
+static void
+test_compare (void)
+{
+  unsigned char data[300], bin[300], refbin[300];
+  char enc[400], refenc[400];
+  size_t len, n, nused, refn, refnused;
+  int pos, c;
+
+  fill_random (data, sizeof data);
+
+  for (len = 0; len <= sizeof data; len += 3)
+    {
+      radix64_encode (enc, data, len);
+      ref_encode (refenc, data, len);
+      if (memcmp (enc, refenc, len / 3 * 4))
+        fail ((int)len);
+      n = radix64_decode (bin, enc, len / 3 * 4, &nused);
+      if (n != len || nused != len / 3 * 4 || memcmp (bin, data, len))
+        fail ((int)len);
+    }
+
+  /* Inject every character at every position.  */
+  len = 256;
+  ref_encode (refenc, data, len / 4 * 3);
+  for (pos = 0; pos < len; pos++)
+    for (c = 0; c < 256; c++)
+      {
+        memcpy (enc, refenc, len);
+        enc[pos] = c;
+        n = radix64_decode (bin, enc, len, &nused);
+        refn = ref_decode (refbin, (unsigned char *)enc, len, &refnused);
+        if (n != refn || nused != refnused || memcmp (bin, refbin, n))
+          {
+            if (verbose)
+              fprintf (stderr, PGM ": %s: mismatch at %d for %02x\n",
+                       radix64_get_impl (), pos, c);
+            fail (pos);
+            return;
+          }
+      }
+}
+
+
+static void
+test_crc24 (void)
+{
+  unsigned char data[1000];
+  size_t len, off;
+  unsigned int crc, refcrc;
+
+  if (radix64_crc24 (RADIX64_CRC24_INIT, "123456789", 9) != 0x21cf02)
+    fail (0);
+  if (radix64_crc24 (RADIX64_CRC24_INIT, "", 0) != RADIX64_CRC24_INIT)
+    fail (0);
+
+  fill_random (data, sizeof data);
+  for (len = 0; len <= sizeof data; len++)
+    {
+      refcrc = ref_crc24 (RADIX64_CRC24_INIT, data, len);
+      crc = radix64_crc24 (RADIX64_CRC24_INIT, data, len);
+      if (crc != refcrc)
+        fail ((int)len);
+      /* Check that the CRC can be computed in pieces.  */
+      off = len / 3;
+      crc = radix64_crc24 (RADIX64_CRC24_INIT, data, off);
+      crc = radix64_crc24 (crc, data + off, len - off);
+      if (crc != refcrc)
+        fail ((int)len);
+    }
+}
+
+
+static void
+run_tests (void)
+{
+  int i;
+
+  ref_init ();
+  for (i = 0; i < DIM (impl_names); i++)
+    {
+      if (radix64_set_impl (impl_names[i]))
+        continue;
+      if (verbose)
+        printf (PGM ": testing %s\n", radix64_get_impl ());
+      test_vectors ();
+      test_compare ();
+    }
+  radix64_set_impl (NULL);
+
+  for (i = 0; i < DIM (crc24_impl_names); i++)
+    {
+      if (radix64_set_crc24_impl (crc24_impl_names[i]))
+        continue;
+      if (verbose)
+        printf (PGM ": testing %s\n", radix64_get_crc24_impl ());
+      test_crc24 ();
+    }
+  radix64_set_crc24_impl (NULL);
+}
+
+
+
+/* Run a benchmark in the way the armor filter uses the functions:
+ * Lines of 48 bytes are encoded to 64 characters and LF; decoding is
+ * done line by line.  */
+#define BENCH_LINES  (1024 * 1024 / 48)
+#define BENCH_ROUNDS 64
+
+static double
+elapsed (clock_t start)
+{
+  return (double)(clock () - start) / CLOCKS_PER_SEC;
+}
+
+
+static void
+print_rate (const char *name, const char *what, double secs)
+{
+  double mb = (double)BENCH_LINES * 48 * BENCH_ROUNDS / (1024.0 * 1024.0);
+
+  printf ("%-8s %-7s %9.1f MiB/s\n", name, what, secs > 0? mb / secs : 0.0);
+}
+
+
+static void
+run_bench (void)
+{
+  unsigned char *data, *bin;
+  char *text;
+  size_t i, nused;
+  int round, impl;
+  unsigned int crc = RADIX64_CRC24_INIT;
+  clock_t start;
+
+  ref_init ();
+  data = xmalloc (BENCH_LINES * 48);
+  bin = xmalloc (BENCH_LINES * 48);
+  text = xmalloc (BENCH_LINES * 65);
+  fill_random (data, BENCH_LINES * 48);
+
+  start = clock ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+    for (i = 0; i < BENCH_LINES; i++)
+      {
+        ref_encode (text + i * 65, data + i * 48, 48);
+        text[i * 65 + 64] = '\n';
+      }
+  print_rate ("table", "encode", elapsed (start));
+
+  start = clock ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+    for (i = 0; i < BENCH_LINES; i++)
+      ref_decode (bin + i * 48, (unsigned char *)text + i * 65, 65, &nused);
+  print_rate ("table", "decode", elapsed (start));
+
+  for (impl = 0; impl < DIM (impl_names); impl++)
+    {
+      if (radix64_set_impl (impl_names[impl]))
+        continue;
+
+      start = clock ();
+      for (round = 0; round < BENCH_ROUNDS; round++)
+        for (i = 0; i < BENCH_LINES; i++)
+          {
+            radix64_encode (text + i * 65, data + i * 48, 48);
+            text[i * 65 + 64] = '\n';
+          }
+      print_rate (impl_names[impl], "encode", elapsed (start));
+
+      start = clock ();
+      for (round = 0; round < BENCH_ROUNDS; round++)
+        for (i = 0; i < BENCH_LINES; i++)
+          radix64_decode (bin + i * 48, text + i * 65, 65, &nused);
+      print_rate (impl_names[impl], "decode", elapsed (start));
+
+      if (memcmp (bin, data, BENCH_LINES * 48))
+        fail (impl);
+    }
+  radix64_set_impl (NULL);
+
+  start = clock ();
+  for (round = 0; round < BENCH_ROUNDS / 8; round++)
+    crc = ref_crc24 (crc, data, BENCH_LINES * 48);
+  print_rate ("bitwise", "crc24", elapsed (start) * 8);
+
+  for (impl = 0; impl < DIM (crc24_impl_names); impl++)
+    {
+      if (radix64_set_crc24_impl (crc24_impl_names[impl]))
+        continue;
+
+      start = clock ();
+      for (round = 0; round < BENCH_ROUNDS; round++)
+        crc = radix64_crc24 (crc, data, BENCH_LINES * 48);
+      print_rate (crc24_impl_names[impl], "crc24", elapsed (start));
+    }
+  radix64_set_crc24_impl (NULL);
+  if (verbose)
+    printf ("(crc %06x)\n", crc);
+
+  xfree (text);
+  xfree (bin);
+  xfree (data);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int opt_bench = 0;
+
+  no_exit_on_fail = 1;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM "\n"
+                 "Options:\n"
+                 "  --verbose         Print progress info\n"
+                 "  --bench           Run a benchmark\n"
+                 , stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--bench"))
+        {
+          opt_bench = 1;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+
+  radix64_init ();
+
+  if (opt_bench)
+    run_bench ();
+  else
+    run_tests ();
+
+  return !!errcount;
+}
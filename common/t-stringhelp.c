@@ -195,6 +195,58 @@ test_compare_filenames (void)
 }
 
 
+static void
+test_ascii_memcasemem (void)
+{
+  struct {
+    const char *haystack;
+    const char *needle;
+    int result;  /* Offset of the match or -1.  */
+  } tests[] = {
+    { "", "", 0 },
+    { "abc", "", 0 },
+    { "", "a", -1 },
+    { "a", "A", 0 },
+    { "ab", "abc", -1 },
+    { "Werner Koch <wk@gnupg.org>", "KOCH", 7 },
+    { "Werner Koch <wk@gnupg.org>", "<WK@GnuPG.Org>", 12 },
+    { "Werner Koch <wk@gnupg.org>", "gnupg.org>", 16 },
+    { "Werner Koch <wk@gnupg.org>", "gnupg.org>x", -1 },
+    { "Werner Koch <wk@gnupg.org>", "koch ", 7 },
+    { "Werner Koch <wk@gnupg.org>", "kochx", -1 },
+    { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab", "AAB", 41 },
+    { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab", "AAC", -1 },
+    { "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxy",
+      "xY", 68 },
+    { "0123456789abcdef0123456789ABCDEF", "FA", -1 },
+    { "0123456789abcdef0123456789ABCDEF", "F0", 15 },
+    { "[@`{]", "{]", 3 },
+    { "[@`{]", "[`", -1 },
+    { "\xc4\xe4 \xc3\xa4", "\xc3\xa4", 3 },
+    { "\xc4\xe4 \xc3\xa4", "\xe4\xc4", -1 },
+    { NULL, NULL, 0 }
+  };
+  int testno;
+  const char *p;
+  size_t len;
+  char *buf;
+
+  for (testno=0; tests[testno].haystack; testno++)
+    {
+      len = strlen (tests[testno].haystack);
+      /* Copy to an exactly sized buffer to detect overreads.  */
+      buf = xmalloc (len + 1);
+      memcpy (buf, tests[testno].haystack, len);
+      p = ascii_memcasemem (buf, len, tests[testno].needle,
+                            strlen (tests[testno].needle));
+      if (tests[testno].result == -1? !!p
+          : (!p || p - buf != tests[testno].result))
+        fail (testno);
+      xfree (buf);
+    }
+}
+
+
 static void
 test_strconcat (void)
 {
@@ -1417,6 +1469,7 @@ main (int argc, char **argv)
 
   test_percent_escape ();
   test_compare_filenames ();
+  test_ascii_memcasemem ();
   test_strconcat ();
   test_xstrconcat ();
   test_make_filename_try ();
@@ -60,6 +60,10 @@
  * This is the possible truncated fingerprint of the primary key.  */
 #define UBID_LEN    20
 
+/* The length of the identifier of a signature verification as stored
+ * in the signature cache of the keyboxd.  This is a SHA-256 hash.  */
+#define SIGCACHE_SIGID_LEN 32
+
 
 /* Get all the stuff from jnlib. */
 #include "../common/logging.h"
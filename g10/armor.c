@@ -29,6 +29,7 @@
 #include "../common/status.h"
 #include "../common/iobuf.h"
 #include "../common/util.h"
+#include "../common/radix64.h"
 #include "filter.h"
 #include "packet.h"
 #include "options.h"
@@ -37,10 +38,17 @@
 
 #define MAX_LINELEN 20000
 
+/* The number of decoded bytes after which the CRC is updated.  This
+   should be small enough for the data to be still in the L1 cache.  */
+#define RADIX64_CRC_CHUNK 4096
+
+/* The number of armor lines encoded before they are written out.  */
+#define ARMOR_OUTPUT_LINES 16
+
 static const byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                "abcdefghijklmnopqrstuvwxyz"
                                "0123456789+/";
-static u32 asctobin[4][256]; /* runtime initialized */
+static u32 asctobin[256]; /* runtime initialized */
 static int is_initialized;
 
 
@@ -114,22 +122,10 @@ armor_filter_context_t *
 new_armor_context (void)
 {
   armor_filter_context_t *afx;
-  gpg_error_t err;
 
   afx = xcalloc (1, sizeof *afx);
   if (afx)
-    {
-      err = gcry_md_open (&afx->crc_md, GCRY_MD_CRC24_RFC2440, 0);
-      if (err != 0)
-	{
-	  log_error ("gcry_md_open failed for GCRY_MD_CRC24_RFC2440: %s",
-		    gpg_strerror (err));
-	  xfree (afx);
-	  return NULL;
-	}
-
-      afx->refcount = 1;
-    }
+    afx->refcount = 1;
 
   return afx;
 }
@@ -144,7 +140,6 @@ release_armor_context (armor_filter_context_t *afx)
   log_assert (afx->refcount);
   if ( --afx->refcount )
     return;
-  gcry_md_close (afx->crc_md);
   xfree (afx);
 }
 
@@ -183,34 +178,12 @@ initialize(void)
        used to detect invalid characters.  */
     memset (asctobin, 0xff, sizeof(asctobin));
     for(s=bintoasc,i=0; *s; s++,i++ )
-      {
-	asctobin[0][*s] = i << (0 * 6);
-	asctobin[1][*s] = i << (1 * 6);
-	asctobin[2][*s] = i << (2 * 6);
-	asctobin[3][*s] = i << (3 * 6);
-      }
+      asctobin[*s] = i;
 
     is_initialized=1;
 }
 
 
-static inline u32
-get_afx_crc (armor_filter_context_t *afx)
-{
-  const byte *crc_buf;
-  u32 crc;
-
-  crc_buf = gcry_md_read (afx->crc_md, GCRY_MD_CRC24_RFC2440);
-
-  crc = crc_buf[0];
-  crc <<= 8;
-  crc |= crc_buf[1];
-  crc <<= 8;
-  crc |= crc_buf[2];
-
-  return crc;
-}
-
 
 /*
  * Check whether this is an armored file.  See also
@@ -633,7 +606,7 @@ check_input( armor_filter_context_t *afx, IOBUF a )
 	afx->faked = 1;
     else {
 	afx->inp_checked = 1;
-	gcry_md_reset (afx->crc_md);
+	afx->crc = RADIX64_CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -825,7 +798,7 @@ fake_packet( armor_filter_context_t *afx, IOBUF a,
 	    }
 	}
 	afx->inp_checked = 1;
-	gcry_md_reset (afx->crc_md);
+	afx->crc = RADIX64_CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -857,6 +830,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     size_t n = 0;
     int idx, onlypad=0;
     int skip_fast = 0;
+    size_t crcdone = 0;
 
     idx = afx->idx;
     val = afx->radbuf[0];
@@ -877,106 +851,43 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	}
 
       again:
-	binc = asctobin[0][c];
+	binc = asctobin[c];
 
 	if( binc != 0xffffffffUL )
 	  {
 	    if( idx == 0 && skip_fast == 0
-		&& afx->buffer_pos + (16 - 1) < afx->buffer_len
-		&& n + 12 < size)
+		&& afx->buffer_pos + (4 - 1) < afx->buffer_len
+		&& n + 3 <= size)
 	      {
-		/* Fast path for radix64 to binary conversion.  */
-		u32 b0,b1,b2,b3;
-
-		/* Speculatively load 15 more input bytes.  */
-		b0 = binc << (3 * 6);
-		b0 |= asctobin[2][afx->buffer[afx->buffer_pos + 0]];
-		b0 |= asctobin[1][afx->buffer[afx->buffer_pos + 1]];
-		b0 |= asctobin[0][afx->buffer[afx->buffer_pos + 2]];
-		b1  = asctobin[3][afx->buffer[afx->buffer_pos + 3]];
-		b1 |= asctobin[2][afx->buffer[afx->buffer_pos + 4]];
-		b1 |= asctobin[1][afx->buffer[afx->buffer_pos + 5]];
-		b1 |= asctobin[0][afx->buffer[afx->buffer_pos + 6]];
-		b2  = asctobin[3][afx->buffer[afx->buffer_pos + 7]];
-		b2 |= asctobin[2][afx->buffer[afx->buffer_pos + 8]];
-		b2 |= asctobin[1][afx->buffer[afx->buffer_pos + 9]];
-		b2 |= asctobin[0][afx->buffer[afx->buffer_pos + 10]];
-		b3  = asctobin[3][afx->buffer[afx->buffer_pos + 11]];
-		b3 |= asctobin[2][afx->buffer[afx->buffer_pos + 12]];
-		b3 |= asctobin[1][afx->buffer[afx->buffer_pos + 13]];
-		b3 |= asctobin[0][afx->buffer[afx->buffer_pos + 14]];
-
-		/* Check if any of the input bytes were invalid. */
-		if( (b0 | b1 | b2 | b3) != 0xffffffffUL )
+		/* Fast path for radix64 to binary conversion.  The
+		   current character has already been consumed.  */
+		size_t nused, inlen, nout;
+
+		inlen = afx->buffer_len - afx->buffer_pos + 1;
+		if (inlen / 4 * 3 > size - n)
+		  inlen = (size - n) / 3 * 4;
+		nout = radix64_decode (buf + n,
+				       afx->buffer + afx->buffer_pos - 1,
+				       inlen, &nused);
+		if (nout)
 		  {
-		    /* All 16 bytes are valid. */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    buf[n + 9] = b3 >> (2 * 8);
-		    buf[n + 10] = b3 >> (1 * 8);
-		    buf[n + 11] = b3 >> (0 * 8);
-		    afx->buffer_pos += 16 - 1;
-		    n += 12;
-		    continue;
-		  }
-		else if( b0 == 0xffffffffUL )
-		  {
-		    /* byte[1..3] have invalid character(s).  Switch to slow
-		       path.  */
-		    skip_fast = 1;
-		  }
-		else if( b1 == 0xffffffffUL )
-		  {
-		    /* byte[4..7] have invalid character(s), first 4 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    afx->buffer_pos += 4 - 1;
-		    n += 3;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else if( b2 == 0xffffffffUL )
-		  {
-		    /* byte[8..11] have invalid character(s), first 8 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    afx->buffer_pos += 8 - 1;
-		    n += 6;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else /*if( b3 == 0xffffffffUL )*/
-		  {
-		    /* byte[12..15] have invalid character(s), first 12 bytes
-		       are valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    afx->buffer_pos += 12 - 1;
-		    n += 9;
-		    skip_fast = 1;
+		    afx->buffer_pos += nused - 1;
+		    n += nout;
+		    /* Update the CRC while the data is still in the
+		       cache.  */
+		    if (n - crcdone >= RADIX64_CRC_CHUNK)
+		      {
+			afx->crc = radix64_crc24 (afx->crc, buf + crcdone,
+						  n - crcdone);
+			crcdone = n;
+		      }
+		    /* If the decoder stopped early, the next group has
+		       an invalid character; use the slow path.  */
+		    if (nused < inlen / 4 * 4)
+		      skip_fast = 1;
 		    continue;
 		  }
+		skip_fast = 1;
 	      }
 
 	    switch(idx)
@@ -1023,10 +934,10 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
             if (afx->buffer_pos + 6 < afx->buffer_len
                 && afx->buffer[afx->buffer_pos + 0] == '3'
                 && afx->buffer[afx->buffer_pos + 1] == 'D'
-                && asctobin[0][afx->buffer[afx->buffer_pos + 2]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 3]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 4]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 5]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 2]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 3]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 4]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 5]] != 0xffffffffUL
                 && afx->buffer[afx->buffer_pos + 6] == '\n')
               {
                 afx->buffer_pos += 2;
@@ -1063,12 +974,12 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 
     if( n )
       {
-        gcry_md_write (afx->crc_md, buf, n);
+        if (n > crcdone)
+          afx->crc = radix64_crc24 (afx->crc, buf + crcdone, n - crcdone);
         afx->any_data = 1;
       }
 
     if( checkcrc ) {
-	gcry_md_final (afx->crc_md);
 	afx->inp_checked=0;
 	afx->faked = 0;
 	for(;;) { /* skip lf and pad characters */
@@ -1096,7 +1007,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	    u32 mycrc = 0;
 	    idx = 0;
 	    do {
-		if( (binc = asctobin[0][c]) == 0xffffffffUL )
+		if( (binc = asctobin[c]) == 0xffffffffUL )
 		    break;
 		switch(idx) {
 		  case 0: val =  binc << 2; break;
@@ -1136,9 +1047,9 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 		log_info(_("malformed CRC\n"));
 		rc = invalid_crc();
 	    }
-	    else if( mycrc != get_afx_crc (afx) ) {
+	    else if( mycrc != afx->crc ) {
 		log_info (_("CRC error; %06lX - %06lX\n"),
-				    (ulong)get_afx_crc (afx), (ulong)mycrc);
+				    (ulong)afx->crc, (ulong)mycrc);
 		rc = invalid_crc();
 	    }
 	    else {
@@ -1176,26 +1087,29 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     return rc;
 }
 
+/* Write BUF of length SIZE radix64 encoded to A and update the CRC.
+   The CRC is updated per chunk so that the data is still in the
+   cache.  */
 static void
 armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 			     byte *buf, size_t size)
 {
   byte radbuf[sizeof (afx->radbuf)];
-  byte outbuf[64 + sizeof (afx->eol)];
+  byte outbuf[4 + sizeof (afx->eol)];
   unsigned int eollen = strlen (afx->eol);
-  u32 in, in2;
+  const byte *start = buf;
+  u32 in;
   int idx, idx2;
-  int i;
 
   idx = afx->idx;
   idx2 = afx->idx2;
   memcpy (radbuf, afx->radbuf, sizeof (afx->radbuf));
 
+  /* preload eol to outbuf buffer */
+  memcpy (outbuf + 4, afx->eol, sizeof (afx->eol));
+
   if (size && (idx || idx2))
     {
-      /* preload eol to outbuf buffer */
-      memcpy (outbuf + 4, afx->eol, sizeof (afx->eol));
-
       for (; size && (idx || idx2); buf++, size--)
 	{
 	  radbuf[idx++] = *buf;
@@ -1220,47 +1134,40 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 		}
 	    }
 	}
+      afx->crc = radix64_crc24 (afx->crc, start, buf - start);
     }
 
   if (size >= (64/4)*3)
     {
-      /* preload eol to outbuf buffer */
-      memcpy (outbuf + 64, afx->eol, sizeof(afx->eol));
+      /* Encode up to ARMOR_OUTPUT_LINES full lines at once.  */
+      byte lines[ARMOR_OUTPUT_LINES * (64 + sizeof (afx->eol))];
+      byte *p;
+      size_t nlines;
 
       do
 	{
 	  /* idx and idx2 == 0 */
 
-	  for (i = 0; i < (64/8); i++)
+	  nlines = size / ((64/4)*3);
+	  if (nlines > ARMOR_OUTPUT_LINES)
+	    nlines = ARMOR_OUTPUT_LINES;
+	  afx->crc = radix64_crc24 (afx->crc, buf, nlines * ((64/4)*3));
+	  for (p = lines; nlines; nlines--)
 	    {
-	      in = (u32)buf[0] << (2 * 8);
-	      in |= (u32)buf[1] << (1 * 8);
-	      in |= (u32)buf[2] << (0 * 8);
-	      in2 = (u32)buf[3] << (2 * 8);
-	      in2 |= (u32)buf[4] << (1 * 8);
-	      in2 |= (u32)buf[5] << (0 * 8);
-	      outbuf[i*8+0] = bintoasc[(in >> 18) & 077];
-	      outbuf[i*8+1] = bintoasc[(in >> 12) & 077];
-	      outbuf[i*8+2] = bintoasc[(in >> 6) & 077];
-	      outbuf[i*8+3] = bintoasc[(in >> 0) & 077];
-	      outbuf[i*8+4] = bintoasc[(in2 >> 18) & 077];
-	      outbuf[i*8+5] = bintoasc[(in2 >> 12) & 077];
-	      outbuf[i*8+6] = bintoasc[(in2 >> 6) & 077];
-	      outbuf[i*8+7] = bintoasc[(in2 >> 0) & 077];
-	      buf+=6;
-	      size-=6;
+	      /* pgp doesn't like 72 here */
+	      radix64_encode ((char *)p, buf, (64/4)*3);
+	      memcpy (p + 64, afx->eol, eollen);
+	      p += 64 + eollen;
+	      buf += (64/4)*3;
+	      size -= (64/4)*3;
 	    }
-
-	  /* pgp doesn't like 72 here */
-	  iobuf_write (a, outbuf, 64 + eollen);
+	  iobuf_write (a, lines, p - lines);
 	}
       while (size >= (64/4)*3);
-
-      /* restore eol for tail handling */
-      if (size)
-	memcpy (outbuf + 4, afx->eol, sizeof (afx->eol));
     }
 
+  if (size)
+    afx->crc = radix64_crc24 (afx->crc, buf, size);
   for (; size; buf++, size--)
     {
       radbuf[idx++] = *buf;
@@ -1482,13 +1389,11 @@ armor_filter( void *opaque, int control,
 	    afx->status++;
 	    afx->idx = 0;
 	    afx->idx2 = 0;
-	    gcry_md_reset (afx->crc_md);
+	    afx->crc = RADIX64_CRC24_INIT;
 	}
 
-	if( size ) {
-	    gcry_md_write (afx->crc_md, buf, size);
+	if( size )
 	    armor_output_buf_as_radix64 (afx, a, buf, size);
-        }
     }
     else if( control == IOBUFCTRL_INIT )
       {
@@ -1514,8 +1419,7 @@ armor_filter( void *opaque, int control,
 	if( afx->cancel )
 	    ;
 	else if( afx->status ) { /* pad, write checksum, and bottom line */
-	    gcry_md_final (afx->crc_md);
-	    crc = get_afx_crc (afx);
+	    crc = afx->crc;
 	    idx = afx->idx;
 	    idx2 = afx->idx2;
 	    if( idx ) {
@@ -1995,6 +1995,8 @@ do_signature( IOBUF out, int ctb, PKT_signature *sig )
   n = pubkey_get_nsig( sig->pubkey_algo );
   if ( !n )
     write_fake_data( a, sig->data[0] );
+  else
+    rc = materialize_sig_data (sig);
   if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
       || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
     for (i=0; i < n && !rc ; i++ )
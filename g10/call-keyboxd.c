@@ -40,6 +40,7 @@
 #include "../common/host2net.h"
 #include "../common/status.h"
 #include "../kbx/kbx-client-util.h"
+#include "../kbx/kbx-snapshot.h"
 #include "keydb.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
@@ -60,9 +61,10 @@ struct keyboxd_local_s
   /* The client data helper context.  */
   kbx_client_data_t kcd;
 
-  /* I/O buffer with the last search result or NULL.  Used if
-   * D-lines are used to convey the keyblocks. */
-  iobuf_t search_result;
+  /* Buffer with the last search result or NULL.  Used if D-lines
+   * are used to convey the keyblocks. */
+  unsigned char *search_result;
+  size_t search_result_len;
 
   /* This flag set while an operation is running on this context.  */
   unsigned int is_active : 1;
@@ -70,12 +72,88 @@ struct keyboxd_local_s
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
 
+  /* Flags telling whether the keyboxd supports SEARCH --multi and
+   * STORE --batch and whether we already asked for it.  */
+  unsigned int multi_search_checked : 1;
+  unsigned int multi_search : 1;
+  unsigned int batch_store_checked : 1;
+  unsigned int batch_store : 1;
+
+  /* Flags telling whether the keyboxd publishes a snapshot and
+   * whether we already asked for it.  */
+  unsigned int snapshot_checked : 1;
+  unsigned int snapshot_published : 1;
+
+  /* The snapshot used by the current search or NULL.  The search
+   * description and the cursor are used by NEXT.  */
+  kbx_snapshot_t snapshot;
+  KEYDB_SEARCH_DESC snapshot_desc;
+  struct kbx_snapshot_cursor_s snapshot_cursor;
 };
 
 
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
+/* The last mapped snapshot of the keyboxd or NULL.  */
+static kbx_snapshot_t current_snapshot;
+
+
+/* The fingerprint and keyid of a key waiting in the store queue.  */
+struct pending_key_s
+{
+  unsigned int blobno;  /* The index of the keyblock in the queue.  */
+  u32 kid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+};
+
+/* In bulk import mode new keys are not sent one by one to the
+ * keyboxd but queued and sent in one STORE --batch command.  The
+ * queue is flushed if it becomes too large or before any other
+ * operation which might depend on the queued keys.  */
+#define PENDING_STORE_MAX_BLOBS 100
+#define PENDING_STORE_MAX_BYTES (1024*1024)
+static struct
+{
+  membuf_t data;  /* The length prefixed keyblock images.  */
+  unsigned int nblobs;
+  struct pending_key_s *keys;
+  unsigned int nkeys;
+  unsigned int keyssize;
+  unsigned int nfailed;  /* Number of keys the keyboxd did not store.  */
+} pending_store;
+
+static gpg_error_t flush_pending_store (keyboxd_local_t kbl);
+
+
+/* A cached signature verification result.  */
+struct sigcache_item_s
+{
+  byte sigid[SIGCACHE_SIGID_LEN];
+  byte result;
+  byte fprlen;
+  byte fpr[MAX_FINGERPRINT_LEN];
+};
+
+/* The signature cache of the keyboxd is fetched for one key at a
+ * time; this is the key whose signatures are checked.  New results
+ * are queued and sent with one PUTSIGCACHE command.  */
+#define PENDING_SIGCACHE_MAX 500
+static struct
+{
+  unsigned int disabled : 1;    /* Not supported by the keyboxd.  */
+  unsigned int ubid_valid : 1;  /* UBID and ITEMS are valid.  */
+  byte ubid[UBID_LEN];
+  struct sigcache_item_s *items; /* Sorted by SIGID.  */
+  unsigned int nitems;
+  unsigned int itemssize;
+  membuf_t pending;             /* The records for PUTSIGCACHE.  */
+  unsigned int npending;
+} sigcache;
+
+static gpg_error_t flush_pending_sigcache (keyboxd_local_t kbl);
+
 
 
 
@@ -93,6 +171,20 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
         log_error ("oops: trying to cleanup an active keyboxd context\n");
       else
         {
+          if (kbl->ctx && pending_store.nblobs)
+            {
+              err = flush_pending_store (kbl);
+              if (err)
+                log_error ("error storing queued keys: %s\n",
+                           gpg_strerror (err));
+            }
+          if (kbl->ctx && sigcache.npending)
+            {
+              err = flush_pending_sigcache (kbl);
+              if (err)
+                log_info ("error storing signature cache: %s\n",
+                          gpg_strerror (err));
+            }
           if (kbl->ctx && in_transaction)
             {
               /* This is our hack to commit the changes done during a
@@ -107,6 +199,8 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
                             gpg_strerror (err));
               in_transaction = 0;
             }
+          kbx_snapshot_release (kbl->snapshot);
+          kbl->snapshot = NULL;
           assuan_release (kbl->ctx);
           kbl->ctx = NULL;
           /*
@@ -356,13 +450,15 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
 
   if (hd->kbl->search_result)
     {
-      err = keydb_parse_keyblock (hd->kbl->search_result,
-                                  hd->last_ubid_valid? hd->last_pk_no  : 0,
-                                  hd->last_ubid_valid? hd->last_uid_no : 0,
-                                  ret_kb);
-      /* In contrast to the old code we close the iobuf here and thus
-       * this function may be called only once to get a keyblock.  */
-      iobuf_close (hd->kbl->search_result);
+      err = keydb_parse_keyblock_buffer
+        (hd->kbl->search_result, hd->kbl->search_result_len,
+         hd->last_ubid_valid? hd->last_pk_no  : 0,
+         hd->last_ubid_valid? hd->last_uid_no : 0,
+         ret_kb);
+      /* In contrast to the old code we release the buffer here and
+       * thus this function may be called only once to get a
+       * keyblock.  */
+      xfree (hd->kbl->search_result);
       hd->kbl->search_result = NULL;
     }
   else
@@ -395,13 +491,140 @@ keydb_default_status_cb (void *opaque, const char *line)
 }
 
 
+/* Return true if the keyboxd connected via KBL supports option
+ * CMDOPT of command CMD.  */
+static int
+server_has_option (keyboxd_local_t kbl, const char *cmd, const char *cmdopt)
+{
+  char line[ASSUAN_LINELENGTH];
+
+  snprintf (line, sizeof line, "GETINFO cmd_has_option %s %s", cmd, cmdopt);
+  return !assuan_transact (kbl->ctx, line,
+                           NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+
+/* Return true if the keyboxd supports SEARCH --multi.  */
+static int
+have_multi_search (keyboxd_local_t kbl)
+{
+  if (!kbl->multi_search_checked)
+    {
+      kbl->multi_search = server_has_option (kbl, "SEARCH", "multi");
+      kbl->multi_search_checked = 1;
+    }
+  return kbl->multi_search;
+}
+
+
+/* Return true if the keyboxd supports STORE --batch.  */
+static int
+have_batch_store (keyboxd_local_t kbl)
+{
+  if (!kbl->batch_store_checked)
+    {
+      kbl->batch_store = server_has_option (kbl, "STORE", "batch");
+      kbl->batch_store_checked = 1;
+    }
+  return kbl->batch_store;
+}
+
+
 
+/* Return the snapshot published by the keyboxd connected via KBL or
+ * NULL if there is none or if it is stale.  */
+static kbx_snapshot_t
+get_snapshot (keyboxd_local_t kbl)
+{
+  gpg_error_t err;
+  char *fname;
+  kbx_snapshot_t snap;
+
+  if (!kbl->snapshot_checked)
+    {
+      kbl->snapshot_published = !assuan_transact (kbl->ctx,
+                                                  "GETINFO snapshot",
+                                                  NULL, NULL, NULL, NULL,
+                                                  NULL, NULL);
+      kbl->snapshot_checked = 1;
+    }
+  if (!kbl->snapshot_published)
+    return NULL;
+
+  if (current_snapshot)
+    {
+      if (!kbx_snapshot_is_stale (current_snapshot))
+        return current_snapshot;
+      if (!kbx_snapshot_is_replaced (current_snapshot))
+        return NULL;  /* Keyboxd has not yet published a new one.  */
+      kbx_snapshot_release (current_snapshot);
+      current_snapshot = NULL;
+    }
+
+  fname = make_filename (gnupg_homedir (), GNUPG_PUBLIC_KEYS_DIR,
+                         KBX_SNAPSHOT_NAME, NULL);
+  err = kbx_snapshot_open (fname, &snap);
+  if (err)
+    {
+      if (DBG_KEYDB)
+        log_debug ("can't use snapshot '%s': %s\n", fname, gpg_strerror (err));
+      xfree (fname);
+      kbl->snapshot_published = 0;
+      return NULL;
+    }
+  if (DBG_KEYDB)
+    log_debug ("mapped snapshot '%s' generation %llu\n",
+               fname, kbx_snapshot_generation (snap));
+  xfree (fname);
+  current_snapshot = snap;
+
+  return kbx_snapshot_is_stale (snap)? NULL : snap;
+}
+
+
+/* Run the search of HD in its snapshot.  */
+static gpg_error_t
+snapshot_search (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  struct kbx_snapshot_result_s result;
+
+  hd->last_ubid_valid = 0;
+  err = kbx_snapshot_search (hd->kbl->snapshot, &hd->kbl->snapshot_desc,
+                             &hd->kbl->snapshot_cursor, &result);
+  if (err)
+    return err;
+
+  hd->kbl->search_result = xtrymalloc (result.bloblen);
+  if (!hd->kbl->search_result)
+    return gpg_error_from_syserror ();
+  memcpy (hd->kbl->search_result, result.blob, result.bloblen);
+  hd->kbl->search_result_len = result.bloblen;
+  memcpy (hd->last_ubid, result.ubid, UBID_LEN);
+  hd->last_ubid_valid = 1;
+  hd->last_uid_no = 0;
+  /* See search_status_cb for the increment.  */
+  hd->last_pk_no = result.pk_no + 1;
+  if (DBG_KEYDB)
+    log_printhex (hd->last_ubid, 20, "found UBID in snapshot (%d,%d):",
+                  hd->last_uid_no, hd->last_pk_no);
+  return 0;
+}
+
+
+
 /* Communication object for STORE commands.  */
 struct store_parm_s
 {
   assuan_context_t ctx;
   const void *data;   /* The key in OpenPGP binary format.  */
   size_t datalen;     /* The length of DATA.  */
+
+  /* Used by flush_pending_store.  */
+  void *buffer;               /* Allocated buffer for DATA.  */
+  unsigned int nstored;       /* From the status line STORED.  */
+  unsigned int got_nstored:1; /* NSTORED is valid.  */
+  unsigned int failed;        /* From the status line STORE_FAILED.  */
 };
 
 
@@ -412,7 +635,8 @@ store_inq_cb (void *opaque, const char *line)
   struct store_parm_s *parm = opaque;
   gpg_error_t err = 0;
 
-  if (has_leading_keyword (line, "BLOB"))
+  if (has_leading_keyword (line, "BLOB")
+      || has_leading_keyword (line, "BLOBS"))
     {
       if (parm->data)
         err = assuan_send_data (parm->ctx, parm->data, parm->datalen);
@@ -424,6 +648,310 @@ store_inq_cb (void *opaque, const char *line)
 }
 
 
+/* Status callback for STORE --batch.  */
+static gpg_error_t
+store_batch_status_cb (void *opaque, const char *line)
+{
+  struct store_parm_s *parm = opaque;
+  const char *s;
+
+  if ((s = has_leading_keyword (line, "STORED")))
+    {
+      parm->nstored = strtoul (s, NULL, 10);
+      parm->got_nstored = 1;
+    }
+  else if ((s = has_leading_keyword (line, "STORE_FAILED")))
+    parm->failed = strtoul (s, NULL, 10);
+  else
+    return keydb_default_status_cb (NULL, line);
+
+  return 0;
+}
+
+
+/* Print an error for the keyblock BLOBNO of the store queue.  */
+static void
+print_store_error (unsigned int blobno, gpg_error_t err)
+{
+  unsigned int k;
+
+  for (k = 0; k < pending_store.nkeys; k++)
+    if (pending_store.keys[k].blobno == blobno)
+      {
+        log_error (_("key %s: error storing key: %s\n"),
+                   keystr (pending_store.keys[k].kid), gpg_strerror (err));
+        return;
+      }
+  log_error ("error storing key: %s\n", gpg_strerror (err));
+}
+
+
+/* Send all keys queued by queue_for_store to the keyboxd using the
+ * connection KBL.  If the keyboxd fails to store a key an error is
+ * printed for that key, it is counted in PENDING_STORE.NFAILED, and
+ * the remaining keys are sent again.  Thus only an error which is not
+ * related to a certain key is returned.  */
+static gpg_error_t
+flush_pending_store (keyboxd_local_t kbl)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+  unsigned char *data, *p;
+  size_t datalen, n, len;
+  unsigned int nblobs, idx, nleft;
+  unsigned char **blobs = NULL;  /* Start of each blob in DATA.  */
+  unsigned char *done = NULL;    /* Blob has been stored or failed.  */
+  unsigned int *map = NULL;      /* Index of a sent blob in BLOBS.  */
+  membuf_t mb;
+
+  if (!pending_store.nblobs)
+    return 0;
+
+  nblobs = nleft = pending_store.nblobs;
+  data = get_membuf (&pending_store.data, &datalen);
+  pending_store.nblobs = 0;
+  if (!data)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  if (DBG_KEYDB)
+    log_debug ("%s: storing %u keys (%zu bytes)\n", __func__,
+               nblobs, datalen);
+
+  parm.ctx = kbl->ctx;
+  parm.data = data;
+  parm.datalen = datalen;
+  parm.failed = (unsigned int)(-1);
+  err = assuan_transact (kbl->ctx, "STORE --insert --batch",
+                         NULL, NULL,
+                         store_inq_cb, &parm,
+                         store_batch_status_cb, &parm);
+  if (!err || !parm.got_nstored || parm.failed >= nblobs)
+    goto leave;  /* Success or not a problem of a certain key.  */
+
+  /* Locate the blobs so that we can send them again without the
+   * failed one.  */
+  blobs = xtrycalloc (nblobs, sizeof *blobs);
+  done = xtrycalloc (nblobs, 1);
+  map = xtrycalloc (nblobs, sizeof *map);
+  if (!blobs || !done || !map)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (idx = 0, p = data, n = datalen; idx < nblobs; idx++)
+    {
+      log_assert (n >= 4);
+      len = 4 + buf32_to_size_t (p);
+      log_assert (len <= n);
+      blobs[idx] = p;
+      p += len;
+      n -= len;
+    }
+  for (idx = 0; idx < nblobs; idx++)
+    map[idx] = idx;
+
+  for (;;)
+    {
+      /* Mark the keys stored before the failed one and the failed
+       * one.  PARM.FAILED and PARM.NSTORED are relative to the sent
+       * blobs.  */
+      for (idx = 0; idx < parm.nstored && idx < nleft; idx++)
+        done[map[idx]] = 1;
+      done[map[parm.failed]] = 1;
+      print_store_error (map[parm.failed], err);
+      pending_store.nfailed++;
+
+      init_membuf (&mb, datalen);
+      for (nleft = idx = 0; idx < nblobs; idx++)
+        if (!done[idx])
+          {
+            put_membuf (&mb, blobs[idx], 4 + buf32_to_size_t (blobs[idx]));
+            map[nleft++] = idx;
+          }
+      xfree (parm.buffer);
+      parm.buffer = get_membuf (&mb, &parm.datalen);
+      if (!parm.buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (!nleft)
+        {
+          err = 0;
+          break;
+        }
+
+      parm.data = parm.buffer;
+      parm.nstored = 0;
+      parm.got_nstored = 0;
+      parm.failed = (unsigned int)(-1);
+      err = assuan_transact (kbl->ctx, "STORE --insert --batch",
+                             NULL, NULL,
+                             store_inq_cb, &parm,
+                             store_batch_status_cb, &parm);
+      if (!err || !parm.got_nstored || parm.failed >= nleft)
+        break;
+    }
+
+ leave:
+  if (err)
+    pending_store.nfailed += nleft;
+  pending_store.nkeys = 0;
+  xfree (parm.buffer);
+  xfree (blobs);
+  xfree (done);
+  xfree (map);
+  xfree (data);
+  return err;
+}
+
+
+/* Send the keys queued in bulk import mode to the keyboxd.  The
+ * number of keys which could not be stored since the last call is
+ * stored at R_NFAILED.  */
+gpg_error_t
+keydb_flush_store_queue (ctrl_t ctrl, unsigned int *r_nfailed)
+{
+  gpg_error_t err = 0;
+  keyboxd_local_t kbl;
+
+  if (opt.use_keyboxd && pending_store.nblobs)
+    {
+      err = open_context (ctrl, &kbl);
+      if (!err)
+        {
+          err = flush_pending_store (kbl);
+          kbl->is_active = 0;
+        }
+    }
+  *r_nfailed = pending_store.nfailed;
+  pending_store.nfailed = 0;
+  return err;
+}
+
+
+/* Flush the store queue using the connection of HD unless all of the
+ * NDESC search descriptions DESC are for key IDs or fingerprints which
+ * are not in the queue.  The queue is not flushed while a search on
+ * another connection may still be continued with NEXT because the new
+ * keys would then change the result of that search; in this case the
+ * queued keys can't be found until the queue is flushed.  */
+static gpg_error_t
+flush_pending_store_for_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
+                                size_t ndesc)
+{
+  size_t n;
+  unsigned int k;
+  struct pending_key_s *pk;
+  keyboxd_local_t kbl;
+  int need_flush = 0;
+
+  if (!pending_store.nblobs)
+    return 0;
+
+  for (n = 0; n < ndesc && !need_flush; n++)
+    {
+      if (desc[n].mode != KEYDB_SEARCH_MODE_FPR
+          && desc[n].mode != KEYDB_SEARCH_MODE_LONG_KID
+          && desc[n].mode != KEYDB_SEARCH_MODE_SHORT_KID)
+        need_flush = 1;
+
+      for (k = 0; k < pending_store.nkeys && !need_flush; k++)
+        {
+          pk = pending_store.keys + k;
+          if (desc[n].mode == KEYDB_SEARCH_MODE_FPR
+              ? (desc[n].fprlen == pk->fprlen
+                 && !memcmp (desc[n].u.fpr, pk->fpr, pk->fprlen))
+              : desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID
+              ? (desc[n].u.kid[0] == pk->kid[0]
+                 && desc[n].u.kid[1] == pk->kid[1])
+              : desc[n].u.kid[1] == pk->kid[1])
+            need_flush = 1;
+        }
+    }
+  if (!need_flush)
+    return 0;
+
+  for (kbl = hd->ctrl->keyboxd_local; kbl; kbl = kbl->next)
+    if (kbl != hd->kbl && kbl->is_active
+        && !kbl->need_search_reset && !kbl->snapshot)
+      {
+        if (DBG_KEYDB)
+          log_debug ("%s: not flushing due to an ongoing search\n",
+                     __func__);
+        return 0;
+      }
+
+  return flush_pending_store (hd->kbl);
+}
+
+
+/* Append the keyblock image (DATA,DATALEN) of the keyblock KB to the
+ * store queue and flush the queue using the connection of HD if it
+ * is full.  */
+static gpg_error_t
+queue_for_store (KEYDB_HANDLE hd, kbnode_t kb,
+                 const void *data, size_t datalen)
+{
+  gpg_error_t err;
+  unsigned char lenbuf[4];
+  size_t queuedlen;
+  kbnode_t node;
+  struct pending_key_s *pk;
+
+  if (!pending_store.nblobs)
+    init_membuf (&pending_store.data, 65536);
+
+  ulongtobuf (lenbuf, datalen);
+  put_membuf (&pending_store.data, lenbuf, 4);
+  put_membuf (&pending_store.data, data, datalen);
+  pending_store.nblobs++;
+
+  for (node = kb; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      if (pending_store.nkeys == pending_store.keyssize)
+        {
+          unsigned int n = pending_store.keyssize + 64;
+
+          pk = xtryrealloc (pending_store.keys, n * sizeof *pk);
+          if (!pk)
+            {
+              err = gpg_error_from_syserror ();
+              /* Without the key list we can't decide whether a
+               * search needs to see the queue; thus flush now.  */
+              flush_pending_store (hd->kbl);
+              return err;
+            }
+          pending_store.keys = pk;
+          pending_store.keyssize = n;
+        }
+      pk = pending_store.keys + pending_store.nkeys++;
+      pk->blobno = pending_store.nblobs - 1;
+      keyid_from_pk (node->pkt->pkt.public_key, pk->kid);
+      fingerprint_from_pk (node->pkt->pkt.public_key, pk->fpr, &pk->fprlen);
+    }
+
+  if (!peek_membuf (&pending_store.data, &queuedlen))
+    {
+      err = gpg_error_from_syserror ();
+      pending_store.nblobs = 0;
+      pending_store.nkeys = 0;
+      return err;
+    }
+  if (pending_store.nblobs >= PENDING_STORE_MAX_BLOBS
+      || queuedlen >= PENDING_STORE_MAX_BYTES)
+    return flush_pending_store (hd->kbl);
+
+  return 0;
+}
+
+
 /* Update the keyblock KB (i.e., extract the fingerprint and find the
  * corresponding keyblock in the keyring).
  *
@@ -464,6 +992,14 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       goto leave;
     }
 
+  err = flush_pending_store (hd->kbl);
+  if (err)
+    goto leave;
+
+  /* The keyboxd forgets the results of signatures issued by the
+   * updated key; we do the same.  */
+  sigcache.ubid_valid = 0;
+
   err = build_keyblock_image (kb, &iobuf);
   if (err)
     goto leave;
@@ -489,7 +1025,10 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
  * came is used.  If there was no previous search result (or
  * keydb_search_reset was called), then the keyring / keybox where the
  * next search would start is used (i.e., the current file position).
- * In keyboxd mode the keyboxd decides where to store it.
+ * In keyboxd mode the keyboxd decides where to store it.  In bulk
+ * import mode the keyblock may be queued and sent later to the
+ * keyboxd; errors of queued keys are reported by the flush of the
+ * queue (see keydb_flush_store_queue).
  *
  * Note: this doesn't do anything if --dry-run was specified.
  *
@@ -520,6 +1059,13 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (err)
     goto leave;
 
+  if (in_transaction && have_batch_store (hd->kbl))
+    {
+      err = queue_for_store (hd, kb, iobuf_get_temp_buffer (iobuf),
+                             iobuf_get_temp_length (iobuf));
+      goto leave;
+    }
+
   parm.ctx = hd->kbl->ctx;
   parm.data = iobuf_get_temp_buffer (iobuf);
   parm.datalen = iobuf_get_temp_length (iobuf);
@@ -567,6 +1113,11 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       goto leave;
     }
 
+  err = flush_pending_store (hd->kbl);
+  if (err)
+    goto leave;
+
+  sigcache.ubid_valid = 0;
   bin2hex (hd->last_ubid, UBID_LEN, hexubid);
   snprintf (line, sizeof line, "DELETE %s", hexubid);
   err = assuan_transact (hd->kbl->ctx, line,
@@ -676,6 +1227,129 @@ search_status_cb (void *opaque, const char *line)
 }
 
 
+/* Format the search description DESC as a keyboxd search pattern and
+ * store it as a malloced string at R_PATTERN.  */
+static gpg_error_t
+format_search_pattern (KEYDB_SEARCH_DESC *desc, char **r_pattern)
+{
+  char *pattern;
+
+  *r_pattern = NULL;
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+      pattern = xtryasprintf ("=%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBSTR:
+      pattern = xtryasprintf ("*%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      pattern = xtryasprintf ("<%s", desc->u.name+(desc->u.name[0] == '<'));
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      pattern = xtryasprintf ("@%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
+      pattern = xtryasprintf (".%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_WORDS:
+      pattern = xtryasprintf ("+%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      pattern = xtryasprintf ("0x%08lX", (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      pattern = xtryasprintf ("0x%08lX%08lX",
+                              (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      {
+        unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
+        log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+        bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
+        pattern = xtryasprintf ("0x%s", hexfpr);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+      pattern = xtryasprintf ("#/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+    case KEYDB_SEARCH_MODE_SN:
+      pattern = xtryasprintf ("#%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      pattern = xtryasprintf ("/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      {
+        unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
+        bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
+        pattern = xtryasprintf ("&%s", hexgrip);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      {
+        unsigned char hexubid[UBID_LEN * 2 + 1];
+        bin2hex (desc->u.ubid, UBID_LEN, hexubid);
+        pattern = xtryasprintf ("^%s", hexubid);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_FIRST:
+      log_debug ("%s: mode first - we should not get to here!\n", __func__);
+      /*fallthru*/
+    default:
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  if (!pattern)
+    return gpg_error_from_syserror ();
+  *r_pattern = pattern;
+  return 0;
+}
+
+
+/* Communication object for SEARCH --multi.  */
+struct search_parm_s
+{
+  assuan_context_t ctx;
+  const char *patterns;  /* LF delimited list of patterns.  */
+  size_t patternslen;    /* The length of PATTERNS.  */
+};
+
+
+/* Handle the inquiries from the SEARCH command.  */
+static gpg_error_t
+search_inq_cb (void *opaque, const char *line)
+{
+  struct search_parm_s *parm = opaque;
+  gpg_error_t err = 0;
+
+  if (has_leading_keyword (line, "PATTERNS"))
+    {
+      if (parm->patterns)
+        err = assuan_send_data (parm->ctx, parm->patterns, parm->patternslen);
+    }
+  else
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return err;
+}
+
+
 /* Search the database for keys matching the search description.  If
  * the DB contains any legacy keys, these are silently ignored.
  *
@@ -703,6 +1377,12 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   char line[ASSUAN_LINELENGTH];
   char *buffer;
   size_t len;
+  struct search_parm_s parm = {NULL};
+  char *multi_patterns = NULL;
+  char **patterns = NULL;
+  size_t npatterns = 0;
+  int too_long;
+  kbx_snapshot_t snap;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -733,7 +1413,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   /* Clear the result objects.  */
   if (hd->kbl->search_result)
     {
-      iobuf_close (hd->kbl->search_result);
+      xfree (hd->kbl->search_result);
       hd->kbl->search_result = NULL;
     }
 
@@ -747,17 +1427,51 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        * search pattern between searches but that is not anymore
        * supported by keyboxd and a cursory check does not show that
        * we actually made used of that misfeature.  */
+      if (hd->kbl->snapshot)
+        {
+          err = snapshot_search (hd);
+          goto leave;
+        }
       snprintf (line, sizeof line, "NEXT");
       goto do_search;
     }
 
   hd->kbl->need_search_reset = 0;
+  if (hd->kbl->snapshot)
+    {
+      kbx_snapshot_release (hd->kbl->snapshot);
+      hd->kbl->snapshot = NULL;
+    }
 
   if (!ndesc)
     {
       err = gpg_error (GPG_ERR_INV_ARG);
       goto leave;
     }
+
+  /* Make sure that keys queued in bulk import mode can be found.  */
+  err = flush_pending_store_for_search (hd, desc, ndesc);
+  if (err)
+    goto leave;
+
+  /* Fingerprint and keyid lookups may be answered by the snapshot
+   * published by keyboxd.  */
+  if (ndesc == 1 && !desc->skipfnc
+      && (desc->mode == KEYDB_SEARCH_MODE_FPR
+          || desc->mode == KEYDB_SEARCH_MODE_LONG_KID)
+      && (snap = get_snapshot (hd->kbl)))
+    {
+      hd->kbl->snapshot = kbx_snapshot_ref (snap);
+      hd->kbl->snapshot_desc = *desc;
+      memset (&hd->kbl->snapshot_cursor, 0, sizeof hd->kbl->snapshot_cursor);
+      err = snapshot_search (hd);
+      if (!err || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        goto leave;
+      /* Not supported by the snapshot - ask keyboxd.  */
+      kbx_snapshot_release (hd->kbl->snapshot);
+      hd->kbl->snapshot = NULL;
+    }
+
   for (i = 0; i < ndesc; i++)
     if (desc->mode == KEYDB_SEARCH_MODE_FIRST)
       {
@@ -767,97 +1481,72 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         goto do_search;
       }
 
-  for ( ; ndesc; desc++, ndesc--)
+  /* Format the patterns.  */
+  patterns = xtrycalloc (ndesc, sizeof *patterns);
+  if (!patterns)
     {
-      const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
-
-      switch (desc->mode)
-        {
-        case KEYDB_SEARCH_MODE_EXACT:
-          snprintf (line, sizeof line, "SEARCH %s -- =%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBSTR:
-          snprintf (line, sizeof line, "SEARCH %s -- *%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAIL:
-          snprintf (line, sizeof line, "SEARCH %s -- <%s",
-                    more, desc->u.name+(desc->u.name[0] == '<') );
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILSUB:
-          snprintf (line, sizeof line, "SEARCH %s -- @%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILEND:
-          snprintf (line, sizeof line, "SEARCH %s -- .%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_WORDS:
-          snprintf (line, sizeof line, "SEARCH %s -- +%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SHORT_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX", more,
-                    (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX%08lX", more,
-                    (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_FPR:
-          {
-            unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
-            log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
-            bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
-            snprintf (line, sizeof line, "SEARCH %s -- 0x%s", more, hexfpr);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER:
-          snprintf (line, sizeof line, "SEARCH %s -- #/%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER_SN:
-        case KEYDB_SEARCH_MODE_SN:
-          snprintf (line, sizeof line, "SEARCH %s -- #%s", more, desc->u.name);
-          break;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  npatterns = ndesc;
+  too_long = 0;
+  for (i = 0; i < ndesc; i++)
+    {
+      if (desc[i].mode == KEYDB_SEARCH_MODE_NEXT)
+        continue;
+      err = format_search_pattern (desc + i, &patterns[i]);
+      if (err)
+        goto leave;
+      if (strlen (patterns[i]) + 30 > sizeof line)
+        too_long = 1;
+    }
 
-        case KEYDB_SEARCH_MODE_SUBJECT:
-          snprintf (line, sizeof line, "SEARCH %s -- /%s", more, desc->u.name);
-          break;
+  if ((ndesc > 1 || too_long) && have_multi_search (hd->kbl))
+    {
+      /* Send all patterns at once.  This is also the only way to
+       * send a pattern which does not fit into a command line.  */
+      membuf_t mb;
 
-        case KEYDB_SEARCH_MODE_KEYGRIP:
-          {
-            unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
-            bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
-            snprintf (line, sizeof line, "SEARCH %s -- &%s", more, hexgrip);
-          }
-          break;
+      init_membuf (&mb, 1024);
+      for (i = 0; i < ndesc; i++)
+        {
+          if (!patterns[i])
+            {
+              xfree (get_membuf (&mb, NULL));
+              err = gpg_error (GPG_ERR_INV_ARG);
+              goto leave;
+            }
+          put_membuf_str (&mb, patterns[i]);
+          put_membuf (&mb, "\n", 1);
+        }
+      multi_patterns = get_membuf (&mb, &parm.patternslen);
+      if (!multi_patterns)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      parm.patterns = multi_patterns;
+      snprintf (line, sizeof line, "SEARCH --openpgp --multi");
+      goto do_search;
+    }
+  if (too_long)
+    {
+      /* To avoid silent truncation we error out on a too long line.  */
+      err = gpg_error (GPG_ERR_ASS_LINE_TOO_LONG);
+      goto leave;
+    }
 
-        case KEYDB_SEARCH_MODE_UBID:
-          {
-            unsigned char hexubid[UBID_LEN * 2 + 1];
-            bin2hex (desc->u.ubid, UBID_LEN, hexubid);
-            snprintf (line, sizeof line, "SEARCH %s -- ^%s", more, hexubid);
-          }
-          break;
+  for (i = 0; ndesc; desc++, ndesc--, i++)
+    {
+      const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
 
-        case KEYDB_SEARCH_MODE_NEXT:
+      if (desc->mode == KEYDB_SEARCH_MODE_NEXT)
+        {
           log_debug ("%s: mode next - we should not get to here!\n", __func__);
           snprintf (line, sizeof line, "NEXT");
-          break;
-
-        case KEYDB_SEARCH_MODE_FIRST:
-          log_debug ("%s: mode first - we should not get to here!\n", __func__);
-          /*fallthru*/
-        default:
-          err = gpg_error (GPG_ERR_INV_ARG);
-          goto leave;
         }
+      else
+        snprintf (line, sizeof line, "SEARCH %s -- %s", more, patterns[i]);
 
       if (ndesc > 1)
         {
@@ -870,7 +1559,9 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
  do_search:
   hd->last_ubid_valid = 0;
-  err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
+  parm.ctx = hd->kbl->ctx;
+  err = kbx_client_data_cmd (hd->kbl->kcd, line, search_inq_cb, &parm,
+                             search_status_cb, hd);
   if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
     {
       int any;
@@ -900,15 +1591,296 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
               }
         }
 
-      hd->kbl->search_result = iobuf_temp_with_content (buffer, len);
-      xfree (buffer);
+      /* Take ownership of the buffer.  */
+      hd->kbl->search_result = (unsigned char *)buffer;
+      hd->kbl->search_result_len = len;
       if (DBG_KEYDB && hd->last_ubid_valid)
         log_printhex (hd->last_ubid, 20, "found UBID (%d,%d):",
                       hd->last_uid_no, hd->last_pk_no);
     }
 
  leave:
+  xfree (multi_patterns);
+  for (i = 0; i < npatterns; i++)
+    xfree (patterns[i]);
+  xfree (patterns);
   if (DBG_CLOCK)
     log_clock ("%s leave (%sfound)", __func__, err? "not ":"");
   return err;
 }
+
+
+
+/* Helper for qsort and bsearch to compare sigcache items by their
+ * SIGID.  */
+static int
+compare_sigcache_items (const void *arg_a, const void *arg_b)
+{
+  const struct sigcache_item_s *a = arg_a;
+  const struct sigcache_item_s *b = arg_b;
+
+  return memcmp (a->sigid, b->sigid, SIGCACHE_SIGID_LEN);
+}
+
+
+/* Insert a copy of ITEM into the sorted items of SIGCACHE unless it
+ * is already there.  */
+static gpg_error_t
+insert_sigcache_item (const struct sigcache_item_s *item)
+{
+  struct sigcache_item_s *p;
+  unsigned int idx;
+
+  if (sigcache.nitems == sigcache.itemssize)
+    {
+      unsigned int n = sigcache.itemssize? 2 * sigcache.itemssize : 64;
+
+      p = xtryrealloc (sigcache.items, n * sizeof *p);
+      if (!p)
+        return gpg_error_from_syserror ();
+      sigcache.items = p;
+      sigcache.itemssize = n;
+    }
+
+  /* Items are usually added in order or to a small list; thus a
+   * linear search from the end is good enough.  */
+  for (idx = sigcache.nitems; idx; idx--)
+    if (compare_sigcache_items (sigcache.items + idx - 1, item) <= 0)
+      break;
+  p = sigcache.items + idx;
+  if (idx && !compare_sigcache_items (p - 1, item)
+      && p[-1].fprlen == item->fprlen
+      && !memcmp (p[-1].fpr, item->fpr, item->fprlen))
+    {
+      p[-1].result = item->result;
+      return 0;
+    }
+  memmove (p + 1, p, (sigcache.nitems - idx) * sizeof *p);
+  *p = *item;
+  sigcache.nitems++;
+  return 0;
+}
+
+
+/* Fetch the signature cache of the key UBID from the keyboxd.  */
+static gpg_error_t
+fetch_sigcache (ctrl_t ctrl, const byte *ubid)
+{
+  gpg_error_t err;
+  keyboxd_local_t kbl;
+  membuf_t mb;
+  char hexubid[UBID_LEN * 2 + 1];
+  char line[ASSUAN_LINELENGTH];
+  unsigned char *data = NULL;
+  const unsigned char *p;
+  size_t datalen, n;
+  struct sigcache_item_s item;
+
+  sigcache.ubid_valid = 0;
+  sigcache.nitems = 0;
+
+  err = open_context (ctrl, &kbl);
+  if (err)
+    return err;
+
+  init_membuf (&mb, 4096);
+  bin2hex (ubid, UBID_LEN, hexubid);
+  snprintf (line, sizeof line, "GETSIGCACHE %s", hexubid);
+  err = assuan_transact (kbl->ctx, line,
+                         put_membuf_cb, &mb,
+                         NULL, NULL,
+                         keydb_default_status_cb, NULL);
+  kbl->is_active = 0;
+  data = get_membuf (&mb, &datalen);
+  if (err)
+    {
+      /* Don't try again; the signatures are then simply verified.  */
+      if (gpg_err_code (err) != GPG_ERR_ASS_UNKNOWN_CMD
+          && gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        log_info ("error reading the signature cache: %s\n",
+                  gpg_strerror (err));
+      else if (DBG_KEYDB)
+        log_debug ("keyboxd has no signature cache\n");
+      sigcache.disabled = 1;
+      goto leave;
+    }
+  if (!data)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (p = data, n = datalen; n >= SIGCACHE_SIGID_LEN + 2; )
+    {
+      memcpy (item.sigid, p, SIGCACHE_SIGID_LEN);
+      item.result = p[SIGCACHE_SIGID_LEN];
+      item.fprlen = p[SIGCACHE_SIGID_LEN + 1];
+      p += SIGCACHE_SIGID_LEN + 2;
+      n -= SIGCACHE_SIGID_LEN + 2;
+      if (item.fprlen > n)
+        break;
+      if (item.fprlen <= MAX_FINGERPRINT_LEN)
+        {
+          memcpy (item.fpr, p, item.fprlen);
+          err = insert_sigcache_item (&item);
+          if (err)
+            goto leave;
+        }
+      p += item.fprlen;
+      n -= item.fprlen;
+    }
+
+  memcpy (sigcache.ubid, ubid, UBID_LEN);
+  sigcache.ubid_valid = 1;
+  if (DBG_KEYDB)
+    log_debug ("%s: got %u cached results\n", __func__, sigcache.nitems);
+
+ leave:
+  xfree (data);
+  return err;
+}
+
+
+/* Handle the inquiry from the PUTSIGCACHE command.  */
+static gpg_error_t
+putsigcache_inq_cb (void *opaque, const char *line)
+{
+  struct store_parm_s *parm = opaque;
+
+  if (!has_leading_keyword (line, "SIGCACHE"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return assuan_send_data (parm->ctx, parm->data, parm->datalen);
+}
+
+
+/* Send the queued signature verification results to the keyboxd
+ * using the connection KBL.  */
+static gpg_error_t
+flush_pending_sigcache (keyboxd_local_t kbl)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+  void *data;
+  size_t datalen;
+
+  if (!sigcache.npending)
+    return 0;
+
+  sigcache.npending = 0;
+  data = get_membuf (&sigcache.pending, &datalen);
+  if (!data)
+    return gpg_error_from_syserror ();
+
+  parm.ctx = kbl->ctx;
+  parm.data = data;
+  parm.datalen = datalen;
+  err = assuan_transact (kbl->ctx, "PUTSIGCACHE",
+                         NULL, NULL,
+                         putsigcache_inq_cb, &parm,
+                         keydb_default_status_cb, NULL);
+  xfree (data);
+  return err;
+}
+
+
+/* Look up the result of the verification identified by SIGID of a
+ * signature on the key UBID issued by SIGNER in the signature cache
+ * of the keyboxd.  On success 1 is stored at R_GOOD for a good
+ * signature and 0 for a bad one.  GPG_ERR_NOT_FOUND is returned if
+ * the result is not cached and GPG_ERR_NOT_SUPPORTED if there is no
+ * signature cache.  */
+gpg_error_t
+keydb_get_sigcache (ctrl_t ctrl, const byte *ubid, const byte *sigid,
+                    PKT_public_key *signer, int *r_good)
+{
+  gpg_error_t err;
+  struct sigcache_item_s item, *found;
+  size_t fprlen;
+
+  *r_good = 0;
+
+  if (!opt.use_keyboxd || !ctrl || sigcache.disabled)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (!sigcache.ubid_valid || memcmp (sigcache.ubid, ubid, UBID_LEN))
+    {
+      err = fetch_sigcache (ctrl, ubid);
+      if (err)
+        return err;
+    }
+
+  memcpy (item.sigid, sigid, SIGCACHE_SIGID_LEN);
+  found = bsearch (&item, sigcache.items, sigcache.nitems,
+                   sizeof *sigcache.items, compare_sigcache_items);
+  if (!found)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  /* There may be several items with the same SIGID; the signer must
+   * match as well.  */
+  while (found > sigcache.items
+         && !compare_sigcache_items (found - 1, &item))
+    found--;
+  fingerprint_from_pk (signer, item.fpr, &fprlen);
+  item.fprlen = fprlen;
+  for (; found < sigcache.items + sigcache.nitems
+         && !compare_sigcache_items (found, &item); found++)
+    if (found->fprlen == item.fprlen
+        && !memcmp (found->fpr, item.fpr, item.fprlen))
+      {
+        *r_good = found->result;
+        return 0;
+      }
+
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+
+/* Queue the result GOOD of the verification identified by SIGID of a
+ * signature on the key UBID issued by SIGNER for storage in the
+ * signature cache of the keyboxd.  */
+gpg_error_t
+keydb_put_sigcache (ctrl_t ctrl, const byte *ubid, const byte *sigid,
+                    PKT_public_key *signer, int good)
+{
+  gpg_error_t err;
+  keyboxd_local_t kbl;
+  struct sigcache_item_s item;
+  size_t fprlen;
+  byte buf[2];
+
+  if (!opt.use_keyboxd || !ctrl || sigcache.disabled || opt.dry_run)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  memcpy (item.sigid, sigid, SIGCACHE_SIGID_LEN);
+  item.result = !!good;
+  fingerprint_from_pk (signer, item.fpr, &fprlen);
+  item.fprlen = fprlen;
+
+  if (sigcache.ubid_valid && !memcmp (sigcache.ubid, ubid, UBID_LEN))
+    {
+      err = insert_sigcache_item (&item);
+      if (err)
+        return err;
+    }
+
+  if (!sigcache.npending)
+    init_membuf (&sigcache.pending, 4096);
+  put_membuf (&sigcache.pending, ubid, UBID_LEN);
+  put_membuf (&sigcache.pending, item.sigid, SIGCACHE_SIGID_LEN);
+  buf[0] = item.result;
+  buf[1] = item.fprlen;
+  put_membuf (&sigcache.pending, buf, 2);
+  put_membuf (&sigcache.pending, item.fpr, item.fprlen);
+  sigcache.npending++;
+
+  if (sigcache.npending < PENDING_SIGCACHE_MAX)
+    return 0;
+
+  err = open_context (ctrl, &kbl);
+  if (err)
+    return err;
+  err = flush_pending_sigcache (kbl);
+  kbl->is_active = 0;
+  return err;
+}
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -32,12 +33,55 @@
 #include "packet.h"
 #include "options.h"
 #include "main.h"
+#include "workpool.h"
 
 
 /* The size of the buffer we allocate to encrypt the data.  This must
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* The maximum number of worker threads used to encrypt chunks in
+ * parallel.  */
+#define AEAD_MAX_WORKERS 8
+
+/* Parallel encryption buffers a complete chunk per job.  To limit the
+ * memory use we fall back to the serial code for larger chunks.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
+
+
+/* A job describes one chunk.  The data is encrypted in place.  */
+struct aead_job_s
+{
+  struct workpool_job_s wp;    /* Must be the first member.  */
+  unsigned int pending : 1;    /* Submitted but not yet written.  */
+  uint64_t chunkindex;  /* The index of this chunk.  */
+  size_t len;           /* The used length of BUFFER.  */
+  gpg_error_t err;      /* The result of the encryption.  */
+  byte tag[16];         /* The authentication tag.  */
+  byte *buffer;         /* Allocated with a size of CHUNKSIZE.  */
+};
+
+/* The argument of a worker thread with its own cipher handle.  */
+struct aead_worker_s
+{
+  cipher_filter_context_t *cfx;
+  gcry_cipher_hd_t cipher_hd;
+};
+
+/* The jobs and the workers used for parallel encryption.  The jobs
+ * are used round robin; this guarantees that they can be written out
+ * in the order of their chunk index.  */
+struct aead_enc_pool_s
+{
+  workpool_t workpool;
+  int nworkers;
+  struct aead_worker_s workers[AEAD_MAX_WORKERS];
+  int njobs;
+  int fillidx;           /* Index of the job to fill next.  */
+  unsigned int filling : 1; /* The job at FILLIDX is being filled.  */
+  struct aead_job_s jobs[AEAD_MAX_WORKERS + 1];
+};
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +99,13 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX on
+ * the cipher handle HD.  If FINAL is set the final AEAD chunk is
+ * processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+set_nonce_and_ad (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                  uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +128,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +148,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +169,232 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* The job function of an encryption worker.  */
+static void
+aead_encrypt_job (void *arg, workpool_job_t wpjob)
+{
+  struct aead_worker_s *wrk = arg;
+  struct aead_job_s *job = (struct aead_job_s *)wpjob;
+  gpg_error_t err;
+
+  err = set_nonce_and_ad (wrk->cfx, wrk->cipher_hd, job->chunkindex, 0);
+  if (!err)
+    {
+      gcry_cipher_final (wrk->cipher_hd);
+      npth_unprotect ();
+      err = gcry_cipher_encrypt (wrk->cipher_hd, job->buffer, job->len,
+                                 NULL, 0);
+      if (!err)
+        err = gcry_cipher_gettag (wrk->cipher_hd, job->tag, 16);
+      npth_protect ();
+    }
+  job->err = err;
+}
+
+
+/* Stop all worker threads and release the pool of CFX.  */
+static void
+release_pool (cipher_filter_context_t *cfx)
+{
+  struct aead_enc_pool_s *pool = cfx->pool;
+  int i;
+
+  if (!pool)
+    return;
+
+  workpool_release (pool->workpool);
+  for (i=0; i < pool->nworkers; i++)
+    gcry_cipher_close (pool->workers[i].cipher_hd);
+  for (i=0; i < pool->njobs; i++)
+    {
+      if (pool->jobs[i].buffer)
+        wipememory (pool->jobs[i].buffer, cfx->chunksize);
+      xfree (pool->jobs[i].buffer);
+    }
+  xfree (pool);
+  cfx->pool = NULL;
+}
+
+
+/* Create a pool of worker threads for CFX.  CIPHERMODE is the
+ * Libgcrypt mode used for the AEAD algorithm.  Returns 0 without
+ * creating a pool if parallel encryption is not possible.  */
+static gpg_error_t
+start_pool (cipher_filter_context_t *cfx, enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err = 0;
+  struct aead_enc_pool_s *pool;
+  void *workerargs[AEAD_MAX_WORKERS];
+  unsigned int nworkers;
+  int i;
+
+  nworkers = workpool_get_nworkers (AEAD_MAX_WORKERS);
+  if (!nworkers || cfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return 0;
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->nworkers = nworkers;
+  /* One job more than workers so that the next chunk can be filled
+   * while all workers are busy.  */
+  pool->njobs = pool->nworkers + 1;
+  cfx->pool = pool;
+
+  for (i=0; i < pool->njobs; i++)
+    {
+      pool->jobs[i].buffer = xtrymalloc (cfx->chunksize);
+      if (!pool->jobs[i].buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i=0; i < pool->nworkers; i++)
+    {
+      pool->workers[i].cfx = cfx;
+      err = openpgp_cipher_open (&pool->workers[i].cipher_hd,
+                                 cfx->dek->algo, ciphermode,
+                                 GCRY_CIPHER_SECURE);
+      if (!err)
+        err = gcry_cipher_setkey (pool->workers[i].cipher_hd,
+                                  cfx->dek->key, cfx->dek->keylen);
+      if (err)
+        goto leave;
+      workerargs[i] = pool->workers + i;
+    }
+
+  err = workpool_new (&pool->workpool, pool->nworkers,
+                      aead_encrypt_job, workerargs);
+  if (err)
+    goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("aead: using %d worker threads for %d jobs\n",
+               pool->nworkers, pool->njobs);
+
+ leave:
+  if (err)
+    release_pool (cfx);
+  return err;
+}
+
+
+/* Wait until the worker is done with JOB and write the ciphertext
+ * and the tag to stream A.  */
+static gpg_error_t
+write_job (cipher_filter_context_t *cfx, iobuf_t a, struct aead_job_s *job)
+{
+  gpg_error_t err;
+
+  workpool_wait (cfx->pool->workpool, &job->wp);
+
+  err = job->err;
+  if (!err)
+    err = my_iobuf_write (a, job->buffer, job->len);
+  if (!err)
+    err = my_iobuf_write (a, job->tag, 16);
+  if (err)
+    log_error ("writing chunk %ju failed: %s\n",
+               (uintmax_t)job->chunkindex, gpg_strerror (err));
+  else if (DBG_FILTER)
+    log_debug ("wrote chunk %ju (%zu bytes)\n",
+               (uintmax_t)job->chunkindex, job->len);
+
+  job->pending = 0;
+  return err;
+}
+
+
+/* Hand the job currently being filled over to the workers.  */
+static void
+submit_job (cipher_filter_context_t *cfx)
+{
+  struct aead_enc_pool_s *pool = cfx->pool;
+  struct aead_job_s *job = pool->jobs + pool->fillidx;
+
+  workpool_submit (pool->workpool, &job->wp);
+  job->pending = 1;
+  pool->filling = 0;
+  pool->fillidx = (pool->fillidx + 1) % pool->njobs;
+}
+
+
+/* The parallel version of do_flush.  The data is collected into
+ * complete chunks which are then encrypted by the workers.  */
+static gpg_error_t
+do_flush_parallel (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buf, size_t size)
+{
+  struct aead_enc_pool_s *pool = cfx->pool;
+  struct aead_job_s *job;
+  gpg_error_t err;
+  size_t n;
+
+  while (size)
+    {
+      job = pool->jobs + pool->fillidx;
+      if (!pool->filling)
+        {
+          /* The job slot is either free or still holds the chunk
+           * submitted NJOBS chunks ago.  Due to the round robin use
+           * of the slots that chunk is the oldest one not yet
+           * written.  */
+          if (job->pending)
+            {
+              err = write_job (cfx, a, job);
+              if (err)
+                return err;
+            }
+          job->chunkindex = cfx->chunkindex++;
+          job->len = 0;
+          job->err = 0;
+          pool->filling = 1;
+        }
+
+      n = cfx->chunksize - job->len;
+      if (n > size)
+        n = size;
+      memcpy (job->buffer + job->len, buf, n);
+      job->len += n;
+      cfx->total += n;
+      buf += n;
+      size -= n;
+
+      if (job->len == cfx->chunksize)
+        submit_job (cfx);
+    }
+
+  return 0;
+}
+
+
+/* Submit a partly filled chunk and write out all pending chunks in
+ * order.  */
+static gpg_error_t
+flush_pool (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_enc_pool_s *pool = cfx->pool;
+  gpg_error_t err = 0;
+  int i, idx;
+
+  if (pool->filling)
+    submit_job (cfx);
+
+  /* FILLIDX now points to the oldest pending job.  */
+  for (i=0; i < pool->njobs; i++)
+    {
+      idx = (pool->fillidx + i) % pool->njobs;
+      if (pool->jobs[idx].pending && !err)
+        err = write_job (cfx, a, pool->jobs + idx);
+    }
+
+  return err;
 }
 
 
@@ -198,6 +468,10 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  err = start_pool (cfx, ciphermode);
+  if (err)
+    goto leave;
+
   cfx->wrote_header = 1;
 
  leave:
@@ -233,7 +507,7 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
   gpg_error_t err;
   char dummy[1];
 
-  err = set_nonce_and_ad (cfx, 1);
+  err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 1);
   if (err)
     goto leave;
 
@@ -341,7 +615,8 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
             {
               if (DBG_FILTER)
                 log_debug ("start encrypting a new chunk\n");
-              err = set_nonce_and_ad (cfx, 0);
+              err = set_nonce_and_ad (cfx, cfx->cipher_hd,
+                                      cfx->chunkindex, 0);
               if (err)
                 goto leave;
             }
@@ -405,7 +680,13 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
-  if (cfx->chunklen || cfx->buflen)
+  if (cfx->pool)
+    {
+      err = flush_pool (cfx, a);
+      if (err)
+        goto leave;
+    }
+  else if (cfx->chunklen || cfx->buflen)
     {
       if (DBG_FILTER)
         log_debug ("encrypting last %zu bytes of the last chunk\n",cfx->buflen);
@@ -414,7 +695,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
         {
           if (DBG_FILTER)
             log_debug ("start encrypting a new chunk\n");
-          err = set_nonce_and_ad (cfx, 0);
+          err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -448,6 +729,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   err = write_final_chunk (cfx, a);
 
  leave:
+  release_pool (cfx);
   xfree (cfx->buffer);
   cfx->buffer = NULL;
   gcry_cipher_close (cfx->cipher_hd);
@@ -475,6 +757,8 @@ cipher_filter_aead (void *opaque, int control,
     {
       if (!cfx->wrote_header && (rc=write_header (cfx, a)))
         ;
+      else if (cfx->pool)
+        rc = do_flush_parallel (cfx, a, buf, size);
       else
         rc = do_flush (cfx, a, buf, size);
     }
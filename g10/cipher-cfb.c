@@ -39,6 +39,11 @@
 
 #define MIN_PARTIAL_SIZE 512
 
+/* The iobuf layer may hand us the data in small pieces.  To keep the
+ * per call overhead of Libgcrypt low the data is collected into
+ * batches of this size.  */
+#define CFB_BUFFER_SIZE (64*1024)
+
 
 static void
 write_header (cipher_filter_context_t *cfx, iobuf_t a)
@@ -108,10 +113,80 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   cfx->short_blklen_warn = (blocksize < 16);
   cfx->short_blklen_count = nprefix+2;
 
+  /* If we can't allocate the buffer we process the data as passed
+   * to the filter.  */
+  cfx->buffer = xtrymalloc (CFB_BUFFER_SIZE);
+  cfx->bufsize = cfx->buffer? CFB_BUFFER_SIZE : 0;
+  cfx->buflen = 0;
+
   cfx->wrote_header = 1;
 }
 
 
+/* Hash and encrypt SIZE bytes at BUF in place and write them to A.  */
+static int
+encrypt_data (cipher_filter_context_t *cfx, iobuf_t a, void *buf, size_t size)
+{
+  iobuf_unprotect ();
+  if (cfx->mdc_hash)
+    gcry_md_write (cfx->mdc_hash, buf, size);
+  gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
+  iobuf_protect ();
+  if (cfx->short_blklen_warn)
+    {
+      cfx->short_blklen_count += size;
+      if (cfx->short_blklen_count > (150 * 1024 * 1024))
+        {
+          log_info ("WARNING: encrypting more than %d MiB with algorithm "
+                    "%s should be avoided\n", 150,
+                    openpgp_cipher_algo_name (cfx->dek->algo));
+          cfx->short_blklen_warn = 0; /* Don't show again.  */
+        }
+    }
+
+  return iobuf_write (a, buf, size);
+}
+
+
+/* Encrypt SIZE bytes from BUF in batches of CFX->BUFSIZE.  Input
+ * which is large enough is encrypted in place as long as the buffer
+ * is empty; the cipher then stays aligned to the block size.  */
+static int
+encrypt_batched (cipher_filter_context_t *cfx, iobuf_t a,
+                 byte *buf, size_t size)
+{
+  unsigned int blocksize = openpgp_cipher_get_algo_blklen (cfx->dek->algo);
+  size_t n;
+  int rc = 0;
+
+  while (size && !rc)
+    {
+      if (!cfx->buflen && size >= cfx->bufsize)
+        {
+          n = size - (size % blocksize);
+          rc = encrypt_data (cfx, a, buf, n);
+        }
+      else
+        {
+          n = cfx->bufsize - cfx->buflen;
+          if (n > size)
+            n = size;
+          memcpy (cfx->buffer + cfx->buflen, buf, n);
+          cfx->buflen += n;
+          if (cfx->buflen == cfx->bufsize)
+            {
+              rc = encrypt_data (cfx, a, cfx->buffer, cfx->buflen);
+              cfx->buflen = 0;
+            }
+        }
+      buf += n;
+      size -= n;
+    }
+
+  return rc;
+}
+
+
 /*
  * This filter is used to en/de-cipher data with a symmetric algorithm
  */
@@ -132,25 +207,24 @@ cipher_filter_cfb (void *opaque, int control,
       log_assert (a);
       if (!cfx->wrote_header)
         write_header (cfx, a);
-      if (cfx->mdc_hash)
-        gcry_md_write (cfx->mdc_hash, buf, size);
-      gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
-      if (cfx->short_blklen_warn)
-        {
-          cfx->short_blklen_count += size;
-          if (cfx->short_blklen_count > (150 * 1024 * 1024))
-            {
-              log_info ("WARNING: encrypting more than %d MiB with algorithm "
-                        "%s should be avoided\n", 150,
-                        openpgp_cipher_algo_name (cfx->dek->algo));
-              cfx->short_blklen_warn = 0; /* Don't show again.  */
-            }
-        }
-
-      rc = iobuf_write (a, buf, size);
+      if (cfx->bufsize)
+        rc = encrypt_batched (cfx, a, buf, size);
+      else
+        rc = encrypt_data (cfx, a, buf, size);
     }
   else if (control == IOBUFCTRL_FREE)
     {
+      if (cfx->buflen
+          && (rc = encrypt_data (cfx, a, cfx->buffer, cfx->buflen)))
+        log_error ("writing encrypted data failed\n");
+      if (cfx->buffer)
+        {
+          wipememory (cfx->buffer, cfx->bufsize);
+          xfree (cfx->buffer);
+          cfx->buffer = NULL;
+        }
+      cfx->bufsize = cfx->buflen = 0;
+
       if (cfx->mdc_hash)
         {
           byte *hash;
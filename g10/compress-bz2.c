@@ -80,7 +80,9 @@ do_compress(compress_filter_context_t *zfx, bz_stream *bzs, int flush, IOBUF a)
       if( DBG_FILTER )
 	log_debug("enter bzCompress: avail_in=%u, avail_out=%u, flush=%d\n",
 		  (unsigned)bzs->avail_in, (unsigned)bzs->avail_out, flush );
+      iobuf_unprotect ();
       zrc = BZ2_bzCompress( bzs, flush );
+      iobuf_protect ();
       if( zrc == BZ_STREAM_END && flush == BZ_FINISH )
 	;
       else if( zrc != BZ_RUN_OK && zrc != BZ_FINISH_OK )
@@ -164,7 +166,9 @@ do_uncompress( compress_filter_context_t *zfx, bz_stream *bzs,
 	log_debug("enter bzDecompress: avail_in=%u, avail_out=%u\n",
 		  (unsigned)bzs->avail_in, (unsigned)bzs->avail_out);
 
+      iobuf_unprotect ();
       zrc=BZ2_bzDecompress(bzs);
+      iobuf_protect ();
       if( DBG_FILTER )
 	log_debug("leave bzDecompress: avail_in=%u, avail_out=%u, zrc=%d\n",
 		  (unsigned)bzs->avail_in, (unsigned)bzs->avail_out, zrc);
@@ -30,16 +30,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <npth.h>
 #ifdef HAVE_ZIP
 # include <zlib.h>
 #endif
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/i18n.h"
+#include "../common/status.h"
 #include "packet.h"
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "workpool.h"
 
 
 #ifdef __riscos__
@@ -54,20 +58,91 @@ int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
+
+/* The size of the blocks compressed by one worker thread.  */
+#define ZIP_BLOCKSIZE (128*1024)
+
+/* The size of the sample used to decide whether the data is
+ * compressed at all and the minimal size for which the decision is
+ * taken.  */
+#define COMPRESS_SAMPLE_SIZE (64*1024)
+#define COMPRESS_MIN_SAMPLE  4096
+
+/* Data with an order-0 entropy of at least this many 1/100 bits per
+ * byte is considered incompressible.  Already compressed data or
+ * encrypted data is close to 8 bits per byte.  */
+#define COMPRESS_BYPASS_ENTROPY 790
+
+/* The maximum number of worker threads used for parallel
+ * compression.  */
+#define ZIP_MAX_WORKERS 8
+
+/* A job describes one block of input.  The buffer holds the
+ * dictionary, that is the tail of the previous block, directly in
+ * front of the block's data.  */
+struct zip_job_s
+{
+  struct workpool_job_s wp;   /* Must be the first member.  */
+  unsigned int pending : 1;   /* Submitted but not yet written.  */
+  unsigned int final : 1;     /* This is the last block.  */
+  uint64_t blockindex;  /* The index of this block.  */
+  size_t dictlen;       /* The length of the dictionary.  */
+  size_t len;           /* The length of the data.  */
+  byte *buffer;         /* DICTSIZE + ZIP_BLOCKSIZE bytes.  */
+  uLong adler;          /* The Adler-32 of the data.  */
+  int zrc;              /* The result of deflate.  */
+  byte *outbuf;         /* The compressed data.  */
+  size_t outlen;        /* The used length of OUTBUF.  */
+  size_t outsize;       /* The allocated size of OUTBUF.  */
+};
+
+/* The argument of a worker thread with its own deflate stream.  */
+struct zip_worker_s
+{
+  struct zip_pool_s *pool;
+  z_stream zs;
+  unsigned int zs_initialized : 1;
+};
+
+/* The jobs and workers used for parallel compression.  Each block is
+ * compressed into an independent raw deflate fragment which is byte
+ * aligned by a sync flush; only the last one is finished.  Priming
+ * each fragment with the tail of the preceding block keeps the
+ * compression ratio close to that of a single stream.  As with the
+ * AEAD encryption pool the jobs are used round robin.  */
+struct zip_pool_s
+{
+  workpool_t workpool;
+  int level;             /* The compression level.  */
+  size_t dictsize;       /* The window size of the compressor.  */
+  uLong adler;           /* The Adler-32 over all written blocks.  */
+  uint64_t blockindex;   /* The index of the next block.  */
+  int nworkers;
+  struct zip_worker_s workers[ZIP_MAX_WORKERS];
+  int njobs;
+  int fillidx;           /* Index of the job to fill next.  */
+  unsigned int filling : 1; /* The job at FILLIDX is being filled.  */
+  struct zip_job_s jobs[ZIP_MAX_WORKERS + 1];
+};
+
+
+/* Return the zlib compression level to use.  */
+static int
+get_compress_level (void)
+{
+  if (opt.compress_level >= 1 && opt.compress_level <= 9)
+    return opt.compress_level;
+  if (opt.compress_level != -1)
+    log_error ("invalid compression level; using default level\n");
+  return Z_DEFAULT_COMPRESSION;
+}
+
+
 static void
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
     int rc;
-    int level;
-
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    int level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -101,7 +176,9 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
 	if( DBG_FILTER )
 	    log_debug("enter deflate: avail_in=%u, avail_out=%u, flush=%d\n",
 		    (unsigned)zs->avail_in, (unsigned)zs->avail_out, flush );
+	iobuf_unprotect ();
 	zrc = deflate( zs, flush );
+	iobuf_protect ();
 	if( zrc == Z_STREAM_END && flush == Z_FINISH )
 	    ;
 	else if( zrc != Z_OK ) {
@@ -127,6 +204,350 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
     return 0;
 }
 
+
+/* The job function of a compression worker.  Compresses the job
+ * using the stream of the worker and stores the result of deflate in
+ * the job.  */
+static void
+compress_job (void *arg, workpool_job_t wpjob)
+{
+  struct zip_worker_s *wrk = arg;
+  struct zip_job_s *job = (struct zip_job_s *)wpjob;
+  z_stream *zs = &wrk->zs;
+  byte *data = job->buffer + wrk->pool->dictsize;
+  int flush = job->final? Z_FINISH : Z_SYNC_FLUSH;
+  byte *p;
+  int zrc;
+
+  zrc = deflateReset (zs);
+  if (zrc == Z_OK && job->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (data - job->dictlen),
+                                job->dictlen);
+  if (zrc != Z_OK)
+    {
+      job->zrc = zrc;
+      return;
+    }
+
+  job->adler = adler32 (adler32 (0, Z_NULL, 0), BYTEF_CAST (data), job->len);
+  job->outlen = 0;
+  zs->next_in = BYTEF_CAST (data);
+  zs->avail_in = job->len;
+  for (;;)
+    {
+      zs->next_out = BYTEF_CAST (job->outbuf + job->outlen);
+      zs->avail_out = job->outsize - job->outlen;
+      npth_unprotect ();
+      zrc = deflate (zs, flush);
+      npth_protect ();
+      job->outlen = job->outsize - zs->avail_out;
+      if (zrc != Z_OK && zrc != Z_STREAM_END)
+        break;
+      /* A sync flush is complete if output space is left.  */
+      if (flush == Z_FINISH? zrc == Z_STREAM_END : zs->avail_out != 0)
+        break;
+      p = xtryrealloc (job->outbuf, 2 * job->outsize);
+      if (!p)
+        {
+          zrc = Z_MEM_ERROR;
+          break;
+        }
+      job->outbuf = p;
+      job->outsize *= 2;
+    }
+  job->zrc = zrc;
+}
+
+
+/* Stop all worker threads and release the pool of ZFX.  */
+static void
+release_pool (compress_filter_context_t *zfx)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  int i;
+
+  if (!pool)
+    return;
+
+  workpool_release (pool->workpool);
+  for (i=0; i < pool->nworkers; i++)
+    if (pool->workers[i].zs_initialized)
+      deflateEnd (&pool->workers[i].zs);
+  for (i=0; i < pool->njobs; i++)
+    {
+      xfree (pool->jobs[i].buffer);
+      xfree (pool->jobs[i].outbuf);
+    }
+  xfree (pool);
+  zfx->pool = NULL;
+}
+
+
+/* Create a pool of worker threads for ZFX.  Returns 0 without
+ * creating a pool if parallel compression is not possible.  */
+static gpg_error_t
+start_pool (compress_filter_context_t *zfx)
+{
+  gpg_error_t err = 0;
+  struct zip_pool_s *pool;
+  void *workerargs[ZIP_MAX_WORKERS];
+  unsigned int nworkers;
+  int level, wbits;
+  int i, rc;
+
+  nworkers = workpool_get_nworkers (ZIP_MAX_WORKERS);
+  if (!nworkers)
+    return 0;
+
+  /* See init_compress for the window size of ZIP.  */
+  wbits = zfx->algo == COMPRESS_ALGO_ZIP? 13 : 15;
+  level = get_compress_level ();
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->level = level;
+  pool->dictsize = (size_t)1 << wbits;
+  pool->adler = adler32 (0, Z_NULL, 0);
+  pool->nworkers = nworkers;
+  /* One job more than workers so that the next block can be filled
+   * while all workers are busy.  */
+  pool->njobs = pool->nworkers + 1;
+  zfx->pool = pool;
+
+  for (i=0; i < pool->nworkers; i++)
+    {
+      pool->workers[i].pool = pool;
+      rc = deflateInit2 (&pool->workers[i].zs, level, Z_DEFLATED,
+                         -wbits, 8, Z_DEFAULT_STRATEGY);
+      if (rc != Z_OK)
+        {
+          err = gpg_error (rc == Z_MEM_ERROR? GPG_ERR_ENOMEM
+                           /**/            : GPG_ERR_INTERNAL);
+          goto leave;
+        }
+      pool->workers[i].zs_initialized = 1;
+      workerargs[i] = pool->workers + i;
+    }
+
+  for (i=0; i < pool->njobs; i++)
+    {
+      pool->jobs[i].buffer = xtrymalloc (pool->dictsize + ZIP_BLOCKSIZE);
+      /* The bound is for a finished stream; the loop in compress_job
+       * takes care of the rare case that this is not sufficient.  */
+      pool->jobs[i].outsize = deflateBound (&pool->workers[0].zs,
+                                            ZIP_BLOCKSIZE) + 16;
+      pool->jobs[i].outbuf = xtrymalloc (pool->jobs[i].outsize);
+      if (!pool->jobs[i].buffer || !pool->jobs[i].outbuf)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  err = workpool_new (&pool->workpool, pool->nworkers,
+                      compress_job, workerargs);
+  if (err)
+    goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("deflate: using %d worker threads for %d jobs\n",
+               pool->nworkers, pool->njobs);
+
+ leave:
+  if (err)
+    release_pool (zfx);
+  return err;
+}
+
+
+/* Write the 2 byte header of the zlib format as deflateInit would do
+ * for a 32k window and LEVEL.  */
+static int
+write_zlib_header (iobuf_t a, int level)
+{
+  unsigned int cmf = 0x78;
+  unsigned int flg;
+
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  if (level < 2)
+    flg = 0;
+  else if (level < 6)
+    flg = 1;
+  else if (level == 6)
+    flg = 2;
+  else
+    flg = 3;
+  flg <<= 6;
+  flg += 31 - (cmf * 256 + flg) % 31;
+  if (iobuf_put (a, cmf) || iobuf_put (a, flg))
+    return -1;
+  return 0;
+}
+
+
+/* Wait until the worker is done with JOB and write the compressed
+ * data to stream A.  For the last block of the zlib format the
+ * Adler-32 trailer is appended.  */
+static int
+write_job (compress_filter_context_t *zfx, iobuf_t a, struct zip_job_s *job)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  byte trailer[4];
+  int rc;
+
+  workpool_wait (pool->workpool, &job->wp);
+
+  if (job->zrc != Z_OK && job->zrc != Z_STREAM_END)
+    {
+      log_error ("zlib deflate problem: rc=%d\n", job->zrc);
+      write_status_error ("zlib.deflate", gpg_error (GPG_ERR_INTERNAL));
+      g10_exit (2);
+    }
+  if (DBG_FILTER)
+    log_debug ("deflate: block %ju: %zu bytes -> %zu bytes\n",
+               (uintmax_t)job->blockindex, job->len, job->outlen);
+
+  rc = iobuf_write (a, job->outbuf, job->outlen);
+  if (!rc && zfx->algo == COMPRESS_ALGO_ZLIB)
+    {
+      pool->adler = adler32_combine (pool->adler, job->adler, job->len);
+      if (job->final)
+        {
+          trailer[0] = pool->adler >> 24;
+          trailer[1] = pool->adler >> 16;
+          trailer[2] = pool->adler >> 8;
+          trailer[3] = pool->adler;
+          rc = iobuf_write (a, trailer, 4);
+        }
+    }
+  if (rc)
+    log_error ("deflate: iobuf_write failed\n");
+
+  job->pending = 0;
+  return rc;
+}
+
+
+/* Start filling the job at FILLIDX.  The tail of the previous block
+ * is copied in front of the data so that the worker can use it as
+ * dictionary.  */
+static int
+start_job (compress_filter_context_t *zfx, iobuf_t a)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  struct zip_job_s *job = pool->jobs + pool->fillidx;
+  struct zip_job_s *prev;
+  int rc;
+
+  /* The job slot is either free or still holds the block submitted
+   * NJOBS blocks ago which is the oldest one not yet written.  */
+  if (job->pending)
+    {
+      rc = write_job (zfx, a, job);
+      if (rc)
+        return rc;
+    }
+
+  job->dictlen = 0;
+  if (pool->blockindex)
+    {
+      /* The previous job has not yet been reused and its data is
+       * only read by the worker.  It is also a full block.  */
+      prev = pool->jobs + (pool->fillidx + pool->njobs - 1) % pool->njobs;
+      job->dictlen = pool->dictsize;
+      memcpy (job->buffer,
+              prev->buffer + pool->dictsize + prev->len - job->dictlen,
+              job->dictlen);
+    }
+  job->blockindex = pool->blockindex++;
+  job->final = 0;
+  job->len = 0;
+  job->zrc = Z_OK;
+  pool->filling = 1;
+  return 0;
+}
+
+
+/* Hand the job currently being filled over to the workers.  */
+static void
+submit_job (compress_filter_context_t *zfx)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  struct zip_job_s *job = pool->jobs + pool->fillidx;
+
+  workpool_submit (pool->workpool, &job->wp);
+  job->pending = 1;
+  pool->filling = 0;
+  pool->fillidx = (pool->fillidx + 1) % pool->njobs;
+}
+
+
+/* The parallel version of do_compress with Z_NO_FLUSH.  The data is
+ * collected into full blocks which are then compressed by the
+ * workers.  */
+static int
+do_compress_parallel (compress_filter_context_t *zfx, iobuf_t a,
+                      byte *buf, size_t size)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  struct zip_job_s *job;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      if (!pool->filling && (rc = start_job (zfx, a)))
+        return rc;
+      job = pool->jobs + pool->fillidx;
+
+      n = ZIP_BLOCKSIZE - job->len;
+      if (n > size)
+        n = size;
+      memcpy (job->buffer + pool->dictsize + job->len, buf, n);
+      job->len += n;
+      buf += n;
+      size -= n;
+
+      if (job->len == ZIP_BLOCKSIZE)
+        submit_job (zfx);
+    }
+
+  return 0;
+}
+
+
+/* The parallel version of do_compress with Z_FINISH.  The last,
+ * possibly empty, block is submitted and all pending blocks are
+ * written in order.  */
+static int
+flush_pool (compress_filter_context_t *zfx, iobuf_t a)
+{
+  struct zip_pool_s *pool = zfx->pool;
+  int i, idx;
+  int rc = 0;
+
+  if (!pool->filling)
+    rc = start_job (zfx, a);
+  if (!rc)
+    {
+      pool->jobs[pool->fillidx].final = 1;
+      submit_job (zfx);
+    }
+
+  /* FILLIDX now points to the oldest pending job.  */
+  for (i=0; i < pool->njobs; i++)
+    {
+      idx = (pool->fillidx + i) % pool->njobs;
+      if (pool->jobs[idx].pending && !rc)
+        rc = write_job (zfx, a, pool->jobs + idx);
+    }
+
+  return rc;
+}
+
+
 static void
 init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -197,7 +618,9 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
 	if( DBG_FILTER )
 	    log_debug("enter inflate: avail_in=%u, avail_out=%u\n",
 		    (unsigned)zs->avail_in, (unsigned)zs->avail_out);
+	iobuf_unprotect ();
 	zrc = inflate ( zs, Z_SYNC_FLUSH );
+	iobuf_protect ();
 	if( DBG_FILTER )
 	    log_debug("leave inflate: avail_in=%u, avail_out=%u, zrc=%d\n",
 		   (unsigned)zs->avail_in, (unsigned)zs->avail_out, zrc);
@@ -222,6 +645,165 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
     return rc;
 }
 
+/* Return log2 of X which must be at least 1.  This avoids the need
+ * for the math library.  */
+static double
+log2_of (double x)
+{
+  double r = 0.0;
+  double bit = 1.0;
+  int i;
+
+  while (x >= 2.0)
+    {
+      x /= 2.0;
+      r += 1.0;
+    }
+  for (i=0; i < 20; i++)
+    {
+      x *= x;
+      bit /= 2.0;
+      if (x >= 2.0)
+        {
+          x /= 2.0;
+          r += bit;
+        }
+    }
+  return r;
+}
+
+
+/* Return the order-0 entropy of the LEN bytes at BUF in units of
+ * 1/100 bit per byte.  */
+static unsigned int
+sample_entropy (const byte *buf, size_t len)
+{
+  size_t count[256];
+  double sum = 0.0;
+  size_t n;
+  int i;
+
+  if (!len)
+    return 0;
+
+  memset (count, 0, sizeof count);
+  for (n=0; n < len; n++)
+    count[buf[n]]++;
+  for (i=0; i < 256; i++)
+    if (count[i])
+      sum += count[i] * log2_of (count[i]);
+
+  return (unsigned int)((log2_of (len) - sum / len) * 100.0 + 0.5);
+}
+
+
+/* Write the compressed packet header and prepare the compressor.  */
+static void
+start_compress (compress_filter_context_t *zfx, iobuf_t a)
+{
+  PACKET pkt;
+  PKT_compressed cd;
+  gpg_error_t err;
+
+  memset (&cd, 0, sizeof cd);
+  cd.len = 0;
+  cd.algorithm = zfx->algo;
+  /* Fixme: We should force a new CTB here:
+     cd.new_ctb = zfx->new_ctb;
+  */
+  init_packet (&pkt);
+  pkt.pkttype = PKT_COMPRESSED;
+  pkt.pkt.compressed = &cd;
+  if (build_packet (a, &pkt))
+    log_bug ("build_packet(PKT_COMPRESSED) failed\n");
+
+  err = start_pool (zfx);
+  if (err)
+    log_info ("parallel compression disabled: %s\n", gpg_strerror (err));
+  if (zfx->pool)
+    {
+      if (zfx->algo == COMPRESS_ALGO_ZLIB
+          && write_zlib_header (a, zfx->pool->level))
+        log_bug ("writing the zlib header failed\n");
+    }
+  else
+    {
+      zfx->opaque = xmalloc_clear (sizeof (z_stream));
+      init_compress (zfx, zfx->opaque);
+    }
+  zfx->status = 2;
+}
+
+
+/* Compress SIZE bytes from BUF and write them to A.  */
+static int
+compress_data (compress_filter_context_t *zfx, iobuf_t a,
+               byte *buf, size_t size)
+{
+  z_stream *zs = zfx->opaque;
+
+  if (zfx->pool)
+    return do_compress_parallel (zfx, a, buf, size);
+
+  zs->next_in = BYTEF_CAST (buf);
+  zs->avail_in = size;
+  return do_compress (zfx, zs, Z_NO_FLUSH, a);
+}
+
+
+/* Decide whether the sample collected in the INBUF of ZFX is worth
+ * compressing.  Depending on that the compression is started or the
+ * filter switches to pass through mode.  The sample is then written
+ * and released.  Samples which are too small to take a decision are
+ * always compressed.  */
+static int
+decide_compression (compress_filter_context_t *zfx, iobuf_t a)
+{
+  unsigned int entropy;
+  int bypass;
+  int rc;
+
+  entropy = sample_entropy (zfx->inbuf, zfx->inbuflen);
+  /* Small samples underestimate the entropy of random data; their
+   * compression is cheap anyway.  */
+  bypass = (zfx->inbuflen >= COMPRESS_MIN_SAMPLE
+            && entropy >= COMPRESS_BYPASS_ENTROPY);
+  if (DBG_FILTER)
+    log_debug ("compress: %u byte sample has %u.%02u bits/byte\n",
+               zfx->inbuflen, entropy / 100, entropy % 100);
+  if (bypass && opt.verbose)
+    log_info (_("data seems to be incompressible;"
+                " compression skipped\n"));
+  if (zfx->inbuflen >= COMPRESS_MIN_SAMPLE)
+    write_status_printf (STATUS_COMPRESSION_INFO, "%d %d %u.%02u",
+                         zfx->algo, !bypass, entropy / 100, entropy % 100);
+
+  if (bypass)
+    {
+      zfx->status = 4;
+      rc = iobuf_write (a, zfx->inbuf, zfx->inbuflen);
+    }
+  else
+    {
+      start_compress (zfx, a);
+      rc = zfx->inbuflen? compress_data (zfx, a, zfx->inbuf, zfx->inbuflen)
+        /**/            : 0;
+    }
+
+  xfree (zfx->inbuf);
+  zfx->inbuf = NULL;
+  zfx->inbufsize = zfx->inbuflen = 0;
+  return rc;
+}
+
+
+/* The filter uses these states:
+ *   0 - Not yet used.
+ *   1 - Decompressing.
+ *   2 - Compressing.
+ *   3 - Collecting a sample to decide on compression.
+ *   4 - Passing the data through uncompressed.
+ */
 static int
 compress_filter( void *opaque, int control,
 		 IOBUF a, byte *buf, size_t *ret_len)
@@ -230,6 +812,7 @@ compress_filter( void *opaque, int control,
     compress_filter_context_t *zfx = opaque;
     z_stream *zs = zfx->opaque;
     int rc=0;
+    size_t n;
 
     if( control == IOBUFCTRL_UNDERFLOW ) {
 	if( !zfx->status ) {
@@ -245,42 +828,60 @@ compress_filter( void *opaque, int control,
     }
     else if( control == IOBUFCTRL_FLUSH ) {
 	if( !zfx->status ) {
-	    PACKET pkt;
-	    PKT_compressed cd;
 	    if(zfx->algo != COMPRESS_ALGO_ZIP
 	       && zfx->algo != COMPRESS_ALGO_ZLIB)
 	      BUG();
-	    memset( &cd, 0, sizeof cd );
-	    cd.len = 0;
-	    cd.algorithm = zfx->algo;
-            /* Fixme: We should force a new CTB here:
-               cd.new_ctb = zfx->new_ctb;
-            */
-	    init_packet( &pkt );
-	    pkt.pkttype = PKT_COMPRESSED;
-	    pkt.pkt.compressed = &cd;
-	    if( build_packet( a, &pkt ))
-		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	    zfx->inbufsize = COMPRESS_SAMPLE_SIZE;
+	    zfx->inbuf = xmalloc( zfx->inbufsize );
+	    zfx->inbuflen = 0;
+	    zfx->status = 3;
+	}
+
+	if( zfx->status == 3 ) {
+	    n = zfx->inbufsize - zfx->inbuflen;
+	    if( n > size )
+		n = size;
+	    memcpy( zfx->inbuf + zfx->inbuflen, buf, n );
+	    zfx->inbuflen += n;
+	    buf += n;
+	    size -= n;
+	    if( zfx->inbuflen == zfx->inbufsize )
+		rc = decide_compression( zfx, a );
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( rc || !size )
+	    ;
+	else if( zfx->status == 4 )
+	    rc = iobuf_write( a, buf, size );
+	else if( zfx->status == 2 )
+	    rc = compress_data( zfx, a, buf, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
+	int rc2;
+
+	if( zfx->status == 3 ) {
+	    rc = decide_compression( zfx, a );
+	    zs = zfx->opaque;
+	}
+
 	if( zfx->status == 1 ) {
 	    inflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 2 && zfx->pool ) {
+	    rc2 = flush_pool (zfx, a);
+	    if (!rc)
+		rc = rc2;
+	    release_pool (zfx);
+	}
 	else if( zfx->status == 2 ) {
 	    zs->next_in = BYTEF_CAST (buf);
 	    zs->avail_in = 0;
-	    do_compress( zfx, zs, Z_FINISH, a );
+	    rc2 = do_compress( zfx, zs, Z_FINISH, a );
+	    if (!rc)
+		rc = rc2;
 	    deflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -31,6 +32,7 @@
 #include "../common/i18n.h"
 #include "../common/status.h"
 #include "../common/compliance.h"
+#include "workpool.h"
 
 
 static int aead_decode_filter (void *opaque, int control, iobuf_t a,
@@ -40,6 +42,58 @@ static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
 static int decode_filter ( void *opaque, int control, IOBUF a,
 					byte *buf, size_t *ret_len);
 
+/* The iobuf layer may ask for the data in small pieces.  For CFB
+ * mode such requests are served from a buffer which is filled and
+ * decrypted in batches of this size.  */
+#define CFB_BATCH_SIZE (64*1024)
+
+/* The maximum number of worker threads used to decrypt AEAD chunks
+ * in parallel.  */
+#define AEAD_MAX_WORKERS 8
+
+/* Parallel decryption reads a complete chunk per job.  To limit the
+ * memory use we fall back to the serial code for larger chunks.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
+
+/* A job describes one chunk.  The buffer holds the ciphertext
+ * followed by its tag and is decrypted in place.  */
+struct aead_job_s
+{
+  struct workpool_job_s wp;    /* Must be the first member.  */
+  int tag_failed;              /* ERR is from the tag check.  */
+  unsigned int pending : 1;    /* Submitted but not yet returned.  */
+  uint64_t chunkindex;  /* The index of this chunk.  */
+  size_t datalen;       /* The length of the data in BUFFER.  */
+  size_t outpos;        /* Bytes already returned to the caller.  */
+  gpg_error_t err;      /* The result of the decryption.  */
+  byte *buffer;         /* Allocated with a size of CHUNKSIZE+32.  */
+};
+
+/* The argument of a worker thread with its own cipher handle.  */
+struct aead_worker_s
+{
+  struct decode_filter_context_s *dfx;
+  gcry_cipher_hd_t cipher_hd;
+};
+
+/* The jobs and the workers used for parallel decryption.  The jobs
+ * are used round robin so that the plaintext can be returned in the
+ * order of the chunk index.  */
+struct aead_dec_pool_s
+{
+  workpool_t workpool;
+  int nworkers;
+  struct aead_worker_s workers[AEAD_MAX_WORKERS];
+  int njobs;
+  int fillidx;           /* Index of the job to read next.  */
+  int outidx;            /* Index of the job to return next.  */
+  unsigned int input_done : 1; /* All chunks have been read.  */
+  byte carry[16];        /* Bytes read ahead for the next chunk.  */
+  unsigned int carrylen;
+  byte finaltag[16];     /* The tag of the final chunk.  */
+  struct aead_job_s jobs[AEAD_MAX_WORKERS + 2];
+};
+
 /* Our context object.  */
 struct decode_filter_context_s
 {
@@ -99,10 +153,25 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* If not NULL the AEAD chunks are read ahead and decrypted by a
+   * pool of worker threads.  */
+  struct aead_dec_pool_s *pool;
+
+  /* For CFB mode the buffer with data decrypted ahead, its used
+   * length, and the read position.  */
+  byte *batchbuf;
+  size_t batchlen;
+  size_t batchpos;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
 
+static void release_pool (decode_filter_ctx_t dfx);
+static gpg_error_t start_pool (decode_filter_ctx_t dfx, DEK *dek,
+                               enum gcry_cipher_modes ciphermode);
+
+
 /* Helper to release the decode context.  */
 static void
 release_dfx_context (decode_filter_ctx_t dfx)
@@ -113,21 +182,28 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      release_pool (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
       dfx->mdc_hash = NULL;
+      if (dfx->batchbuf)
+        {
+          wipememory (dfx->batchbuf, CFB_BATCH_SIZE);
+          xfree (dfx->batchbuf);
+        }
       xfree (dfx);
     }
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX on
+ * the cipher handle HD.  This also reset the decryption machinery so
+ * that the handle can be used for a new chunk.  If FINAL is set the
+ * final AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                       uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -149,18 +225,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -169,14 +245,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -190,7 +266,19 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Helper to report a failed tag check with error ERR.  The FINAL
+ * flag is only for diagnostics.  */
+static void
+aead_tag_failed (decode_filter_ctx_t dfx, int final, gpg_error_t err)
+{
+  log_error ("gcry_cipher_checktag%s failed: %s\n",
+             final? " (final)":"", gpg_strerror (err));
+  write_status_error ("aead_checktag", err);
+  dfx->checktag_failed = 1;
 }
 
 
@@ -206,10 +294,7 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
   err = gcry_cipher_checktag (dfx->cipher_hd, tagbuf, 16);
   if (err)
     {
-      log_error ("gcry_cipher_checktag%s failed: %s\n",
-                 final? " (final)":"", gpg_strerror (err));
-      write_status_error ("aead_checktag", err);
-      dfx->checktag_failed = 1;
+      aead_tag_failed (dfx, final, err);
       return err;
     }
   if (DBG_FILTER)
@@ -409,6 +494,13 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
+      rc = start_pool (dfx, dek, ciphermode);
+      if (rc)
+        {
+          log_error ("error starting the decryption threads: %s\n",
+                     gpg_strerror (rc));
+          goto leave;
+        }
     }
   else /* CFB encryption.  */
     {
@@ -647,6 +739,310 @@ fill_buffer (decode_filter_ctx_t dfx, iobuf_t stream,
 }
 
 
+/* The job function of a decryption worker.  */
+static void
+aead_decrypt_job (void *arg, workpool_job_t wpjob)
+{
+  struct aead_worker_s *wrk = arg;
+  struct aead_job_s *job = (struct aead_job_s *)wpjob;
+  gpg_error_t err;
+  int tag_failed = 0;
+
+  err = aead_set_nonce_and_ad (wrk->dfx, wrk->cipher_hd,
+                               job->chunkindex, 0);
+  if (!err)
+    {
+      gcry_cipher_final (wrk->cipher_hd);
+      npth_unprotect ();
+      err = gcry_cipher_decrypt (wrk->cipher_hd, job->buffer,
+                                 job->datalen, NULL, 0);
+      if (!err)
+        {
+          err = gcry_cipher_checktag (wrk->cipher_hd,
+                                      job->buffer + job->datalen, 16);
+          tag_failed = !!err;
+        }
+      npth_protect ();
+    }
+  job->err = err;
+  job->tag_failed = tag_failed;
+}
+
+
+/* Stop all worker threads and release the pool of DFX.  */
+static void
+release_pool (decode_filter_ctx_t dfx)
+{
+  struct aead_dec_pool_s *pool = dfx->pool;
+  int i;
+
+  if (!pool)
+    return;
+
+  workpool_release (pool->workpool);
+  for (i=0; i < pool->nworkers; i++)
+    gcry_cipher_close (pool->workers[i].cipher_hd);
+  for (i=0; i < pool->njobs; i++)
+    {
+      if (pool->jobs[i].buffer)
+        wipememory (pool->jobs[i].buffer, dfx->chunksize + 32);
+      xfree (pool->jobs[i].buffer);
+    }
+  xfree (pool);
+  dfx->pool = NULL;
+}
+
+
+/* Create a pool of worker threads for DFX using the key from DEK.
+ * CIPHERMODE is the Libgcrypt mode used for the AEAD algorithm.
+ * Returns 0 without creating a pool if parallel decryption is not
+ * possible.  */
+static gpg_error_t
+start_pool (decode_filter_ctx_t dfx, DEK *dek,
+            enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err = 0;
+  struct aead_dec_pool_s *pool;
+  void *workerargs[AEAD_MAX_WORKERS];
+  unsigned int nworkers;
+  int i;
+
+  nworkers = workpool_get_nworkers (AEAD_MAX_WORKERS);
+  if (!nworkers || dfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return 0;
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->nworkers = nworkers;
+  /* Two jobs more than workers so that we can read ahead while all
+   * workers are busy and the oldest chunk is being returned.  */
+  pool->njobs = pool->nworkers + 2;
+  dfx->pool = pool;
+
+  for (i=0; i < pool->njobs; i++)
+    {
+      pool->jobs[i].buffer = xtrymalloc (dfx->chunksize + 32);
+      if (!pool->jobs[i].buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i=0; i < pool->nworkers; i++)
+    {
+      pool->workers[i].dfx = dfx;
+      err = openpgp_cipher_open (&pool->workers[i].cipher_hd,
+                                 dfx->cipher_algo, ciphermode,
+                                 GCRY_CIPHER_SECURE);
+      if (!err)
+        {
+          err = gcry_cipher_setkey (pool->workers[i].cipher_hd,
+                                    dek->key, dek->keylen);
+          if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+            err = 0;  /* Already reported for the main handle.  */
+        }
+      if (err)
+        goto leave;
+      workerargs[i] = pool->workers + i;
+    }
+
+  err = workpool_new (&pool->workpool, pool->nworkers,
+                      aead_decrypt_job, workerargs);
+  if (err)
+    goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("aead: using %d worker threads for %d jobs\n",
+               pool->nworkers, pool->njobs);
+
+ leave:
+  if (err)
+    release_pool (dfx);
+  return err;
+}
+
+
+/* Read the next chunk from STREAM into JOB and hand it over to the
+ * workers.  If the last chunk has been read the final tag is stored
+ * in the pool and the INPUT_DONE flag set.  */
+static gpg_error_t
+read_job (decode_filter_ctx_t dfx, iobuf_t stream, struct aead_job_s *job)
+{
+  struct aead_dec_pool_s *pool = dfx->pool;
+  size_t len;
+
+  /* We read the chunk, its tag and 16 more bytes.  If the stream
+   * does not end there the extra bytes are carried over to the next
+   * chunk; otherwise they are the final tag.  */
+  memcpy (job->buffer, pool->carry, pool->carrylen);
+  len = fill_buffer (dfx, stream, job->buffer, dfx->chunksize + 32,
+                     pool->carrylen);
+  pool->carrylen = 0;
+
+  if (dfx->eof_seen)
+    {
+      pool->input_done = 1;
+      if (len == 16 && dfx->chunkindex)
+        {
+          /* The previous chunk was the last one.  */
+          memcpy (pool->finaltag, job->buffer, 16);
+          return 0;
+        }
+      if (len <= 32)
+        {
+          /* Not enough data for the last two tags.  */
+          return gpg_error (GPG_ERR_TRUNCATED);
+        }
+      job->datalen = len - 32;
+      memcpy (pool->finaltag, job->buffer + len - 16, 16);
+    }
+  else
+    {
+      log_assert (len == dfx->chunksize + 32);
+      job->datalen = dfx->chunksize;
+      memcpy (pool->carry, job->buffer + len - 16, 16);
+      pool->carrylen = 16;
+    }
+
+  job->chunkindex = dfx->chunkindex++;
+  job->outpos = 0;
+  job->err = 0;
+  job->tag_failed = 0;
+  dfx->total += job->datalen;
+
+  if (DBG_FILTER)
+    log_debug ("aead: submitting chunk %ju (%zu bytes)%s\n",
+               (uintmax_t)job->chunkindex, job->datalen,
+               pool->input_done? " last":"");
+
+  workpool_submit (pool->workpool, &job->wp);
+  job->pending = 1;
+  pool->fillidx = (pool->fillidx + 1) % pool->njobs;
+  return 0;
+}
+
+
+/* Wait until the worker is done with JOB and return its result.  A
+ * failed tag check is reported here so that the diagnostics are
+ * emitted in chunk order.  */
+static gpg_error_t
+wait_job (decode_filter_ctx_t dfx, struct aead_job_s *job)
+{
+  workpool_wait (dfx->pool->workpool, &job->wp);
+
+  if (job->tag_failed)
+    aead_tag_failed (dfx, 0, job->err);
+  else if (job->err)
+    log_error ("gcry_cipher_decrypt failed (chunk %ju): %s\n",
+               (uintmax_t)job->chunkindex, gpg_strerror (job->err));
+  else if (DBG_FILTER)
+    log_debug ("aead: chunk %ju is valid\n", (uintmax_t)job->chunkindex);
+  return job->err;
+}
+
+
+/* Check the final tag of the stream.  */
+static gpg_error_t
+aead_check_final (decode_filter_ctx_t dfx)
+{
+  gpg_error_t err;
+  byte dummy[1];
+
+  err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd, dfx->chunkindex, 1);
+  if (err)
+    return err;
+  gcry_cipher_final (dfx->cipher_hd);
+  /* Decrypt an empty string.  */
+  err = gcry_cipher_decrypt (dfx->cipher_hd, dummy, 0, NULL, 0);
+  if (err)
+    {
+      log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                 gpg_strerror (err));
+      return err;
+    }
+  return aead_checktag (dfx, 1, dfx->pool->finaltag);
+}
+
+
+/* The parallel version of aead_underflow.  Chunks are read ahead and
+ * decrypted by the workers; the plaintext of a chunk is only returned
+ * after its tag has been verified.  */
+static gpg_error_t
+aead_underflow_parallel (decode_filter_ctx_t dfx, iobuf_t a,
+                         byte *buf, size_t *ret_len)
+{
+  struct aead_dec_pool_s *pool = dfx->pool;
+  const size_t size = *ret_len; /* The allocated size of BUF.  */
+  gpg_error_t err = 0;
+  size_t totallen = 0;
+  struct aead_job_s *job;
+  size_t n;
+
+  while (totallen < size)
+    {
+      /* Keep the workers busy by reading ahead into all free jobs.  */
+      while (!pool->input_done && !pool->jobs[pool->fillidx].pending)
+        {
+          err = read_job (dfx, a, pool->jobs + pool->fillidx);
+          if (err)
+            goto leave;
+        }
+
+      job = pool->jobs + pool->outidx;
+      if (!job->pending)
+        {
+          /* All chunks have been returned.  */
+          log_assert (pool->input_done);
+          err = aead_check_final (dfx);
+          if (!err)
+            err = gpg_error (GPG_ERR_EOF);
+          goto leave;
+        }
+
+      err = wait_job (dfx, job);
+      if (err)
+        goto leave;
+
+      n = job->datalen - job->outpos;
+      if (n > size - totallen)
+        n = size - totallen;
+      memcpy (buf + totallen, job->buffer + job->outpos, n);
+      job->outpos += n;
+      totallen += n;
+
+      if (job->outpos == job->datalen)
+        {
+          job->pending = 0;
+          pool->outidx = (pool->outidx + 1) % pool->njobs;
+        }
+    }
+
+ leave:
+  if (DBG_FILTER)
+    log_debug ("aead_underflow_parallel: returning %zu (%s)\n",
+               totallen, gpg_strerror (err));
+
+  if (err)
+    {
+      /* We are done; either with an error or at the EOF.  */
+      release_pool (dfx);
+      if (gpg_err_code (err) != GPG_ERR_EOF)
+        {
+          memset (buf, 0, size);
+          totallen = 0;
+        }
+      if (!dfx->eof_seen)
+        dfx->eof_seen = 1;
+    }
+
+  *ret_len = totallen;
+
+  return err;
+}
+
+
 /* The core of the AEAD decryption.  This is the underflow function of
  * the aead_decode_filter.  */
 static gpg_error_t
@@ -725,7 +1121,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                       dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -807,7 +1204,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                       dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -857,7 +1255,7 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
         }
 
       /* Check the final chunk.  */
-      err = aead_set_nonce_and_ad (dfx, 1);
+      err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd, dfx->chunkindex, 1);
       if (err)
         goto leave;
       gcry_cipher_final (dfx->cipher_hd);
@@ -899,7 +1297,7 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen && !dfx->pool )
     {
       *ret_len = 0;
       rc = -1;
@@ -908,7 +1306,10 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
     {
       log_assert (a);
 
-      rc = aead_underflow (dfx, a, buf, ret_len);
+      if (dfx->pool)
+        rc = aead_underflow_parallel (dfx, a, buf, ret_len);
+      else
+        rc = aead_underflow (dfx, a, buf, ret_len);
       if (gpg_err_code (rc) == GPG_ERR_EOF)
         rc = -1; /* We need to use the old convention in the filter.  */
 
@@ -926,12 +1327,124 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
 }
 
 
+/* Serve an underflow request for CFB mode.  Requests for less than
+ * CFB_BATCH_SIZE bytes are served from DFX->BATCHBUF which is filled
+ * using DECODE_DATA; larger ones are passed directly to DECODE_DATA.
+ * That function returns the number of bytes decrypted into its
+ * buffer or 0 on EOF.  */
+static int
+cfb_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len,
+               size_t (*decode_data) (decode_filter_ctx_t dfx, iobuf_t a,
+                                      byte *buf, size_t size))
+{
+  size_t size = *ret_len;
+  size_t n;
+
+  if (dfx->batchpos == dfx->batchlen && !dfx->eof_seen
+      && size < CFB_BATCH_SIZE)
+    {
+      if (!dfx->batchbuf)
+        dfx->batchbuf = xtrymalloc (CFB_BATCH_SIZE);
+      if (dfx->batchbuf)
+        {
+          dfx->batchlen = decode_data (dfx, a, dfx->batchbuf, CFB_BATCH_SIZE);
+          dfx->batchpos = 0;
+        }
+    }
+
+  if (dfx->batchpos < dfx->batchlen)
+    {
+      n = dfx->batchlen - dfx->batchpos;
+      if (n > size)
+        n = size;
+      memcpy (buf, dfx->batchbuf + dfx->batchpos, n);
+      dfx->batchpos += n;
+      *ret_len = n;
+      return 0;
+    }
+
+  if (dfx->eof_seen)
+    {
+      *ret_len = 0;
+      return -1;
+    }
+
+  n = decode_data (dfx, a, buf, size);
+  *ret_len = n;
+  return n? 0 : -1;
+}
+
+
+/* Read and decrypt up to SIZE bytes into BUF for the MDC mode.  The
+ * trailing MDC packet is kept in the holdback buffer.  Returns the
+ * number of bytes stored at BUF or 0 on EOF.  */
+static size_t
+mdc_decode_data (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t size)
+{
+  size_t n;
+
+  log_assert (size > 44); /* Our code requires at least this size.  */
+
+  /* Get at least 22 bytes and put it ahead in the buffer.  */
+  n = fill_buffer (dfx, a, buf, 44, 22);
+  if (n == 44)
+    {
+      /* We have enough stuff - flush the holdback buffer.  */
+      if ( !dfx->holdbacklen )  /* First time. */
+        {
+          memcpy (buf, buf+22, 22);
+          n = 22;
+        }
+      else
+        {
+          memcpy (buf, dfx->holdback, 22);
+        }
+
+      /* Fill up the buffer. */
+      n = fill_buffer (dfx, a, buf, size, n);
+
+      /* Move the trailing 22 bytes back to the holdback buffer.  We
+         have at least 44 bytes thus a memmove is not needed.  */
+      n -= 22;
+      memcpy (dfx->holdback, buf+n, 22 );
+      dfx->holdbacklen = 22;
+    }
+  else if ( !dfx->holdbacklen ) /* EOF seen but empty holdback. */
+    {
+      /* This is bad because it means an incomplete hash. */
+      n -= 22;
+      memcpy (buf, buf+22, n );
+      dfx->eof_seen = 2; /* EOF with incomplete hash.  */
+    }
+  else  /* EOF seen (i.e. read less than 22 bytes). */
+    {
+      memcpy (buf, dfx->holdback, 22 );
+      n -= 22;
+      memcpy (dfx->holdback, buf+n, 22 );
+      dfx->eof_seen = 1; /* Normal EOF. */
+    }
+
+  if ( n )
+    {
+      iobuf_unprotect ();
+      if ( dfx->cipher_hd )
+        gcry_cipher_decrypt (dfx->cipher_hd, buf, n, NULL, 0);
+      if ( dfx->mdc_hash )
+        gcry_md_write (dfx->mdc_hash, buf, n);
+      iobuf_protect ();
+    }
+  else
+    log_assert ( dfx->eof_seen );
+
+  return n;
+}
+
+
 static int
 mdc_decode_filter (void *opaque, int control, IOBUF a,
                    byte *buf, size_t *ret_len)
 {
   decode_filter_ctx_t dfx = opaque;
-  size_t n, size = *ret_len;
   int rc = 0;
 
   /* Note: We need to distinguish between a partial and a fixed length
@@ -942,68 +1455,10 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
      packet is not followed by other data.  This used to be a long
      standing bug which was fixed on 2009-10-02.  */
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
-    {
-      *ret_len = 0;
-      rc = -1;
-    }
-  else if( control == IOBUFCTRL_UNDERFLOW )
+  if( control == IOBUFCTRL_UNDERFLOW )
     {
       log_assert (a);
-      log_assert (size > 44); /* Our code requires at least this size.  */
-
-      /* Get at least 22 bytes and put it ahead in the buffer.  */
-      n = fill_buffer (dfx, a, buf, 44, 22);
-      if (n == 44)
-        {
-          /* We have enough stuff - flush the holdback buffer.  */
-          if ( !dfx->holdbacklen )  /* First time. */
-            {
-              memcpy (buf, buf+22, 22);
-              n = 22;
-	    }
-          else
-            {
-              memcpy (buf, dfx->holdback, 22);
-	    }
-
-          /* Fill up the buffer. */
-          n = fill_buffer (dfx, a, buf, size, n);
-
-          /* Move the trailing 22 bytes back to the holdback buffer.  We
-             have at least 44 bytes thus a memmove is not needed.  */
-          n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
-          dfx->holdbacklen = 22;
-	}
-      else if ( !dfx->holdbacklen ) /* EOF seen but empty holdback. */
-        {
-          /* This is bad because it means an incomplete hash. */
-          n -= 22;
-          memcpy (buf, buf+22, n );
-          dfx->eof_seen = 2; /* EOF with incomplete hash.  */
-	}
-      else  /* EOF seen (i.e. read less than 22 bytes). */
-        {
-          memcpy (buf, dfx->holdback, 22 );
-          n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
-          dfx->eof_seen = 1; /* Normal EOF. */
-	}
-
-      if ( n )
-        {
-          if ( dfx->cipher_hd )
-            gcry_cipher_decrypt (dfx->cipher_hd, buf, n, NULL, 0);
-          if ( dfx->mdc_hash )
-            gcry_md_write (dfx->mdc_hash, buf, n);
-	}
-      else
-        {
-          log_assert ( dfx->eof_seen );
-          rc = -1; /* Return EOF.  */
-	}
-      *ret_len = n;
+      rc = cfb_underflow (dfx, a, buf, ret_len, mdc_decode_data);
     }
   else if ( control == IOBUFCTRL_FREE )
     {
@@ -1017,37 +1472,40 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
 }
 
 
+/* Read and decrypt up to SIZE bytes into BUF for the mode without
+ * MDC.  Returns the number of bytes stored at BUF or 0 on EOF.  */
+static size_t
+decode_data (decode_filter_ctx_t fc, iobuf_t a, byte *buf, size_t size)
+{
+  size_t n;
+
+  n = fill_buffer (fc, a, buf, size, 0);
+  if (n)
+    {
+      if (fc->cipher_hd)
+        {
+          iobuf_unprotect ();
+          gcry_cipher_decrypt (fc->cipher_hd, buf, n, NULL, 0);
+          iobuf_protect ();
+        }
+    }
+  else if (!fc->eof_seen)
+    fc->eof_seen = 1;
+
+  return n;
+}
+
+
 static int
 decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
 {
   decode_filter_ctx_t fc = opaque;
-  size_t size = *ret_len;
-  size_t n;
   int rc = 0;
 
-
-  if ( control == IOBUFCTRL_UNDERFLOW && fc->eof_seen )
-    {
-      *ret_len = 0;
-      rc = -1;
-    }
-  else if ( control == IOBUFCTRL_UNDERFLOW )
+  if ( control == IOBUFCTRL_UNDERFLOW )
     {
       log_assert (a);
-
-      n = fill_buffer (fc, a, buf, size, 0);
-      if (n)
-        {
-          if (fc->cipher_hd)
-            gcry_cipher_decrypt (fc->cipher_hd, buf, n, NULL, 0);
-        }
-      else
-        {
-          if (!fc->eof_seen)
-            fc->eof_seen = 1;
-          rc = -1; /* Return EOF. */
-        }
-      *ret_len = n;
+      rc = cfb_underflow (fc, a, buf, ret_len, decode_data);
     }
   else if ( control == IOBUFCTRL_FREE )
     {
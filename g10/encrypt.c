@@ -664,6 +664,11 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
       pkt.pkt.generic = NULL;
     }
 
+  /* Run the cipher filter and everything below it on a separate
+   * thread.  */
+  if (mode && (opt.compat_flags & COMPAT_PARALLELIZED))
+    iobuf_push_thread_filter (out, 0);
+
   /* Register the compress filter. */
   if ( do_compress )
     {
@@ -1016,6 +1021,11 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
   else
     cfx.datalen = filesize && !do_compress ? filesize : 0;
 
+  /* Run the cipher filter and everything below it on a separate
+   * thread.  */
+  if ((opt.compat_flags & COMPAT_PARALLELIZED))
+    iobuf_push_thread_filter (out, 0);
+
   /* Register the compress filter. */
   if (do_compress)
     {
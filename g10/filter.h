@@ -29,9 +29,6 @@ typedef struct {
     size_t maxbuf_size;
 } md_filter_context_t;
 
-typedef struct md_thd_filter_context *md_thd_filter_context_t;
-void md_thd_filter_set_md (md_thd_filter_context_t mfx, gcry_md_hd_t md);
-
 typedef struct {
     int  refcount;          /* Initialized to 1.  */
 
@@ -66,7 +63,7 @@ typedef struct {
 
     byte radbuf[4];
     int idx, idx2;
-    gcry_md_hd_t crc_md;
+    u32 crc;		    /* The running CRC-24.  */
 
     int status; 	    /* an internal state flag */
     int cancel;
@@ -81,11 +78,13 @@ struct compress_filter_context_s {
     void *opaque;   /* (used for z_stream) */
     byte *inbuf;
     unsigned inbufsize;
+    unsigned inbuflen;  /* Used length of INBUF while sampling.  */
     byte *outbuf;
     unsigned outbufsize;
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    struct zip_pool_s *pool; /* Used for parallel compression.  */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -137,6 +136,10 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* If not NULL the AEAD chunks are encrypted by a pool of worker
+   * threads.  */
+  struct aead_enc_pool_s *pool;
+
 } cipher_filter_context_t;
 
 
@@ -168,7 +171,6 @@ typedef struct {
 
 /*-- mdfilter.c --*/
 int md_filter( void *opaque, int control, iobuf_t a, byte *buf, size_t *ret_len);
-int md_thd_filter( void *opaque, int control, iobuf_t a, byte *buf, size_t *ret_len);
 void free_md_filter_context( md_filter_context_t *mfx );
 
 /*-- armor.c --*/
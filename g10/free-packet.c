@@ -113,6 +113,7 @@ free_seckey_enc( PKT_signature *sig )
   xfree(sig->revkey);
   xfree(sig->hashed);
   xfree(sig->unhashed);
+  xfree (sig->rawdata);
 
   /* Do not forget to update copy_signature() too. */
   xfree(sig->rev_subject_info);
@@ -324,6 +325,11 @@ copy_signature( PKT_signature *d, PKT_signature *s )
 	for(i=0; i < n; i++ )
 	    d->data[i] = my_mpi_copy( s->data[i] );
     }
+    if (s->rawdata)
+      {
+        d->rawdata = xmalloc (s->rawdatalen);
+        memcpy (d->rawdata, s->rawdata, s->rawdatalen);
+      }
     d->hashed = cp_subpktarea (s->hashed);
     d->unhashed = cp_subpktarea (s->unhashed);
     if (s->signers_uid)
@@ -620,6 +626,8 @@ cmp_signatures( PKT_signature *a, PKT_signature *b )
     n = pubkey_get_nsig( a->pubkey_algo );
     if( !n )
 	return -1; /* can't compare due to unknown algorithm */
+    if (materialize_sig_data (a) || materialize_sig_data (b))
+        return -1;
     for(i=0; i < n; i++ ) {
 	if( mpi_cmp( a->data[i] , b->data[i] ) )
 	    return -1;
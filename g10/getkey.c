@@ -125,15 +125,34 @@ typedef struct keyid_list
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table keyed by the key ID.  All
+ * entries are also kept on a doubly linked list in the order of their
+ * last use so that the least recently used entry is evicted if the
+ * cache is full.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next entry in the bucket.  */
+  struct pk_cache_entry *lru_prev;  /* The more recently used entry.  */
+  struct pk_cache_entry *lru_next;  /* The less recently used entry.  */
   u32 keyid[2];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
-static int pk_cache_entries;	/* Number of entries in pk cache.  */
+static pk_cache_entry_t *pk_cache;      /* The hash table.  */
+static unsigned int pk_cache_size;      /* Number of buckets (2^n).  */
+static pk_cache_entry_t pk_cache_head;  /* The most recently used.  */
+static pk_cache_entry_t pk_cache_tail;  /* The least recently used.  */
+static unsigned int pk_cache_entries;	/* Number of entries in pk cache.  */
+static unsigned int pk_cache_max;       /* Max. number of entries.  */
 static int pk_cache_disabled;
+
+/* Statistics for the public key cache.  */
+static struct
+{
+  unsigned long hits;     /* Number of lookups found in the cache.  */
+  unsigned long misses;   /* Number of lookups not found.  */
+  unsigned long added;    /* Number of added entries.  */
+  unsigned long evicted;  /* Number of evicted entries.  */
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -168,6 +187,99 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Return the bucket for KEYID.  */
+static inline pk_cache_entry_t *
+pk_cache_bucket (const u32 *keyid)
+{
+  return pk_cache + ((keyid[1] ^ keyid[0]) & (pk_cache_size - 1));
+}
+
+
+/* Remove CE from the LRU list.  */
+static void
+pk_cache_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_head = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_tail = ce->lru_prev;
+  ce->lru_prev = ce->lru_next = NULL;
+}
+
+
+/* Put CE at the head of the LRU list.  */
+static void
+pk_cache_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_head;
+  if (pk_cache_head)
+    pk_cache_head->lru_prev = ce;
+  pk_cache_head = ce;
+  if (!pk_cache_tail)
+    pk_cache_tail = ce;
+}
+
+
+/* Return the cache entry for KEYID or NULL if there is none.  If
+ * PRIMARY_ONLY is set only primary keys are considered.  A found
+ * entry is marked as the most recently used one.  */
+static pk_cache_entry_t
+pk_cache_lookup (const u32 *keyid, int primary_only)
+{
+  pk_cache_entry_t ce;
+
+  if (pk_cache)
+    for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+      if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+        {
+          if (primary_only
+              && (ce->pk->keyid[0] != ce->pk->main_keyid[0]
+                  || ce->pk->keyid[1] != ce->pk->main_keyid[1]))
+            break;
+          if (ce != pk_cache_head)
+            {
+              pk_cache_unlink (ce);
+              pk_cache_push (ce);
+            }
+          pk_cache_stats.hits++;
+          return ce;
+        }
+
+  pk_cache_stats.misses++;
+  return NULL;
+}
+
+
+/* Evict the least recently used entry from the cache.  */
+static void
+pk_cache_evict (void)
+{
+  pk_cache_entry_t ce, *cep;
+
+  ce = pk_cache_tail;
+  if (!ce)
+    return;
+  for (cep = pk_cache_bucket (ce->keyid); *cep; cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  pk_cache_unlink (ce);
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+  pk_cache_stats.evicted++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
@@ -179,12 +291,13 @@ print_stats ()
  * instance.
  *
  * This cache is filled by get_pubkey and is read by get_pubkey and
- * get_pubkey_fast.  */
+ * get_pubkey_fast.  If the cache is full the least recently used
+ * entry is evicted.  Its size is set with --pubkey-cache-size.  */
 void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce, *cep;
   u32 keyid[2];
 
   if (pk_cache_disabled)
@@ -205,7 +318,22 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
+  if (!pk_cache)
+    {
+      /* Allocate the hash table with about one bucket per entry.  */
+      pk_cache_max = (opt.pubkey_cache_size? opt.pubkey_cache_size
+                      /* */                : MAX_PK_CACHE_ENTRIES);
+      if (pk_cache_max < 2)
+        pk_cache_max = 2;  /* We need the cache for key creation.  */
+      for (pk_cache_size = 16;
+           pk_cache_size < pk_cache_max && pk_cache_size < (1u << 24);
+           pk_cache_size <<= 1)
+        ;
+      pk_cache = xcalloc (pk_cache_size, sizeof *pk_cache);
+    }
+
+  cep = pk_cache_bucket (keyid);
+  for (ce = *cep; ce; ce = ce->next)
     if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
       {
 	if (DBG_CACHE)
@@ -213,32 +341,15 @@ cache_public_key (PKT_public_key * pk)
 	return;
       }
 
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
-    {
-      int n;
+  while (pk_cache_entries >= pk_cache_max)
+    pk_cache_evict ();
 
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
-    }
   pk_cache_entries++;
+  pk_cache_stats.added++;
   ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
+  ce->next = *cep;
+  *cep = ce;
+  pk_cache_push (ce);
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
@@ -246,6 +357,20 @@ cache_public_key (PKT_public_key * pk)
 }
 
 
+/* Dump the statistics of the public key cache.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk_cache: entries=%u/%u hits=%lu misses=%lu"
+            " added=%lu evicted=%lu\n",
+            pk_cache_entries, pk_cache_max,
+            pk_cache_stats.hits, pk_cache_stats.misses,
+            pk_cache_stats.added, pk_cache_stats.evicted);
+#endif
+}
+
+
 /* Return a const utf-8 string with the text "[User ID not found]".
    This function is required so that we don't need to switch gettext's
    encoding temporary.  */
@@ -270,14 +395,9 @@ getkey_disable_caches (void)
 {
 #if MAX_PK_CACHE_ENTRIES
   {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
+    while (pk_cache_tail)
+      pk_cache_evict ();
+    xfree (pk_cache);
     pk_cache_disabled = 1;
     pk_cache_entries = 0;
     pk_cache = NULL;
@@ -417,14 +537,13 @@ get_pubkey_bykid (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
        * entire keyblock.  This is because the cache does not
        * associate the public key with its primary key.  */
       pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+
+      ce = pk_cache_lookup (keyid, 0);
+      if (ce)
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
     }
 #endif
 
@@ -563,17 +682,13 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
     /* Try to get it from the cache */
     pk_cache_entry_t ce;
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    /* Only consider primary keys.  */
+    ce = pk_cache_lookup (keyid, 1);
+    if (ce)
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -3635,6 +3750,8 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
       BUG ();
     }
 
+  check_key_signatures_start (ctrl, keyblock, 1);
+
   merge_selfsigs_main (ctrl, keyblock, &revoked, &rinfo);
 
   /* Now merge in the data from each of the subkeys.  */
@@ -3646,6 +3763,8 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
 	}
     }
 
+  check_key_signatures_end (ctrl, keyblock);
+
   main_pk = keyblock->pkt->pkt.public_key;
   if (revoked || main_pk->has_expired || !main_pk->flags.valid)
     {
@@ -395,6 +395,7 @@ enum cmd_and_opt_values
     oFixedListMode,
     oLegacyListMode,
     oNoSigCache,
+    oPubkeyCacheSize,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -948,6 +949,8 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_header (NULL, N_("Other options")),
 
+  ARGPARSE_s_u (oPubkeyCacheSize, "pubkey-cache-size",
+                N_("|N|keep up to N public keys in the memory cache")),
   ARGPARSE_s_s (oRequestOrigin,   "request-origin", "@"),
   ARGPARSE_s_s (oDisplay,    "display",    "@"),
   ARGPARSE_s_s (oTTYname,    "ttyname",    "@"),
@@ -3587,6 +3590,9 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oPubkeyCacheSize:
+            opt.pubkey_cache_size = pargs.r.ret_ulong;
+            break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -5694,10 +5700,13 @@ g10_exit( int rc )
     {
       keydb_dump_stats ();
       sig_check_dump_stats ();
+      getkey_dump_stats ();
       objcache_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
+  else if (DBG_CACHE)
+    getkey_dump_stats ();
   if (opt.debug)
     gcry_control (GCRYCTL_DUMP_SECMEM_STATS );
 
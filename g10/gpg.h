@@ -116,6 +116,10 @@ struct server_control_s
   /* This is used to cache a key data base handle.  */
   KEYDB_HANDLE cached_getkey_kdb;
 
+  /* The active batch of key signature verifications; see
+   * check_key_signatures_start.  */
+  struct sig_batch_s *sig_batch;
+
   /* Cached results from HAVEKEY --list.  They are used if the pointer
    * is not NULL.  The length gives the length in bytes and is a
    * multiple of 20.  If the no_more flag is set the list shall not
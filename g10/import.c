@@ -768,6 +768,21 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
         }
     }
   stats->v3keys += v3keys;
+
+  /* In bulk import mode the new keys may have been queued; store them
+   * now so that errors are shown and counted before the summary.  */
+  {
+    unsigned int nfailed;
+    gpg_error_t err = keydb_flush_store_queue (ctrl, &nfailed);
+
+    if (err)
+      log_error ("error storing the queued keys: %s\n", gpg_strerror (err));
+    stats->imported -= nfailed < stats->imported? nfailed : stats->imported;
+    stats->not_imported += nfailed;
+    if (err && (!rc || rc == -1))
+      rc = err;
+  }
+
   if (rc == -1)
     rc = 0;
   else if (rc && gpg_err_code (rc) != GPG_ERR_INV_KEYRING)
@@ -3885,6 +3900,8 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
   int rc;
   kbnode_t n;
 
+  check_key_signatures_start (ctrl, keyblock, 1);
+
   for (n=keyblock; (n = find_next_kbnode (n, 0)); )
     {
       if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
@@ -3920,6 +3937,7 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
             {
               log_error( _("key %s: no user ID for signature\n"),
                          keystr(keyid));
+              check_key_signatures_end (ctrl, keyblock);
               return -1;  /* The complete keyblock is invalid.  */
             }
 
@@ -4069,6 +4087,7 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
         }
     }
 
+  check_key_signatures_end (ctrl, keyblock);
   return 0;
 }
 
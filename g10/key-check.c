@@ -160,6 +160,9 @@ remove_duplicate_sigs (kbnode_t kb, int *dups, int *modified)
         }
       sig = n->pkt->pkt.signature;
       sig->help_counter = block;
+      /* The comparison needs the MPIs.  This can't fail because the
+       * raw MPIs have already been checked by the parser.  */
+      materialize_sig_data (sig);
       sigs[i++] = n;
     }
   log_assert (i == nsigs);
@@ -579,7 +582,7 @@ key_check_all_keysigs (ctrl_t ctrl, int mode, kbnode_t kb,
 				     has_selfsig, 0, only_selfsigs);
           }
 
-          if (dump_sig_params)
+          if (dump_sig_params && !materialize_sig_data (sig))
             {
               int i;
 
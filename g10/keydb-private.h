@@ -156,6 +156,9 @@ struct keydb_handle_s
 
 gpg_error_t keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
                                   kbnode_t *r_keyblock);
+gpg_error_t keydb_parse_keyblock_buffer (const void *buffer, size_t length,
+                                         int pk_no, int uid_no,
+                                         kbnode_t *r_keyblock);
 
 /* These are the functions call-keyboxd diverts to if the keyboxd is
  * not used.  */
@@ -1185,17 +1185,14 @@ keydb_pop_found_state (KEYDB_HANDLE hd)
 
 
 
-/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  PK_NO gives
- * the index of the public (sub)key which matched the search criteria;
- * the primary key is 1, the first subkey 2, 0 means unknown.  UID_NO
- * is the same for user-ids as search criteria; 1 is the first
- * user-id, 0 means unknown.  */
-gpg_error_t
-keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
-                      kbnode_t *r_keyblock)
+/* Parse the keyblock using the packet parser context PARSECTX which
+ * has either been setup for an iobuf or for a buffer.  See
+ * keydb_parse_keyblock for the other args.  */
+static gpg_error_t
+parse_keyblock (parse_packet_ctx_t parsectx, int pk_no, int uid_no,
+                kbnode_t *r_keyblock)
 {
   gpg_error_t err;
-  struct parse_packet_ctx_s parsectx;
   PACKET *pkt;
   kbnode_t keyblock = NULL;
   kbnode_t node, *tail;
@@ -1208,16 +1205,21 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
   if (!pkt)
     return gpg_error_from_syserror ();
   init_packet (pkt);
-  init_parse_packet (&parsectx, iobuf);
   save_mode = set_packet_list_mode (0);
   in_cert = 0;
   tail = NULL;
   pk_count = uid_count = 0;
-  while ((err = parse_packet (&parsectx, pkt)) != -1)
+  for (;;)
     {
+      if (parsectx->inp)
+        err = parse_packet (parsectx, pkt);
+      else
+        err = parse_packet_buffer (parsectx, pkt);
+      if (err == -1)
+        break;
       if (gpg_err_code (err) == GPG_ERR_UNKNOWN_PACKET)
         {
-          free_packet (pkt, &parsectx);
+          free_packet (pkt, parsectx);
           init_packet (pkt);
           continue;
 	}
@@ -1228,7 +1230,7 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
                      gpg_strerror (err));
           if (gpg_err_code (err) == GPG_ERR_INV_PACKET)
             {
-              free_packet (pkt, &parsectx);
+              free_packet (pkt, parsectx);
               init_packet (pkt);
               continue;
             }
@@ -1251,7 +1253,7 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
 
         default:
           log_info ("skipped packet of type %d in keybox\n", (int)pkt->pkttype);
-          free_packet(pkt, &parsectx);
+          free_packet(pkt, parsectx);
           init_packet(pkt);
           continue;
         }
@@ -1320,13 +1322,49 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
       *r_keyblock = keyblock;
       keydb_stats.parse_keyblocks++;
     }
-  free_packet (pkt, &parsectx);
-  deinit_parse_packet (&parsectx);
+  free_packet (pkt, parsectx);
   xfree (pkt);
   return err;
 }
 
 
+/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  PK_NO gives
+ * the index of the public (sub)key which matched the search criteria;
+ * the primary key is 1, the first subkey 2, 0 means unknown.  UID_NO
+ * is the same for user-ids as search criteria; 1 is the first
+ * user-id, 0 means unknown.  */
+gpg_error_t
+keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
+                      kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+
+  init_parse_packet (&parsectx, iobuf);
+  err = parse_keyblock (&parsectx, pk_no, uid_no, r_keyblock);
+  deinit_parse_packet (&parsectx);
+  return err;
+}
+
+
+/* Same as keydb_parse_keyblock but parse the keyblock from the
+ * LENGTH bytes at BUFFER.  This is used for blobs which are anyway
+ * in memory; it avoids the iobuf layer and parses the MPIs of
+ * signatures only when they are needed.  */
+gpg_error_t
+keydb_parse_keyblock_buffer (const void *buffer, size_t length,
+                             int pk_no, int uid_no, kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+
+  init_parse_packet_buffer (&parsectx, buffer, length);
+  err = parse_keyblock (&parsectx, pk_no, uid_no, r_keyblock);
+  deinit_parse_packet (&parsectx);
+  return err;
+}
+
+
 /* Return the keyblock last found by keydb_search() in *RET_KB.
  * keydb_get_keyblock divert to here in the non-keyboxd mode.
  *
@@ -1346,24 +1384,15 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 
   if (hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED)
     {
-      err = iobuf_seek (hd->keyblock_cache.iobuf, 0);
+      err = keydb_parse_keyblock_buffer
+        (iobuf_get_temp_buffer (hd->keyblock_cache.iobuf),
+         iobuf_get_temp_length (hd->keyblock_cache.iobuf),
+         hd->keyblock_cache.pk_no, hd->keyblock_cache.uid_no, ret_kb);
       if (err)
-	{
-	  log_error ("keydb_get_keyblock: failed to rewind iobuf for cache\n");
-	  keyblock_cache_clear (hd);
-	}
-      else
-	{
-	  err = keydb_parse_keyblock (hd->keyblock_cache.iobuf,
-				      hd->keyblock_cache.pk_no,
-				      hd->keyblock_cache.uid_no,
-				      ret_kb);
-	  if (err)
-	    keyblock_cache_clear (hd);
-	  if (DBG_CLOCK)
-	    log_clock ("%s leave (cached mode)", __func__);
-	  return err;
-	}
+        keyblock_cache_clear (hd);
+      if (DBG_CLOCK)
+        log_clock ("%s leave (cached mode)", __func__);
+      return err;
     }
 
   if (hd->found < 0 || hd->found >= hd->used)
@@ -1386,7 +1415,9 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
                                    &iobuf, &pk_no, &uid_no);
         if (!err)
           {
-            err = keydb_parse_keyblock (iobuf, pk_no, uid_no, ret_kb);
+            err = keydb_parse_keyblock_buffer (iobuf_get_temp_buffer (iobuf),
+                                               iobuf_get_temp_length (iobuf),
+                                               pk_no, uid_no, ret_kb);
             if (!err && hd->keyblock_cache.state == KEYBLOCK_CACHE_PREPARED)
               {
                 hd->keyblock_cache.state     = KEYBLOCK_CACHE_FILLED;
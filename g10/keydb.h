@@ -194,6 +194,9 @@ gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 /* Insert a keyblock into one of the storage system.  */
 gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 
+/* Store the keyblocks queued by keydb_insert_keyblock.  */
+gpg_error_t keydb_flush_store_queue (ctrl_t ctrl, unsigned int *r_nfailed);
+
 /* Delete the currently selected keyblock.  */
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
 
@@ -204,6 +207,16 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Look up a signature verification result in the keyboxd's cache.  */
+gpg_error_t keydb_get_sigcache (ctrl_t ctrl, const byte *ubid,
+                                const byte *sigid, PKT_public_key *signer,
+                                int *r_good);
+
+/* Queue a signature verification result for the keyboxd's cache.  */
+gpg_error_t keydb_put_sigcache (ctrl_t ctrl, const byte *ubid,
+                                const byte *sigid, PKT_public_key *signer,
+                                int good);
+
 
 
 /*-- keydb.c --*/
@@ -326,6 +339,9 @@ char *gpg_format_keydesc (ctrl_t ctrl,
 /* Cache a copy of a public key in the public key cache.  */
 void cache_public_key( PKT_public_key *pk );
 
+/* Dump the statistics of the public key cache.  */
+void getkey_dump_stats (void);
+
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
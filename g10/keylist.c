@@ -2581,6 +2581,11 @@ list_keyblock (ctrl_t ctrl,
         return 0;  /* Skip this one.  */
     }
 
+  /* With --check-sigs verify all signatures of the keyblock up front
+   * so that this can be done in parallel.  */
+  if (opt.check_sigs)
+    check_key_signatures_start (ctrl, keyblock, 0);
+
   if (opt.with_colons)
     list_keyblock_colon (ctrl, keyblock, secret, has_secret);
   else if ((opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
@@ -2592,6 +2597,9 @@ list_keyblock (ctrl_t ctrl,
   else
     list_keyblock_print (ctrl, keyblock, secret, fpr, listctx);
 
+  if (opt.check_sigs)
+    check_key_signatures_end (ctrl, keyblock);
+
   if (es_ferror (es_stdout))
     err = gpg_error_from_syserror ();
 
@@ -307,6 +307,12 @@ gpg_error_t check_signature_over_key_or_uid (ctrl_t ctrl,
                                              int *is_selfsig,
                                              PKT_public_key *ret_pk);
 
+/* Verify the signatures of KEYBLOCK in parallel so that the
+   following check_key_signature calls only pick up the results.  */
+void check_key_signatures_start (ctrl_t ctrl, kbnode_t keyblock,
+                                 int selfsigs_only);
+void check_key_signatures_end (ctrl_t ctrl, kbnode_t keyblock);
+
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (ctrl_t ctrl,
@@ -30,13 +30,21 @@
 #include "options.h"
 #include "objcache.h"
 
-/* Note that max value for uid_items is actually the threshold when
- * we start to look for items which can be removed.  */
-#define NO_OF_UID_ITEM_BUCKETS    107
-#define MAX_UID_ITEMS_PER_BUCKET  20
-
-#define NO_OF_KEY_ITEM_BUCKETS    383
-#define MAX_KEY_ITEMS_PER_BUCKET  20
+/* The initial number of buckets of the tables.  This must be a power
+ * of 2.  A table is doubled in size if the average length of its
+ * chains exceeds MAX_CHAIN_LENGTH.  The buckets of the old table are
+ * then moved to the new table while the cache is used so that there
+ * is no single expensive rehash; MIGRATE_STEP is the number of
+ * buckets moved with each put.  */
+#define INITIAL_UID_BUCKETS  128
+#define INITIAL_KEY_BUCKETS  512
+#define MAX_CHAIN_LENGTH     4
+#define MIGRATE_STEP         8
+
+/* The memory budget for both tables in bytes.  If it would be
+ * exceeded the tables are not grown anymore and items are dropped
+ * from the bucket a new item is put into.  */
+#define OBJCACHE_BUDGET  (32*1024*1024)
 
 
 /* An object to store a user id.  This describes an item in the linked
@@ -45,6 +53,7 @@
 typedef struct uid_item_s
 {
   struct uid_item_s *next;
+  unsigned int hash;      /* The hash value of the name.           */
   unsigned int refcount;  /* The reference count for this item.   */
   unsigned int namelen;   /* The length of the UID sans the nul.  */
   char name[1];
@@ -52,9 +61,15 @@ typedef struct uid_item_s
 
 static uid_item_t *uid_table; /* Hash table for with user ids.  */
 static size_t uid_table_size; /* Number of allocated buckets.   */
-static unsigned int uid_table_max;    /* Max. # of items in a bucket.  */
+static uid_item_t *uid_table_old;     /* Table being migrated or NULL. */
+static size_t uid_table_old_size;     /* Its number of buckets.        */
+static size_t uid_table_migrated;     /* # of migrated old buckets.    */
+static unsigned int uid_table_count;  /* # of items in the table.  */
 static unsigned int uid_table_added;  /* # of items added.   */
 static unsigned int uid_table_dropped;/* # of items dropped.  */
+static unsigned int uid_table_grown;  /* # of times the table grew.  */
+static unsigned long uid_table_hits;  /* # of puts finding an item.  */
+static size_t uid_table_bytes;        /* Memory used by the items.  */
 
 
 /* An object to store properties of a key.  Note that this can be used
@@ -72,13 +87,31 @@ typedef struct key_item_s
 
 static key_item_t *key_table; /* Hash table with the keys.      */
 static size_t key_table_size; /* Number of allocated buckents.  */
-static unsigned int key_table_max;    /* Max. # of items in a bucket.  */
+static key_item_t *key_table_old;     /* Table being migrated or NULL. */
+static size_t key_table_old_size;     /* Its number of buckets.        */
+static size_t key_table_migrated;     /* # of migrated old buckets.    */
+static unsigned int key_table_count;  /* # of items in the table.  */
 static unsigned int key_table_added;  /* # of items added.   */
 static unsigned int key_table_dropped;/* # of items dropped.  */
+static unsigned int key_table_grown;  /* # of times the table grew.  */
+static unsigned long key_table_hits;  /* # of lookups finding an item. */
+static unsigned long key_table_misses;/* # of lookups not finding one. */
 static key_item_t key_item_attic;     /* List of freed items.  */
 
 
 
+/* Return the number of bytes used by both tables.  Freed key items
+ * are not counted because they are reused.  */
+static size_t
+objcache_bytes (void)
+{
+  return (uid_table_bytes
+          + key_table_count * sizeof (struct key_item_s)
+          + (uid_table_size + uid_table_old_size) * sizeof (uid_item_t)
+          + (key_table_size + key_table_old_size) * sizeof (key_item_t));
+}
+
+
 /* Dump stats.  */
 void
 objcache_dump_stats (void)
@@ -110,13 +143,17 @@ objcache_dump_stats (void)
       else if (minlen == -1 || len < minlen)
         minlen = len;
     }
+  for (idx = 0; idx < key_table_old_size; idx++)
+    for (ki = key_table_old[idx]; ki; ki = ki->next)
+      count++;
   for (attic=0, ki = key_item_attic; ki; ki = ki->next)
     attic++;
-  log_info ("objcache: keys=%u/%u/%u chains=%u,%d..%d buckets=%zu/%u"
-            " attic=%u\n",
+  log_info ("objcache: keys=%u/%u/%u hits=%lu/%lu chains=%u,%d..%d"
+            " buckets=%zu/%zu grown=%u attic=%u\n",
             count, key_table_added, key_table_dropped,
+            key_table_hits, key_table_misses,
             empty, minlen > 0? minlen : 0, maxlen,
-            key_table_size, key_table_max, attic);
+            key_table_size, key_table_old_size, key_table_grown, attic);
 
   count = empty = 0;
   minlen = -1;
@@ -139,10 +176,17 @@ objcache_dump_stats (void)
       else if (minlen == -1 || len < minlen)
         minlen = len;
     }
-  log_info ("objcache: uids=%u/%u/%u chains=%u,%d..%d buckets=%zu/%u\n",
-            count, uid_table_added, uid_table_dropped,
+  for (idx = 0; idx < uid_table_old_size; idx++)
+    for (ui = uid_table_old[idx]; ui; ui = ui->next)
+      count++;
+  log_info ("objcache: uids=%u/%u/%u hits=%lu chains=%u,%d..%d"
+            " buckets=%zu/%zu grown=%u bytes=%zu\n",
+            count, uid_table_added, uid_table_dropped, uid_table_hits,
             empty, minlen > 0? minlen : 0, maxlen,
-            uid_table_size, uid_table_max);
+            uid_table_size, uid_table_old_size, uid_table_grown,
+            uid_table_bytes);
+  log_info ("objcache: bytes=%zu/%u\n",
+            objcache_bytes (), (unsigned int)OBJCACHE_BUDGET);
 }
 
 
@@ -166,23 +210,102 @@ uid_table_hasher (const char *name, unsigned namelen)
         }
     }
 
-  return hashval % uid_table_size;
+  return hashval;
 }
 
 
-/* Run time allocation of the uid table.  This allows us to eventually
- * add an option to gpg to control the size.  */
+/* Run time allocation of the uid table.  */
 static void
 uid_table_init (void)
 {
   if (uid_table)
     return;
-  uid_table_size = NO_OF_UID_ITEM_BUCKETS;
-  uid_table_max = MAX_UID_ITEMS_PER_BUCKET;
+  uid_table_size = INITIAL_UID_BUCKETS;
   uid_table = xcalloc (uid_table_size, sizeof *uid_table);
 }
 
 
+/* Move the items of the bucket IDX of the old uid table to the
+ * current table.  Must not call a system function.  */
+static void
+uid_table_migrate_bucket (size_t idx)
+{
+  uid_item_t ui, ui_next, *bucket;
+
+  for (ui = uid_table_old[idx]; ui; ui = ui_next)
+    {
+      ui_next = ui->next;
+      bucket = uid_table + (ui->hash & (uid_table_size - 1));
+      ui->next = *bucket;
+      *bucket = ui;
+    }
+  uid_table_old[idx] = NULL;
+}
+
+
+/* Migrate a few buckets of the old uid table and release it after
+ * the last bucket has been migrated.  */
+static void
+uid_table_migrate (void)
+{
+  uid_item_t *old;
+  unsigned int n;
+
+  if (!uid_table_old)
+    return;
+
+  for (n=0; n < MIGRATE_STEP && uid_table_migrated < uid_table_old_size; n++)
+    uid_table_migrate_bucket (uid_table_migrated++);
+  if (uid_table_migrated == uid_table_old_size)
+    {
+      old = uid_table_old;
+      uid_table_old = NULL;
+      uid_table_old_size = 0;
+      xfree (old);
+    }
+}
+
+
+/* Return the bucket of the uid table for HASH.  If the table is being
+ * migrated the corresponding old bucket is migrated first.  */
+static uid_item_t *
+uid_table_bucket (unsigned int hash)
+{
+  if (uid_table_old)
+    uid_table_migrate_bucket (hash & (uid_table_old_size - 1));
+  return uid_table + (hash & (uid_table_size - 1));
+}
+
+
+/* Double the size of the uid table if the chains get too long and the
+ * memory budget allows for it.  */
+static void
+uid_table_maybe_grow (void)
+{
+  uid_item_t *table;
+  size_t newsize;
+
+  if (uid_table_old || uid_table_count < uid_table_size * MAX_CHAIN_LENGTH)
+    return;
+
+  newsize = 2 * uid_table_size;
+  if (objcache_bytes () + newsize * sizeof *table > OBJCACHE_BUDGET)
+    return;
+  table = xtrycalloc (newsize, sizeof *table);
+  if (!table)
+    return;  /* That is not a problem; we keep the current table.  */
+
+  /* No syscalls from here .. */
+  uid_table_old = uid_table;
+  uid_table_old_size = uid_table_size;
+  uid_table_migrated = 0;
+  uid_table = table;
+  uid_table_size = newsize;
+  /* ... to here */
+  uid_table_grown++;
+}
+
+
 static uid_item_t
 uid_item_ref (uid_item_t ui)
 {
@@ -215,24 +338,29 @@ static uid_item_t
 uid_table_put (const char *name, unsigned int namelen)
 {
   unsigned int hash;
-  uid_item_t ui;
+  uid_item_t ui, *bucket;
   unsigned int count;
 
   if (!uid_table)
     uid_table_init ();
+  uid_table_migrate ();
 
   hash = uid_table_hasher (name, namelen);
-  for (ui = uid_table[hash], count = 0; ui; ui = ui->next, count++)
+  bucket = uid_table_bucket (hash);
+  for (ui = *bucket; ui; ui = ui->next)
     if (ui->namelen == namelen && !memcmp (ui->name, name, namelen))
-      return uid_item_ref (ui);  /* Found.  */
+      {
+        uid_table_hits++;
+        return uid_item_ref (ui);  /* Found.  */
+      }
 
-  /* If the bucket is full remove all unrefed items.  */
-  if (count >= uid_table_max)
+  /* If we are over budget remove all unrefed items of the bucket.  */
+  if (objcache_bytes () + sizeof *ui + namelen > OBJCACHE_BUDGET)
     {
       uid_item_t ui_next, ui_prev, list_head, drop_head;
 
       /* No syscalls from here .. */
-      list_head = uid_table[hash];
+      list_head = *bucket;
       drop_head = NULL;
       while (list_head && !list_head->refcount)
         {
@@ -254,12 +382,14 @@ uid_table_put (const char *name, unsigned int namelen)
             else
               ui_prev = ui;
           }
-      uid_table[hash] = list_head;
+      *bucket = list_head;
       /* ... to here */
 
       for (ui = drop_head; ui; ui = ui_next)
         {
           ui_next = ui->next;
+          uid_table_count--;
+          uid_table_bytes -= sizeof *ui + ui->namelen;
           xfree (ui);
           uid_table_dropped++;
         }
@@ -269,12 +399,13 @@ uid_table_put (const char *name, unsigned int namelen)
   ui = xtrycalloc (1, sizeof *ui + namelen);
   if (!ui)
     return NULL;  /* Out of core.  */
+  bucket = uid_table_bucket (hash);
   if (count != uid_table_added + uid_table_dropped)
     {
       /* During the malloc another thread added an item.  Thus we need
        * to check again.  */
       uid_item_t ui_new = ui;
-      for (ui = uid_table[hash]; ui; ui = ui->next)
+      for (ui = *bucket; ui; ui = ui->next)
         if (ui->namelen == namelen && !memcmp (ui->name, name, namelen))
           {
             /* Found.  */
@@ -287,10 +418,15 @@ uid_table_put (const char *name, unsigned int namelen)
   memcpy (ui->name, name, namelen);
   ui->name[namelen] = 0; /* Extra Nul so we can use it as a string.  */
   ui->namelen = namelen;
+  ui->hash = hash;
   ui->refcount = 1;
-  ui->next = uid_table[hash];
-  uid_table[hash] = ui;
+  ui->next = *bucket;
+  *bucket = ui;
+  uid_table_count++;
+  uid_table_bytes += sizeof *ui + namelen;
   uid_table_added++;
+
+  uid_table_maybe_grow ();
   return ui;
 }
 
@@ -306,23 +442,103 @@ key_table_hasher (u32 *keyid)
    * older signatures to identify a key.  Since v4 keys the keyid is
    * anyway a part of the fingerprint so it quickly extracted from a
    * fingerprint.  Note that v3 keys are not supported by gpg.  */
-  return keyid[0] % key_table_size;
+  return keyid[0];
 }
 
 
-/* Run time allocation of the key table.  This allows us to eventually
- * add an option to gpg to control the size.  */
+/* Run time allocation of the key table.  */
 static void
 key_table_init (void)
 {
   if (key_table)
     return;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_max  = MAX_KEY_ITEMS_PER_BUCKET;
+  key_table_size = INITIAL_KEY_BUCKETS;
   key_table = xcalloc (key_table_size, sizeof *key_table);
 }
 
 
+/* Move the items of the bucket IDX of the old key table to the
+ * current table.  Must not call a system function.  */
+static void
+key_table_migrate_bucket (size_t idx)
+{
+  key_item_t ki, ki_next, *bucket;
+
+  for (ki = key_table_old[idx]; ki; ki = ki_next)
+    {
+      ki_next = ki->next;
+      bucket = key_table + (key_table_hasher (ki->keyid)
+                            & (key_table_size - 1));
+      ki->next = *bucket;
+      *bucket = ki;
+    }
+  key_table_old[idx] = NULL;
+}
+
+
+/* Migrate a few buckets of the old key table and release it after
+ * the last bucket has been migrated.  */
+static void
+key_table_migrate (void)
+{
+  key_item_t *old;
+  unsigned int n;
+
+  if (!key_table_old)
+    return;
+
+  for (n=0; n < MIGRATE_STEP && key_table_migrated < key_table_old_size; n++)
+    key_table_migrate_bucket (key_table_migrated++);
+  if (key_table_migrated == key_table_old_size)
+    {
+      old = key_table_old;
+      key_table_old = NULL;
+      key_table_old_size = 0;
+      xfree (old);
+    }
+}
+
+
+/* Return the bucket of the key table for HASH.  If the table is being
+ * migrated the corresponding old bucket is migrated first.  */
+static key_item_t *
+key_table_bucket (unsigned int hash)
+{
+  if (key_table_old)
+    key_table_migrate_bucket (hash & (key_table_old_size - 1));
+  return key_table + (hash & (key_table_size - 1));
+}
+
+
+/* Double the size of the key table if the chains get too long and the
+ * memory budget allows for it.  */
+static void
+key_table_maybe_grow (void)
+{
+  key_item_t *table;
+  size_t newsize;
+
+  if (key_table_old || key_table_count < key_table_size * MAX_CHAIN_LENGTH)
+    return;
+
+  newsize = 2 * key_table_size;
+  if (objcache_bytes () + newsize * sizeof *table > OBJCACHE_BUDGET)
+    return;
+  table = xtrycalloc (newsize, sizeof *table);
+  if (!table)
+    return;  /* That is not a problem; we keep the current table.  */
+
+  /* No syscalls from here .. */
+  key_table_old = key_table;
+  key_table_old_size = key_table_size;
+  key_table_migrated = 0;
+  key_table = table;
+  key_table_size = newsize;
+  /* ... to here */
+  key_table_grown++;
+}
+
+
 static void
 key_item_free (key_item_t ki)
 {
@@ -332,6 +548,7 @@ key_item_free (key_item_t ki)
   ki->ui = NULL;
   ki->next = key_item_attic;
   key_item_attic = ki;
+  key_table_count--;
 }
 
 
@@ -341,7 +558,6 @@ key_item_free (key_item_t ki)
 static key_item_t
 key_table_get (PKT_public_key *pk, u32 *keyid)
 {
-  unsigned int hash;
   key_item_t ki, ki2;
 
   if (!key_table)
@@ -355,15 +571,15 @@ key_table_get (PKT_public_key *pk, u32 *keyid)
 
       fingerprint_from_pk (pk, fpr, &fprlen);
       keyid_from_pk (pk, tmpkeyid);
-      hash = key_table_hasher (tmpkeyid);
-      for (ki = key_table[hash]; ki; ki = ki->next)
+      for (ki = *key_table_bucket (key_table_hasher (tmpkeyid));
+           ki; ki = ki->next)
         if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
           return ki; /* Found */
     }
   else if (keyid)
     {
-      hash = key_table_hasher (keyid);
-      for (ki = key_table[hash]; ki; ki = ki->next)
+      for (ki = *key_table_bucket (key_table_hasher (keyid));
+           ki; ki = ki->next)
         if (ki->keyid[0] == keyid[0] && ki->keyid[1] == keyid[1])
           {
             /* Found.  We need to check for dups.  */
@@ -403,7 +619,7 @@ static key_item_t
 key_table_put (PKT_public_key *pk, uid_item_t ui)
 {
   unsigned int hash;
-  key_item_t ki;
+  key_item_t ki, *bucket;
   u32 keyid[2];
   byte fpr[MAX_FINGERPRINT_LEN];
   size_t fprlen;
@@ -411,16 +627,18 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
 
   if (!key_table)
     key_table_init ();
+  key_table_migrate ();
 
   fingerprint_from_pk (pk, fpr, &fprlen);
   keyid_from_pk (pk, keyid);
   hash = key_table_hasher (keyid);
-  for (ki = key_table[hash], count=0; ki; ki = ki->next, count++)
+  bucket = key_table_bucket (hash);
+  for (ki = *bucket, count=0; ki; ki = ki->next, count++)
     if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
       return ki;  /* Found  */
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= key_table_max)
+  /* If we are over budget remove a couple of items of the bucket. */
+  if (count && objcache_bytes () + sizeof *ki > OBJCACHE_BUDGET)
     {
       key_item_t list_head, *list_tailp, ki_next;
       key_item_t *array;
@@ -430,8 +648,8 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
        * disturb us.  If another thread adds or removes something only
        * one will be the winner.  Bad luck for the drooped cache items
        * but after all it is just a cache.  */
-      list_head = key_table[hash];
-      key_table[hash] = NULL;
+      list_head = *bucket;
+      *bucket = NULL;
 
       /* Put all items into an array for sorting.  */
       array = xtrycalloc (count, sizeof *array);
@@ -462,8 +680,9 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
         }
 
       /* Put the new list into the bucket.  */
-      ki = key_table[hash];
-      key_table[hash] = list_head;
+      bucket = key_table_bucket (hash);
+      ki = *bucket;
+      *bucket = list_head;
       list_head = ki;
 
       /* Free the remaining items and the array.  */
@@ -504,7 +723,8 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
 
       /* During the malloc another thread may have changed the bucket.
        * Thus we need to check again.  */
-      for (ki = key_table[hash]; ki; ki = ki->next)
+      bucket = key_table_bucket (hash);
+      for (ki = *bucket; ki; ki = ki->next)
         if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
           return ki;  /* Found  */
     }
@@ -520,9 +740,12 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
   ki->keyid[1] = keyid[1];
   ki->ui = uid_item_ref (ui);
   ki->usecount = 0;
-  ki->next = key_table[hash];
-  key_table[hash] = ki;
+  ki->next = *bucket;
+  *bucket = ki;
+  key_table_count++;
   key_table_added++;
+
+  key_table_maybe_grow ();
   return ki;
 }
 
@@ -622,7 +845,11 @@ cache_get_uid_bykid (u32 *keyid, unsigned int *r_length)
 
   ki = key_table_get (NULL, keyid);
   if (!ki)
-    return NULL; /* Not found or duplicate keyid.  */
+    {
+      key_table_misses++;
+      return NULL; /* Not found or duplicate keyid.  */
+    }
+  key_table_hits++;
 
   if (!ki->ui)
     p = NULL;  /* No user id known for key.  */
@@ -652,7 +879,6 @@ char *
 cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
 {
   char *p;
-  unsigned int hash;
   u32 keyid[2];
   key_item_t ki;
 
@@ -663,13 +889,16 @@ cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
     return NULL;
 
   keyid_from_fingerprint (NULL, fpr, fprlen, keyid);
-  hash = key_table_hasher (keyid);
-  for (ki = key_table[hash]; ki; ki = ki->next)
+  for (ki = *key_table_bucket (key_table_hasher (keyid)); ki; ki = ki->next)
     if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
       break; /* Found */
 
   if (!ki)
-    return NULL; /* Not found.  */
+    {
+      key_table_misses++;
+      return NULL; /* Not found.  */
+    }
+  key_table_hits++;
 
   if (!ki->ui)
     p = NULL;  /* No user id known for key.  */
@@ -244,6 +244,7 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  unsigned int pubkey_cache_size; /* Max. # of cached keys; 0 = default. */
   int no_auto_check_trustdb;
   int preserve_permissions;
   int no_homedir_creation;
@@ -308,6 +308,11 @@ typedef struct
   byte digest_start[2];
   /* The signature.  (Serialized.)  */
   gcry_mpi_t  data[PUBKEY_MAX_NSIG];
+  /* If not NULL, DATA has not yet been parsed and this holds the
+     RAWDATALEN bytes with the serialized MPIs instead.  Call
+     materialize_sig_data before accessing DATA.  */
+  byte *rawdata;
+  size_t rawdatalen;
   /* The message digest and its length (in bytes).  Note the maximum
      digest length is 512 bits (64 bytes).  If DIGEST_LEN is 0, then
      the digest's value has not been saved here.  */
@@ -729,6 +734,9 @@ struct parse_packet_ctx_s
   int only_fookey_enc;  /* Stop if the packet is not {sym,pub}key_enc. */
   unsigned int n_parsed_packets;	/* Number of parsed packets.  */
   int last_ctb;      /* The last CTB read.  */
+  const byte *buffer;  /* The packets for parse_packet_buffer.  */
+  size_t buflen;       /* The length of BUFFER.  */
+  size_t bufoff;       /* The offset of the next packet in BUFFER.  */
 };
 typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
 
@@ -741,6 +749,18 @@ typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
     (a)->only_fookey_enc = 0;       \
     (a)->n_parsed_packets = 0;      \
     (a)->last_ctb = 1;              \
+    (a)->buffer = NULL;             \
+    (a)->buflen = 0;                \
+    (a)->bufoff = 0;                \
+  } while (0)
+
+/* Setup a context to parse the LENGTH bytes at BUFFER with
+   parse_packet_buffer.  BUFFER must be valid until the context is
+   not anymore used.  */
+#define init_parse_packet_buffer(a,b,n) do { \
+    init_parse_packet ((a), NULL);           \
+    (a)->buffer = (b);                       \
+    (a)->buflen = (n);                       \
   } while (0)
 
 #define deinit_parse_packet(a) do { \
@@ -823,6 +843,17 @@ int copy_some_packets (iobuf_t inp, iobuf_t out, off_t stopoff);
 int skip_some_packets (iobuf_t inp, unsigned int n);
 #endif
 
+/* Like parse_packet but parse the packets from the buffer setup with
+ * init_parse_packet_buffer.  The MPIs of signatures are only parsed
+ * when needed; see materialize_sig_data.  This is much faster for
+ * large keyblocks and the preferred function if the keyblock is
+ * already in memory.  */
+int parse_packet_buffer (parse_packet_ctx_t ctx, PACKET *pkt);
+
+/* Parse the raw MPIs of SIG into SIG->DATA.  This is a no-op if they
+ * have already been parsed.  */
+gpg_error_t materialize_sig_data (PKT_signature *sig);
+
 /* Parse a signature packet and store it in *SIG.
 
    The signature packet is read from INP.  The OpenPGP header (the tag
@@ -2226,6 +2226,149 @@ parse_revkeys (PKT_signature * sig)
 }
 
 
+/* Extract the information from the subpackets of the v4 or v5
+ * signature SIG and store it in SIG.  */
+static gpg_error_t
+parse_signature_subpkts (PKT_signature *sig)
+{
+  const byte *p;
+  size_t len;
+
+  /* Set sig->flags.unknown_critical if there is a critical bit
+   * set for packets which we do not understand.  */
+  if (!parse_sig_subpkt (sig, 1, SIGSUBPKT_TEST_CRITICAL, NULL)
+      || !parse_sig_subpkt (sig, 0, SIGSUBPKT_TEST_CRITICAL, NULL))
+    sig->flags.unknown_critical = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_CREATED, NULL);
+  if (p)
+    sig->timestamp = buf32_to_u32 (p);
+  else if (!(sig->pubkey_algo >= 100 && sig->pubkey_algo <= 110)
+	   && opt.verbose > 1 && !glo_ctrl.silence_parse_warnings)
+    log_info ("signature packet without timestamp\n");
+
+  /* Set the key id.  We first try the issuer fingerprint and if
+   * it is a v4 signature the fallback to the issuer.  Note that
+   * only the issuer packet is also searched in the unhashed area.  */
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_ISSUER_FPR, &len);
+  if (p && len == 21 && p[0] == 4)
+    {
+      sig->keyid[0] = buf32_to_u32 (p + 1 + 12);
+      sig->keyid[1] = buf32_to_u32 (p + 1 + 16);
+    }
+  else if (p && len == 33 && p[0] == 5)
+    {
+      sig->keyid[0] = buf32_to_u32 (p + 1 );
+      sig->keyid[1] = buf32_to_u32 (p + 1 + 4);
+    }
+  else if ((p = parse_sig_subpkt2 (sig, SIGSUBPKT_ISSUER)))
+    {
+      sig->keyid[0] = buf32_to_u32 (p);
+      sig->keyid[1] = buf32_to_u32 (p + 4);
+    }
+  else if (!(sig->pubkey_algo >= 100 && sig->pubkey_algo <= 110)
+	   && opt.verbose > 1 && !glo_ctrl.silence_parse_warnings)
+    log_info ("signature packet without keyid\n");
+
+  /* Get the intended recipient (revocation subject) fpr. */
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_INT_RCP_FPR, &len);
+  if (p && len == 21 && p[0] == 4)
+    {
+      sig->rev_subject_info = xmalloc_clear (sizeof *sig->rev_subject_info);
+
+      sig->rev_subject_info->fprlen = 20;
+      memcpy (sig->rev_subject_info->fpr, p + 1, 20);
+    }
+  else if (p && len == 33 && p[0] == 5)
+    {
+      sig->rev_subject_info = xmalloc_clear (sizeof *sig->rev_subject_info);
+
+      sig->rev_subject_info->fprlen = 32;
+      memcpy (sig->rev_subject_info->fpr, p + 1, 32);
+    }
+  else
+    {
+     sig->rev_subject_info = NULL;
+    }
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_EXPIRE, NULL);
+  if (p && buf32_to_u32 (p))
+    sig->expiredate = sig->timestamp + buf32_to_u32 (p);
+  if (sig->expiredate && sig->expiredate <= make_timestamp ())
+    sig->flags.expired = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_POLICY, NULL);
+  if (p)
+    sig->flags.policy_url = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_PREF_KS, NULL);
+  if (p)
+    sig->flags.pref_ks = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIGNERS_UID, &len);
+  if (p && len)
+    {
+      char *mbox;
+
+      sig->signers_uid = try_make_printable_string (p, len, 0);
+      if (!sig->signers_uid)
+	{
+	  return gpg_error_from_syserror ();
+	}
+      mbox = mailbox_from_userid (sig->signers_uid, 0);
+      if (mbox)
+	{
+	  xfree (sig->signers_uid);
+	  sig->signers_uid = mbox;
+	}
+    }
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_KEY_BLOCK, NULL);
+  if (p)
+    sig->flags.key_block = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_NOTATION, NULL);
+  if (p)
+    sig->flags.notation = 1;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_REVOCABLE, NULL);
+  if (p && *p == 0)
+    sig->flags.revocable = 0;
+
+  p = parse_sig_subpkt (sig, 1, SIGSUBPKT_TRUST, &len);
+  if (p && len == 2)
+    {
+      sig->trust_depth = p[0];
+      sig->trust_value = p[1];
+
+      /* Only look for a regexp if there is also a trust
+	 subpacket. */
+      sig->trust_regexp =
+	parse_sig_subpkt (sig, 1, SIGSUBPKT_REGEXP, &len);
+
+      /* If the regular expression is of 0 length, there is no
+	 regular expression. */
+      if (len == 0)
+	sig->trust_regexp = NULL;
+    }
+
+  /* We accept the exportable subpacket from either the hashed or
+     unhashed areas as older versions of gpg put it in the
+     unhashed area.  In theory, anyway, we should never see this
+     packet off of a local keyring. */
+
+  p = parse_sig_subpkt2 (sig, SIGSUBPKT_EXPORTABLE);
+  if (p && *p == 0)
+    sig->flags.exportable = 0;
+
+  /* Find all revocation keys.  */
+  if (sig->sig_class == 0x1F)
+    parse_revkeys (sig);
+
+  return 0;
+}
+
+
 /* Note that the function returns -1 to indicate an EOF (which also
  * indicates a broken packet in this case.  In most other cases
  * GPG_ERR_INV_PACKET is returned and callers of parse_packet will
@@ -2367,140 +2510,9 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 
   if (is_v4or5 && sig->pubkey_algo)  /* Extract required information.  */
     {
-      const byte *p;
-      size_t len;
-
-      /* Set sig->flags.unknown_critical if there is a critical bit
-       * set for packets which we do not understand.  */
-      if (!parse_sig_subpkt (sig, 1, SIGSUBPKT_TEST_CRITICAL, NULL)
-	  || !parse_sig_subpkt (sig, 0, SIGSUBPKT_TEST_CRITICAL, NULL))
-	sig->flags.unknown_critical = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_CREATED, NULL);
-      if (p)
-	sig->timestamp = buf32_to_u32 (p);
-      else if (!(sig->pubkey_algo >= 100 && sig->pubkey_algo <= 110)
-	       && opt.verbose > 1 && !glo_ctrl.silence_parse_warnings)
-        log_info ("signature packet without timestamp\n");
-
-      /* Set the key id.  We first try the issuer fingerprint and if
-       * it is a v4 signature the fallback to the issuer.  Note that
-       * only the issuer packet is also searched in the unhashed area.  */
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_ISSUER_FPR, &len);
-      if (p && len == 21 && p[0] == 4)
-        {
-          sig->keyid[0] = buf32_to_u32 (p + 1 + 12);
-	  sig->keyid[1] = buf32_to_u32 (p + 1 + 16);
-	}
-      else if (p && len == 33 && p[0] == 5)
-        {
-          sig->keyid[0] = buf32_to_u32 (p + 1 );
-	  sig->keyid[1] = buf32_to_u32 (p + 1 + 4);
-	}
-      else if ((p = parse_sig_subpkt2 (sig, SIGSUBPKT_ISSUER)))
-        {
-          sig->keyid[0] = buf32_to_u32 (p);
-	  sig->keyid[1] = buf32_to_u32 (p + 4);
-	}
-      else if (!(sig->pubkey_algo >= 100 && sig->pubkey_algo <= 110)
-	       && opt.verbose > 1 && !glo_ctrl.silence_parse_warnings)
-	log_info ("signature packet without keyid\n");
-
-      /* Get the intended recipient (revocation subject) fpr. */
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_INT_RCP_FPR, &len);
-      if (p && len == 21 && p[0] == 4)
-        {
-          sig->rev_subject_info = xmalloc_clear (sizeof *sig->rev_subject_info);
-
-          sig->rev_subject_info->fprlen = 20;
-          memcpy (sig->rev_subject_info->fpr, p + 1, 20);
-	}
-      else if (p && len == 33 && p[0] == 5)
-        {
-          sig->rev_subject_info = xmalloc_clear (sizeof *sig->rev_subject_info);
-
-          sig->rev_subject_info->fprlen = 32;
-          memcpy (sig->rev_subject_info->fpr, p + 1, 32);
-	}
-      else
-        {
-         sig->rev_subject_info = NULL;
-        }
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_EXPIRE, NULL);
-      if (p && buf32_to_u32 (p))
-	sig->expiredate = sig->timestamp + buf32_to_u32 (p);
-      if (sig->expiredate && sig->expiredate <= make_timestamp ())
-	sig->flags.expired = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_POLICY, NULL);
-      if (p)
-	sig->flags.policy_url = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_PREF_KS, NULL);
-      if (p)
-	sig->flags.pref_ks = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIGNERS_UID, &len);
-      if (p && len)
-        {
-          char *mbox;
-
-          sig->signers_uid = try_make_printable_string (p, len, 0);
-          if (!sig->signers_uid)
-            {
-              rc = gpg_error_from_syserror ();
-              goto leave;
-            }
-          mbox = mailbox_from_userid (sig->signers_uid, 0);
-          if (mbox)
-            {
-              xfree (sig->signers_uid);
-              sig->signers_uid = mbox;
-            }
-        }
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_KEY_BLOCK, NULL);
-      if (p)
-        sig->flags.key_block = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_NOTATION, NULL);
-      if (p)
-	sig->flags.notation = 1;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_REVOCABLE, NULL);
-      if (p && *p == 0)
-	sig->flags.revocable = 0;
-
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_TRUST, &len);
-      if (p && len == 2)
-	{
-	  sig->trust_depth = p[0];
-	  sig->trust_value = p[1];
-
-	  /* Only look for a regexp if there is also a trust
-	     subpacket. */
-	  sig->trust_regexp =
-	    parse_sig_subpkt (sig, 1, SIGSUBPKT_REGEXP, &len);
-
-	  /* If the regular expression is of 0 length, there is no
-	     regular expression. */
-	  if (len == 0)
-	    sig->trust_regexp = NULL;
-	}
-
-      /* We accept the exportable subpacket from either the hashed or
-         unhashed areas as older versions of gpg put it in the
-         unhashed area.  In theory, anyway, we should never see this
-         packet off of a local keyring. */
-
-      p = parse_sig_subpkt2 (sig, SIGSUBPKT_EXPORTABLE);
-      if (p && *p == 0)
-	sig->flags.exportable = 0;
-
-      /* Find all revocation keys.  */
-      if (sig->sig_class == 0x1F)
-	parse_revkeys (sig);
+      rc = parse_signature_subpkts (sig);
+      if (rc)
+        goto leave;
     }
 
   if (list_mode)
@@ -2581,6 +2593,354 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 }
 
 
+/* Parse the signature packet with the PKTLEN bytes at BUFFER and
+ * store it in SIG.  This is the same as parse_signature but the MPIs
+ * are only checked here and kept for materialize_sig_data.  */
+static gpg_error_t
+parse_signature_buffer (const byte *buffer, unsigned long pktlen,
+                        PKT_signature *sig)
+{
+  const byte *p = buffer;
+  const byte *endp = buffer + pktlen;
+  const byte *q;
+  gpg_error_t err;
+  unsigned int n, nbits;
+  int is_v4or5;
+  int i, ndata;
+
+  if (pktlen < 16)
+    goto underflow;
+  sig->version = *p++;
+  if (sig->version == 4 || sig->version == 5)
+    is_v4or5 = 1;
+  else if (sig->version == 2 || sig->version == 3)
+    is_v4or5 = 0;
+  else
+    {
+      log_error ("packet(%d) with unknown version %d\n",
+		 PKT_SIGNATURE, sig->version);
+      return gpg_error (GPG_ERR_INV_PACKET);
+    }
+
+  if (!is_v4or5)
+    {
+      /* Skip the length of the hashed material.  */
+      if (endp - p < 14)
+        goto underflow;
+      p++;
+      sig->sig_class = *p++;
+      sig->timestamp = buf32_to_u32 (p);
+      sig->keyid[0] = buf32_to_u32 (p + 4);
+      sig->keyid[1] = buf32_to_u32 (p + 8);
+      p += 12;
+    }
+  else
+    sig->sig_class = *p++;
+  if (endp - p < 2)
+    goto underflow;
+  sig->pubkey_algo = *p++;
+  sig->digest_algo = *p++;
+  sig->flags.exportable = 1;
+  sig->flags.revocable = 1;
+  if (is_v4or5) /* Copy the subpackets.  */
+    {
+      if (endp - p < 2)
+	goto underflow;
+      n = buf16_to_uint (p);
+      p += 2;
+      if (endp - p < n)
+	goto underflow;
+      if (n > 30000)
+	{
+	  log_error ("signature packet: hashed data too long (%u)\n", n);
+          return gpg_error (GPG_ERR_INV_PACKET);
+	}
+      if (n)
+	{
+	  sig->hashed = xmalloc (sizeof (*sig->hashed) + n - 1);
+	  sig->hashed->size = n;
+	  sig->hashed->len = n;
+          memcpy (sig->hashed->data, p, n);
+          p += n;
+	}
+      if (endp - p < 2)
+	goto underflow;
+      n = buf16_to_uint (p);
+      p += 2;
+      if (endp - p < n)
+	goto underflow;
+      if (n > 10000)
+	{
+	  log_error ("signature packet: unhashed data too long (%u)\n", n);
+          return gpg_error (GPG_ERR_INV_PACKET);
+	}
+      if (n)
+	{
+	  sig->unhashed = xmalloc (sizeof (*sig->unhashed) + n - 1);
+	  sig->unhashed->size = n;
+	  sig->unhashed->len = n;
+          memcpy (sig->unhashed->data, p, n);
+          p += n;
+	}
+    }
+
+  if (endp - p < 2)
+    goto underflow;
+  sig->digest_start[0] = *p++;
+  sig->digest_start[1] = *p++;
+
+  if (is_v4or5 && sig->pubkey_algo)  /* Extract required information.  */
+    {
+      err = parse_signature_subpkts (sig);
+      if (err)
+        return err;
+    }
+
+  ndata = pubkey_get_nsig (sig->pubkey_algo);
+  if (!ndata)
+    {
+      unknown_pubkey_warning (sig->pubkey_algo);
+
+      /* We store the plain material in data[0], so that we are able
+       * to write it back with build_packet().  */
+      n = endp - p;
+      if (n > (5 * MAX_EXTERN_MPI_BITS / 8))
+	{
+	  log_error ("signature packet: too much data\n");
+	  return gpg_error (GPG_ERR_INV_PACKET);
+	}
+      if (n)
+        sig->data[0] = gcry_mpi_set_opaque_copy (NULL, p, n * 8);
+      else
+        sig->data[0] = gcry_mpi_set_opaque (NULL, NULL, 0);
+      return 0;
+    }
+
+  /* Check that the MPIs are well-formed and keep them as they are.
+   * Trailing garbage is ignored as in parse_signature.  */
+  for (q = p, i = 0; i < ndata; i++)
+    {
+      if (endp - q < 2)
+        goto mpi_overflow;
+      nbits = buf16_to_uint (q);
+      q += 2;
+      if (nbits > MAX_EXTERN_MPI_BITS)
+        {
+          log_error ("mpi too large (%u bits)\n", nbits);
+          return gpg_error (GPG_ERR_INV_PACKET);
+        }
+      if (endp - q < (nbits + 7) / 8)
+        goto mpi_overflow;
+      q += (nbits + 7) / 8;
+    }
+  sig->rawdatalen = q - p;
+  sig->rawdata = xmalloc (sig->rawdatalen);
+  memcpy (sig->rawdata, p, sig->rawdatalen);
+  return 0;
+
+ mpi_overflow:
+  log_error ("mpi larger than indicated length (%u bits)\n",
+             (unsigned int)(8 * (endp - p)));
+  return gpg_error (GPG_ERR_INV_PACKET);
+
+ underflow:
+  log_error ("packet(%d) too short\n", PKT_SIGNATURE);
+  return gpg_error (GPG_ERR_INV_PACKET);
+}
+
+
+/* Parse the raw MPIs of SIG as stored by parse_signature_buffer into
+ * SIG->DATA.  This is a no-op if SIG has no raw MPIs.  */
+gpg_error_t
+materialize_sig_data (PKT_signature *sig)
+{
+  gpg_error_t err;
+  const byte *p;
+  unsigned int nbits, nbytes;
+  byte *buf;
+  int i, ndata;
+
+  if (!sig->rawdata)
+    return 0;
+
+  /* The lengths have already been checked by parse_signature_buffer.  */
+  p = sig->rawdata;
+  ndata = pubkey_get_nsig (sig->pubkey_algo);
+  for (i = 0; i < ndata; i++)
+    {
+      nbits = buf16_to_uint (p);
+      nbytes = (nbits + 7) / 8;
+      if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
+          || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
+        {
+          /* Same as sos_read.  */
+          buf = gcry_xmalloc (nbytes);
+          memcpy (buf, p + 2, nbytes);
+          sig->data[i] = gcry_mpi_set_opaque (NULL, buf, nbits);
+          gcry_mpi_set_flag (sig->data[i], GCRYMPI_FLAG_USER2);
+        }
+      else
+        {
+          err = gcry_mpi_scan (&sig->data[i], GCRYMPI_FMT_PGP,
+                               p, 2 + nbytes, NULL);
+          if (err)
+            {
+              for (; i >= 0; i--)
+                {
+                  gcry_mpi_release (sig->data[i]);
+                  sig->data[i] = NULL;
+                }
+              return err;
+            }
+        }
+      p += 2 + nbytes;
+    }
+
+  xfree (sig->rawdata);
+  sig->rawdata = NULL;
+  sig->rawdatalen = 0;
+  return 0;
+}
+
+
+/* Decode the header of the packet at BUFFER of LENGTH bytes.  On
+ * success store the packet type at R_PKTTYPE, the length of the
+ * header at R_HDRLEN and the length of the body at R_PKTLEN.  Packets
+ * with a partial or indeterminate length are not supported.  */
+static gpg_error_t
+parse_packet_header_buffer (const byte *buffer, size_t length,
+                            int *r_pkttype, size_t *r_hdrlen,
+                            unsigned long *r_pktlen)
+{
+  int ctb, c, lenbytes;
+  size_t hdrlen = 1;
+  unsigned long pktlen = 0;
+
+  ctb = buffer[0];
+  if (!(ctb & 0x80))
+    {
+      log_error ("[buffer]: invalid packet (ctb=%02x)\n", ctb);
+      return gpg_error (GPG_ERR_INV_PACKET);
+    }
+
+  if ((ctb & 0x40))
+    {
+      *r_pkttype = ctb & 0x3f;
+      if (length < 2)
+        goto too_short;
+      c = buffer[hdrlen++];
+      if (c < 192)
+        pktlen = c;
+      else if (c < 224)
+        {
+          if (length < 3)
+            goto too_short;
+          pktlen = (c - 192) * 256 + buffer[hdrlen++] + 192;
+        }
+      else if (c == 255)
+        {
+          if (length < 6)
+            goto too_short;
+          pktlen = buf32_to_ulong (buffer + hdrlen);
+          hdrlen += 4;
+        }
+      else
+        {
+          log_error ("[buffer]: partial length invalid for"
+                     " packet type %d\n", *r_pkttype);
+          return gpg_error (GPG_ERR_INV_PACKET);
+        }
+    }
+  else
+    {
+      *r_pkttype = (ctb >> 2) & 0xf;
+      lenbytes = ((ctb & 3) == 3) ? 0 : (1 << (ctb & 3));
+      if (!lenbytes)
+        {
+          log_error ("[buffer]: indeterminate length for"
+                     " packet type %d\n", *r_pkttype);
+          return gpg_error (GPG_ERR_INV_PACKET);
+        }
+      if (length < 1 + lenbytes)
+        goto too_short;
+      for (; lenbytes; lenbytes--)
+        pktlen = (pktlen << 8) | buffer[hdrlen++];
+    }
+
+  if (pktlen > length - hdrlen)
+    goto too_short;
+
+  *r_hdrlen = hdrlen;
+  *r_pktlen = pktlen;
+  return 0;
+
+ too_short:
+  log_error ("[buffer]: packet(%d) extends beyond the buffer\n", *r_pkttype);
+  return gpg_error (GPG_ERR_INV_PACKET);
+}
+
+
+/* Return the next packet from the buffer setup with
+ * init_parse_packet_buffer in *PKT.  Signatures are parsed directly
+ * from the buffer; for all other packets the regular parser is used.
+ * The return semantics are the same as parse_packet.  */
+int
+parse_packet_buffer (parse_packet_ctx_t ctx, PACKET *pkt)
+{
+  const byte *buffer;
+  size_t length, hdrlen;
+  unsigned long pktlen;
+  int pkttype;
+  int rc;
+
+  for (;;)
+    {
+      if (ctx->bufoff >= ctx->buflen)
+        return -1;
+      buffer = ctx->buffer + ctx->bufoff;
+      length = ctx->buflen - ctx->bufoff;
+
+      rc = parse_packet_header_buffer (buffer, length,
+                                       &pkttype, &hdrlen, &pktlen);
+      if (rc)
+        {
+          /* We can't find the next packet.  */
+          ctx->bufoff = ctx->buflen;
+          return rc;
+        }
+      ctx->bufoff += hdrlen + pktlen;
+
+      if (pkttype == PKT_SIGNATURE && !list_mode && !ctx->only_fookey_enc)
+        {
+          if (DBG_PACKET)
+            log_debug ("parse_packet(buffer): type=%d length=%lu\n",
+                       pkttype, pktlen);
+          ctx->last_ctb = buffer[0];
+          ctx->n_parsed_packets++;
+          pkt->pkttype = pkttype;
+          pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
+          rc = parse_signature_buffer (buffer + hdrlen, pktlen,
+                                       pkt->pkt.signature);
+          /* Store a shallow copy in the context as parse does.  */
+          free_packet (NULL, ctx);
+          if (!rc)
+            ctx->last_pkt = *pkt;
+          return rc;
+        }
+
+      /* Use the regular parser for this packet.  */
+      ctx->inp = iobuf_temp_with_content ((const char *)buffer,
+                                          hdrlen + pktlen);
+      rc = parse_packet (ctx, pkt);
+      iobuf_close (ctx->inp);
+      ctx->inp = NULL;
+      if (rc != -1)
+        return rc;
+      /* The packet has been skipped (e.g. a ring trust packet).  */
+    }
+}
+
+
 static int
 parse_onepass_sig (IOBUF inp, int pkttype, unsigned long pktlen,
 		   PKT_onepass_sig * ops)
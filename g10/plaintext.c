@@ -648,16 +648,17 @@ do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
   else
     {
       size_t temp_size = iobuf_set_buffer_size(0) * 1024;
-      byte *buffer = xmalloc (temp_size);
-      int ret;
+      const void *buffer;
+      size_t n;
 
-      while ((ret = iobuf_read (fp, buffer, temp_size)) != -1)
+      /* Hash the data in place; for large files this is directly
+       * taken from the memory mapped file.  */
+      iobuf_ioctl (fp, IOBUF_IOCTL_MMAP, 0, NULL);
+      while ((buffer = iobuf_read_ptr (fp, temp_size, &n)))
 	{
 	  if (md)
-	    gcry_md_write (md, buffer, ret);
+	    gcry_md_write (md, buffer, n);
 	}
-
-      xfree (buffer);
     }
 }
 
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -34,6 +35,8 @@
 #include "options.h"
 #include "pkglue.h"
 #include "../common/compliance.h"
+#include "../common/host2net.h"
+#include "workpool.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 				gcry_md_hd_t digest,
@@ -41,10 +44,14 @@ static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 				int *r_expired, int *r_revoked,
 				PKT_public_key *ret_pk);
 
-static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+static int check_signature_end_simple (ctrl_t ctrl,
+                                       PKT_public_key *pk, PKT_signature *sig,
                                        gcry_md_hd_t digest,
                                        const void *extrahash,
-                                       size_t extrahashlen);
+                                       size_t extrahashlen,
+                                       const byte *ubid);
+static gpg_error_t sig_batch_get_result (struct sig_batch_s *batch,
+                                         const byte *sigid, int *r_rc);
 
 
 /* Statistics for signature verification.  */
@@ -54,6 +61,9 @@ struct
   unsigned int cached; /* Number of seen cache entries.  */
   unsigned int goodsig;/* Number of good verifications from the cache.  */
   unsigned int badsig; /* Number of bad verifications from the cache.  */
+  unsigned int kbxd_lookups; /* Lookups in the keyboxd's cache.  */
+  unsigned int kbxd_hits;    /* Results found in the keyboxd's cache.  */
+  unsigned int batched;      /* Results taken from a batch verification.  */
 } cache_stats;
 
 
@@ -61,9 +71,12 @@ struct
 void
 sig_check_dump_stats (void)
 {
-  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u\n",
+  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u kbxd=%u/%u"
+            " batched=%u\n",
             cache_stats.total, cache_stats.cached,
-            cache_stats.goodsig, cache_stats.badsig);
+            cache_stats.goodsig, cache_stats.badsig,
+            cache_stats.kbxd_hits, cache_stats.kbxd_lookups,
+            cache_stats.batched);
 }
 
 
@@ -477,8 +490,8 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
                                                r_expired, r_revoked)))
     return rc;
 
-  if ((rc = check_signature_end_simple (pk, sig, digest,
-                                        extrahash, extrahashlen)))
+  if ((rc = check_signature_end_simple (NULL, pk, sig, digest,
+                                        extrahash, extrahashlen, NULL)))
     return rc;
 
   if (!rc && ret_pk)
@@ -488,54 +501,104 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-/* This function is similar to check_signature_end, but it only checks
- * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
-static int
-check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
-                            gcry_md_hd_t digest,
-                            const void *extrahash, size_t extrahashlen)
+/* Compute the identifier used for the signature cache of the keyboxd
+ * and store it at SIGID.  DIGEST is the finalized hash context of
+ * the signature SIG and PK is the signer's key.  The identifier
+ * covers all inputs of the public key verification so that a cached
+ * result can't be used for a different key with the same
+ * fingerprint.  */
+static gpg_error_t
+compute_sigid (PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
+               byte *sigid)
 {
-  gcry_mpi_t result = NULL;
-  int rc = 0;
-
-  if (!opt.flags.allow_weak_digest_algos)
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  const byte *dp;
+  unsigned char *buf;
+  unsigned int nbits;
+  size_t n;
+  size_t rawoff = 0;
+  int i, nsig;
+  byte lenbuf[4];
+
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  if (!nsig)
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  dp = gcry_md_read (digest, sig->digest_algo);
+  if (!dp)
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    return err;
+
+  hash_public_key (md, pk);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, dp, gcry_md_get_algo_dlen (sig->digest_algo));
+  gcry_md_putc (md, sig->pubkey_algo);
+  for (i=0; i < nsig; i++)
     {
-      if (is_weak_digest (sig->digest_algo))
+      buf = NULL;
+      if (sig->rawdata)
         {
-          print_digest_rejected_note (sig->digest_algo);
-          return GPG_ERR_DIGEST_ALGO;
+          /* Not yet materialized: Hash the magnitude directly from
+           * the raw MPIs so that a cache hit won't parse them.  */
+          if (rawoff + 2 > sig->rawdatalen)
+            {
+              err = gpg_error (GPG_ERR_BAD_MPI);
+              goto leave;
+            }
+          n = (buf16_to_uint (sig->rawdata + rawoff) + 7) / 8;
+          dp = sig->rawdata + rawoff + 2;
+          rawoff += 2 + n;
+          if (rawoff > sig->rawdatalen)
+            {
+              err = gpg_error (GPG_ERR_BAD_MPI);
+              goto leave;
+            }
         }
+      else if (!sig->data[i])
+        {
+          err = gpg_error (GPG_ERR_BAD_MPI);
+          goto leave;
+        }
+      else if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          dp = gcry_mpi_get_opaque (sig->data[i], &nbits);
+          n = (nbits+7)/8;
+        }
+      else
+        {
+          err = gcry_mpi_aprint (GCRYMPI_FMT_USG, &buf, &n, sig->data[i]);
+          if (err)
+            goto leave;
+          dp = buf;
+        }
+      lenbuf[0] = n >> 24;
+      lenbuf[1] = n >> 16;
+      lenbuf[2] = n >>  8;
+      lenbuf[3] = n;
+      gcry_md_write (md, lenbuf, 4);
+      if (n)
+        gcry_md_write (md, dp, n);
+      gcry_free (buf);
     }
 
-  /* For key signatures check that the key has a cert usage.  We may
-   * do this only for subkeys because the primary may always issue key
-   * signature.  The latter may not be reflected in the pubkey_usage
-   * field because we need to check the key signatures to extract the
-   * key usage.  */
-  if (!pk->flags.primary
-      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
+  memcpy (sigid, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_SIGID_LEN);
 
-  /* For data signatures check that the key has sign usage.  */
-  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
-      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
+ leave:
+  gcry_md_close (md);
+  return err;
+}
 
+
+/* Hash the trailer of the signature SIG into DIGEST and finalize
+ * it.  EXTRAHASH and EXTRAHASHLEN are the data from the literal data
+ * packet for v5 data signatures.  */
+static void
+complete_sig_digest (PKT_signature *sig, gcry_md_hd_t digest,
+                     const void *extrahash, size_t extrahashlen)
+{
   /* Make sure the digest algo is enabled (in case of a detached
    * signature).  */
   gcry_md_enable (digest, sig->digest_algo);
@@ -616,21 +679,111 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
       buf[i++] = n;
       gcry_md_write (digest, buf, i);
     }
-    gcry_md_final( digest );
+  gcry_md_final (digest);
+}
+
+
+/* This function is similar to check_signature_end, but it only checks
+ * whether the signature was generated by PK.  It does not check
+ * expiration, revocation, etc.  If UBID is not NULL, the result of
+ * the public key operation is looked up in and stored into the
+ * signature cache of the keyboxd under that key.  */
+static int
+check_signature_end_simple (ctrl_t ctrl, PKT_public_key *pk,
+                            PKT_signature *sig, gcry_md_hd_t digest,
+                            const void *extrahash, size_t extrahashlen,
+                            const byte *ubid)
+{
+  gcry_mpi_t result = NULL;
+  int rc = 0;
+  byte sigid[SIGCACHE_SIGID_LEN];
+  int have_sigid;
+  int good;
+
+  if (!opt.flags.allow_weak_digest_algos)
+    {
+      if (is_weak_digest (sig->digest_algo))
+        {
+          print_digest_rejected_note (sig->digest_algo);
+          return GPG_ERR_DIGEST_ALGO;
+        }
+    }
 
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
+  /* For key signatures check that the key has a cert usage.  We may
+   * do this only for subkeys because the primary may always issue key
+   * signature.  The latter may not be reflected in the pubkey_usage
+   * field because we need to check the key signatures to extract the
+   * key usage.  */
+  if (!pk->flags.primary
+      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
 
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+  /* For data signatures check that the key has sign usage.  */
+  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
+      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
+
+  complete_sig_digest (sig, digest, extrahash, extrahashlen);
+
+    have_sigid = ((ubid || (ctrl && ctrl->sig_batch))
+                  && !compute_sigid (pk, sig, digest, sigid));
+    if (!have_sigid)
+      ubid = NULL;
+    if (ubid)
+      {
+        cache_stats.kbxd_lookups++;
+        if (!keydb_get_sigcache (ctrl, ubid, sigid, pk, &good))
+          {
+            cache_stats.kbxd_hits++;
+            rc = good? 0 : gpg_error (GPG_ERR_BAD_SIGNATURE);
+            goto leave;
+          }
+      }
+
+    /* Use the result of a batch verification if there is one.  */
+    if (have_sigid && ctrl && ctrl->sig_batch
+        && !sig_batch_get_result (ctrl->sig_batch, sigid, &rc))
+      cache_stats.batched++;
+    else
+      {
+        /* The MPIs of a signature parsed from a keyblock buffer are
+         * only now needed.  */
+        rc = materialize_sig_data (sig);
+        if (rc)
+          return rc;
+
+        /* Convert the digest to an MPI.  */
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+          return GPG_ERR_GENERAL;
+
+        /* Verify the signature.  */
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("enter pk_verify");
+        rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("leave pk_verify");
+        gcry_mpi_release (result);
+      }
+
+    if (ubid && (!rc || gpg_err_code (rc) == GPG_ERR_BAD_SIGNATURE))
+      keydb_put_sigcache (ctrl, ubid, sigid, pk, !rc);
 
+ leave:
   if (!rc && sig->flags.unknown_critical)
     {
       log_info(_("assuming bad signature from key %s"
@@ -677,6 +830,48 @@ hash_uid_packet (PKT_user_id *uid, gcry_md_hd_t md, PKT_signature *sig )
     }
 }
 
+
+/* Hash the key or user id PACKET of the keyblock with the primary
+ * key PRIPK into MD as required for the key signature SIG by SIGNER.
+ * The caller must have checked that PACKET matches the class of
+ * SIG.  */
+static void
+hash_signed_packet (gcry_md_hd_t md, PKT_signature *sig,
+                    PKT_public_key *pripk, PKT_public_key *signer,
+                    PACKET *packet)
+{
+  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_BACK_SIG (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+      hash_public_key (md, signer);
+    }
+  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
+      hash_public_key (md, pripk);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_USER_ID);
+      hash_public_key (md, pripk);
+      hash_uid_packet (packet->pkt.user_id, md, sig);
+    }
+  else
+    {
+      /* We should never get here.  (The caller should have already
+       * caught this error.)  */
+      BUG ();
+    }
+}
+
+
 static void
 cache_sig_result ( PKT_signature *sig, int result )
 {
@@ -905,6 +1100,8 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
   gcry_md_hd_t md;
   int signer_alloced = 0;
   int stub_is_selfsig;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  const byte *ubid = NULL;
 
   if (!is_selfsig)
     is_selfsig = &stub_is_selfsig;
@@ -1023,53 +1220,28 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
   if (gcry_md_open (&md, sig->digest_algo, 0))
     BUG ();
 
-  /* Hash the relevant data.  */
+  /* With the keyboxd the signature cache is used for all signatures
+   * of this key.  Note that for OpenPGP the UBID is the truncated
+   * fingerprint of the primary key.  */
+  if (opt.use_keyboxd && !opt.no_sig_cache)
+    ubid = fingerprint_from_pk (pripk, fpr, NULL);
 
-  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_BACK_SIG (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      hash_public_key (md, signer);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+  if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+      && sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
+      && !opt.flags.allow_weak_key_signatures)
     {
-      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
-      hash_public_key (md, pripk);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_USER_ID);
-      if (sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
-          && !opt.flags.allow_weak_key_signatures)
-        {
-          /* If the signature was created using SHA-1 we consider this
-           * signature invalid because it makes it possible to mount a
-           * chosen-prefix collision.  We don't do this for
-           * self-signatures, though.  */
-          print_sha1_keysig_rejected_note ();
-          rc = gpg_error (GPG_ERR_DIGEST_ALGO);
-        }
-      else
-        {
-          hash_public_key (md, pripk);
-          hash_uid_packet (packet->pkt.user_id, md, sig);
-          rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-        }
+      /* If the signature was created using SHA-1 we consider this
+       * signature invalid because it makes it possible to mount a
+       * chosen-prefix collision.  We don't do this for
+       * self-signatures, though.  */
+      print_sha1_keysig_rejected_note ();
+      rc = gpg_error (GPG_ERR_DIGEST_ALGO);
     }
   else
     {
-      /* We should never get here.  (The first if above should have
-       * already caught this error.)  */
-      BUG ();
+      hash_signed_packet (md, sig, pripk, signer, packet);
+      rc = check_signature_end_simple (ctrl, signer, sig, md,
+                                       NULL, 0, ubid);
     }
 
   gcry_md_close (md);
@@ -1314,3 +1486,329 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* The maximum number of threads used for a batch verification.  */
+#define SIG_BATCH_MAX_WORKERS 8
+
+/* The minimum number of signatures for which a batch verification
+ * is worth the overhead of starting the threads.  */
+#define SIG_BATCH_MIN_JOBS 8
+
+/* A signature to be verified by a batch.  */
+struct sig_batch_job_s
+{
+  struct workpool_job_s wp;  /* Must be the first member.  */
+  PKT_signature *sig;    /* The signature; owned by the keyblock.  */
+  PKT_public_key *pk;    /* A copy of the signer's key.  */
+  gcry_mpi_t hash;       /* The encoded digest.  */
+  byte sigid[SIGCACHE_SIGID_LEN];  /* Identifies the job's inputs.  */
+  gpg_error_t err;       /* The result of pk_verify.  */
+};
+
+/* A batch of key signatures which are verified in advance by a pool
+ * of worker threads.  The results are written to the jobs in the
+ * order of the keyblock and picked up by check_signature_end_simple
+ * when the caller checks the signatures as usual.  */
+struct sig_batch_s
+{
+  kbnode_t keyblock;     /* The keyblock of this batch.  */
+  int njobs;
+  int jobsize;           /* The allocated number of JOBS.  */
+  int lookupidx;         /* The job where the next lookup starts.  */
+  struct sig_batch_job_s *jobs;
+};
+
+
+static void
+release_sig_batch (struct sig_batch_s *batch)
+{
+  int i;
+
+  if (!batch)
+    return;
+
+  for (i=0; i < batch->njobs; i++)
+    {
+      free_public_key (batch->jobs[i].pk);
+      gcry_mpi_release (batch->jobs[i].hash);
+    }
+  xfree (batch->jobs);
+  xfree (batch);
+}
+
+
+/* Return the signer of the key signature SIG in KEYBLOCK as used by
+ * check_key_signature2.  PRIPK is the primary key of KEYBLOCK.
+ * Returns NULL if the signer is not known or not usable without
+ * diagnostics.  The caller must release the returned key.  */
+static PKT_public_key *
+get_batch_signer (ctrl_t ctrl, kbnode_t keyblock, PKT_public_key *pripk,
+                  PKT_signature *sig)
+{
+  PKT_public_key *signer = NULL;
+  kbnode_t n;
+
+  if ((sig->keyid[0] == pripk->keyid[0] && sig->keyid[1] == pripk->keyid[1])
+      || IS_KEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    return copy_public_key (NULL, pripk);
+
+  for (n = keyblock; n; n = n->next)
+    if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY
+        && sig->keyid[0] == n->pkt->pkt.public_key->keyid[0]
+        && sig->keyid[1] == n->pkt->pkt.public_key->keyid[1])
+      {
+        signer = n->pkt->pkt.public_key;
+        if (!(signer->pubkey_usage & PUBKEY_USAGE_CERT))
+          return NULL;
+        return copy_public_key (NULL, signer);
+      }
+
+  signer = xmalloc_clear (sizeof *signer);
+  signer->req_usage = PUBKEY_USAGE_CERT;  /* All key signatures are certs.  */
+  if (get_pubkey_for_sig (ctrl, signer, sig, NULL, NULL)
+      || (!signer->flags.primary
+          && !(signer->pubkey_usage & PUBKEY_USAGE_CERT)))
+    {
+      free_public_key (signer);
+      return NULL;
+    }
+  return signer;
+}
+
+
+/* Prepare the verification of the signature at NODE of KEYBLOCK and
+ * add it as a job to BATCH.  Signatures which would not take the
+ * plain path of check_key_signature2 are silently skipped; they are
+ * later checked the usual way.  */
+static gpg_error_t
+add_sig_batch_job (ctrl_t ctrl, struct sig_batch_s *batch,
+                   kbnode_t keyblock, kbnode_t node)
+{
+  PKT_public_key *pripk = keyblock->pkt->pkt.public_key;
+  PKT_signature *sig = node->pkt->pkt.signature;
+  PKT_public_key *signer = NULL;
+  struct sig_batch_job_s *job;
+  kbnode_t pnode;
+  gcry_md_hd_t md = NULL;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  const byte *ubid = NULL;
+  int good;
+
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return 0;
+  if (!opt.flags.allow_weak_digest_algos && is_weak_digest (sig->digest_algo))
+    return 0;
+
+  if (IS_KEY_SIG (sig))
+    pnode = keyblock;
+  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    pnode = find_prev_kbnode (keyblock, node, PKT_PUBLIC_SUBKEY);
+  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      pnode = find_prev_kbnode (keyblock, node, PKT_USER_ID);
+      if (sig->digest_algo == DIGEST_ALGO_SHA1
+          && keyid_cmp (pk_keyid (pripk), sig->keyid)
+          && !opt.flags.allow_weak_key_signatures)
+        return 0;
+    }
+  else /* Key revocations may need a lookup of designated revokers.  */
+    return 0;
+  if (!pnode)
+    return 0;
+
+  signer = get_batch_signer (ctrl, keyblock, pripk, sig);
+  if (!signer)
+    return 0;
+
+  if (batch->njobs == batch->jobsize)
+    {
+      int newsize = batch->jobsize? 2 * batch->jobsize : 64;
+
+      job = xtryrealloc (batch->jobs, newsize * sizeof *batch->jobs);
+      if (!job)
+        {
+          free_public_key (signer);
+          return gpg_error_from_syserror ();
+        }
+      batch->jobs = job;
+      batch->jobsize = newsize;
+    }
+  job = batch->jobs + batch->njobs;
+  memset (job, 0, sizeof *job);
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    BUG ();
+  hash_signed_packet (md, sig, pripk, signer, pnode->pkt);
+  complete_sig_digest (sig, md, NULL, 0);
+  if (compute_sigid (signer, sig, md, job->sigid))
+    goto leave;
+
+  /* No need to verify what the keyboxd already knows.  */
+  if (opt.use_keyboxd && !opt.no_sig_cache)
+    ubid = fingerprint_from_pk (pripk, fpr, NULL);
+  if (ubid && !keydb_get_sigcache (ctrl, ubid, job->sigid, signer, &good))
+    goto leave;
+
+  /* The workers must not modify the signature.  */
+  if (materialize_sig_data (sig))
+    goto leave;
+
+  job->hash = encode_md_value (signer, md, sig->digest_algo);
+  if (!job->hash)
+    goto leave;
+  job->sig = sig;
+  job->pk = signer;
+  signer = NULL;
+  batch->njobs++;
+
+ leave:
+  gcry_md_close (md);
+  free_public_key (signer);
+  return 0;
+}
+
+
+/* The job function of a batch verification worker.  */
+static void
+sig_batch_verify_job (void *arg, workpool_job_t wpjob)
+{
+  struct sig_batch_job_s *job = (struct sig_batch_job_s *)wpjob;
+
+  (void)arg;
+
+  npth_unprotect ();
+  job->err = pk_verify (job->pk->pubkey_algo, job->hash,
+                        job->sig->data, job->pk->pkey);
+  npth_protect ();
+}
+
+
+/* Verify all jobs of BATCH using up to NWORKERS threads.  */
+static gpg_error_t
+run_sig_batch (struct sig_batch_s *batch, unsigned int nworkers)
+{
+  gpg_error_t err;
+  workpool_t workpool;
+  int i;
+
+  if (nworkers > batch->njobs)
+    nworkers = batch->njobs;
+  err = workpool_new (&workpool, nworkers, sig_batch_verify_job, NULL);
+  if (err)
+    return err;
+
+  if (DBG_CRYPTO)
+    log_debug ("sig-check: verifying %d signatures using %u threads\n",
+               batch->njobs, nworkers);
+
+  for (i=0; i < batch->njobs; i++)
+    workpool_submit (workpool, &batch->jobs[i].wp);
+  for (i=0; i < batch->njobs; i++)
+    workpool_wait (workpool, &batch->jobs[i].wp);
+
+  workpool_release (workpool);
+  return 0;
+}
+
+
+/* Take the result of the verification identified by SIGID from
+ * BATCH and store it at R_RC.  Returns GPG_ERR_NOT_FOUND if BATCH has
+ * no such result.  */
+static gpg_error_t
+sig_batch_get_result (struct sig_batch_s *batch, const byte *sigid, int *r_rc)
+{
+  int i, idx;
+
+  /* The signatures are usually checked in the order of the keyblock
+   * and thus in the order of the jobs.  */
+  for (i=0; i < batch->njobs; i++)
+    {
+      idx = (batch->lookupidx + i) % batch->njobs;
+      if (!memcmp (batch->jobs[idx].sigid, sigid, SIGCACHE_SIGID_LEN))
+        {
+          *r_rc = batch->jobs[idx].err;
+          batch->lookupidx = idx + 1;
+          return 0;
+        }
+    }
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+
+/* Verify the key signatures of KEYBLOCK in parallel so that the
+ * following calls to check_key_signature for this keyblock only need
+ * to pick up the results.  If SELFSIGS_ONLY is set only the
+ * self-signatures are verified.  This is a no-op unless the
+ * "parallelized" compatibility flag is set, several CPUs are
+ * available, and the keyblock has enough unchecked signatures.  The
+ * caller must call check_key_signatures_end with the same keyblock
+ * when done.  */
+void
+check_key_signatures_start (ctrl_t ctrl, kbnode_t keyblock, int selfsigs_only)
+{
+  struct sig_batch_s *batch;
+  PKT_public_key *pripk;
+  PKT_signature *sig;
+  unsigned int nworkers;
+  kbnode_t node;
+  gpg_error_t err = 0;
+
+  if (!ctrl || ctrl->sig_batch)
+    return;  /* No context or nested call for another keyblock.  */
+  if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+  nworkers = workpool_get_nworkers (SIG_BATCH_MAX_WORKERS);
+  if (!nworkers)
+    return;
+
+  batch = xtrycalloc (1, sizeof *batch);
+  if (!batch)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  batch->keyblock = keyblock;
+  pripk = keyblock->pkt->pkt.public_key;
+  keyid_from_pk (pripk, NULL);
+
+  for (node = keyblock->next; node && !err; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked && !opt.no_sig_cache)
+        continue;  /* Already cached in the packet.  */
+      if (selfsigs_only && keyid_cmp (pripk->keyid, sig->keyid))
+        continue;
+      err = add_sig_batch_job (ctrl, batch, keyblock, node);
+    }
+  if (err || batch->njobs < SIG_BATCH_MIN_JOBS)
+    goto leave;
+
+  err = run_sig_batch (batch, nworkers);
+  if (err)
+    goto leave;
+  ctrl->sig_batch = batch;
+  batch = NULL;
+
+ leave:
+  if (err)
+    log_info ("parallel signature verification failed: %s\n",
+              gpg_strerror (err));
+  release_sig_batch (batch);
+}
+
+
+/* Release the batch created by check_key_signatures_start for
+ * KEYBLOCK.  */
+void
+check_key_signatures_end (ctrl_t ctrl, kbnode_t keyblock)
+{
+  if (ctrl && ctrl->sig_batch && ctrl->sig_batch->keyblock == keyblock)
+    {
+      release_sig_batch (ctrl->sig_batch);
+      ctrl->sig_batch = NULL;
+    }
+}
@@ -1055,7 +1055,6 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
   compress_filter_context_t zfx;
   gcry_md_hd_t md = NULL;
   md_filter_context_t mfx;
-  md_thd_filter_context_t mfx2 = NULL;
   text_filter_context_t tfx;
   progress_filter_context_t *pfx;
   encrypt_filter_context_t efx;
@@ -1265,16 +1264,11 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 
   if (!multifile)
     {
+      iobuf_push_filter (inp, md_filter, &mfx);
+      mfx.md = md;
+      /* Hash the input on a separate thread.  */
       if (encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED))
-        {
-          iobuf_push_filter (inp, md_thd_filter, &mfx2);
-          md_thd_filter_set_md (mfx2, md);
-        }
-      else
-        {
-          iobuf_push_filter (inp, md_filter, &mfx);
-          mfx.md = md;
-        }
+        iobuf_push_thread_filter (inp, 0);
     }
 
   if (detached && !encryptflag)
@@ -1288,6 +1282,9 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
       efx.pk_list = pk_list;
       /* fixme: set efx.cfx.datalen if known */
       iobuf_push_filter (out, encrypt_filter, &efx);
+      /* Encrypt on a separate thread.  */
+      if ((opt.compat_flags & COMPAT_PARALLELIZED))
+        iobuf_push_thread_filter (out, 0);
     }
 
   if (opt.compress_algo && !outfile && !detached)
@@ -1378,16 +1375,10 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
                   memset (&tfx, 0, sizeof tfx);
                   iobuf_push_filter (inp, text_filter, &tfx);
                 }
+              iobuf_push_filter (inp, md_filter, &mfx);
+              mfx.md = md;
               if (encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED))
-                {
-                  iobuf_push_filter (inp, md_thd_filter, &mfx2);
-                  md_thd_filter_set_md (mfx2, md);
-                }
-              else
-                {
-                  iobuf_push_filter (inp, md_filter, &mfx);
-                  mfx.md = md;
-                }
+                iobuf_push_thread_filter (inp, 0);
               while (iobuf_read (inp, NULL, iobuf_size) != -1)
                 ;
               iobuf_close (inp);
@@ -1616,7 +1607,6 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
   progress_filter_context_t *pfx;
   compress_filter_context_t zfx;
   md_filter_context_t mfx;
-  md_thd_filter_context_t mfx2 = NULL;
   gcry_md_hd_t md = NULL;
   text_filter_context_t tfx;
   cipher_filter_context_t cfx;
@@ -1709,16 +1699,11 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
   for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
     gcry_md_enable (md, hash_for (sk_rover->pk));
 
+  iobuf_push_filter (inp, md_filter, &mfx);
+  mfx.md = md;
+  /* Hash the input on a separate thread.  */
   if ((opt.compat_flags & COMPAT_PARALLELIZED))
-    {
-      iobuf_push_filter (inp, md_thd_filter, &mfx2);
-      md_thd_filter_set_md (mfx2, md);
-    }
-  else
-    {
-      iobuf_push_filter (inp, md_filter, &mfx);
-      mfx.md = md;
-    }
+    iobuf_push_thread_filter (inp, 0);
 
 
   /* Push armor output filter */
@@ -1757,6 +1742,8 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
                      cfx.dek->use_aead? cipher_filter_aead
                      /**/             : cipher_filter_cfb,
                      &cfx);
+  if ((opt.compat_flags & COMPAT_PARALLELIZED))
+    iobuf_push_thread_filter (out, 0);
 
   /* Push the compress filter */
   if (default_compress_algo())
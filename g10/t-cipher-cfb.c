@@ -0,0 +1,188 @@
+/* t-cipher-cfb.c - Tests for cipher-cfb.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "test.c"
+
+#include "../common/iobuf.h"
+#include "keydb.h"
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+
+/* More than three batches of the filter and not a multiple of the
+ * block size.  */
+#define DATALEN (3 * 65536 + 4711)
+
+
+/* A filter which fails to write once more than LIMIT bytes have
+ * been written and then accepts everything again.  */
+static int
+failing_filter (void *opaque, int control,
+                iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  size_t *limit = opaque;
+
+  (void)chain;
+
+  if (control == IOBUFCTRL_FLUSH)
+    {
+      if (*ret_len > *limit)
+        {
+          *limit = (size_t)(-1);
+          return gpg_error (GPG_ERR_ENOSPC);
+        }
+      *limit -= *ret_len;
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "failing_filter", *ret_len);
+  return 0;
+}
+
+
+/* Push the cipher filter with CFX onto OUT and write DATA to it.
+ * The data is written in chunks of varying size so that both the
+ * buffered and the in-place code paths are used.  A copy is written
+ * because large writes may be encrypted in the caller's buffer.  */
+static void
+encrypt_to (iobuf_t out, cipher_filter_context_t *cfx, DEK *dek,
+            const byte *data, size_t datalen)
+{
+  byte *copy;
+  size_t off, n;
+
+  copy = xmalloc (datalen);
+  memcpy (copy, data, datalen);
+  memset (cfx, 0, sizeof *cfx);
+  cfx->dek = dek;
+  cfx->datalen = datalen;
+  iobuf_push_filter (out, cipher_filter_cfb, cfx);
+  for (off = 0, n = 1; off < datalen; off += n, n = n * 3 + 1)
+    {
+      if (n > datalen - off)
+        n = datalen - off;
+      if (iobuf_write (out, copy + off, n))
+        ABORT ("Failed to write the plaintext.");
+    }
+  xfree (copy);
+}
+
+
+/* Decrypt the encrypted data packet in BUFFER with DEK and return
+ * true if it holds DATA and a valid MDC.  */
+static int
+check_decrypt (const byte *buffer, size_t length, DEK *dek,
+               const byte *data, size_t datalen)
+{
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  iobuf_t inp;
+  gcry_cipher_hd_t hd;
+  gcry_md_hd_t md;
+  unsigned int blocksize = openpgp_cipher_get_algo_blklen (dek->algo);
+  byte *plain;
+  size_t plainlen;
+  int okay;
+
+  inp = iobuf_temp_with_content (buffer, length);
+  init_parse_packet (&parsectx, inp);
+  init_packet (&pkt);
+  if (parse_packet (&parsectx, &pkt)
+      || pkt.pkttype != PKT_ENCRYPTED_MDC)
+    ABORT ("Failed to parse the encrypted data packet.");
+  plainlen = pkt.pkt.encrypted->len;
+  if (plainlen != blocksize + 2 + datalen + 22)
+    ABORT ("Unexpected packet length.");
+  plain = xmalloc (plainlen);
+  if (iobuf_read (pkt.pkt.encrypted->buf, plain, plainlen) != plainlen)
+    ABORT ("Failed to read the encrypted data.");
+
+  if (openpgp_cipher_open (&hd, dek->algo, GCRY_CIPHER_MODE_CFB, 0)
+      || gcry_cipher_setkey (hd, dek->key, dek->keylen)
+      || gcry_cipher_decrypt (hd, plain, plainlen, NULL, 0))
+    ABORT ("Failed to decrypt.");
+  gcry_cipher_close (hd);
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    ABORT ("Failed to open the hash.");
+  gcry_md_write (md, plain, plainlen - 20);
+  okay = (!memcmp (plain + blocksize - 2, plain + blocksize, 2)
+          && !memcmp (plain + blocksize + 2, data, datalen)
+          && plain[plainlen - 22] == 0xd3
+          && plain[plainlen - 21] == 0x14
+          && !memcmp (plain + plainlen - 20, gcry_md_read (md, 0), 20));
+  gcry_md_close (md);
+
+  xfree (plain);
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+  return okay;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  static const int algos[] = { CIPHER_ALGO_AES256, CIPHER_ALGO_3DES };
+  DEK dek;
+  cipher_filter_context_t cfx;
+  byte *data;
+  iobuf_t out;
+  size_t i, limit;
+  int n, rc;
+
+  (void) argc;
+  (void) argv;
+
+  data = xmalloc (DATALEN);
+  for (i = 0; i < DATALEN; i++)
+    data[i] = (i * 7 + i / 251) & 0xff;
+
+  TEST_GROUP ("Round trip");
+  for (n = 0; n < DIM (algos); n++)
+    {
+      memset (&dek, 0, sizeof dek);
+      dek.algo = algos[n];
+      dek.keylen = openpgp_cipher_get_algo_keylen (dek.algo);
+      dek.use_mdc = 1;
+      gcry_randomize (dek.key, dek.keylen, GCRY_STRONG_RANDOM);
+
+      out = iobuf_temp ();
+      encrypt_to (out, &cfx, &dek, data, DATALEN);
+      rc = iobuf_pop_filter (out, cipher_filter_cfb, &cfx);
+      TEST_P (openpgp_cipher_algo_name (dek.algo),
+              !rc && check_decrypt (iobuf_get_temp_buffer (out),
+                                    iobuf_get_temp_length (out),
+                                    &dek, data, DATALEN));
+      iobuf_close (out);
+    }
+
+  TEST_GROUP ("Write errors");
+  /* Just less than a batch stays in the buffer of the cipher filter
+   * until the pipeline is closed and then no longer fits into the
+   * buffer in front of the failing filter.  */
+  out = iobuf_temp ();
+  limit = 100;
+  iobuf_push_filter (out, failing_filter, &limit);
+  encrypt_to (out, &cfx, &dek, data, 65535);
+  TEST_P ("last batch", iobuf_close (out));
+
+  xfree (data);
+}
@@ -0,0 +1,151 @@
+/* t-getkey.c - Tests for the public key cache of getkey.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "test.c"
+
+#include "keydb.h"
+#include "options.h"
+
+#define NKEYS 4
+
+static ctrl_t ctrl;
+static PKT_public_key *pks[NKEYS];
+static u32 keyids[NKEYS][2];
+
+
+/* Read the primary keys of the first NKEYS keyblocks of the
+ * distribution signing keys.  */
+static void
+load_keys (void)
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+  char *fname;
+  int i;
+
+  fname = prepend_srcdir ("distsigkey.gpg");
+  if (keydb_add_resource (fname, 0))
+    ABORT ("Failed to open keyring.");
+  test_free (fname);
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  for (i=0; i < NKEYS; i++)
+    {
+      if (keydb_search (hd, &desc, 1, NULL))
+        ABORT ("Not enough keys.");
+      if (keydb_get_keyblock (hd, &keyblock))
+        ABORT ("Failed to get keyblock.");
+      pks[i] = copy_public_key (NULL, keyblock->pkt->pkt.public_key);
+      keyid_from_pk (pks[i], keyids[i]);
+      /* This is done by merge_selfsigs for keys cached by get_pubkey.  */
+      pks[i]->main_keyid[0] = keyids[i][0];
+      pks[i]->main_keyid[1] = keyids[i][1];
+      release_kbnode (keyblock);
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+    }
+  keydb_release (hd);
+}
+
+
+/* Put key N into the cache.  The cached copy is marked with MARKER
+ * as expiration date, which the keys in the keyring don't have.  */
+static void
+cache_key (int n, u32 marker)
+{
+  pks[n]->expiredate = marker;
+  cache_public_key (pks[n]);
+  pks[n]->expiredate = 0;
+}
+
+
+/* Return the marker of key N if it has been taken from the cache or
+ * 0 if it has been read from the keyring.  */
+static u32
+lookup_key (int n)
+{
+  PKT_public_key pk;
+  u32 marker;
+
+  memset (&pk, 0, sizeof pk);
+  if (get_pubkey_fast (ctrl, &pk, keyids[n]))
+    return 0;
+  marker = pk.expiredate;
+  release_public_key_parts (&pk);
+  return marker;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  int i;
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  load_keys ();
+
+  opt.pubkey_cache_size = 3;
+
+  TEST_GROUP ("Caching and lookup");
+  for (i=0; i < 3; i++)
+    cache_key (i, 100 + i);
+  TEST_P ("", lookup_key (0) == 100);
+  TEST_P ("", lookup_key (1) == 101);
+  TEST_P ("", lookup_key (2) == 102);
+  TEST_P ("", lookup_key (3) == 0);
+
+  /* An entry is not replaced.  */
+  cache_key (1, 201);
+  TEST_P ("", lookup_key (1) == 101);
+
+  TEST_GROUP ("Eviction of the least recently used entry");
+  /* The order is now 1, 2, 0; using key 0 makes key 2 the least
+   * recently used one.  */
+  TEST_P ("", lookup_key (0) == 100);
+  cache_key (3, 103);
+  TEST_P ("", lookup_key (2) == 0);
+  TEST_P ("", lookup_key (3) == 103);
+  TEST_P ("", lookup_key (1) == 101);
+  TEST_P ("", lookup_key (0) == 100);
+
+  /* Now key 3 is the least recently used one.  */
+  cache_key (2, 202);
+  TEST_P ("", lookup_key (3) == 0);
+  TEST_P ("", lookup_key (2) == 202);
+  TEST_P ("", lookup_key (0) == 100);
+  TEST_P ("", lookup_key (1) == 101);
+
+  TEST_GROUP ("Disabling the cache");
+  getkey_disable_caches ();
+  cache_key (3, 103);
+  for (i=0; i < NKEYS; i++)
+    TEST_P ("", lookup_key (i) == 0);
+
+  for (i=0; i < NKEYS; i++)
+    free_public_key (pks[i]);
+  xfree (ctrl);
+}
@@ -0,0 +1,176 @@
+/* t-objcache.c - Tests for objcache.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "test.c"
+
+#include "keydb.h"
+#include "objcache.h"
+#include "../common/host2net.h"
+
+/* Enough keys to let both tables grow several times.  */
+#define NKEYS 20000
+
+/* Enough keys with long user ids to exceed the memory budget.  */
+#define NBIGKEYS 400000
+
+
+/* Store the keyid and the fingerprint of the synthetic key N.  The
+ * keyids are spread over the buckets.  */
+static void
+key_n (unsigned int n, u32 *keyid, byte *fpr)
+{
+  keyid[0] = n * 2654435761u;
+  keyid[1] = n;
+  memset (fpr, 0x42, 12);
+  ulongtobuf (fpr + 12, keyid[0]);
+  ulongtobuf (fpr + 16, keyid[1]);
+}
+
+
+/* Return a keyblock with the key N and the primary user id UID.  The
+ * fingerprint is set directly so that no key material is needed.  */
+static kbnode_t
+make_keyblock (unsigned int n, const char *uid)
+{
+  PACKET *pkt;
+  PKT_public_key *pk;
+  PKT_user_id *userid;
+  kbnode_t keyblock;
+  size_t uidlen = strlen (uid);
+
+  pk = xcalloc (1, sizeof *pk);
+  pk->version = 4;
+  pk->pubkey_algo = PUBKEY_ALGO_RSA;
+  key_n (n, pk->keyid, pk->fpr);
+  pk->fprlen = 20;
+  pkt = xcalloc (1, sizeof *pkt);
+  pkt->pkttype = PKT_PUBLIC_KEY;
+  pkt->pkt.public_key = pk;
+  keyblock = new_kbnode (pkt);
+
+  userid = xcalloc (1, sizeof *userid + uidlen);
+  userid->ref = 1;
+  userid->len = uidlen;
+  memcpy (userid->name, uid, uidlen);
+  userid->flags.primary = 1;
+  pkt = xcalloc (1, sizeof *pkt);
+  pkt->pkttype = PKT_USER_ID;
+  pkt->pkt.user_id = userid;
+  add_kbnode (keyblock, new_kbnode (pkt));
+
+  return keyblock;
+}
+
+
+static void
+put_key (unsigned int n, const char *uid)
+{
+  kbnode_t keyblock = make_keyblock (n, uid);
+
+  cache_put_keyblock (keyblock);
+  release_kbnode (keyblock);
+}
+
+
+/* Return true if the user id of key N is found as UID by keyid and
+ * by fingerprint.  */
+static int
+have_key (unsigned int n, const char *uid)
+{
+  u32 keyid[2];
+  byte fpr[20];
+  char *p;
+  unsigned int len;
+  size_t fprlen;
+  int okay;
+
+  key_n (n, keyid, fpr);
+  p = cache_get_uid_bykid (keyid, &len);
+  okay = p && len == strlen (uid) && !strcmp (p, uid);
+  xfree (p);
+  p = cache_get_uid_byfpr (fpr, 20, &fprlen);
+  okay = okay && p && fprlen == strlen (uid) && !strcmp (p, uid);
+  xfree (p);
+  return okay;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  char uid[200];
+  unsigned int n, nfound;
+  int okay;
+
+  (void) argc;
+  (void) argv;
+
+  TEST_GROUP ("Growing the tables");
+  /* Look up older keys while the tables grow so that buckets of the
+   * old tables are also found.  */
+  okay = 1;
+  for (n=0; n < NKEYS; n++)
+    {
+      snprintf (uid, sizeof uid, "User %u <u%u@example.org>", n, n);
+      put_key (n, uid);
+      snprintf (uid, sizeof uid, "User %u <u%u@example.org>", n/2, n/2);
+      if (!have_key (n/2, uid))
+        okay = 0;
+    }
+  TEST_P ("lookups during growth", okay);
+  okay = 1;
+  for (n=0; n < NKEYS; n++)
+    {
+      snprintf (uid, sizeof uid, "User %u <u%u@example.org>", n, n);
+      if (!have_key (n, uid))
+        okay = 0;
+    }
+  TEST_P ("lookups after growth", okay);
+
+  TEST_GROUP ("Shared user ids");
+  for (n=NKEYS; n < NKEYS + 10; n++)
+    put_key (n, "Shared User");
+  okay = 1;
+  for (n=NKEYS; n < NKEYS + 10; n++)
+    if (!have_key (n, "Shared User"))
+      okay = 0;
+  TEST_P ("", okay);
+
+  TEST_GROUP ("Memory budget");
+  memset (uid, 'x', 150);
+  for (n=NKEYS + 10; n < NKEYS + 10 + NBIGKEYS; n++)
+    {
+      snprintf (uid + 150, sizeof uid - 150, "%u", n);
+      put_key (n, uid);
+    }
+  TEST_P ("last key", have_key (n - 1, uid));
+  nfound = 0;
+  for (n=NKEYS + 10; n < NKEYS + 10 + NBIGKEYS; n++)
+    {
+      snprintf (uid + 150, sizeof uid - 150, "%u", n);
+      if (have_key (n, uid))
+        nfound++;
+    }
+  TEST_P ("keys dropped", nfound < NBIGKEYS);
+  TEST_P ("keys kept", nfound > NBIGKEYS / 10);
+
+  if (verbose)
+    objcache_dump_stats ();
+}
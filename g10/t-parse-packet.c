@@ -0,0 +1,233 @@
+/* t-parse-packet.c - Tests for parse_packet_buffer
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "test.c"
+
+#include "../common/iobuf.h"
+#include "keydb.h"
+#include "packet.h"
+
+
+/* Return the content of the file NAME in the g10 source directory and
+ * store its length at R_LEN.  */
+static char *
+read_test_file (const char *name, size_t *r_len)
+{
+  char *fname;
+  FILE *fp;
+  char *buffer;
+  long n;
+
+  fname = prepend_srcdir (name);
+  fp = fopen (fname, "rb");
+  test_free (fname);
+  if (!fp || fseek (fp, 0, SEEK_END) || (n = ftell (fp)) < 0
+      || fseek (fp, 0, SEEK_SET))
+    ABORT ("Failed to open the keyring.");
+  buffer = xmalloc (n + 1);
+  if (n && fread (buffer, n, 1, fp) != 1)
+    ABORT ("Failed to read the keyring.");
+  fclose (fp);
+  *r_len = n;
+  return buffer;
+}
+
+
+/* Return the serialization of the signature SIG as a temporary
+ * iobuf.  */
+static iobuf_t
+build_signature (PKT_signature *sig)
+{
+  PACKET pkt;
+  iobuf_t out;
+
+  out = iobuf_temp ();
+  init_packet (&pkt);
+  pkt.pkttype = PKT_SIGNATURE;
+  pkt.pkt.signature = sig;
+  if (build_packet (out, &pkt))
+    ABORT ("Failed to build a signature packet.");
+  return out;
+}
+
+
+/* Compare the signature A parsed from a buffer with the signature B
+ * parsed by the regular parser.  Returns true if they are equal.
+ * MODE selects how the MPIs of A are materialized: 0 = explicitly,
+ * 1 = by cmp_signatures, 2 = by building the packet from a copy.  */
+static int
+same_signature (PKT_signature *a, PKT_signature *b, int mode)
+{
+  PKT_signature *copy;
+  iobuf_t outa, outb;
+  int okay;
+
+  if (!a->rawdata || a->data[0])
+    return 0;  /* The MPIs have not been deferred.  */
+  if (a->version != b->version
+      || a->sig_class != b->sig_class
+      || a->digest_algo != b->digest_algo
+      || a->timestamp != b->timestamp
+      || a->expiredate != b->expiredate
+      || memcmp (a->digest_start, b->digest_start, 2)
+      || !a->hashed != !b->hashed
+      || (a->hashed && (a->hashed->len != b->hashed->len
+                        || memcmp (a->hashed->data, b->hashed->data,
+                                   a->hashed->len)))
+      || !a->unhashed != !b->unhashed
+      || (a->unhashed && (a->unhashed->len != b->unhashed->len
+                          || memcmp (a->unhashed->data, b->unhashed->data,
+                                     a->unhashed->len))))
+    return 0;
+
+  switch (mode)
+    {
+    case 0:
+      if (materialize_sig_data (a) || a->rawdata)
+        return 0;
+      return !cmp_signatures (a, b);
+
+    case 1:
+      return !cmp_signatures (a, b) && !a->rawdata;
+
+    default:
+      copy = copy_signature (NULL, a);
+      if (!copy->rawdata || copy->data[0])
+        return 0;
+      outa = build_signature (copy);
+      outb = build_signature (b);
+      okay = (iobuf_get_temp_length (outa) == iobuf_get_temp_length (outb)
+              && !memcmp (iobuf_get_temp_buffer (outa),
+                          iobuf_get_temp_buffer (outb),
+                          iobuf_get_temp_length (outa)));
+      iobuf_close (outa);
+      iobuf_close (outb);
+      free_seckey_enc (copy);
+      return okay;
+    }
+}
+
+
+/* Parse the keyring NAME with parse_packet_buffer and parse_packet
+ * and return true if both return the same packets.  The number of
+ * compared signatures is stored at R_NSIGS.  */
+static int
+check_keyring (const char *name, int *r_nsigs)
+{
+  char *buffer;
+  size_t length;
+  struct parse_packet_ctx_s ctxa, ctxb;
+  iobuf_t inp;
+  PACKET pkta, pktb;
+  int rca, rcb;
+  int nsigs = 0;
+  int okay = 1;
+
+  buffer = read_test_file (name, &length);
+  init_parse_packet_buffer (&ctxa, buffer, length);
+  inp = iobuf_temp_with_content (buffer, length);
+  init_parse_packet (&ctxb, inp);
+  init_packet (&pkta);
+  init_packet (&pktb);
+
+  for (;;)
+    {
+      rca = parse_packet_buffer (&ctxa, &pkta);
+      rcb = parse_packet (&ctxb, &pktb);
+      if (rca != rcb)
+        {
+          okay = 0;
+          break;
+        }
+      if (rca == -1)
+        break;
+      if (!rca && pkta.pkttype != pktb.pkttype)
+        okay = 0;
+      else if (!rca && pkta.pkttype == PKT_SIGNATURE)
+        {
+          if (!same_signature (pkta.pkt.signature, pktb.pkt.signature,
+                               nsigs % 3))
+            okay = 0;
+          nsigs++;
+        }
+      free_packet (&pkta, &ctxa);
+      init_packet (&pkta);
+      free_packet (&pktb, &ctxb);
+      init_packet (&pktb);
+    }
+  free_packet (&pkta, &ctxa);
+  free_packet (&pktb, &ctxb);
+  deinit_parse_packet (&ctxa);
+  deinit_parse_packet (&ctxb);
+  iobuf_close (inp);
+  xfree (buffer);
+  *r_nsigs = nsigs;
+  return okay;
+}
+
+
+/* Check that a keyring which ends within a signature packet is
+ * detected.  */
+static void
+check_truncated (void)
+{
+  char *buffer;
+  size_t length;
+  struct parse_packet_ctx_s ctx;
+  PACKET pkt;
+  int rc, lastrc;
+
+  buffer = read_test_file ("distsigkey.gpg", &length);
+  init_parse_packet_buffer (&ctx, buffer, length - 10);
+  init_packet (&pkt);
+  lastrc = 0;
+  while ((rc = parse_packet_buffer (&ctx, &pkt)) != -1)
+    {
+      lastrc = rc;
+      free_packet (&pkt, &ctx);
+      init_packet (&pkt);
+    }
+  TEST_P ("truncated keyring", gpg_err_code (lastrc) == GPG_ERR_INV_PACKET);
+  free_packet (&pkt, &ctx);
+  deinit_parse_packet (&ctx);
+  xfree (buffer);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  int nsigs;
+
+  (void) argc;
+  (void) argv;
+
+  TEST_GROUP ("Comparing with the regular parser");
+  /* The distribution keys have RSA and EdDSA signatures; the other
+   * keyring has DSA signatures and a PGP-2 key.  */
+  TEST_P ("distsigkey.gpg", check_keyring ("distsigkey.gpg", &nsigs));
+  TEST_P ("signatures compared", nsigs > 10);
+  TEST_P ("t-keydb-get-keyblock.gpg",
+          check_keyring ("t-keydb-get-keyblock.gpg", &nsigs));
+  TEST_P ("signatures compared", nsigs > 100);
+
+  TEST_GROUP ("Damaged input");
+  check_truncated ();
+}
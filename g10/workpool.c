@@ -0,0 +1,284 @@
+/* workpool.c - A pool of worker threads for gpg
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The AEAD encryption and decryption, the compression, and the key
+ * signature verification use the same scheme to run work in
+ * parallel: The main thread submits jobs in the order in which it
+ * later needs their results, the workers take the jobs in this order
+ * from a queue, and the main thread waits for a job before it uses
+ * its result.  This module implements that scheme.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "options.h"
+#include "workpool.h"
+
+
+/* A worker thread.  */
+struct workpool_worker_s
+{
+  workpool_t pool;
+  void *arg;             /* The argument for the job function.  */
+  npth_t thd;
+  unsigned int started : 1;
+};
+
+struct workpool_s
+{
+  npth_mutex_t mutex;
+  npth_cond_t cond;      /* Signaled on any change of a job state.  */
+  unsigned int stop : 1; /* Tell the workers to terminate.  */
+  workpool_func_t func;  /* The function to process a job.  */
+  workpool_job_t head;   /* The queue of submitted jobs ...  */
+  workpool_job_t tail;   /* ... and its last element.  */
+  unsigned int nworkers;
+  struct workpool_worker_s *workers;
+};
+
+
+static void
+lock_pool (workpool_t pool)
+{
+  int rc = npth_mutex_lock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pool (workpool_t pool)
+{
+  int rc = npth_mutex_unlock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Set the STATE of JOB and wake up all threads waiting for a state
+ * change.  The caller must hold the lock.  */
+static void
+set_job_state (workpool_t pool, workpool_job_t job,
+               enum workpool_job_states state)
+{
+  job->state = state;
+  npth_cond_broadcast (&pool->cond);
+}
+
+
+/* The thread function of a worker.  */
+static void *
+worker_thread (void *arg)
+{
+  struct workpool_worker_s *wrk = arg;
+  workpool_t pool = wrk->pool;
+  workpool_job_t job;
+
+  lock_pool (pool);
+  for (;;)
+    {
+      while (!pool->stop && !pool->head)
+        npth_cond_wait (&pool->cond, &pool->mutex);
+      if (pool->stop)
+        break;
+      job = pool->head;
+      pool->head = job->next;
+      if (!pool->head)
+        pool->tail = NULL;
+      job->next = NULL;
+      set_job_state (pool, job, WORKPOOL_JOB_BUSY);
+      unlock_pool (pool);
+
+      pool->func (wrk->arg, job);
+
+      lock_pool (pool);
+      set_job_state (pool, job, WORKPOOL_JOB_DONE);
+    }
+  unlock_pool (pool);
+
+  return NULL;
+}
+
+
+/* Return the number of worker threads to use for a parallel
+ * operation or 0 if the operation shall not be done in parallel.
+ * MAXWORKERS limits the returned value.  This checks the
+ * "parallelized" compatibility flag and the number of CPUs.  */
+unsigned int
+workpool_get_nworkers (unsigned int maxworkers)
+{
+  unsigned int ncpus;
+
+  if (!(opt.compat_flags & COMPAT_PARALLELIZED))
+    return 0;
+  ncpus = gnupg_get_ncpus ();
+  if (ncpus < 2)
+    return 0;
+  return ncpus < maxworkers? ncpus : maxworkers;
+}
+
+
+/* Create a pool with NWORKERS threads which call FUNC for each
+ * submitted job.  WORKERARGS is either NULL or an array with
+ * NWORKERS elements; the Nth worker passes the Nth element to FUNC.
+ * If not all threads can be started the pool works with fewer
+ * threads.  On success the new pool is stored at R_POOL.  */
+gpg_error_t
+workpool_new (workpool_t *r_pool, unsigned int nworkers,
+              workpool_func_t func, void **workerargs)
+{
+  gpg_error_t err = 0;
+  workpool_t pool;
+  npth_attr_t tattr;
+  unsigned int i;
+  int rc;
+
+  *r_pool = NULL;
+  log_assert (nworkers);
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->workers = xtrycalloc (nworkers, sizeof *pool->workers);
+  if (!pool->workers)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (pool);
+      return err;
+    }
+  pool->func = func;
+
+  rc = npth_mutex_init (&pool->mutex, NULL);
+  if (rc)
+    {
+      xfree (pool->workers);
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+  rc = npth_cond_init (&pool->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&pool->mutex);
+      xfree (pool->workers);
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nworkers; i++)
+    {
+      pool->workers[i].pool = pool;
+      pool->workers[i].arg = workerargs? workerargs[i] : NULL;
+      rc = npth_create (&pool->workers[i].thd, &tattr,
+                        worker_thread, pool->workers + i);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      pool->workers[i].started = 1;
+    }
+  npth_attr_destroy (&tattr);
+  pool->nworkers = i;
+
+  if (pool->nworkers && err)
+    {
+      /* If we can't start a thread the others do its work.  */
+      log_info ("error spawning worker thread: %s\n", gpg_strerror (err));
+      err = 0;
+    }
+
+ leave:
+  if (err)
+    workpool_release (pool);
+  else
+    *r_pool = pool;
+  return err;
+}
+
+
+/* Stop all worker threads and release POOL.  Jobs which are still
+ * in the queue are not processed.  When this function returns no
+ * worker accesses a job anymore.  */
+void
+workpool_release (workpool_t pool)
+{
+  unsigned int i;
+
+  if (!pool)
+    return;
+
+  lock_pool (pool);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->cond);
+  unlock_pool (pool);
+
+  for (i=0; i < pool->nworkers; i++)
+    if (pool->workers[i].started)
+      npth_join (pool->workers[i].thd, NULL);
+
+  npth_cond_destroy (&pool->cond);
+  npth_mutex_destroy (&pool->mutex);
+  xfree (pool->workers);
+  xfree (pool);
+}
+
+
+/* Append JOB to the queue of POOL.  The caller may not access the
+ * job until workpool_wait returns.  */
+void
+workpool_submit (workpool_t pool, workpool_job_t job)
+{
+  lock_pool (pool);
+  job->next = NULL;
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  set_job_state (pool, job, WORKPOOL_JOB_QUEUED);
+  unlock_pool (pool);
+}
+
+
+/* Wait until the workers of POOL are done with JOB.  This returns
+ * immediately if the job has not been submitted.  */
+void
+workpool_wait (workpool_t pool, workpool_job_t job)
+{
+  lock_pool (pool);
+  while (job->state == WORKPOOL_JOB_QUEUED
+         || job->state == WORKPOOL_JOB_BUSY)
+    npth_cond_wait (&pool->cond, &pool->mutex);
+  unlock_pool (pool);
+}
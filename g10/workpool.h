@@ -0,0 +1,56 @@
+/* workpool.h - A pool of worker threads for gpg
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_WORKPOOL_H
+#define GNUPG_G10_WORKPOOL_H
+
+/* The states of a job.  */
+enum workpool_job_states
+  {
+    WORKPOOL_JOB_IDLE = 0,  /* Owned by the submitter.            */
+    WORKPOOL_JOB_QUEUED,    /* Waiting for a worker.              */
+    WORKPOOL_JOB_BUSY,      /* A worker is processing the job.    */
+    WORKPOOL_JOB_DONE       /* Done and again owned by the submitter.  */
+  };
+
+/* The header of a job.  The users embed this into their own job
+ * objects.  Both fields are protected by the lock of the pool.  */
+struct workpool_job_s
+{
+  struct workpool_job_s *next;      /* Used for the queue.  */
+  enum workpool_job_states state;
+};
+typedef struct workpool_job_s *workpool_job_t;
+
+struct workpool_s;
+typedef struct workpool_s *workpool_t;
+
+/* The function called by a worker for JOB.  WORKERARG is the
+ * argument of that worker as given to workpool_new.  */
+typedef void (*workpool_func_t) (void *workerarg, workpool_job_t job);
+
+unsigned int workpool_get_nworkers (unsigned int maxworkers);
+gpg_error_t workpool_new (workpool_t *r_pool, unsigned int nworkers,
+                          workpool_func_t func, void **workerargs);
+void workpool_release (workpool_t pool);
+void workpool_submit (workpool_t pool, workpool_job_t job);
+void workpool_wait (workpool_t pool, workpool_job_t job);
+
+#endif /*GNUPG_G10_WORKPOOL_H*/
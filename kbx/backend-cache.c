@@ -29,21 +29,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "keyboxd.h"
 #include "../common/i18n.h"
 #include "../common/host2net.h"
 #include "backend.h"
+#include "frontend.h"
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The size of the cache in bytes is bounded.  Unless configured with
+ * --cache-size it is derived from the size of the database but not
+ * less than CACHE_MIN_BYTES and not more than CACHE_DEFAULT_MAX_BYTES.
+ * The number of hash buckets is derived from the size of the cache
+ * using an expected average size of a blob but limited to
+ * MAX_NO_OF_BUCKETS.  */
+#define CACHE_MIN_BYTES          (256 * 1024)
+#define CACHE_DEFAULT_MAX_BYTES  (32 * 1024 * 1024)
+#define MIN_NO_OF_BUCKETS        383
+#define MAX_NO_OF_BUCKETS        (1024 * 1024)
+#define EXPECTED_BYTES_PER_BLOB  4096
 
 
 /* Our definition of the backend handle.  */
@@ -57,10 +64,14 @@ struct backend_handle_s
 /* The object holding a blob.  */
 typedef struct blob_s
 {
-  struct blob_s *next;
+  struct blob_s *next;        /* Next blob in the hash bucket.  */
+  struct blob_s *lru_prev;    /* The previous more recently used blob.  */
+  struct blob_s *lru_next;    /* The next less recently used blob.  */
+  unsigned long last_used;    /* Value of CACHE_CLOCK at the last use.  */
   enum pubkey_types pktype;
+  unsigned int is_ephemeral:1;
+  unsigned int is_revoked:1;
   unsigned int refcount;
-  unsigned int usecount;
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
@@ -69,10 +80,11 @@ typedef struct blob_s
 
 static blob_t *blob_table;                /* Hash table with the blobs.   */
 static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
 static unsigned int blob_table_added;     /* Number of items added.       */
 static unsigned int blob_table_dropped;   /* Number of items dropped.     */
 static blob_t blob_attic;                 /* List of freed blobs.         */
+static blob_t blob_lru_head;              /* Most recently used blob.     */
+static blob_t blob_lru_tail;              /* Least recently used blob.    */
 
 
 /* A list item to blob data.  This is so that a next operation on a
@@ -105,42 +117,55 @@ static bloblist_t bloblist_attic;  /* List of freed items.  */
  */
 typedef struct key_item_s
 {
-  struct key_item_s *next;
+  struct key_item_s *next;     /* Next item in the hash bucket.  */
+  struct key_item_s *lru_prev; /* The previous more recently used item.  */
+  struct key_item_s *lru_next; /* The next less recently used item.  */
+  unsigned long last_used;     /* Value of CACHE_CLOCK at the last use.  */
   bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
   unsigned int refcount;   /* Reference counter for this item.  */
+  unsigned int nbytes;     /* Bytes accounted for this item.  */
   u32 kid_h;               /* Upper 4 bytes of the keyid.  */
   u32 kid_l;               /* Lower 4 bytes of the keyid.  */
 } *key_item_t;
 
 static key_item_t *key_table;            /* Hash table with the keys.    */
 static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
 static unsigned int key_table_added;     /* Number of items added.       */
 static unsigned int key_table_dropped;   /* Number of items dropped.     */
 static key_item_t key_item_attic;        /* List of freed items.         */
+static key_item_t key_lru_head;          /* Most recently used item.     */
+static key_item_t key_lru_tail;          /* Least recently used item.    */
+
+
+/* The accounting for the size bound of the cache.  Blobs and key
+ * items are kept in separate LRU lists; to decide which list to
+ * evict from the LAST_USED stamps of their tails are compared.  */
+static size_t cache_max_bytes;       /* Configured size of the cache.  */
+static size_t cache_bytes;           /* Bytes used by cached items.    */
+static unsigned long cache_clock;    /* Incremented with each use.     */
+static unsigned long cache_hits;     /* Searches answered by the cache. */
+static unsigned long cache_misses;   /* Searches not in the cache.     */
+static unsigned long cache_evictions;/* Items evicted due to the size. */
+
 
 
 
-
 /* The hash function we use for the key_table.  Must not call a system
  * function.  */
 static inline unsigned int
 blob_table_hasher (const unsigned char *ubid)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_uint (ubid) % blob_table_size;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the blob table with NBUCKETS buckets.  */
 static gpg_error_t
-blob_table_init (void)
+blob_table_init (size_t nbuckets)
 {
   if (blob_table)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
+  blob_table_size = nbuckets;
   blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
@@ -167,40 +192,191 @@ blob_unref (blob_t blob)
 }
 
 
+/* Remove BLOB from the LRU list.  */
+static void
+blob_lru_unlink (blob_t blob)
+{
+  if (blob->lru_prev)
+    blob->lru_prev->lru_next = blob->lru_next;
+  else
+    blob_lru_head = blob->lru_next;
+  if (blob->lru_next)
+    blob->lru_next->lru_prev = blob->lru_prev;
+  else
+    blob_lru_tail = blob->lru_prev;
+  blob->lru_prev = blob->lru_next = NULL;
+}
+
+
+/* Put BLOB at the head of the LRU list.  */
+static void
+blob_lru_push (blob_t blob)
+{
+  blob->lru_prev = NULL;
+  blob->lru_next = blob_lru_head;
+  if (blob_lru_head)
+    blob_lru_head->lru_prev = blob;
+  else
+    blob_lru_tail = blob;
+  blob_lru_head = blob;
+  blob->last_used = ++cache_clock;
+}
+
+
+/* Remove BLOB from the cache and drop the reference held by the
+ * cache.  */
+static void
+blob_table_remove (blob_t blob)
+{
+  blob_t *bp;
+
+  for (bp = &blob_table[blob_table_hasher (blob->ubid)]; *bp;
+       bp = &(*bp)->next)
+    if (*bp == blob)
+      {
+        *bp = blob->next;
+        break;
+      }
+  blob->next = NULL;
+  blob_lru_unlink (blob);
+  cache_bytes -= sizeof *blob + blob->datalen;
+  blob_table_dropped++;
+  blob_unref (blob);
+}
+
+
 /* Given the hash value and the ubid, find the blob in the bucket.
- * Returns NULL if not found or the blob item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  */
+ * Returns NULL if not found or the blob item if found.  */
 static blob_t
-find_blob (unsigned int hash, const unsigned char *ubid,
-           unsigned int *r_count)
+find_blob (unsigned int hash, const unsigned char *ubid)
 {
   blob_t b;
-  unsigned int count = 0;
 
-  for (b = blob_table[hash]; b; b = b->next, count++)
+  for (b = blob_table[hash]; b; b = b->next)
     if (!memcmp (b->ubid, ubid, UBID_LEN))
       break;
-  if (r_count)
-    *r_count = count;
   return b;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* The hash function we use for the key_table.  Must not call a system
+ * function.  */
+static inline unsigned int
+key_table_hasher (u32 kid_l)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  return kid_l % key_table_size;
+}
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
+
+/* Runtime allocation of the key table with NBUCKETS buckets.  */
+static gpg_error_t
+key_table_init (size_t nbuckets)
+{
+  if (key_table)
     return 0;
+  key_table_size = nbuckets;
+  key_table = xtrycalloc (key_table_size, sizeof *key_table);
+  if (!key_table)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+/* Free a key_item.  This is done by moving it to the attic list.  */
+static void
+key_item_unref (key_item_t ki)
+{
+  bloblist_t bl, bl2;
+
+  if (!ki)
+    return;
+  log_assert (ki->refcount);
+  if (!--ki->refcount)
+    {
+      bl = ki->blist;
+      ki->blist = NULL;
+      ki->next = key_item_attic;
+      key_item_attic = ki;
+
+      if (bl)
+        {
+          for (bl2 = bl; bl2->next; bl2 = bl2->next)
+            ;
+          bl2->next = bloblist_attic;
+          bloblist_attic = bl;
+        }
+    }
+}
+
+
+/* Remove KI from the LRU list.  */
+static void
+key_lru_unlink (key_item_t ki)
+{
+  if (ki->lru_prev)
+    ki->lru_prev->lru_next = ki->lru_next;
+  else
+    key_lru_head = ki->lru_next;
+  if (ki->lru_next)
+    ki->lru_next->lru_prev = ki->lru_prev;
+  else
+    key_lru_tail = ki->lru_prev;
+  ki->lru_prev = ki->lru_next = NULL;
+}
+
+
+/* Put KI at the head of the LRU list.  */
+static void
+key_lru_push (key_item_t ki)
+{
+  ki->lru_prev = NULL;
+  ki->lru_next = key_lru_head;
+  if (key_lru_head)
+    key_lru_head->lru_prev = ki;
   else
-    return 1;
+    key_lru_tail = ki;
+  key_lru_head = ki;
+  ki->last_used = ++cache_clock;
+}
+
+
+/* Remove KI from the cache and drop the reference held by the
+ * cache.  */
+static void
+key_table_remove (key_item_t ki)
+{
+  key_item_t *kp;
+
+  for (kp = &key_table[key_table_hasher (ki->kid_l)]; *kp;
+       kp = &(*kp)->next)
+    if (*kp == ki)
+      {
+        *kp = ki->next;
+        break;
+      }
+  ki->next = NULL;
+  key_lru_unlink (ki);
+  cache_bytes -= ki->nbytes;
+  key_table_dropped++;
+  key_item_unref (ki);
+}
+
+
+/* Evict the least recently used items until NEEDED more bytes fit
+ * into the cache.  Note that no system calls are done.  */
+static void
+make_room (size_t needed)
+{
+  while (cache_bytes + needed > cache_max_bytes
+         && (blob_lru_tail || key_lru_tail))
+    {
+      if (blob_lru_tail
+          && (!key_lru_tail
+              || blob_lru_tail->last_used <= key_lru_tail->last_used))
+        blob_table_remove (blob_lru_tail);
+      else
+        key_table_remove (key_lru_tail);
+      cache_evictions++;
+    }
 }
 
 
@@ -208,16 +384,20 @@ compare_blobs (const void *arg_a, const void *arg_b)
  * the index.  If it is already in the cache nothing happens.  */
 static void
 blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
+                int is_ephemeral, int is_revoked,
                 const void *blobdata, unsigned int blobdatalen)
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
+  if (sizeof *b + blobdatalen > cache_max_bytes)
+    return;  /* Too large for the cache.  */
+
   hash = blob_table_hasher (ubid);
  find_again:
-  b = find_blob (hash, ubid, &count);
+  b = find_blob (hash, ubid);
   if (b)
     {
       xfree (blobdatacopy);
@@ -237,72 +417,6 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       memcpy (blobdatacopy, blobdata, blobdatalen);
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
-    }
-
   /* Add an item to the bucket.  We allocate a whole block of items
    * for cache performance reasons.  */
   if (!blob_attic)
@@ -330,19 +444,25 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       goto find_again;
     }
 
+  /* If the cache is full evict the least recently used items.  */
+  make_room (sizeof *b + blobdatalen);
+
   /* We now know that there is an item in the attic.  Put it into the
    * chain.  Note that we may not use any system call here. */
   b = blob_attic;
   blob_attic = b->next;
   b->next = NULL;
   b->pktype = pktype;
+  b->is_ephemeral = !!is_ephemeral;
+  b->is_revoked = !!is_revoked;
   b->data = blobdatacopy;
   b->datalen = blobdatalen;
   memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
   b->refcount = 1;
   b->next = blob_table[hash];
   blob_table[hash] = b;
+  blob_lru_push (b);
+  cache_bytes += sizeof *b + blobdatalen;
   blob_table_added++;
 }
 
@@ -356,10 +476,11 @@ blob_table_get (const unsigned char *ubid)
   blob_t b;
 
   hash = blob_table_hasher (ubid);
-  b = find_blob (hash, ubid, NULL);
+  b = find_blob (hash, ubid);
   if (b)
     {
-      b->usecount++;
+      blob_lru_unlink (b);
+      blob_lru_push (b);
       b->refcount++;
       return b;  /* Found  */
     }
@@ -368,96 +489,21 @@ blob_table_get (const unsigned char *ubid)
 }
 
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
-static inline unsigned int
-key_table_hasher (u32 kid_l)
-{
-  return kid_l % key_table_size;
-}
-
-
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
-static gpg_error_t
-key_table_init (void)
-{
-  if (key_table)
-    return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
-  key_table = xtrycalloc (key_table_size, sizeof *key_table);
-  if (!key_table)
-    return gpg_error_from_syserror ();
-  return 0;
-}
-
-/* Free a key_item.  This is done by moving it to the attic list.  */
-static void
-key_item_unref (key_item_t ki)
-{
-  bloblist_t bl, bl2;
-
-  if (!ki)
-    return;
-  log_assert (ki->refcount);
-  if (!--ki->refcount)
-    {
-      bl = ki->blist;
-      ki->blist = NULL;
-      ki->next = key_item_attic;
-      key_item_attic = ki;
-
-      if (bl)
-        {
-          for (bl2 = bl; bl2->next; bl2 = bl2->next)
-            ;
-          bl2->next = bloblist_attic;
-          bloblist_attic = bl;
-        }
-    }
-}
-
 
 /* Given the hash value and the search info, find the key item in the
- * bucket.  Return NULL if not found or the key item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  Note that FPR may only be NULL
- * if FPRLEN is 0. */
+ * bucket.  Return NULL if not found or the key item if found.  */
 static key_item_t
-find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
-               unsigned int *r_count)
+find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l)
 {
   key_item_t ki = key_table[hash];
-  unsigned int count = 0;
 
-  for (; ki; ki = ki->next, count++)
+  for (; ki; ki = ki->next)
     if (ki->kid_h == kid_h && ki->kid_l == kid_l)
       break;
-  if (r_count)
-    *r_count = count;
   return ki;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
-{
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
-}
-
-
 /* Allocate new key items.  They are put to the attic so that the
  * caller can take them from there.  On allocation failure a note
  * is printed and an error returned.  */
@@ -545,85 +591,6 @@ new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
-{
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
-
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
-    {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
-
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
-}
-
-
 /* This is the core of
  *   key_table_put,
  *   key_table_put_no_fpr,
@@ -637,14 +604,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   unsigned int hash;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
   int do_find_again;
   int mark_not_found = !fpr;
 
   hash = key_table_hasher (kid_l);
  find_again:
   do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  ki = find_in_chain (hash, kid_h, kid_l);
   if (ki)
     {
       if (mark_not_found)
@@ -674,17 +640,15 @@ do_key_table_put (u32 kid_h, u32 kid_l,
       else
         ki->blist = bl;
 
+      /* We do not evict anything here because that might hit KI
+       * itself; the next new item will make room.  */
+      ki->nbytes += sizeof *bl;
+      cache_bytes += sizeof *bl;
+      key_lru_unlink (ki);
+      key_lru_push (ki);
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
   if (!key_item_attic)
     {
       if (alloc_more_key_items ())
@@ -702,24 +666,32 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   if (do_find_again)
     goto find_again;
 
+  /* If the cache is full evict the least recently used items.  */
+  make_room (sizeof *ki + (mark_not_found? 0 : sizeof *bl));
+
   /* We now know that there are items in the attics.  Put them into
    * the chain.  Note that we may not use any system call here. */
   ki = key_item_attic;
   key_item_attic = ki->next;
   ki->next = NULL;
 
+  ki->nbytes = sizeof *ki;
   if (mark_not_found)
     ki->blist = NULL;
   else
-    ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
+    {
+      ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
+      ki->nbytes += sizeof *ki->blist;
+    }
 
   ki->kid_h = kid_h;
   ki->kid_l = kid_l;
-  ki->usecount = 1;
   ki->refcount = 1;
 
   ki->next = key_table[hash];
   key_table[hash] = ki;
+  key_lru_push (ki);
+  cache_bytes += ki->nbytes;
   key_table_added++;
 }
 
@@ -793,10 +765,11 @@ key_table_get (u32 kid_h, u32 kid_l)
   key_item_t ki;
 
   hash = key_table_hasher (kid_l);
-  ki = find_in_chain (hash, kid_h, kid_l, NULL);
+  ki = find_in_chain (hash, kid_h, kid_l);
   if (ki)
     {
-      ki->usecount++;
+      key_lru_unlink (ki);
+      key_lru_push (ki);
       ki->refcount++;
       return ki;  /* Found  */
     }
@@ -846,19 +819,68 @@ query_by_fpr (const unsigned char *fpr, unsigned int fprlen)
 
 
 
-/* Make sure the tables are initialized.  */
+/* Make sure the tables are initialized.  DBSIZE is the size of the
+ * database file in bytes or 0 if not known; it is used to size the
+ * cache unless the size has been configured.  */
 gpg_error_t
-be_cache_initialize (void)
+be_cache_initialize (size_t dbsize)
 {
   gpg_error_t err;
+  size_t nbuckets;
+
+  if (blob_table && key_table)
+    return 0;
+
+  if (opt.cache_size)
+    {
+      /* Take care not to overflow a 32 bit size_t.  */
+      if (opt.cache_size > SIZE_MAX / 1024)
+        cache_max_bytes = SIZE_MAX / 1024 * 1024;
+      else
+        cache_max_bytes = (size_t)opt.cache_size * 1024;
+    }
+  else
+    {
+      /* The blobs are the bulk of a database but we also need room
+       * for the key items.  */
+      cache_max_bytes = dbsize + dbsize / 2;
+      if (cache_max_bytes < CACHE_MIN_BYTES)
+        cache_max_bytes = CACHE_MIN_BYTES;
+      else if (cache_max_bytes > CACHE_DEFAULT_MAX_BYTES)
+        cache_max_bytes = CACHE_DEFAULT_MAX_BYTES;
+    }
 
-  err = blob_table_init ();
-  if (!err)
-    err = key_table_init ();
+  nbuckets = cache_max_bytes / EXPECTED_BYTES_PER_BLOB;
+  if (nbuckets < MIN_NO_OF_BUCKETS)
+    nbuckets = MIN_NO_OF_BUCKETS;
+  else if (nbuckets > MAX_NO_OF_BUCKETS)
+    nbuckets = MAX_NO_OF_BUCKETS;
+  nbuckets |= 1;
+
+  err = blob_table_init (nbuckets);
+  if (!err) /* A keyblock has usually a primary key and a subkey.  */
+    err = key_table_init (2 * nbuckets + 1);
+  if (!err && opt.verbose)
+    log_info ("cache: using up to %zu KiB with %zu buckets\n",
+              cache_max_bytes / 1024, nbuckets);
   return err;
 }
 
 
+/* Store a copy of the cache statistics at R_STATS.  */
+void
+be_cache_get_stats (struct kbxd_cache_stats_s *r_stats)
+{
+  r_stats->hits = cache_hits;
+  r_stats->misses = cache_misses;
+  r_stats->evictions = cache_evictions;
+  r_stats->blobs = blob_table_added - blob_table_dropped;
+  r_stats->keys = key_table_added - key_table_dropped;
+  r_stats->bytes = cache_bytes;
+  r_stats->max_bytes = cache_max_bytes;
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
@@ -877,7 +899,7 @@ be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
   hd->backend_id = be_new_backend_id ();
 
   /* Just in case make sure we are initialized.  */
-  err = be_cache_initialize ();
+  err = be_cache_initialize (0);
   if (err)
     goto leave;
 
@@ -1079,6 +1101,10 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
     err = gpg_error (GPG_ERR_EOF);
 
  leave:
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    cache_misses++;
+  else if (!err || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    cache_hits++;
   return err;
 }
 
@@ -1134,15 +1160,24 @@ be_cache_mark_final (ctrl_t ctrl, db_request_t request)
 }
 
 
-/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.  */
+/* Put the key (BLOB,BLOBLEN) of PUBKEY_TYPE into the cache.
+ * IS_EPHEMERAL and IS_REVOKED are the flags of the key as returned
+ * by the backend.  */
 void
 be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                  const void *blob, unsigned int bloblen,
-                 enum pubkey_types pubkey_type)
+                 enum pubkey_types pubkey_type,
+                 int is_ephemeral, int is_revoked)
 {
   gpg_error_t err;
 
-  (void)ctrl;
+  /* Building a snapshot reads all keys; don't let them evict the
+   * keys in actual use.  */
+  if (ctrl->snapshot_builder)
+    return;
+
+  blob_table_put (ubid, pubkey_type, is_ephemeral, is_revoked,
+                  blob, bloblen);
 
   if (pubkey_type == PUBKEY_TYPE_OPGP)
     {
@@ -1157,8 +1192,6 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
           return;
         }
 
-      blob_table_put (ubid, pubkey_type, blob, bloblen);
-
       kinfo = &info.primary;
       key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 0);
       if (info.nsubkeys)
@@ -1199,3 +1232,65 @@ be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
         }
     }
 }
+
+
+/* Return the key with UBID from the cache via be_return_pubkey.
+ * This is used by the frontend to answer a search by UBID without
+ * asking the actual database.  Returns 0 on success or GPG_ERR_EOF
+ * if the key is not cached or the ephemeral flag or the key type
+ * filter of CTRL excludes it.  */
+gpg_error_t
+be_cache_get_by_ubid (ctrl_t ctrl, const unsigned char *ubid)
+{
+  gpg_error_t err;
+  blob_t b;
+
+  if (!blob_table)
+    return gpg_error (GPG_ERR_EOF);
+
+  b = blob_table_get (ubid);
+  if (!b)
+    {
+      cache_misses++;
+      return gpg_error (GPG_ERR_EOF);
+    }
+  /* Leave keys hidden from this client to the database.  */
+  if ((b->is_ephemeral && !ctrl->ephemeral)
+      || ((ctrl->filter_opgp || ctrl->filter_x509)
+          && !(ctrl->filter_opgp && b->pktype == PUBKEY_TYPE_OPGP)
+          && !(ctrl->filter_x509 && b->pktype == PUBKEY_TYPE_X509)))
+    {
+      blob_unref (b);
+      return gpg_error (GPG_ERR_EOF);
+    }
+  cache_hits++;
+  err = be_return_pubkey (ctrl, b->data, b->datalen, b->pktype, ubid,
+                          b->is_ephemeral, b->is_revoked, 0, 0);
+  blob_unref (b);
+  return err;
+}
+
+
+/* Remove the key with UBID from the cache.  This must be called
+ * before the key is changed or deleted in the database.  */
+void
+be_cache_forget (const unsigned char *ubid)
+{
+  blob_t b;
+
+  if (!blob_table)
+    return;
+
+  b = find_blob (blob_table_hasher (ubid), ubid);
+  if (b)
+    blob_table_remove (b);
+}
+
+
+/* Remove all keys from the cache.  */
+void
+be_cache_forget_all (void)
+{
+  while (blob_lru_tail)
+    blob_table_remove (blob_lru_tail);
+}
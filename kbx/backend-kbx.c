@@ -188,6 +188,9 @@ be_kbx_add_resource (ctrl_t ctrl, backend_handle_t *r_hd,
       goto leave;
     }
 
+  /* We are the only user of the keybox and the frontend serializes
+   * the searches with the updates; thus we can update in place.  */
+  keybox_set_update_in_place (1);
   err = keybox_register_file (filename, 0, &token);
   if (err)
     goto leave;
@@ -282,7 +285,7 @@ be_kbx_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
       err = be_return_pubkey (ctrl, buffer, buflen, pubkey_type, ubid,
                               0, 0, 0, 0);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, buffer, buflen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, buffer, buflen, pubkey_type, 0, 0);
       xfree (buffer);
     }
 
@@ -456,3 +459,24 @@ be_kbx_delete (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request)
  leave:
   return err;
 }
+
+
+/* Do one step of the incremental compaction of the keybox.  BUDGET
+ * is the number of bytes to move at most.  R_DONE is set to true if
+ * there is nothing left to compact.  The caller must hold the write
+ * lock.  */
+gpg_error_t
+be_kbx_compact (backend_handle_t backend_hd, size_t budget, int *r_done)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE kbx_hd;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_KBX);
+
+  kbx_hd = keybox_new_openpgp (backend_hd->token, 0);
+  if (!kbx_hd)
+    return gpg_error_from_syserror ();
+  err = keybox_compact_step (kbx_hd, budget, r_done);
+  be_kbx_release_kbx_hd (kbx_hd);
+  return err;
+}
@@ -51,6 +51,9 @@ struct be_sqlite_local_s
   /* The statement object of the current select command.  */
   sqlite3_stmt *select_stmt;
 
+  /* The read-only connection of this request or NULL.  */
+  sqlite3 *reader_hd;
+
   /* The column numbers for UIDNO and SUBKEY or 0.  */
   int select_col_uidno;
   int select_col_subkey;
@@ -62,6 +65,9 @@ struct be_sqlite_local_s
   unsigned int filter_opgp : 1;
   unsigned int filter_x509 : 1;
 
+  /* The current select command uses the userid_fts table.  */
+  unsigned int select_fts : 1;
+
   /* Flag indicating that LASTUBID has a value.  */
   unsigned int lastubid_valid : 1;
 
@@ -82,17 +88,45 @@ struct be_sqlite_local_s
 };
 
 
-/* The Mutex we use to protect all our SQLite calls.  */
+/* The Mutex we use to protect all our SQLite calls on DATABASE_HD.  */
 static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
-/* The one and only database handle. */
+/* The one and only database handle for writing. */
 static sqlite3 *database_hd;
+/* The name of the database file; required to open the readers.  */
+static char *database_fname;
+
+/* Searches outside of a global transaction use their own read-only
+ * connection so that they do not need DATABASE_MUTEX.  With the
+ * database in WAL mode they see the last committed state and may run
+ * in parallel to each other and to the writer.  READERS_ENABLED is
+ * set if WAL mode is active and SQLite is thread-safe.  Connections
+ * returned by a request are kept in IDLE_READERS for reuse.  */
+#define MAX_IDLE_READERS 8
+static int readers_enabled;
+static npth_mutex_t reader_pool_mutex = NPTH_MUTEX_INITIALIZER;
+static sqlite3 *idle_readers[MAX_IDLE_READERS];
+static int n_idle_readers;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
 
 /* The version of our current database schema and the maximum version
  * supported without migration.  */
-#define DATABASE_VERSION 2
-#define DATABASE_VERSION_MAX 2
+#define DATABASE_VERSION 3
+#define DATABASE_VERSION_MAX 3
+
+/* The minimum SQLite version which provides the trigram tokenizer
+ * for FTS5.  */
+#define SQLITE_VERSION_TRIGRAM 3034000
+
+/* Flag indicating that the userid_fts table exists and is in sync
+ * with the userid table.  It is only changed while holding
+ * DATABASE_MUTEX and READER_POOL_MUTEX; reading requires one of them.
+ * Use get_userid_fts_enabled and set_userid_fts_enabled.  */
+static int userid_fts_enabled;
+
+/* Flag indicating that a transaction for a batch of stores is
+ * active; see be_sqlite_begin_batch.  Protected by DATABASE_MUTEX.  */
+static int batch_transaction;
 
 /* Table definitions for the database.  */
 static struct
@@ -158,6 +192,8 @@ static struct
 
    /* Table to allow fast access via user ids or mail addresses.  */
    { "CREATE TABLE IF NOT EXISTS userid ("
+     /* A stable row id used as the key for the userid_fts table.  */
+     "id   INTEGER PRIMARY KEY,"
      /* The full user id - for X.509 the Subject or altSubject.  */
      "uid  TEXT NOT NULL,"
      /* The mail address if available or NULL.  */
@@ -171,12 +207,15 @@ static struct
      "uidno INTEGER NOT NULL,"
      /* The Unique Blob ID (possibly truncated fingerprint).  */
      "ubid BLOB NOT NULL REFERENCES pubkey"
-     ")"  },
+     ")", "userid"  },
 
    /* Indices for the userid table.  */
-   { "CREATE INDEX IF NOT EXISTS userididx0 on userid (ubid)"     },
-   { "CREATE INDEX IF NOT EXISTS userididx1 on userid (uid)"      },
-   { "CREATE INDEX IF NOT EXISTS userididx3 on userid (addrspec)" },
+   { "CREATE INDEX IF NOT EXISTS userididx0 on userid (ubid)",
+     "userid-index" },
+   { "CREATE INDEX IF NOT EXISTS userididx1 on userid (uid)",
+     "userid-index" },
+   { "CREATE INDEX IF NOT EXISTS userididx3 on userid (addrspec)",
+     "userid-index" },
 
    /* Table to allow fast access via s/n + issuer DN  (X.509 only).  */
    { "CREATE TABLE IF NOT EXISTS issuer ("
@@ -187,10 +226,44 @@ static struct
      /* The Unique Blob ID (usually the truncated fingerprint).  */
      "ubid BLOB NOT NULL REFERENCES pubkey"
      ")"  },
-   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)" }
+   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)" },
+
+   /* Table with the results of signature verifications done by gpg.
+    * This is a cache; rows may be deleted at any time.  */
+   { "CREATE TABLE IF NOT EXISTS sigcache ("
+     /* The Unique Blob ID of the key carrying the signature.  This
+      * is not a reference because gpg verifies the signatures of a
+      * key before it is stored.  */
+     "ubid BLOB NOT NULL,"
+     /* The identifier of the verification as computed by gpg; that
+      * is a hash over the signed data, the signature and the key
+      * material of the signer.  */
+     "sigid BLOB NOT NULL,"
+     /* The fingerprint of the signer.  */
+     "signer BLOB NOT NULL,"
+     /* The result: 0 = bad signature, 1 = good signature.  */
+     "result INTEGER NOT NULL,"
+     "PRIMARY KEY (sigid, signer)"
+     ")", "sigcache" },
+   { "CREATE INDEX IF NOT EXISTS sigcacheidx0 on sigcache (ubid)",
+     "sigcache-index" },
+   { "CREATE INDEX IF NOT EXISTS sigcacheidx1 on sigcache (signer)",
+     "sigcache-index" }
 
   };
 
+/* The trigram index used for substring searches on user ids and
+ * mail addresses.  This is an external content table which takes the
+ * actual strings from the userid table; it is only used if the
+ * SQLite library provides FTS5 and the trigram tokenizer.  Trigram
+ * tables support LIKE with the same case folding as used for a plain
+ * table but do not need to scan all rows.  */
+static const char userid_fts_definition[] =
+  "CREATE VIRTUAL TABLE IF NOT EXISTS userid_fts USING fts5 ("
+  "uid, addrspec,"
+  "content='userid', content_rowid='id',"
+  "tokenize='trigram')";
+
 
 /*-- prototypes --*/
 static gpg_error_t get_config_value (const char *name, char **r_value);
@@ -221,6 +294,15 @@ release_mutex (void)
 }
 
 
+/* Return true if the store functions run within a transaction started
+ * by someone else.  The caller must hold DATABASE_MUTEX.  */
+static int
+in_outer_transaction (void)
+{
+  return opt.active_transaction || batch_transaction;
+}
+
+
 static void
 show_sqlstr (const char *sqlstr)
 {
@@ -322,12 +404,13 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the connection DB and return a
+ * statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
-                 sqlite3_stmt **r_stmt)
+run_sql_prepare_on (sqlite3 *db, const char *sqlstr,
+                    const char *extra, const char *extra2,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
@@ -341,7 +424,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (db, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -351,6 +434,15 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
 }
 
 
+/* Same as run_sql_prepare_on for the writer connection.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_on (database_hd, sqlstr, extra, extra2, r_stmt);
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -465,14 +557,22 @@ run_sql_step (sqlite3_stmt *stmt)
 
 /* Wrapper around sqlite3_step for use with select.  This version does
  * not print diags for SQLITE_DONE or SQLITE_ROW but returns them as
- * gpg error codes.  */
+ * gpg error codes.  Other threads may run while a statement on a
+ * reader connection is executed.  */
 static gpg_error_t
 run_sql_step_for_select (sqlite3_stmt *stmt)
 {
   gpg_error_t err;
   int res;
 
-  res = sqlite3_step (stmt);
+  if (sqlite3_db_handle (stmt) != database_hd)
+    {
+      npth_unprotect ();
+      res = sqlite3_step (stmt);
+      npth_protect ();
+    }
+  else
+    res = sqlite3_step (stmt);
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -628,7 +728,7 @@ migrate_from_v1_to_v2 (void)
         if (err)
           goto leave;
       }
-  err = set_config_value ("dbversion", STR2(DATABASE_VERSION));
+  err = set_config_value ("dbversion", "2");
   if (err)
     goto leave;
   err = run_sql_statement ("commit");
@@ -646,6 +746,204 @@ migrate_from_v1_to_v2 (void)
 }
 
 
+/* Migrate from database version 2 to 3.  We need to apply this change:
+ *        CREATE TABLE IF NOT EXISTS userid (
+ *    +     id   INTEGER PRIMARY KEY,
+ *          uid  TEXT NOT NULL,
+ * The implicit rowid of a table may change with a VACUUM and thus it
+ * can't be used as the key for the userid_fts table.  As with the
+ * previous migration this requires copying the table.  The
+ * userid_fts table itself is created later by setup_userid_fts.  The
+ * function is only called from create_or_open_database but it is
+ * guaranteed that the database is open.
+ */
+static gpg_error_t
+migrate_from_v2_to_v3 (void)
+{
+  gpg_error_t err;
+  int idx;
+  const char *origsql = NULL;
+  char *sql = NULL;
+  int intransaction = 0;
+
+  log_info ("migrating database from version 2 to version 3\n");
+  for (idx=0; idx < DIM(table_definitions); idx++)
+    if (table_definitions[idx].name
+        && !strcmp (table_definitions[idx].name, "userid"))
+      {
+        origsql = table_definitions[idx].sql;
+        break;
+      }
+  log_assert (origsql);
+  sql = replace_substr (origsql, " userid ", " userid_new ");
+  if (!sql)
+    return gpg_error_from_syserror ();
+
+  err = run_sql_statement ("begin transaction");
+  if (err)
+    goto leave;
+  intransaction = 1;
+  err = run_sql_statement (sql);
+  if (err)
+    goto leave;
+  err = run_sql_statement ("INSERT"
+                           " INTO userid_new(uid,addrspec,type,uidno,ubid)"
+                           " SELECT uid,addrspec,type,uidno,ubid FROM userid");
+  if (err)
+    goto leave;
+  err = run_sql_statement ("DROP TABLE userid");
+  if (err)
+    goto leave;
+  err = run_sql_statement ("ALTER TABLE userid_new RENAME TO userid");
+  if (err)
+    goto leave;
+  for (idx=0; idx < DIM(table_definitions); idx++)
+    if (table_definitions[idx].name
+        && !strcmp (table_definitions[idx].name, "userid-index"))
+      {
+        err = run_sql_statement (table_definitions[idx].sql);
+        if (err)
+          goto leave;
+      }
+  err = set_config_value ("userid-fts", "0");
+  if (err)
+    goto leave;
+  err = set_config_value ("dbversion", "3");
+  if (err)
+    goto leave;
+  err = run_sql_statement ("commit");
+  if (err)
+    goto leave;
+  intransaction = 0;
+  log_info ("database migration succeeded\n");
+
+
+ leave:
+  if (intransaction && run_sql_statement ("rollback"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  xfree (sql);
+  return err;
+}
+
+
+/* Create the userid_fts table if SQLite supports it and make sure
+ * that it is in sync with the userid table.  The config value
+ * "userid-fts" tells whether the index has been maintained by all
+ * previous writers; an instance without FTS5 support resets it so
+ * that the next instance with support rebuilds the index.  On return
+ * USERID_FTS_ENABLED tells whether the index may be used.  The
+ * function is only called from create_or_open_database.  */
+static void
+set_userid_fts_enabled (int yes)
+{
+  npth_mutex_lock (&reader_pool_mutex);
+  userid_fts_enabled = yes;
+  npth_mutex_unlock (&reader_pool_mutex);
+}
+
+/* Return USERID_FTS_ENABLED for a search on the connection DB.  */
+static int
+get_userid_fts_enabled (sqlite3 *db)
+{
+  int yes;
+
+  if (db == database_hd)
+    return userid_fts_enabled;  /* We hold DATABASE_MUTEX.  */
+
+  npth_mutex_lock (&reader_pool_mutex);
+  yes = userid_fts_enabled;
+  npth_mutex_unlock (&reader_pool_mutex);
+  return yes;
+}
+
+
+static gpg_error_t
+setup_userid_fts (void)
+{
+  gpg_error_t err;
+  char *value;
+  int insync;
+  int intransaction = 0;
+  int res;
+  char *errmsg = NULL;
+
+  set_userid_fts_enabled (0);
+
+  err = get_config_value ("userid-fts", &value);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      insync = 0;
+      err = 0;
+    }
+  else if (err)
+    return err;
+  else
+    insync = (atoi (value) == 1);
+  xfree (value);
+
+  /* We use sqlite3_exec here to avoid error diagnostics for a
+   * missing fts5 module or trigram tokenizer.  The select makes sure
+   * that an existing table can actually be used.  */
+  if (sqlite3_libversion_number () < SQLITE_VERSION_TRIGRAM)
+    res = SQLITE_ERROR;
+  else
+    res = sqlite3_exec (database_hd, userid_fts_definition,
+                        NULL, NULL, &errmsg);
+  if (!res)
+    res = sqlite3_exec (database_hd, "SELECT rowid FROM userid_fts WHERE 0",
+                        NULL, NULL, &errmsg);
+  if (res)
+    {
+      if (opt.verbose)
+        log_info ("trigram index not available: %s\n",
+                  errmsg? errmsg : "SQLite too old");
+      sqlite3_free (errmsg);
+      if (insync)
+        err = set_config_value ("userid-fts", "0");
+      return err;
+    }
+
+  if (!insync)
+    {
+      log_info ("building the trigram index for user ids\n");
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        goto leave;
+      intransaction = 1;
+      err = run_sql_statement ("INSERT INTO userid_fts(userid_fts)"
+                               " VALUES('rebuild')");
+      if (err)
+        goto leave;
+      err = set_config_value ("userid-fts", "1");
+      if (err)
+        goto leave;
+      err = run_sql_statement ("commit");
+      if (err)
+        goto leave;
+      intransaction = 0;
+    }
+  set_userid_fts_enabled (1);
+
+ leave:
+  if (intransaction && run_sql_statement ("rollback"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  return err;
+}
+
+
+
+/* Callback for the journal_mode pragma.  */
+static int
+journal_mode_cb (void *opaque, int ncols, char **values, char **names)
+{
+  int *r_wal = opaque;
+
+  (void)names;
+
+  *r_wal = (ncols > 0 && values[0] && !strcmp (values[0], "wal"));
+  return 0;
+}
+
 
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
@@ -660,6 +958,7 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   int dbversion;
   int setdbversion = 0;
   int baddbversion = 0;
+  int walmode = 0;
 
   acquire_mutex ();
 
@@ -702,10 +1001,10 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
     }
 
   /* Database has not yet been opened.  Open or create it, make sure
-   * the tables exist, and prepare the required statements.  We use
-   * our own locking instead of the more complex serialization sqlite
-   * would have to do and it avoid that we call
-   * npth_unprotect/protect.  */
+   * the tables exist, and prepare the required statements.  For
+   * this writer connection we use our own locking instead of the
+   * more complex serialization sqlite would have to do and it avoid
+   * that we call npth_unprotect/protect.  */
   res = sqlite3_open_v2 (filename,
                          &database_hd,
                          (SQLITE_OPEN_READWRITE
@@ -721,6 +1020,24 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  /* Switch to WAL mode so that searches on the reader connections
+   * are neither blocked by nor block the writer.  The mode is
+   * persistent but we need to know whether it is in effect.  */
+  if (!sqlite3_threadsafe ())
+    log_info ("SQLite is not thread-safe - searches are serialized\n");
+  else if (sqlite3_exec (database_hd, "PRAGMA journal_mode=WAL",
+                         journal_mode_cb, &walmode, NULL) || !walmode)
+    {
+      log_info ("WAL mode not available - searches are serialized\n");
+      walmode = 0;
+    }
+  database_fname = xtrystrdup (filename);
+  if (!database_fname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
   /* Create the tables if needed.  */
   dbversion = 0; /* unknown.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
@@ -781,8 +1098,14 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
       if (!err)
         err = set_config_value ("created", isotimestamp (gnupg_get_time ()));
     }
-  else if (dbversion == 1 && DATABASE_VERSION == 2)
-    err = migrate_from_v1_to_v2 ();
+  else if (dbversion == 1 && DATABASE_VERSION == 3)
+    {
+      err = migrate_from_v1_to_v2 ();
+      if (!err)
+        err = migrate_from_v2_to_v3 ();
+    }
+  else if (dbversion == 2 && DATABASE_VERSION == 3)
+    err = migrate_from_v2_to_v3 ();
   else if (baddbversion)
     {
       log_info ("no migration procedure for this database version available\n");
@@ -794,6 +1117,10 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   if (err)
     goto leave;
 
+  err = setup_userid_fts ();
+  if (err)
+    goto leave;
+
 
  leave:
   if (err)
@@ -803,11 +1130,100 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
       dotlock_destroy (database_lock);
       database_lock = NULL;
     }
+  else
+    readers_enabled = walmode;
   release_mutex ();
   return err;
 }
 
 
+/* Take a read-only connection from the pool or open a new one and
+ * store it at R_DB.  */
+static gpg_error_t
+take_reader (sqlite3 **r_db)
+{
+  int res;
+  sqlite3 *db = NULL;
+
+  *r_db = NULL;
+
+  npth_mutex_lock (&reader_pool_mutex);
+  if (n_idle_readers)
+    db = idle_readers[--n_idle_readers];
+  npth_mutex_unlock (&reader_pool_mutex);
+
+  if (!db)
+    {
+      res = sqlite3_open_v2 (database_fname, &db,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                             NULL);
+      if (res)
+        {
+          log_error ("error opening '%s' for reading: %s\n",
+                     database_fname, sqlite3_errstr (res));
+          sqlite3_close (db);
+          return gpg_error (gpg_err_code_from_sqlite (res));
+        }
+      sqlite3_extended_result_codes (db, 1);
+      /* A reader may only see SQLITE_BUSY while the writer runs a
+       * recovery or a checkpoint.  */
+      sqlite3_busy_timeout (db, 10000);
+    }
+
+  *r_db = db;
+  return 0;
+}
+
+
+/* Return the read-only connection DB to the pool.  DB may be NULL.
+ * Statements still active on DB are reset so that the idle
+ * connection does not keep a read transaction open; such a
+ * transaction would pin an old snapshot and prevent checkpoints of
+ * the WAL.  Note that they can't be finalized because the FTS5
+ * module owns some of them.  */
+static void
+put_reader (sqlite3 *db)
+{
+  sqlite3_stmt *stmt = NULL;
+
+  if (!db)
+    return;
+
+  while ((stmt = sqlite3_next_stmt (db, stmt)))
+    if (sqlite3_stmt_busy (stmt))
+      sqlite3_reset (stmt);
+
+  npth_mutex_lock (&reader_pool_mutex);
+  if (n_idle_readers < MAX_IDLE_READERS && sqlite3_get_autocommit (db))
+    {
+      idle_readers[n_idle_readers++] = db;
+      db = NULL;
+    }
+  npth_mutex_unlock (&reader_pool_mutex);
+
+  sqlite3_close (db);  /* Pool is full or DB is not idle.  */
+}
+
+
+/* Close all idle read-only connections.  This is called at shutdown
+ * after all requests have been released.  */
+void
+be_sqlite_close_readers (void)
+{
+  sqlite3 *db;
+
+  for (;;)
+    {
+      npth_mutex_lock (&reader_pool_mutex);
+      db = n_idle_readers? idle_readers[--n_idle_readers] : NULL;
+      npth_mutex_unlock (&reader_pool_mutex);
+      if (!db)
+        break;
+      sqlite3_close (db);
+    }
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_sqlite_add_resource (ctrl_t ctrl, backend_handle_t *r_hd,
@@ -865,6 +1281,7 @@ be_sqlite_release_local (be_sqlite_local_t ctx)
 {
   if (ctx->select_stmt)
     sqlite3_finalize (ctx->select_stmt);
+  put_reader (ctx->reader_hd);
   xfree (ctx);
 }
 
@@ -905,6 +1322,53 @@ be_sqlite_commit (void)
 }
 
 
+/* Start a transaction for a batch of stores unless a global
+ * transaction is already active.  The caller must hold the write lock
+ * of the frontend until be_sqlite_end_batch has been called.  Unlike
+ * a global transaction this does not change OPT.  */
+gpg_error_t
+be_sqlite_begin_batch (void)
+{
+  gpg_error_t err;
+
+  if (!database_hd)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  acquire_mutex ();
+  if (in_outer_transaction ())
+    err = 0;
+  else
+    {
+      err = run_sql_statement ("begin transaction");
+      if (!err)
+        batch_transaction = 1;
+    }
+  release_mutex ();
+  return err;
+}
+
+
+/* End the transaction started by be_sqlite_begin_batch.  The changes
+ * are committed if COMMIT is true and rolled back otherwise.  */
+gpg_error_t
+be_sqlite_end_batch (int commit)
+{
+  gpg_error_t err = 0;
+
+  acquire_mutex ();
+  if (batch_transaction)
+    {
+      batch_transaction = 0;
+      if (commit)
+        err = run_sql_statement ("commit");
+      if ((!commit || err) && run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
+  release_mutex ();
+  return err;
+}
+
+
 /* Return a value from the config table.  NAME most not have quotes
  * etc.  If no error is returned the caller must xfree the value
  * stored at R_VALUE.  On error NULL is stored there.  */
@@ -972,10 +1436,10 @@ set_config_value (const char *name, const char *value)
 }
 
 
-/* Run a select for the search given by (DESC,NDESC).  The data is not
- * returned but stored in the request item.  */
+/* Run a select for the search given by (DESC,NDESC) on the connection
+ * DB.  The data is not returned but stored in the request item.  */
 static gpg_error_t
-run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
+run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx, sqlite3 *db,
                       KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   gpg_error_t err = 0;
@@ -984,6 +1448,7 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   unsigned char kidbuf[8];
   const char *s;
   size_t n;
+  int use_fts;
 
 
   descidx = ctx->descidx;
@@ -993,9 +1458,22 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       goto leave;
     }
 
+  /* The trigram index can't help with patterns shorter than a
+   * trigram; for those we stick to a plain LIKE.  */
+  use_fts = (get_userid_fts_enabled (db)
+             && (desc[descidx].mode == KEYDB_SEARCH_MODE_SUBSTR
+                 || desc[descidx].mode == KEYDB_SEARCH_MODE_MAILSUB)
+             && desc[descidx].u.name
+             && strlen (desc[descidx].u.name) >= 3);
+
   /* Check whether we can reuse the current select statement.  */
   if (!ctx->select_stmt)
     ;
+  else if (sqlite3_db_handle (ctx->select_stmt) != db)
+    {
+      sqlite3_finalize (ctx->select_stmt);
+      ctx->select_stmt = NULL;
+    }
   else if (ctx->select_mode != desc[descidx].mode)
     {
       sqlite3_finalize (ctx->select_stmt);
@@ -1008,10 +1486,16 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       sqlite3_finalize (ctx->select_stmt);
       ctx->select_stmt = NULL;
     }
+  else if (ctx->select_fts != use_fts)
+    {
+      sqlite3_finalize (ctx->select_stmt);
+      ctx->select_stmt = NULL;
+    }
 
   ctx->select_mode = desc[descidx].mode;
   ctx->filter_opgp = ctrl->filter_opgp;
   ctx->filter_x509 = ctrl->filter_x509;
+  ctx->select_fts = use_fts;
 
   /* Prepare the select and bind the parameters.  */
   if (ctx->select_stmt)
@@ -1044,22 +1528,24 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         {
           if (desc[descidx].mode == KEYDB_SEARCH_MODE_MAIL)
@@ -1097,12 +1583,24 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (ctx->select_stmt)
+        ;
+      else if (use_fts)
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.id IN"
+           " (SELECT rowid FROM userid_fts"
+           "  WHERE addrspec LIKE ?1)",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -1110,12 +1608,24 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (ctx->select_stmt)
+        ;
+      else if (use_fts)
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.id IN"
+           " (SELECT rowid FROM userid_fts"
+           "  WHERE uid LIKE ?1)",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -1128,12 +1638,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob"
-                               " FROM pubkey as p, issuer as i"
-                               " WHERE p.ubid = i.ubid"
-                               " AND i.dn = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob"
+           " FROM pubkey as p, issuer as i"
+           " WHERE p.ubid = i.ubid"
+           " AND i.dn = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1149,13 +1660,14 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                                   " p.revoked, p.keyblob"
-                                   " FROM pubkey as p, issuer as i"
-                                   " WHERE p.ubid = i.ubid"
-                                   " AND i.sn = $1 AND i.dn = $2",
-                                   extra, " ORDER BY p.ubid",
-                                   &ctx->select_stmt);
+            err = run_sql_prepare_on
+              (db, "SELECT p.ubid, p.type, p.ephemeral,"
+               " p.revoked, p.keyblob"
+               " FROM pubkey as p, issuer as i"
+               " WHERE p.ubid = i.ubid"
+               " AND i.sn = $1 AND i.dn = $2",
+               extra, " ORDER BY p.ubid",
+               &ctx->select_stmt);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1175,12 +1687,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid"
-                               " AND u.uid = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid"
+           " AND u.uid = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1189,12 +1702,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND"
+           " substr(f.kid,5) = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
@@ -1204,11 +1718,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.kid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf),
@@ -1218,11 +1733,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.fpr = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.fpr, desc[descidx].fprlen);
@@ -1231,11 +1747,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1243,10 +1760,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
-                               " FROM pubkey as p"
-                               " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+        err = run_sql_prepare_on
+          (db, "SELECT ubid, type, ephemeral, revoked, keyblob"
+           " FROM pubkey as p"
+           " WHERE ubid = ?1",
+           extra, NULL, &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1264,10 +1782,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
-                                 " keyblob"
-                                 " FROM pubkey as p",
-                                 extra, NULL, &ctx->select_stmt);
+          err = run_sql_prepare_on
+            (db, "SELECT ubid, type, ephemeral, revoked,"
+             " keyblob"
+             " FROM pubkey as p",
+             extra, NULL, &ctx->select_stmt);
         }
       break;
 
@@ -1296,6 +1815,8 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  sqlite3 *db;
+  int use_reader;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
@@ -1304,14 +1825,31 @@ be_sqlite_search (ctrl_t ctrl,
   if (err)
     return err;
 
-  acquire_mutex ();
-
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
-    goto leave;
+    return err;
   ctx = part->besqlite;
 
+  /* A search within a global transaction needs to see the changes
+   * done so far and thus uses the writer connection.  A select in
+   * progress continues on its connection.  */
+  if (desc && ctx->select_done && ctx->select_stmt)
+    use_reader = (sqlite3_db_handle (ctx->select_stmt) != database_hd);
+  else
+    use_reader = (readers_enabled
+                  && !opt.in_transaction && !opt.active_transaction);
+  if (use_reader && !ctx->reader_hd)
+    {
+      err = take_reader (&ctx->reader_hd);
+      if (err)
+        return err;
+    }
+  db = use_reader? ctx->reader_hd : database_hd;
+
+  if (!use_reader)
+    acquire_mutex ();
+
   if (!desc)
     {
       /* Reset */
@@ -1331,7 +1869,7 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
   /* Start a global transaction if needed.  */
-  if (!opt.active_transaction && opt.in_transaction)
+  if (!use_reader && !opt.active_transaction && opt.in_transaction)
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1344,7 +1882,7 @@ be_sqlite_search (ctrl_t ctrl,
   if (!ctx->select_done)
     {
       /* Initial search - run the select.  */
-      err = run_select_statement (ctrl, ctx, desc, ndesc);
+      err = run_select_statement (ctrl, ctx, db, desc, ndesc);
       if (err)
         goto leave;
       ctx->select_done = 1;
@@ -1364,7 +1902,7 @@ be_sqlite_search (ctrl_t ctrl,
       int pk_no, uid_no;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1381,7 +1919,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1414,7 +1952,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1425,7 +1963,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1439,7 +1977,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1453,7 +1991,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1472,7 +2010,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1491,7 +2029,8 @@ be_sqlite_search (ctrl_t ctrl,
       err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
                               ubid, is_ephemeral, is_revoked, uid_no, pk_no);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type,
+                         is_ephemeral, is_revoked);
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
@@ -1509,7 +2048,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (!use_reader)
+    release_mutex ();
   return err;
 }
 
@@ -1643,6 +2183,13 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
     goto leave;
 
   err = run_sql_step (stmt);
+  if (err)
+    goto leave;
+
+  if (userid_fts_enabled)
+    err = run_sql_statement ("INSERT INTO userid_fts(rowid,uid,addrspec)"
+                             " SELECT id,uid,addrspec FROM userid"
+                             " WHERE id = last_insert_rowid()");
 
  leave:
   if (stmt)
@@ -1652,6 +2199,25 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
 }
 
 
+/* Helper for be_sqlite_store and be_sqlite_delete to delete all rows
+ * of the userid table for UBID.  The userid_fts table needs the old
+ * values to remove them from the index.  */
+static gpg_error_t
+delete_from_userid (const unsigned char *ubid)
+{
+  gpg_error_t err = 0;
+
+  if (userid_fts_enabled)
+    err = run_sql_statement_bind_ubid
+      ("INSERT INTO userid_fts(userid_fts,rowid,uid,addrspec)"
+       " SELECT 'delete',id,uid,addrspec FROM userid WHERE ubid = ?1", ubid);
+  if (!err)
+    err = run_sql_statement_bind_ubid
+      ("DELETE FROM userid WHERE ubid = ?1", ubid);
+  return err;
+}
+
+
 /* Helper for be_sqlite_store to update or insert a row in the
  * issuer table.  */
 static gpg_error_t
@@ -1757,7 +2323,7 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     goto leave;
   /* ctx = part->besqlite; */
 
-  if (!opt.active_transaction)
+  if (!in_outer_transaction ())
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1771,14 +2337,21 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
   if (err)
     goto leave;
 
+  /* The keys of this keyblock may have changed; thus forget the
+   * verification results of all signatures they issued.  */
+  err = run_sql_statement_bind_ubid
+    ("DELETE FROM sigcache WHERE signer IN"
+     " (SELECT fpr FROM fingerprint WHERE ubid = ?1)", ubid);
+  if (err)
+    goto leave;
+
   /* Delete all related rows so that we can freshly add possibly added
    * or changed user ids and subkeys.  */
   err = run_sql_statement_bind_ubid
     ("DELETE FROM fingerprint WHERE ubid = ?1", ubid);
   if (err)
     goto leave;
-  err = run_sql_statement_bind_ubid
-    ("DELETE FROM userid WHERE ubid = ?1", ubid);
+  err = delete_from_userid (ubid);
   if (err)
     goto leave;
   if (cert)
@@ -1909,15 +2482,15 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
  leave:
   if (in_transaction && !err)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else
         err = run_sql_statement ("commit");
     }
   else if (in_transaction)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else if (run_sql_statement ("rollback"))
         log_error ("Warning: database rollback failed - should not happen!\n");
     }
@@ -1960,7 +2533,7 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
     goto leave;
   /* ctx = part->besqlite; */
 
-  if (!opt.active_transaction)
+  if (!in_outer_transaction ())
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1971,7 +2544,10 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
   in_transaction = 1;
 
   err = run_sql_statement_bind_ubid
-    ("DELETE from userid WHERE ubid = ?1", ubid);
+    ("DELETE FROM sigcache WHERE ubid = ?1 OR signer IN"
+     " (SELECT fpr FROM fingerprint WHERE ubid = ?1)", ubid);
+  if (!err)
+    err = delete_from_userid (ubid);
   if (!err)
     err = run_sql_statement_bind_ubid
       ("DELETE from fingerprint WHERE ubid = ?1", ubid);
@@ -1989,15 +2565,15 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
 
   if (in_transaction && !err)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else
         err = run_sql_statement ("commit");
     }
   else if (in_transaction)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else if (run_sql_statement ("rollback"))
         log_error ("Warning: database rollback failed - should not happen!\n");
     }
@@ -2036,7 +2612,7 @@ be_sqlite_putkeyflag (ctrl_t ctrl, backend_handle_t backend_hd,
     goto leave;
   /* ctx = part->besqlite; */
 
-  if (!opt.active_transaction)
+  if (!in_outer_transaction ())
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -2074,18 +2650,206 @@ be_sqlite_putkeyflag (ctrl_t ctrl, backend_handle_t backend_hd,
 
   if (in_transaction && !err)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
+      else
+        err = run_sql_statement ("commit");
+    }
+  else if (in_transaction)
+    {
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
+      else if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
+  release_mutex ();
+  return err;
+}
+
+
+/* Call CB for each cached signature verification result of the key
+ * specified by UBID.  The arguments passed to CB are OPAQUE, the
+ * SIGID, the RESULT and the fingerprint (FPR,FPRLEN) of the signer.
+ * BACKEND_HD is the handle for this backend.  */
+gpg_error_t
+be_sqlite_get_sigcache (ctrl_t ctrl, backend_handle_t backend_hd,
+                        const unsigned char *ubid,
+                        gpg_error_t (*cb)(void *opaque,
+                                          const unsigned char *sigid,
+                                          int result,
+                                          const unsigned char *fpr,
+                                          size_t fprlen),
+                        void *opaque)
+{
+  gpg_error_t err;
+  sqlite3 *db = NULL;
+  sqlite3_stmt *stmt = NULL;
+  int use_reader;
+  const unsigned char *sigid, *fpr;
+  size_t fprlen;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+
+  err = create_or_open_database (ctrl, backend_hd->filename);
+  if (err)
+    return err;
+
+  /* See be_sqlite_search for the use of the reader connections.  */
+  use_reader = (readers_enabled
+                && !opt.in_transaction && !opt.active_transaction);
+  if (use_reader)
+    {
+      err = take_reader (&db);
+      if (err)
+        return err;
+    }
+  else
+    {
+      acquire_mutex ();
+      db = database_hd;
+    }
+
+  err = run_sql_prepare_on (db, "SELECT sigid, result, signer FROM sigcache"
+                            " WHERE ubid = ?1", NULL, NULL, &stmt);
+  if (err)
+    goto leave;
+  err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (err)
+    goto leave;
+
+  while (gpg_err_code (err = run_sql_step_for_select (stmt))
+         == GPG_ERR_SQL_ROW)
+    {
+      sigid = sqlite3_column_blob (stmt, 0);
+      fpr = sqlite3_column_blob (stmt, 2);
+      fprlen = sqlite3_column_bytes (stmt, 2);
+      if (!sigid || sqlite3_column_bytes (stmt, 0) != SIGCACHE_SIGID_LEN
+          || !fpr || !fprlen || fprlen > 255)
+        continue;  /* Ignore invalid rows.  */
+      err = cb (opaque, sigid, !!sqlite3_column_int (stmt, 1), fpr, fprlen);
+      if (err)
+        goto leave;
+    }
+  if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = 0;
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+  if (use_reader)
+    put_reader (db);
+  else
+    release_mutex ();
+  return err;
+}
+
+
+/* Store the signature verification results from (DATA,DATALEN) which
+ * is a sequence of records
+ *
+ *   ubid   - UBID_LEN bytes
+ *   sigid  - SIGCACHE_SIGID_LEN bytes
+ *   result - 1 byte; 0 = bad signature, 1 = good signature
+ *   fprlen - 1 byte
+ *   fpr    - FPRLEN bytes
+ *
+ * Existing rows are replaced.  BACKEND_HD is the handle for this
+ * backend.  The number of stored records is stored at R_NSTORED.  */
+gpg_error_t
+be_sqlite_put_sigcache (ctrl_t ctrl, backend_handle_t backend_hd,
+                        const unsigned char *data, size_t datalen,
+                        unsigned int *r_nstored)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  int in_transaction = 0;
+  const unsigned char *p;
+  size_t n, fprlen;
+
+  *r_nstored = 0;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+
+  /* First check the records so that we don't need to rollback.  */
+  for (p = data, n = datalen; n; p += fprlen, n -= fprlen)
+    {
+      if (n < UBID_LEN + SIGCACHE_SIGID_LEN + 2)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+      p += UBID_LEN + SIGCACHE_SIGID_LEN;
+      n -= UBID_LEN + SIGCACHE_SIGID_LEN;
+      if (p[0] > 1)
+        return gpg_error (GPG_ERR_INV_VALUE);
+      fprlen = p[1];
+      p += 2;
+      n -= 2;
+      if (!fprlen || fprlen > n)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+    }
+
+  err = create_or_open_database (ctrl, backend_hd->filename);
+  if (err)
+    return err;
+
+  acquire_mutex ();
+
+  if (!in_outer_transaction ())
+    {
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        goto leave;
+      if (opt.in_transaction)
+        opt.active_transaction = 1;
+    }
+  in_transaction = 1;
+
+  err = run_sql_prepare ("INSERT OR REPLACE INTO sigcache"
+                         "(ubid,sigid,signer,result) VALUES(?1,?2,?3,?4)",
+                         NULL, NULL, &stmt);
+  if (err)
+    goto leave;
+
+  for (p = data, n = datalen; n; p += fprlen, n -= fprlen)
+    {
+      fprlen = p[UBID_LEN + SIGCACHE_SIGID_LEN + 1];
+      err = run_sql_bind_blob (stmt, 1, p, UBID_LEN);
+      if (!err)
+        err = run_sql_bind_blob (stmt, 2, p + UBID_LEN, SIGCACHE_SIGID_LEN);
+      if (!err)
+        err = run_sql_bind_blob (stmt, 3, p + UBID_LEN + SIGCACHE_SIGID_LEN + 2,
+                                 fprlen);
+      if (!err)
+        err = run_sql_bind_int (stmt, 4, p[UBID_LEN + SIGCACHE_SIGID_LEN]);
+      if (!err)
+        err = run_sql_step (stmt);
+      if (!err)
+        err = run_sql_reset (stmt);
+      if (err)
+        goto leave;
+      (*r_nstored)++;
+      p += UBID_LEN + SIGCACHE_SIGID_LEN + 2;
+      n -= UBID_LEN + SIGCACHE_SIGID_LEN + 2;
+    }
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+
+  if (in_transaction && !err)
+    {
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else
         err = run_sql_statement ("commit");
     }
   else if (in_transaction)
     {
-      if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+      if (in_outer_transaction ())
+        ; /* We are in a global or batch transaction.  */
       else if (run_sql_statement ("rollback"))
         log_error ("Warning: database rollback failed - should not happen!\n");
     }
+  if (err && !in_outer_transaction ())
+    *r_nstored = 0;
   release_mutex ();
   return err;
 }
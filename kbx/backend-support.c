@@ -30,6 +30,7 @@
 #include "../common/tlv.h"
 #include "backend.h"
 #include "keybox-defs.h"
+#include "kbx-snapshot.h"
 
 
 /* Common definition part of all backend handle.  All definitions of
@@ -114,6 +115,7 @@ be_release_request (db_request_t req)
       be_sqlite_release_local (part->besqlite);
       xfree (part);
     }
+  xfree (req->pending.data);
 }
 
 
@@ -162,12 +164,11 @@ be_find_request_part (backend_handle_t backend_hd, db_request_t request,
 }
 
 
-/* Return the public key (BUFFER,BUFLEN) which has the type
- * PUBKEY_TYPE to the caller.  */
-gpg_error_t
-be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
-                  enum pubkey_types pubkey_type, const unsigned char *ubid,
-                  int is_ephemeral, int is_revoked, int uid_no, int pk_no)
+/* Send the public key (BUFFER,BUFLEN) to the client.  */
+static gpg_error_t
+send_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
+             enum pubkey_types pubkey_type, const unsigned char *ubid,
+             int is_ephemeral, int is_revoked, int uid_no, int pk_no)
 {
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
@@ -179,15 +180,74 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
                             is_revoked?   'r':'-',
                             uid_no, pk_no);
   if (err)
-    goto leave;
+    return err;
 
   if (ctrl->no_data_return)
-    err = 0;
-  else
-    err = kbxd_write_data_line (ctrl, buffer, buflen);
+    return 0;
+  return kbxd_write_data_line (ctrl, buffer, buflen);
+}
 
- leave:
-  return err;
+
+/* Return the public key (BUFFER,BUFLEN) which has the type
+ * PUBKEY_TYPE to the caller.  While a snapshot is built the key is
+ * instead added to the snapshot.  Within a request the key is only
+ * copied; see be_send_pending_pubkey.  */
+gpg_error_t
+be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
+                  enum pubkey_types pubkey_type, const unsigned char *ubid,
+                  int is_ephemeral, int is_revoked, int uid_no, int pk_no)
+{
+  db_request_t request = ctrl->db_req;
+
+  if (ctrl->snapshot_builder)
+    {
+      if (pubkey_type != PUBKEY_TYPE_OPGP)
+        return 0;
+      return kbx_snapshot_builder_add (ctrl->snapshot_builder,
+                                       ubid, buffer, buflen);
+    }
+
+  if (!request)
+    return send_pubkey (ctrl, buffer, buflen, pubkey_type, ubid,
+                        is_ephemeral, is_revoked, uid_no, pk_no);
+
+  if (ctrl->no_data_return)
+    buflen = 0;
+  if (buflen > request->pending.datasize)
+    {
+      void *p = xtryrealloc (request->pending.data, buflen);
+      if (!p)
+        return gpg_error_from_syserror ();
+      request->pending.data = p;
+      request->pending.datasize = buflen;
+    }
+  if (buflen)
+    memcpy (request->pending.data, buffer, buflen);
+  request->pending.datalen = buflen;
+  request->pending.pubkey_type = pubkey_type;
+  memcpy (request->pending.ubid, ubid, UBID_LEN);
+  request->pending.is_ephemeral = !!is_ephemeral;
+  request->pending.is_revoked = !!is_revoked;
+  request->pending.uid_no = uid_no;
+  request->pending.pk_no = pk_no;
+  request->pending.valid = 1;
+  return 0;
+}
+
+
+/* Send the key stored by be_return_pubkey in REQUEST to the client.
+ * This is a nop if no key is pending.  */
+gpg_error_t
+be_send_pending_pubkey (ctrl_t ctrl, db_request_t request)
+{
+  if (!request || !request->pending.valid)
+    return 0;
+  request->pending.valid = 0;
+  return send_pubkey (ctrl, request->pending.data, request->pending.datalen,
+                      request->pending.pubkey_type, request->pending.ubid,
+                      request->pending.is_ephemeral,
+                      request->pending.is_revoked,
+                      request->pending.uid_no, request->pending.pk_no);
 }
 
 
@@ -78,6 +78,7 @@ struct db_request_s
 {
   unsigned int any_search:1;  /* Any search has been done.  */
   unsigned int any_found:1;   /* Any object has been found.  */
+  unsigned int ubid_cached:1; /* The UBID search was answered by the cache.  */
   unsigned int last_cached_valid:1; /* see below */
   unsigned int last_cached_final:1; /* see below */
   unsigned int last_cached_fprlen:8;/* see below */
@@ -96,6 +97,23 @@ struct db_request_s
   u32 last_cached_kid_h;
   u32 last_cached_kid_l;
   unsigned char last_cached_fpr[32];
+
+  /* The object found by the last search.  be_return_pubkey stores a
+   * copy here and the frontend sends it to the client using
+   * be_send_pending_pubkey after the database lock has been released.
+   * DATA is kept allocated for the next search.  */
+  struct {
+    unsigned int valid:1;
+    unsigned int is_ephemeral:1;
+    unsigned int is_revoked:1;
+    enum pubkey_types pubkey_type;
+    unsigned char ubid[UBID_LEN];
+    int uid_no;
+    int pk_no;
+    void *data;
+    size_t datalen;
+    size_t datasize;   /* Allocated size of DATA.  */
+  } pending;
 };
 
 
@@ -113,6 +131,7 @@ gpg_error_t be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
                               const unsigned char *ubid,
                               int is_ephemeral, int is_revoked,
                               int uidno, int pkno);
+gpg_error_t be_send_pending_pubkey (ctrl_t ctrl, db_request_t request);
 int be_is_x509_blob (const unsigned char *blob, size_t bloblen);
 gpg_error_t be_ubid_from_blob (const void *blob, size_t bloblen,
                                enum pubkey_types *r_pktype, char *r_ubid);
@@ -121,7 +140,9 @@ gpg_error_t be_get_x509_keygrip (ksba_cert_t cert, unsigned char *keygrip);
 
 
 /*-- backend-cache.c --*/
-gpg_error_t be_cache_initialize (void);
+struct kbxd_cache_stats_s;
+gpg_error_t be_cache_initialize (size_t dbsize);
+void be_cache_get_stats (struct kbxd_cache_stats_s *r_stats);
 gpg_error_t be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd);
 void be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd);
 gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
@@ -130,9 +151,13 @@ gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
 void be_cache_mark_final (ctrl_t ctrl, db_request_t request);
 void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       const void *blob, unsigned int bloblen,
-                      enum pubkey_types pubkey_type);
+                      enum pubkey_types pubkey_type,
+                      int is_ephemeral, int is_revoked);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+gpg_error_t be_cache_get_by_ubid (ctrl_t ctrl, const unsigned char *ubid);
+void be_cache_forget (const unsigned char *ubid);
+void be_cache_forget_all (void);
 
 
 /*-- backend-kbx.c --*/
@@ -156,6 +181,8 @@ gpg_error_t be_kbx_update (ctrl_t ctrl, backend_handle_t backend_hd,
                            const void *blob, size_t bloblen);
 gpg_error_t be_kbx_delete (ctrl_t ctrl, backend_handle_t backend_hd,
                            db_request_t request);
+gpg_error_t be_kbx_compact (backend_handle_t backend_hd, size_t budget,
+                            int *r_done);
 
 
 /*-- backend-sqlite.c --*/
@@ -166,7 +193,10 @@ void be_sqlite_release_resource (ctrl_t ctrl, backend_handle_t hd);
 gpg_error_t be_sqlite_init_local (backend_handle_t backend_hd,
                                   db_request_part_t part);
 void be_sqlite_release_local (be_sqlite_local_t ctx);
+void be_sqlite_close_readers (void);
 gpg_error_t be_sqlite_rollback (void);
+gpg_error_t be_sqlite_begin_batch (void);
+gpg_error_t be_sqlite_end_batch (int commit);
 gpg_error_t be_sqlite_commit (void);
 gpg_error_t be_sqlite_search (ctrl_t ctrl, backend_handle_t hd,
                               db_request_t request,
@@ -182,6 +212,17 @@ gpg_error_t be_sqlite_putkeyflag (ctrl_t ctrl, backend_handle_t backend_hd,
                                   db_request_t request,
                                   const unsigned char *ubid,
                                   unsigned int flags, int clear);
+gpg_error_t be_sqlite_get_sigcache (ctrl_t ctrl, backend_handle_t backend_hd,
+                                    const unsigned char *ubid,
+                                    gpg_error_t (*cb)(void *opaque,
+                                                 const unsigned char *sigid,
+                                                 int result,
+                                                 const unsigned char *fpr,
+                                                 size_t fprlen),
+                                    void *opaque);
+gpg_error_t be_sqlite_put_sigcache (ctrl_t ctrl, backend_handle_t backend_hd,
+                                    const unsigned char *data, size_t datalen,
+                                    unsigned int *r_nstored);
 
 
 #endif /*KBX_BACKEND_H*/
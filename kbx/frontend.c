@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -30,6 +33,8 @@
 #include "../common/userids.h"
 #include "backend.h"
 #include "frontend.h"
+#include "kbx-snapshot.h"
+#include "kbx-rwlock.h"
 
 
 /* An object to keep infos about the database.  */
@@ -40,13 +45,28 @@ struct
 } the_database;
 
 
+/* The reader/writer lock for all backends.  */
+static struct kbx_rwlock_s db_lock = KBX_RWLOCK_INITIALIZER;
+
+
+/* The state of the published snapshot.  */
+static struct
+{
+  char *fname;                   /* Name of the snapshot file.  */
+  unsigned long long generation; /* Generation of the published file.  */
+  unsigned int published : 1;    /* The file has been published.  */
+  unsigned int dirty : 1;        /* The database has been changed.  */
+} snapshot;
+
+
 
 /* Take a lock for reading the databases.  */
 static void
 take_read_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  log_assert (!ctrl->db_locked);
+  kbx_rwlock_read (&db_lock);
+  ctrl->db_locked = 1;
 }
 
 
@@ -54,8 +74,9 @@ take_read_lock (ctrl_t ctrl)
 static void
 take_read_write_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  log_assert (!ctrl->db_locked);
+  kbx_rwlock_write (&db_lock);
+  ctrl->db_locked = 2;
 }
 
 
@@ -64,8 +85,27 @@ take_read_write_lock (ctrl_t ctrl)
 static void
 release_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  if (!ctrl->db_locked)
+    return;
+
+  kbx_rwlock_release (&db_lock, ctrl->db_locked == 2);
+  ctrl->db_locked = 0;
+}
+
+
+/* Store a copy of the lock statistics at R_STATS.  */
+void
+kbxd_get_lock_stats (struct kbxd_lock_stats_s *r_stats)
+{
+  kbx_rwlock_get_stats (&db_lock, r_stats);
+}
+
+
+/* Store a copy of the cache statistics at R_STATS.  */
+void
+kbxd_get_cache_stats (struct kbxd_cache_stats_s *r_stats)
+{
+  be_cache_get_stats (r_stats);
 }
 
 
@@ -83,6 +123,7 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   enum database_types db_type = 0;
   backend_handle_t handle = NULL;
   unsigned int n;
+  struct stat sb;
 
   /* Do tilde expansion etc. */
   if (strchr (filename_arg, DIRSEP_C)
@@ -105,8 +146,10 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
       goto leave;
     }
 
-  /* Init the cache.  */
-  err = be_cache_initialize ();
+  /* Init the cache; its size depends on the size of the database.  */
+  if (gnupg_stat (filename, &sb))
+    sb.st_size = 0;
+  err = be_cache_initialize (sb.st_size > 0? (size_t)sb.st_size : 0);
   if (err)
     goto leave;
 
@@ -149,6 +192,14 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   the_database.backend_handle = handle;
   handle = NULL;
 
+  /* A snapshot left behind by a former instance can't be trusted.  */
+  snapshot.fname = make_filename (gnupg_homedir (), GNUPG_PUBLIC_KEYS_DIR,
+                                  KBX_SNAPSHOT_NAME, NULL);
+  kbx_snapshot_mark_stale (snapshot.fname);
+  gnupg_remove (snapshot.fname);
+  snapshot.generation = (unsigned long long)gnupg_get_time () << 16;
+  snapshot.dirty = 1;
+
  leave:
   if (err)
     {
@@ -173,9 +224,163 @@ kbxd_release_session_info (ctrl_t ctrl)
 
 
 
+/* Note that the database is going to be changed.  This marks the
+ * published snapshot as stale so that clients will ask us again.
+ * The caller must hold the write lock.  */
+static void
+invalidate_snapshot (void)
+{
+  gpg_error_t err;
+
+  snapshot.dirty = 1;
+  if (!snapshot.published)
+    return;
+
+  err = kbx_snapshot_mark_stale (snapshot.fname);
+  if (err)
+    log_error ("error invalidating snapshot '%s': %s\n",
+               snapshot.fname, gpg_strerror (err));
+}
+
+
+/* Build and publish a new snapshot if the database has been changed.
+ * This is called periodically by the snapshot thread.  */
+void
+kbxd_update_snapshot (void)
+{
+  gpg_error_t err;
+  ctrl_t ctrl;
+  KEYDB_SEARCH_DESC desc;
+  kbx_snapshot_builder_t builder = NULL;
+
+  if (!snapshot.fname || !snapshot.dirty || opt.in_transaction)
+    return;
+
+  ctrl = xtrycalloc (1, sizeof *ctrl);
+  if (!ctrl)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  ctrl->magic = SERVER_CONTROL_MAGIC;
+  ctrl->filter_opgp = 1;
+  err = kbx_snapshot_builder_new (&builder);
+  if (err)
+    goto leave;
+  ctrl->snapshot_builder = builder;
+
+  /* Any change from now on makes this snapshot useless.  */
+  snapshot.dirty = 0;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  err = kbxd_search (ctrl, &desc, 1, 1);
+  while (!err)
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      err = kbxd_search (ctrl, &desc, 1, 0);
+    }
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    goto leave;
+
+  /* The read lock keeps writers out while we check for changes and
+   * replace the file.  */
+  take_read_lock (ctrl);
+  if (snapshot.dirty || opt.in_transaction)
+    err = 0;  /* Try again later.  */
+  else
+    {
+      err = kbx_snapshot_builder_write (builder, snapshot.fname,
+                                        snapshot.generation + 1);
+      if (!err)
+        {
+          snapshot.generation++;
+          snapshot.published = 1;
+          if (DBG_CACHE)
+            log_debug ("published snapshot %llu\n", snapshot.generation);
+        }
+    }
+  release_lock (ctrl);
+
+ leave:
+  if (err)
+    {
+      log_error ("error publishing snapshot '%s': %s\n",
+                 snapshot.fname, gpg_strerror (err));
+      snapshot.dirty = 1;
+    }
+  if (ctrl)
+    kbxd_release_session_info (ctrl);
+  xfree (ctrl);
+  kbx_snapshot_builder_release (builder);
+}
+
+
+/* Return true if a snapshot has been published and store its
+ * generation at R_GENERATION.  */
+int
+kbxd_get_snapshot_info (unsigned long long *r_generation)
+{
+  *r_generation = snapshot.generation;
+  return snapshot.published;
+}
+
+
+/* Invalidate and remove the published snapshot.  This is called at
+ * shutdown.  */
+void
+kbxd_remove_snapshot (void)
+{
+  if (!snapshot.published)
+    return;
+  kbx_snapshot_mark_stale (snapshot.fname);
+  gnupg_remove (snapshot.fname);
+  snapshot.published = 0;
+}
+
+
+/* Release the resources of the database which are not bound to a
+ * request.  This is called at shutdown.  */
+void
+kbxd_close_database (void)
+{
+  if (the_database.db_type == DB_TYPE_SQLITE)
+    be_sqlite_close_readers ();
+}
+
+
+/* Do one step of the incremental compaction of the database.  This is
+ * called periodically by the compaction thread.  */
+void
+kbxd_compact (void)
+{
+  gpg_error_t err;
+  struct server_control_s ctrl;
+  int done;
+
+  if (the_database.db_type != DB_TYPE_KBX || opt.in_transaction)
+    return;
+
+  memset (&ctrl, 0, sizeof ctrl);
+  ctrl.magic = SERVER_CONTROL_MAGIC;
+  take_read_write_lock (&ctrl);
+  err = be_kbx_compact (the_database.backend_handle, 1024*1024, &done);
+  /* The content did not change but the blobs moved; this spoils a
+   * snapshot which is currently being built.  */
+  if (!err && !done)
+    snapshot.dirty = 1;
+  release_lock (&ctrl);
+
+  if (!err && !done && DBG_CACHE)
+    log_debug ("compacted the database\n");
+}
+
+
 gpg_error_t
 kbxd_rollback (void)
 {
+  /* Keys read within the transaction may have been cached.  */
+  be_cache_forget_all ();
   return be_sqlite_rollback ();
 }
 
@@ -183,6 +388,9 @@ kbxd_rollback (void)
 gpg_error_t
 kbxd_commit (void)
 {
+  /* Other connections may have cached the old versions of keys
+   * changed within the transaction.  */
+  be_cache_forget_all ();
   return be_sqlite_commit ();
 }
 
@@ -333,6 +541,7 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
       request->any_search = 0;
       request->any_found = 0;
+      request->ubid_cached = 0;
       request->next_dbidx = 0;
       if (!desc) /* Reset only mode */
         {
@@ -341,6 +550,32 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
     }
 
+  /* A UBID identifies at most one key; thus the cache can answer the
+   * first search and the continuation of a search by UBID.  */
+  if (ndesc == 1 && desc[0].mode == KEYDB_SEARCH_MODE_UBID
+      && the_database.db_type != DB_TYPE_CACHE && !ctrl->snapshot_builder)
+    {
+      if (request->ubid_cached)
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+      if (!request->any_search)
+        {
+          err = be_cache_get_by_ubid (ctrl, desc[0].u.ubid);
+          if (!err)
+            {
+              request->any_search = 1;
+              request->any_found = 1;
+              request->ubid_cached = 1;
+              goto leave;
+            }
+          if (gpg_err_code (err) != GPG_ERR_EOF)
+            goto leave;
+          err = 0;
+        }
+    }
+
   /* Divert to the backend for the actual search.  */
   switch (the_database.db_type)
     {
@@ -394,7 +629,15 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
 
 
  leave:
+  /* Send the result only after releasing the lock so that a slow
+   * client does not block writers.  */
   release_lock (ctrl);
+  if (ctrl->db_req)
+    {
+      if (!err)
+        err = be_send_pending_pubkey (ctrl, ctrl->db_req);
+      ctrl->db_req->pending.valid = 0;
+    }
   if (DBG_CLOCK)
     log_clock ("%s: leave (%s)", __func__, err? "not found" : "found");
   return err;
@@ -402,11 +645,11 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
 
 
 
-/* Store; that is insert or update the key (BLOB,BLOBLEN).  MODE
- * controls whether only updates or only inserts are allowed.  */
-gpg_error_t
-kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
-            enum kbxd_store_modes mode)
+/* Worker for kbxd_store and kbxd_store_batch.  The caller must hold
+ * the write lock.  */
+static gpg_error_t
+store_one (ctrl_t ctrl, const void *blob, size_t bloblen,
+           enum kbxd_store_modes mode)
 {
   gpg_error_t err;
   db_request_t request;
@@ -414,11 +657,6 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   enum pubkey_types pktype;
   int insert = 0;
 
-  if (DBG_CLOCK)
-    log_clock ("%s: enter", __func__);
-
-  take_read_write_lock (ctrl);
-
   /* Allocate a handle object if none exists for this context.  */
   if (!ctrl->db_req)
     {
@@ -442,6 +680,7 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   err = be_ubid_from_blob (blob, bloblen, &pktype, ubid);
   if (err)
     goto leave;
+  be_cache_forget ((unsigned char *)ubid);
 
   if (the_database.db_type == DB_TYPE_KBX)
     {
@@ -486,9 +725,87 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
+ leave:
+  return err;
+}
+
+
+/* Store; that is insert or update the key (BLOB,BLOBLEN).  MODE
+ * controls whether only updates or only inserts are allowed.  */
+gpg_error_t
+kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
+            enum kbxd_store_modes mode)
+{
+  gpg_error_t err;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: enter", __func__);
+
+  take_read_write_lock (ctrl);
+  invalidate_snapshot ();
+  err = store_one (ctrl, blob, bloblen, mode);
+  release_lock (ctrl);
+
+  if (DBG_CLOCK)
+    log_clock ("%s: leave", __func__);
+  return err;
+}
+
+
+/* Store the NBLOBS keys given by the arrays BLOBS and BLOBLENS using
+ * MODE as with kbxd_store.  The write lock is taken only once and,
+ * unless the client already started a transaction, all keys are
+ * stored in one transaction; thus on error none of the keys is
+ * stored.  In a global transaction the keys stored before the error
+ * are kept.  The number of stored keys is stored at R_NSTORED and on
+ * error the index of the failed key at R_FAILED.  */
+gpg_error_t
+kbxd_store_batch (ctrl_t ctrl, const void **blobs, const size_t *bloblens,
+                  unsigned int nblobs, enum kbxd_store_modes mode,
+                  unsigned int *r_nstored, unsigned int *r_failed)
+{
+  gpg_error_t err = 0;
+  unsigned int n = 0;
+  int own_transaction = 0;
+
+  *r_nstored = 0;
+  *r_failed = nblobs;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: enter", __func__);
+
+  take_read_write_lock (ctrl);
+  invalidate_snapshot ();
+
+  if (the_database.db_type == DB_TYPE_SQLITE && !opt.in_transaction)
+    {
+      err = be_sqlite_begin_batch ();
+      if (err)
+        goto leave;
+      own_transaction = 1;
+    }
+
+  for (n=0; n < nblobs; n++)
+    {
+      err = store_one (ctrl, blobs[n], bloblens[n], mode);
+      if (err)
+        {
+          *r_failed = n;
+          break;
+        }
+    }
+
+  if (own_transaction)
+    {
+      gpg_error_t err2 = be_sqlite_end_batch (!err);
+      if (!err)
+        err = err2;
+    }
+  *r_nstored = (err && own_transaction)? 0 : n;
 
  leave:
   release_lock (ctrl);
+
   if (DBG_CLOCK)
     log_clock ("%s: leave", __func__);
   return err;
@@ -508,6 +825,7 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
     log_clock ("%s: enter", __func__);
 
   take_read_write_lock (ctrl);
+  invalidate_snapshot ();
 
   /* Allocate a handle object if none exists for this context.  */
   if (!ctrl->db_req)
@@ -528,6 +846,7 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       goto leave;
     }
 
+  be_cache_forget (ubid);
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -579,6 +898,7 @@ kbxd_putkeyflag (ctrl_t ctrl, const unsigned char *ubid,
     log_clock ("%s: enter", __func__);
 
   take_read_write_lock (ctrl);
+  invalidate_snapshot ();
 
   /* Allocate a handle object if none exists for this context.  */
   if (!ctrl->db_req)
@@ -599,6 +919,7 @@ kbxd_putkeyflag (ctrl_t ctrl, const unsigned char *ubid,
       goto leave;
     }
 
+  be_cache_forget (ubid);
   if (the_database.db_type == DB_TYPE_SQLITE)
     {
       err = be_sqlite_putkeyflag (ctrl, the_database.backend_handle, request, ubid,
@@ -618,3 +939,74 @@ kbxd_putkeyflag (ctrl_t ctrl, const unsigned char *ubid,
     log_clock ("%s: leave", __func__);
   return err;
 }
+
+
+/* Call CB for each cached signature verification result of the key
+ * specified by UBID.  See be_sqlite_get_sigcache for the arguments
+ * of CB.  */
+gpg_error_t
+kbxd_get_sigcache (ctrl_t ctrl, const unsigned char *ubid,
+                   gpg_error_t (*cb)(void *opaque,
+                                     const unsigned char *sigid, int result,
+                                     const unsigned char *fpr, size_t fprlen),
+                   void *opaque)
+{
+  gpg_error_t err;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: enter", __func__);
+
+  take_read_lock (ctrl);
+
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_get_sigcache (ctrl, the_database.backend_handle, ubid,
+                                  cb, opaque);
+  else
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  release_lock (ctrl);
+  if (DBG_CLOCK)
+    log_clock ("%s: leave", __func__);
+  return err;
+}
+
+
+/* Store the signature verification results (DATA,DATALEN) in the
+ * signature cache.  See be_sqlite_put_sigcache for the format.  The
+ * number of stored results is stored at R_NSTORED.  */
+gpg_error_t
+kbxd_put_sigcache (ctrl_t ctrl, const void *data, size_t datalen,
+                   unsigned int *r_nstored)
+{
+  gpg_error_t err;
+
+  *r_nstored = 0;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: enter", __func__);
+
+  /* The snapshot does not contain the cache; thus there is no need
+   * to invalidate it.  */
+  take_read_write_lock (ctrl);
+
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_put_sigcache (ctrl, the_database.backend_handle,
+                                  data, datalen, r_nstored);
+  else
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  release_lock (ctrl);
+  if (DBG_CLOCK)
+    log_clock ("%s: leave", __func__);
+  return err;
+}
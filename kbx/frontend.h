@@ -21,6 +21,20 @@
 #define KBX_FRONTEND_H
 
 #include "keybox-search-desc.h"
+#include "kbx-rwlock.h"  /* For struct kbxd_lock_stats_s.  */
+
+
+/* Statistics about the cache.  */
+struct kbxd_cache_stats_s
+{
+  unsigned long hits;           /* Lookups answered by the cache.  */
+  unsigned long misses;         /* Lookups not found in the cache.  */
+  unsigned long evictions;      /* Items evicted to stay within size.  */
+  unsigned long blobs;          /* Number of cached blobs.  */
+  unsigned long keys;           /* Number of cached key items.  */
+  size_t bytes;                 /* Bytes used by the cached items.  */
+  size_t max_bytes;             /* Configured size of the cache.  */
+};
 
 
 gpg_error_t kbxd_set_database (ctrl_t ctrl,
@@ -35,8 +49,29 @@ gpg_error_t kbxd_search (ctrl_t ctrl,
                          int reset);
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
+gpg_error_t kbxd_store_batch (ctrl_t ctrl,
+                              const void **blobs, const size_t *bloblens,
+                              unsigned int nblobs, enum kbxd_store_modes mode,
+                              unsigned int *r_nstored,
+                              unsigned int *r_failed);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
 gpg_error_t kbxd_putkeyflag (ctrl_t ctrl, const unsigned char *ubid,
                              unsigned int flags, int clear);
+void kbxd_get_lock_stats (struct kbxd_lock_stats_s *r_stats);
+void kbxd_get_cache_stats (struct kbxd_cache_stats_s *r_stats);
+void kbxd_update_snapshot (void);
+int kbxd_get_snapshot_info (unsigned long long *r_generation);
+void kbxd_remove_snapshot (void);
+void kbxd_close_database (void);
+void kbxd_compact (void);
+gpg_error_t kbxd_get_sigcache (ctrl_t ctrl, const unsigned char *ubid,
+                               gpg_error_t (*cb)(void *opaque,
+                                                 const unsigned char *sigid,
+                                                 int result,
+                                                 const unsigned char *fpr,
+                                                 size_t fprlen),
+                               void *opaque);
+gpg_error_t kbxd_put_sigcache (ctrl_t ctrl, const void *data, size_t datalen,
+                               unsigned int *r_nstored);
 
 #endif /*KBX_FRONTEND_H*/
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <npth.h>
 #include <assuan.h>
 
@@ -65,6 +67,14 @@ struct kbx_client_data_s
   size_t datalen;
   gpg_error_t dataerr;
 
+  /* Set if the data of length DATALEN has been passed as file
+   * descriptor which still needs to be received.  */
+  int data_in_fd;
+
+  /* Number of passed file descriptors which need to be discarded
+   * because their announcement has been overwritten.  */
+  unsigned int stale_fds;
+
   /* Helper variables in case D-lines are used (FP is NULL)  */
   char *dlinedata;
   size_t dlinedatalen;
@@ -154,6 +164,12 @@ prepare_data_pipe (kbx_client_data_t kcd)
   CloseHandle (inpipe);
 #else
   close (inpipe);
+  /* Large blobs are faster transferred by passing a file descriptor.
+   * Older keyboxd versions don't support this.  */
+  if (!assuan_transact (kcd->ctx, "OPTION blob-fd",
+                        NULL, NULL, NULL, NULL, NULL, NULL))
+    if (debug_client)
+      log_debug ("%s: keyboxd passes large blobs as fd\n", __func__);
 #endif
   kcd->fp = infp;
 
@@ -195,6 +211,7 @@ datastream_thread (void *arg)
   size_t nread, datalen;
   char *data = NULL;
   char *tmpdata;
+  int in_fd;
 
   if (debug_client)
     log_debug ("%s: started\n", __func__);
@@ -215,9 +232,20 @@ datastream_thread (void *arg)
       if (nread < 4)
         break;
 
+      in_fd = 0;
       datalen = buf32_to_size_t (lenbuf);
+      if (datalen == KBX_BLOB_FD_MARKER)
+        {
+          /* The data is passed as file descriptor via the Assuan
+           * connection; here we only get its length.  */
+          if (es_read (kcd->fp, lenbuf, 4, &nread) || nread < 4)
+            break;
+          datalen = buf32_to_size_t (lenbuf);
+          in_fd = 1;
+        }
       if (debug_client)
-        log_debug ("%s: keyboxd announced %zu bytes\n", __func__, datalen);
+        log_debug ("%s: keyboxd announced %zu bytes%s\n", __func__,
+                   datalen, in_fd? " (fd)":"");
       if (!datalen)
         {
           log_info ("ignoring empty blob received from keyboxd\n");
@@ -229,6 +257,10 @@ datastream_thread (void *arg)
           err = gpg_error (GPG_ERR_TOO_LARGE);
           /* Drop connection or what shall we do?  */
         }
+      else if (in_fd)
+        {
+          err = 0;  /* Received by kbx_client_data_wait.  */
+        }
       else if (!(data = xtrymalloc (datalen+1)))
         {
           err = gpg_error_from_syserror ();
@@ -260,9 +292,14 @@ datastream_thread (void *arg)
 
       /* Thread-safe assignment to the result var:  */
       tmpdata = kcd->data;
+      if (kcd->data_in_fd)
+        kcd->stale_fds++;
+      if (in_fd && err)
+        kcd->stale_fds++;
       kcd->data = data;
       kcd->datalen = datalen;
       kcd->dataerr = err;
+      kcd->data_in_fd = in_fd && !err;
       xfree (tmpdata);
       data = NULL;
 
@@ -375,12 +412,15 @@ kbx_client_data_simple (kbx_client_data_t kcd, const char *command)
 
 
 /* Send the COMMAND down to the keyboxd associated with KCD.
- * STATUS_CB and STATUS_CB_VALUE are the usual status callback as used
- * by assuan_transact.  After this function has returned success
+ * INQUIRE_CB and INQUIRE_CB_VALUE as well as STATUS_CB and
+ * STATUS_CB_VALUE are the usual inquire and status callbacks as used
+ * by assuan_transact; INQUIRE_CB may be NULL.  After this function has returned success
  * kbx_client_data_wait needs to be called to actually return the
  * data.  */
 gpg_error_t
 kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
+                     gpg_error_t (*inquire_cb)(void *opaque, const char *line),
+                     void *inquire_cb_value,
                      gpg_error_t (*status_cb)(void *opaque, const char *line),
                      void *status_cb_value)
 {
@@ -397,7 +437,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
         log_debug ("%s: sending command '%s'\n", __func__, command);
       err = assuan_transact (kcd->ctx, command,
                              NULL, NULL,
-                             NULL, NULL,
+                             inquire_cb, inquire_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
@@ -422,7 +462,7 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       init_membuf (&mb, 8192);
       err = assuan_transact (kcd->ctx, command,
                              put_membuf_cb, &mb,
-                             NULL, NULL,
+                             inquire_cb, inquire_cb_value,
                              status_cb, status_cb_value);
       if (err)
         {
@@ -450,6 +490,70 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
 
 
 
+/* Receive the blob of length DATALEN which the keyboxd passed as file
+ * descriptor and store it in a new buffer at R_DATA.  */
+static gpg_error_t
+receive_blob_fd (kbx_client_data_t kcd, size_t datalen, char **r_data)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)kcd;
+  (void)datalen;
+  *r_data = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else
+  gpg_error_t err = 0;
+  assuan_fd_t fd;
+  char *data;
+  size_t off;
+  ssize_t n;
+
+  *r_data = NULL;
+
+  /* Skip descriptors whose announcement we did not see.  */
+  for (; kcd->stale_fds; kcd->stale_fds--)
+    if (!assuan_receivefd (kcd->ctx, &fd))
+      close (fd);
+
+  err = assuan_receivefd (kcd->ctx, &fd);
+  if (err)
+    {
+      log_error ("error receiving blob fd from keyboxd: %s\n",
+                 gpg_strerror (err));
+      return err;
+    }
+
+  data = xtrymalloc (datalen+1);
+  if (!data)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (off = 0; off < datalen; off += n)
+    {
+      n = pread (fd, data + off, datalen - off, off);
+      if (n < 0 && errno == EINTR)
+        {
+          n = 0;
+          continue;
+        }
+      if (n <= 0)
+        {
+          err = n? gpg_error_from_syserror () : gpg_error (GPG_ERR_TOO_SHORT);
+          log_error ("error reading blob fd from keyboxd: %s\n",
+                     gpg_strerror (err));
+          xfree (data);
+          goto leave;
+        }
+    }
+  *r_data = data;
+
+ leave:
+  close (fd);
+  return err;
+#endif
+}
+
+
 /* Wait for the data from the server and on success return it at
  * (R_DATA, R_DATALEN). */
 gpg_error_t
@@ -462,8 +566,10 @@ kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
   *r_datalen = 0;
   if (kcd->fp)
     {
+      int in_fd;
+
       lock_datastream (kcd);
-      if (!kcd->data && !kcd->dataerr)
+      if (!kcd->data && !kcd->dataerr && !kcd->data_in_fd)
         {
           if (debug_client)
             log_debug ("%s: waiting on datastream_cond ...\n", __func__);
@@ -481,8 +587,17 @@ kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
       kcd->data = NULL;
       *r_datalen = kcd->datalen;
       err = err? err : kcd->dataerr;
+      in_fd = kcd->data_in_fd;
+      kcd->data_in_fd = 0;
 
       unlock_datastream (kcd);
+
+      if (!err && in_fd)
+        {
+          err = receive_blob_fd (kcd, *r_datalen, r_data);
+          if (err)
+            *r_datalen = 0;
+        }
     }
   else
     {
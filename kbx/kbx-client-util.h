@@ -22,6 +22,13 @@
 #define GNUPG_KBX_CLIENT_UTIL_H 1
 
 
+/* If the client has set the option "blob-fd", keyboxd passes blobs
+ * of at least this size as file descriptor.  In the output stream
+ * such a blob is announced by the marker value instead of the length
+ * which is then given by the next 4 bytes.  */
+#define KBX_BLOB_FD_THRESHOLD  (64*1024)
+#define KBX_BLOB_FD_MARKER     0xffffffff
+
 struct kbx_client_data_s;
 typedef struct kbx_client_data_s *kbx_client_data_t;
 
@@ -30,6 +37,9 @@ gpg_error_t kbx_client_data_new (kbx_client_data_t *r_kcd,
 void kbx_client_data_release (kbx_client_data_t kcd);
 gpg_error_t kbx_client_data_simple (kbx_client_data_t kcd, const char *command);
 gpg_error_t kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
+                                 gpg_error_t (*inquire_cb)(void *opaque,
+                                                           const char *line),
+                                 void *inquire_cb_value,
                                  gpg_error_t (*status_cb)(void *opaque,
                                                           const char *line),
                                  void *status_cb_value);
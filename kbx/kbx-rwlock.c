@@ -0,0 +1,156 @@
+/* kbx-rwlock.c - The reader/writer lock of keyboxd
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <npth.h>
+
+#include "keyboxd.h"
+#include "kbx-rwlock.h"
+
+
+/* Lock the mutex of LOCK.  */
+static void
+lock_mutex (kbx_rwlock_t lock)
+{
+  int res = npth_mutex_lock (&lock->mutex);
+  if (res)
+    log_fatal ("failed to acquire database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+
+/* Unlock the mutex of LOCK.  */
+static void
+unlock_mutex (kbx_rwlock_t lock)
+{
+  int res = npth_mutex_unlock (&lock->mutex);
+  if (res)
+    log_fatal ("failed to release database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+
+/* Return the milliseconds passed since T0.  */
+static unsigned long
+elapsed_ms (const struct timespec *t0)
+{
+  struct timespec t1;
+  long ms;
+
+  npth_clock_gettime (&t1);
+  ms = ((long)(t1.tv_sec - t0->tv_sec) * 1000
+        + (t1.tv_nsec - t0->tv_nsec) / 1000000);
+  return ms > 0? ms : 0;
+}
+
+
+/* Account for a wait for LOCK which started at T0.  */
+static void
+update_wait_stats (kbx_rwlock_t lock, const struct timespec *t0,
+                   unsigned long *r_waits, unsigned long *r_wait_ms)
+{
+  unsigned long ms = elapsed_ms (t0);
+
+  (*r_waits)++;
+  *r_wait_ms += ms;
+  if (ms > lock->stats.max_wait_ms)
+    lock->stats.max_wait_ms = ms;
+}
+
+
+/* Take LOCK for reading.  */
+void
+kbx_rwlock_read (kbx_rwlock_t lock)
+{
+  struct timespec t0;
+
+  lock_mutex (lock);
+  if (lock->writer || lock->waiting_writers)
+    {
+      npth_clock_gettime (&t0);
+      do
+        npth_cond_wait (&lock->cond, &lock->mutex);
+      while (lock->writer || lock->waiting_writers);
+      update_wait_stats (lock, &t0, &lock->stats.read_waits,
+                         &lock->stats.read_wait_ms);
+    }
+  lock->readers++;
+  lock->stats.reads++;
+  unlock_mutex (lock);
+}
+
+
+/* Take LOCK for reading and writing.  */
+void
+kbx_rwlock_write (kbx_rwlock_t lock)
+{
+  struct timespec t0;
+
+  lock_mutex (lock);
+  if (lock->writer || lock->readers)
+    {
+      npth_clock_gettime (&t0);
+      lock->waiting_writers++;
+      do
+        npth_cond_wait (&lock->cond, &lock->mutex);
+      while (lock->writer || lock->readers);
+      lock->waiting_writers--;
+      update_wait_stats (lock, &t0, &lock->stats.write_waits,
+                         &lock->stats.write_wait_ms);
+    }
+  lock->writer = 1;
+  lock->stats.writes++;
+  unlock_mutex (lock);
+}
+
+
+/* Release LOCK which has been taken for writing if WRITER is set or
+ * for reading otherwise.  */
+void
+kbx_rwlock_release (kbx_rwlock_t lock, int writer)
+{
+  lock_mutex (lock);
+  if (writer)
+    {
+      log_assert (lock->writer);
+      lock->writer = 0;
+    }
+  else
+    {
+      log_assert (lock->readers);
+      lock->readers--;
+    }
+  if (!lock->readers)
+    npth_cond_broadcast (&lock->cond);
+  unlock_mutex (lock);
+}
+
+
+/* Store a copy of the statistics of LOCK at R_STATS.  */
+void
+kbx_rwlock_get_stats (kbx_rwlock_t lock, struct kbxd_lock_stats_s *r_stats)
+{
+  lock_mutex (lock);
+  *r_stats = lock->stats;
+  unlock_mutex (lock);
+}
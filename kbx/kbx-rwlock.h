@@ -0,0 +1,61 @@
+/* kbx-rwlock.h - The reader/writer lock of keyboxd
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_KBX_RWLOCK_H
+#define GNUPG_KBX_RWLOCK_H 1
+
+#include <npth.h>
+
+/* Statistics about the database lock.  */
+struct kbxd_lock_stats_s
+{
+  unsigned long reads;          /* Number of read locks taken.  */
+  unsigned long read_waits;     /* Number of those which had to wait.  */
+  unsigned long read_wait_ms;   /* Total wait time in milliseconds.  */
+  unsigned long writes;         /* Number of write locks taken.  */
+  unsigned long write_waits;    /* Number of those which had to wait.  */
+  unsigned long write_wait_ms;  /* Total wait time in milliseconds.  */
+  unsigned long max_wait_ms;    /* Longest wait for any lock.  */
+};
+
+/* A reader/writer lock.  Writers are preferred: Once a writer is
+ * waiting no new readers are let in so that a steady stream of
+ * readers can't starve a writer.  All fields are protected by
+ * MUTEX.  */
+struct kbx_rwlock_s
+{
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  unsigned int readers;          /* Number of active readers.  */
+  unsigned int writer;           /* True if a writer is active.  */
+  unsigned int waiting_writers;  /* Number of waiting writers.  */
+  struct kbxd_lock_stats_s stats;
+};
+typedef struct kbx_rwlock_s *kbx_rwlock_t;
+
+#define KBX_RWLOCK_INITIALIZER { NPTH_MUTEX_INITIALIZER, NPTH_COND_INITIALIZER }
+
+void kbx_rwlock_read (kbx_rwlock_t lock);
+void kbx_rwlock_write (kbx_rwlock_t lock);
+void kbx_rwlock_release (kbx_rwlock_t lock, int writer);
+void kbx_rwlock_get_stats (kbx_rwlock_t lock,
+                           struct kbxd_lock_stats_s *r_stats);
+
+#endif /*GNUPG_KBX_RWLOCK_H*/
@@ -0,0 +1,632 @@
+/* kbx-snapshot.c - Read-only key snapshots published by keyboxd
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+* The snapshot file format
+
+   With the option --publish-snapshot keyboxd writes the OpenPGP keys
+   of its database to the file "keyboxd.snap" in the public-keys.d
+   directory.  Clients map this file read-only and resolve fingerprint
+   and long keyid searches without a round trip to keyboxd.  All
+   integers are stored in network byte order.
+
+   - b7   Magic 'KBXSNAP'
+   - byte Version number (1)
+   - u32  Flags
+          bit 0 = The snapshot is stale.
+   - u32  [NINDEX] Number of index records
+   - u64  Generation
+   - u32  Number of keyblocks
+   - u32  Offset of the index records
+   - u32  Offset of the keyblock records
+   - u32  Total length of the file
+   - b8   RFU
+   - NINDEX times:
+     - u32  High 32 bits of the keyid
+     - u32  Low 32 bits of the keyid
+     - u32  Offset of the keyblock record
+     - byte Length of the fingerprint
+     - byte RFU
+     - u16  Ordinal of the key: 0 for the primary key and N for the
+            Nth subkey.
+     - b32  The fingerprint, left aligned and padded with zeroes.
+   - For each keyblock:
+     - u32  [N] Length of the keyblock
+     - b20  UBID of the keyblock
+     - bN   The keyblock
+
+   The index records are sorted by keyid and UBID.  A published file
+   is never rewritten; each new version is written under a temporary
+   name and renamed, thus a client may keep using its mapping.  The
+   only exception is the stale flag which keyboxd sets in place while
+   it holds the database write lock and before the change is visible
+   to any other client.  Thus a client which sees the flag cleared may
+   use the data; otherwise it must ask keyboxd.  The generation is
+   incremented with each new file.
+*/
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_MMAP_SNAPSHOT 1
+#endif
+
+#include "keybox-defs.h"
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+#include "kbx-snapshot.h"
+
+#define SNAP_MAGIC        "KBXSNAP"
+#define SNAP_VERSION      1
+#define SNAP_HEADER_SIZE  48
+#define SNAP_INDEX_SIZE   48
+#define SNAP_BLOBHDR_SIZE (4 + UBID_LEN)
+#define SNAP_FLAGS_OFF    8
+#define SNAP_FLAG_STALE   1
+
+/* Snapshots are limited by the 32 bit offsets.  */
+#define SNAP_MAX_SIZE     0xffffffffUL
+
+
+/* An index record of the builder.  */
+struct snap_key_s
+{
+  u32 kid[2];
+  u32 blob_off;                 /* Offset into the keyblock area.  */
+  unsigned short pk_no;
+  unsigned char fprlen;
+  unsigned char fpr[32];
+  unsigned char ubid[UBID_LEN];
+};
+
+struct kbx_snapshot_builder_s
+{
+  struct snap_key_s *keys;
+  size_t nkeys;
+  size_t keyssize;
+  unsigned char *blobs;         /* The keyblock records.  */
+  size_t blobslen;
+  size_t blobssize;
+  unsigned int nblobs;
+};
+
+struct kbx_snapshot_s
+{
+  int refcount;
+  char *fname;
+  const unsigned char *image;   /* The mapped file.  */
+  size_t imagelen;
+  const unsigned char *index;
+  unsigned int nindex;
+  unsigned long long generation;
+  dev_t dev;                    /* To detect a replaced file.  */
+  ino_t ino;
+};
+
+
+static void
+put32 (unsigned char *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+static void
+put64 (unsigned char *p, unsigned long long a)
+{
+  put32 (p, a >> 32);
+  put32 (p + 4, a);
+}
+
+
+/* Create a new snapshot builder object and store it at R_BUILDER.  */
+gpg_error_t
+kbx_snapshot_builder_new (kbx_snapshot_builder_t *r_builder)
+{
+  *r_builder = xtrycalloc (1, sizeof **r_builder);
+  if (!*r_builder)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+void
+kbx_snapshot_builder_release (kbx_snapshot_builder_t builder)
+{
+  if (!builder)
+    return;
+  xfree (builder->keys);
+  xfree (builder->blobs);
+  xfree (builder);
+}
+
+
+/* Append one index record for key KINFO with ordinal PK_NO.  */
+static gpg_error_t
+add_key (kbx_snapshot_builder_t builder, const unsigned char *ubid,
+         u32 blob_off, int pk_no, struct _keybox_openpgp_key_info *kinfo)
+{
+  struct snap_key_s *k;
+
+  if (builder->nkeys == builder->keyssize)
+    {
+      size_t n = builder->keyssize? 2 * builder->keyssize : 1024;
+
+      k = xtryrealloc (builder->keys, n * sizeof *k);
+      if (!k)
+        return gpg_error_from_syserror ();
+      builder->keys = k;
+      builder->keyssize = n;
+    }
+  k = builder->keys + builder->nkeys++;
+  memset (k, 0, sizeof *k);
+  k->kid[0] = buf32_to_u32 (kinfo->keyid);
+  k->kid[1] = buf32_to_u32 (kinfo->keyid + 4);
+  k->blob_off = blob_off;
+  k->pk_no = pk_no;
+  k->fprlen = kinfo->fprlen;
+  memcpy (k->fpr, kinfo->fpr, kinfo->fprlen);
+  memcpy (k->ubid, ubid, UBID_LEN);
+  return 0;
+}
+
+
+/* Add the OpenPGP keyblock (BLOB,BLOBLEN) with the UBID to the
+ * snapshot.  */
+gpg_error_t
+kbx_snapshot_builder_add (kbx_snapshot_builder_t builder,
+                          const unsigned char *ubid,
+                          const void *blob, size_t bloblen)
+{
+  gpg_error_t err;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *kinfo;
+  size_t nparsed;
+  size_t needed;
+  u32 blob_off;
+  int pk_no;
+
+  err = _keybox_parse_openpgp (blob, bloblen, 0, &nparsed, &info);
+  if (err)
+    return err;
+
+  needed = SNAP_BLOBHDR_SIZE + bloblen;
+  if (bloblen > SNAP_MAX_SIZE || builder->blobslen > SNAP_MAX_SIZE - needed)
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+  if (builder->blobslen + needed > builder->blobssize)
+    {
+      size_t n = builder->blobssize? 2 * builder->blobssize : 65536;
+      unsigned char *p;
+
+      while (n < builder->blobslen + needed)
+        n *= 2;
+      p = xtryrealloc (builder->blobs, n);
+      if (!p)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      builder->blobs = p;
+      builder->blobssize = n;
+    }
+  blob_off = builder->blobslen;
+
+  err = add_key (builder, ubid, blob_off, 0, &info.primary);
+  pk_no = 1;
+  if (!err && info.nsubkeys)
+    for (kinfo = &info.subkeys; kinfo && !err; kinfo = kinfo->next)
+      err = add_key (builder, ubid, blob_off, pk_no++, kinfo);
+  if (err)
+    goto leave;
+
+  put32 (builder->blobs + blob_off, bloblen);
+  memcpy (builder->blobs + blob_off + 4, ubid, UBID_LEN);
+  memcpy (builder->blobs + blob_off + SNAP_BLOBHDR_SIZE, blob, bloblen);
+  builder->blobslen += needed;
+  builder->nblobs++;
+
+ leave:
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+/* Sort function for the index records.  */
+static int
+compare_keys (const void *arg_a, const void *arg_b)
+{
+  const struct snap_key_s *a = arg_a;
+  const struct snap_key_s *b = arg_b;
+
+  if (a->kid[0] != b->kid[0])
+    return a->kid[0] < b->kid[0]? -1 : 1;
+  if (a->kid[1] != b->kid[1])
+    return a->kid[1] < b->kid[1]? -1 : 1;
+  return memcmp (a->ubid, b->ubid, UBID_LEN);
+}
+
+
+/* Write the snapshot to FNAME using GENERATION.  The file is first
+ * written under a temporary name and then renamed.  */
+gpg_error_t
+kbx_snapshot_builder_write (kbx_snapshot_builder_t builder,
+                            const char *fname,
+                            unsigned long long generation)
+{
+  gpg_error_t err;
+  char *tmpfname;
+  estream_t fp = NULL;
+  unsigned char hdr[SNAP_HEADER_SIZE];
+  unsigned char rec[SNAP_INDEX_SIZE];
+  size_t blobs_off, n;
+  struct snap_key_s *k;
+
+  if (builder->nkeys > (SNAP_MAX_SIZE - SNAP_HEADER_SIZE) / SNAP_INDEX_SIZE)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  blobs_off = SNAP_HEADER_SIZE + builder->nkeys * SNAP_INDEX_SIZE;
+  if (builder->blobslen > SNAP_MAX_SIZE - blobs_off)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  tmpfname = xtryasprintf ("%s.%lu", fname, (unsigned long)getpid ());
+  if (!tmpfname)
+    return gpg_error_from_syserror ();
+
+  if (builder->nkeys)
+    qsort (builder->keys, builder->nkeys, sizeof *builder->keys,
+           compare_keys);
+
+  memset (hdr, 0, sizeof hdr);
+  memcpy (hdr, SNAP_MAGIC, 7);
+  hdr[7] = SNAP_VERSION;
+  put32 (hdr + 12, builder->nkeys);
+  put64 (hdr + 16, generation);
+  put32 (hdr + 24, builder->nblobs);
+  put32 (hdr + 28, SNAP_HEADER_SIZE);
+  put32 (hdr + 32, blobs_off);
+  put32 (hdr + 36, blobs_off + builder->blobslen);
+
+  fp = es_fopen (tmpfname, "wb,sysopen");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (hdr, SNAP_HEADER_SIZE, 1, fp) != 1)
+    goto write_error;
+  for (n=0; n < builder->nkeys; n++)
+    {
+      k = builder->keys + n;
+      memset (rec, 0, sizeof rec);
+      put32 (rec, k->kid[0]);
+      put32 (rec + 4, k->kid[1]);
+      put32 (rec + 8, blobs_off + k->blob_off);
+      rec[12] = k->fprlen;
+      rec[14] = k->pk_no >> 8;
+      rec[15] = k->pk_no;
+      memcpy (rec + 16, k->fpr, 32);
+      if (es_fwrite (rec, SNAP_INDEX_SIZE, 1, fp) != 1)
+        goto write_error;
+    }
+  if (builder->blobslen
+      && es_fwrite (builder->blobs, builder->blobslen, 1, fp) != 1)
+    goto write_error;
+  err = es_fclose (fp)? gpg_error_from_syserror () : 0;
+  fp = NULL;
+  if (err)
+    goto leave;
+
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  goto leave;
+
+ write_error:
+  err = gpg_error_from_syserror ();
+
+ leave:
+  if (fp)
+    es_fclose (fp);
+  if (err)
+    gnupg_remove (tmpfname);
+  xfree (tmpfname);
+  return err;
+}
+
+
+/* Set the stale flag of the snapshot FNAME.  It is not an error if
+ * the file does not exist.  */
+gpg_error_t
+kbx_snapshot_mark_stale (const char *fname)
+{
+  gpg_error_t err = 0;
+  unsigned char flags[4];
+  int fd;
+
+  fd = gnupg_open (fname, O_WRONLY, 0);
+  if (fd == -1)
+    return errno == ENOENT? 0 : gpg_error_from_syserror ();
+
+  put32 (flags, SNAP_FLAG_STALE);
+  if (lseek (fd, SNAP_FLAGS_OFF, SEEK_SET) == (off_t)(-1)
+      || write (fd, flags, 4) != 4)
+    err = gpg_error_from_syserror ();
+  close (fd);
+  return err;
+}
+
+
+
+/* Map the snapshot FNAME and store a new snapshot object at R_SNAP.
+ * GPG_ERR_NOT_SUPPORTED is returned if this system can't map
+ * files.  */
+gpg_error_t
+kbx_snapshot_open (const char *fname, kbx_snapshot_t *r_snap)
+{
+#ifdef USE_MMAP_SNAPSHOT
+  gpg_error_t err;
+  kbx_snapshot_t snap;
+  struct stat st;
+  const unsigned char *image;
+  size_t index_off, blobs_off;
+  int fd;
+
+  *r_snap = NULL;
+
+  fd = gnupg_open (fname, O_RDONLY, 0);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  if (st.st_size < SNAP_HEADER_SIZE || st.st_size > SNAP_MAX_SIZE)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_INV_KEYRING);
+    }
+
+  image = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  err = image == MAP_FAILED? gpg_error_from_syserror () : 0;
+  close (fd);
+  if (err)
+    return err;
+
+  snap = xtrycalloc (1, sizeof *snap);
+  if (!snap || !(snap->fname = xtrystrdup (fname)))
+    {
+      err = gpg_error_from_syserror ();
+      munmap ((void*)image, st.st_size);
+      xfree (snap);
+      return err;
+    }
+  snap->refcount = 1;
+  snap->image = image;
+  snap->imagelen = st.st_size;
+  snap->dev = st.st_dev;
+  snap->ino = st.st_ino;
+
+  if (memcmp (image, SNAP_MAGIC, 7))
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+  if (image[7] != SNAP_VERSION)
+    {
+      err = gpg_error (GPG_ERR_UNSUPPORTED_PROTOCOL);
+      goto leave;
+    }
+  snap->nindex = buf32_to_uint (image + 12);
+  snap->generation = (((unsigned long long)buf32_to_u32 (image + 16)) << 32
+                      | buf32_to_u32 (image + 20));
+  index_off = buf32_to_size_t (image + 28);
+  blobs_off = buf32_to_size_t (image + 32);
+  if (buf32_to_size_t (image + 36) != snap->imagelen
+      || index_off < SNAP_HEADER_SIZE
+      || blobs_off > snap->imagelen
+      || blobs_off < index_off
+      || (blobs_off - index_off) / SNAP_INDEX_SIZE < snap->nindex)
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+  snap->index = image + index_off;
+
+ leave:
+  if (err)
+    kbx_snapshot_release (snap);
+  else
+    *r_snap = snap;
+  return err;
+#else /*!USE_MMAP_SNAPSHOT*/
+  (void)fname;
+  *r_snap = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!USE_MMAP_SNAPSHOT*/
+}
+
+
+/* Take another reference to SNAP and return it.  */
+kbx_snapshot_t
+kbx_snapshot_ref (kbx_snapshot_t snap)
+{
+  if (snap)
+    snap->refcount++;
+  return snap;
+}
+
+
+/* Drop a reference to SNAP and unmap it if this was the last one.  */
+void
+kbx_snapshot_release (kbx_snapshot_t snap)
+{
+  if (!snap || --snap->refcount > 0)
+    return;
+#ifdef USE_MMAP_SNAPSHOT
+  munmap ((void*)snap->image, snap->imagelen);
+#endif
+  xfree (snap->fname);
+  xfree (snap);
+}
+
+
+unsigned long long
+kbx_snapshot_generation (kbx_snapshot_t snap)
+{
+  return snap->generation;
+}
+
+
+/* Return true if keyboxd has marked SNAP as stale.  */
+int
+kbx_snapshot_is_stale (kbx_snapshot_t snap)
+{
+  const volatile unsigned char *p = snap->image + SNAP_FLAGS_OFF;
+
+  return !!(p[3] & SNAP_FLAG_STALE);
+}
+
+
+/* Return true if the file of SNAP has been replaced by a new
+ * snapshot.  */
+int
+kbx_snapshot_is_replaced (kbx_snapshot_t snap)
+{
+  struct stat st;
+
+  if (gnupg_stat (snap->fname, &st))
+    return 0;
+  return st.st_dev != snap->dev || st.st_ino != snap->ino;
+}
+
+
+/* Search SNAP for DESC starting at CURSOR and store the next match at
+ * R_RESULT.  Only fingerprint and long keyid searches are supported;
+ * GPG_ERR_NOT_SUPPORTED is returned for all other modes.  Returns
+ * GPG_ERR_NOT_FOUND if there is no more match.  */
+gpg_error_t
+kbx_snapshot_search (kbx_snapshot_t snap, struct keydb_search_desc *desc,
+                     struct kbx_snapshot_cursor_s *cursor,
+                     struct kbx_snapshot_result_s *r_result)
+{
+  u32 kid[2];
+  const unsigned char *rec, *blobrec;
+  size_t blob_off, bloblen;
+  unsigned int lo, hi, mid;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      kid[0] = desc->u.kid[0];
+      kid[1] = desc->u.kid[1];
+      break;
+    case KEYDB_SEARCH_MODE_FPR:
+      /* v4 keys use the low and v5 keys the high 64 bits of the
+       * fingerprint as keyid; v3 keys can't be looked up.  */
+      if (desc->fprlen == 20)
+        {
+          kid[0] = buf32_to_u32 (desc->u.fpr + 12);
+          kid[1] = buf32_to_u32 (desc->u.fpr + 16);
+        }
+      else if (desc->fprlen == 32)
+        {
+          kid[0] = buf32_to_u32 (desc->u.fpr);
+          kid[1] = buf32_to_u32 (desc->u.fpr + 4);
+        }
+      else
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      break;
+    default:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  if (!cursor->started)
+    {
+      /* Find the first record with KID.  */
+      lo = 0;
+      hi = snap->nindex;
+      while (lo < hi)
+        {
+          u32 k0, k1;
+
+          mid = lo + (hi - lo) / 2;
+          rec = snap->index + (size_t)mid * SNAP_INDEX_SIZE;
+          k0 = buf32_to_u32 (rec);
+          k1 = buf32_to_u32 (rec + 4);
+          if (k0 < kid[0] || (k0 == kid[0] && k1 < kid[1]))
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      cursor->pos = lo;
+      cursor->started = 1;
+    }
+
+  for (; cursor->pos < snap->nindex; cursor->pos++)
+    {
+      rec = snap->index + (size_t)cursor->pos * SNAP_INDEX_SIZE;
+      if (buf32_to_u32 (rec) != kid[0] || buf32_to_u32 (rec + 4) != kid[1])
+        break;
+      if (desc->mode == KEYDB_SEARCH_MODE_FPR
+          && (rec[12] != desc->fprlen
+              || memcmp (rec + 16, desc->u.fpr, desc->fprlen)))
+        continue;
+
+      blob_off = buf32_to_size_t (rec + 8);
+      if (blob_off > snap->imagelen
+          || snap->imagelen - blob_off < SNAP_BLOBHDR_SIZE)
+        return gpg_error (GPG_ERR_INV_KEYRING);
+      blobrec = snap->image + blob_off;
+      bloblen = buf32_to_size_t (blobrec);
+      if (snap->imagelen - blob_off - SNAP_BLOBHDR_SIZE < bloblen)
+        return gpg_error (GPG_ERR_INV_KEYRING);
+
+      /* Return each keyblock only once like keyboxd does.  */
+      if (cursor->lastubid_valid
+          && !memcmp (cursor->lastubid, blobrec + 4, UBID_LEN))
+        continue;
+      memcpy (cursor->lastubid, blobrec + 4, UBID_LEN);
+      cursor->lastubid_valid = 1;
+      cursor->pos++;
+
+      r_result->ubid = blobrec + 4;
+      r_result->blob = blobrec + SNAP_BLOBHDR_SIZE;
+      r_result->bloblen = bloblen;
+      r_result->pk_no = buf16_to_uint (rec + 14);
+      return 0;
+    }
+
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
@@ -0,0 +1,83 @@
+/* kbx-snapshot.h - Read-only key snapshots published by keyboxd
+ * Copyright (C) 2026  g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_KBX_SNAPSHOT_H
+#define GNUPG_KBX_SNAPSHOT_H 1
+
+/* The name of the snapshot file in the public-keys.d directory.  */
+#define KBX_SNAPSHOT_NAME "keyboxd.snap"
+
+struct keydb_search_desc;
+
+
+/*-- Writer (keyboxd) --*/
+
+struct kbx_snapshot_builder_s;
+typedef struct kbx_snapshot_builder_s *kbx_snapshot_builder_t;
+
+gpg_error_t kbx_snapshot_builder_new (kbx_snapshot_builder_t *r_builder);
+void kbx_snapshot_builder_release (kbx_snapshot_builder_t builder);
+gpg_error_t kbx_snapshot_builder_add (kbx_snapshot_builder_t builder,
+                                      const unsigned char *ubid,
+                                      const void *blob, size_t bloblen);
+gpg_error_t kbx_snapshot_builder_write (kbx_snapshot_builder_t builder,
+                                        const char *fname,
+                                        unsigned long long generation);
+gpg_error_t kbx_snapshot_mark_stale (const char *fname);
+
+
+/*-- Reader (clients) --*/
+
+struct kbx_snapshot_s;
+typedef struct kbx_snapshot_s *kbx_snapshot_t;
+
+/* The state of a search in a snapshot.  Clear it to start a new
+ * search.  */
+struct kbx_snapshot_cursor_s
+{
+  unsigned int started : 1;
+  unsigned int lastubid_valid : 1;
+  unsigned int pos;
+  unsigned char lastubid[20];
+};
+
+/* A search result.  The pointers are valid as long as the snapshot
+ * is not released.  */
+struct kbx_snapshot_result_s
+{
+  const unsigned char *ubid;
+  const void *blob;
+  size_t bloblen;
+  int pk_no;            /* 0 for the primary key, N for the Nth subkey.  */
+};
+
+gpg_error_t kbx_snapshot_open (const char *fname, kbx_snapshot_t *r_snap);
+kbx_snapshot_t kbx_snapshot_ref (kbx_snapshot_t snap);
+void kbx_snapshot_release (kbx_snapshot_t snap);
+unsigned long long kbx_snapshot_generation (kbx_snapshot_t snap);
+int kbx_snapshot_is_stale (kbx_snapshot_t snap);
+int kbx_snapshot_is_replaced (kbx_snapshot_t snap);
+gpg_error_t kbx_snapshot_search (kbx_snapshot_t snap,
+                                 struct keydb_search_desc *desc,
+                                 struct kbx_snapshot_cursor_s *cursor,
+                                 struct kbx_snapshot_result_s *r_result);
+
+
+#endif /*GNUPG_KBX_SNAPSHOT_H*/
@@ -28,6 +28,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef HAVE_MEMFD_CREATE
+# include <fcntl.h>
+# include <sys/mman.h>
+#endif
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -37,6 +41,7 @@
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
 #include "frontend.h"
+#include "kbx-client-util.h"
 
 
 
@@ -87,6 +92,10 @@ struct server_local_s
   /* This flag is set if the last search command was successful.  */
   unsigned int search_any_found : 1;
 
+  /* This flag is set if the client asked to receive large blobs as
+   * file descriptors.  */
+  unsigned int blob_fd : 1;
+
   /* The first is the current search description as parsed by the
    * cmd_search.  If more than one pattern is required, cmd_search
    * also allocates and sets multi_search_desc and
@@ -195,6 +204,53 @@ kbxd_status_printf (ctrl_t ctrl, const char *keyword, const char *format, ...)
 }
 
 
+#ifdef HAVE_MEMFD_CREATE
+/* Copy (BUFFER,SIZE) to a new memfd and send that to the client.  On
+ * error nothing has been sent and the caller shall use the pipe.  */
+static gpg_error_t
+send_blob_fd (ctrl_t ctrl, const void *buffer, size_t size)
+{
+  gpg_error_t err = 0;
+  const char *p = buffer;
+  ssize_t n;
+  int fd;
+
+  fd = memfd_create ("kbx-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  while (size)
+    {
+      n = write (fd, p, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          err = n? gpg_error_from_syserror () : gpg_error (GPG_ERR_EIO);
+          goto leave;
+        }
+      p += n;
+      size -= n;
+    }
+
+  /* The client shall see exactly what we have written.  */
+  if (fcntl (fd, F_ADD_SEALS,
+             F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error sealing blob fd: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  err = assuan_sendfd (ctrl->server_local->assuan_ctx, fd);
+
+ leave:
+  close (fd);
+  return err;
+}
+#endif /*HAVE_MEMFD_CREATE*/
+
+
 /* A wrapper around assuan_send_data which makes debugging the output
  * in verbose mode easier.  It also takes CTRL as argument.  */
 gpg_error_t
@@ -210,12 +266,28 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
   /* Write toa file descriptor if enabled.  */
   if (ctrl && ctrl->server_local && ctrl->server_local->outstream)
     {
-      unsigned char lenbuf[4];
+      unsigned char lenbuf[8];
+
+#ifdef HAVE_MEMFD_CREATE
+      /* Large blobs are passed as file descriptor and only their
+       * length is written to the stream.  */
+      if (ctrl->server_local->blob_fd && size >= KBX_BLOB_FD_THRESHOLD
+          && !send_blob_fd (ctrl, buffer, size))
+        {
+          u32 marker = KBX_BLOB_FD_MARKER;
 
-      ulongtobuf (lenbuf, size);
-      err = kbxd_writen (ctrl->server_local->outstream, lenbuf, 4);
-      if (!err)
-        err = kbxd_writen (ctrl->server_local->outstream, buffer, size);
+          ulongtobuf (lenbuf, marker);
+          ulongtobuf (lenbuf+4, size);
+          err = kbxd_writen (ctrl->server_local->outstream, lenbuf, 8);
+        }
+      else
+#endif /*HAVE_MEMFD_CREATE*/
+        {
+          ulongtobuf (lenbuf, size);
+          err = kbxd_writen (ctrl->server_local->outstream, lenbuf, 4);
+          if (!err)
+            err = kbxd_writen (ctrl->server_local->outstream, buffer, size);
+        }
       if (!err && es_fflush (ctrl->server_local->outstream))
         {
           err = gpg_error_from_syserror ();
@@ -312,6 +384,14 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
       if (!ctrl->lc_messages)
         return out_of_core ();
     }
+  else if (!strcmp (key, "blob-fd"))
+    {
+#ifdef HAVE_MEMFD_CREATE
+      ctrl->server_local->blob_fd = *value? !!atoi (value) : 1;
+#else
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+    }
   else
     err = gpg_error (GPG_ERR_UNKNOWN_OPTION);
 
@@ -320,31 +400,195 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Append the current search description of CTRL to the list of
+ * search descriptions used for a search with several patterns.  */
+static gpg_error_t
+append_multi_search_desc (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned int n, k;
+  KEYBOX_SEARCH_DESC *desc;
+  struct search_backing_store_s *store;
+
+  if (!ctrl->server_local->multi_search_desc_size)
+    {
+      n = 10;
+      ctrl->server_local->multi_search_desc
+        = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_desc);
+      if (!ctrl->server_local->multi_search_desc)
+        {
+          err = gpg_error_from_syserror ();
+          return err;
+        }
+      ctrl->server_local->multi_search_store
+        = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_store);
+      if (!ctrl->server_local->multi_search_store)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (ctrl->server_local->multi_search_desc);
+          ctrl->server_local->multi_search_desc = NULL;
+          return err;
+        }
+      ctrl->server_local->multi_search_desc_size = n;
+    }
+
+  if (ctrl->server_local->multi_search_desc_len
+      == ctrl->server_local->multi_search_desc_size)
+    {
+      n = ctrl->server_local->multi_search_desc_size + 10;
+      desc = xtrycalloc (n, sizeof *desc);
+      if (!desc)
+        {
+          err = gpg_error_from_syserror ();
+          return err;
+        }
+      store = xtrycalloc (n, sizeof *store);
+      if (!store)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (desc);
+          return err;
+        }
+      for (k=0; k < ctrl->server_local->multi_search_desc_size; k++)
+        {
+          desc[k] = ctrl->server_local->multi_search_desc[k];
+          store[k] = ctrl->server_local->multi_search_store[k];
+        }
+      xfree (ctrl->server_local->multi_search_desc);
+      xfree (ctrl->server_local->multi_search_store);
+      ctrl->server_local->multi_search_desc = desc;
+      ctrl->server_local->multi_search_store = store;
+      ctrl->server_local->multi_search_desc_size = n;
+    }
+  /* Actually store. We need to fix up the const pointers by
+   * copies from our backing store.  */
+  desc = &(ctrl->server_local->multi_search_desc
+           [ctrl->server_local->multi_search_desc_len]);
+  store = &(ctrl->server_local->multi_search_store
+            [ctrl->server_local->multi_search_desc_len]);
+  *desc = ctrl->server_local->search_desc;
+  if (ctrl->server_local->search_desc.sn)
+    {
+      xfree (store->sn);
+      store->sn = xtrymalloc (ctrl->server_local->search_desc.snlen);
+      if (!store->sn)
+        {
+          err = gpg_error_from_syserror ();
+          return err;
+        }
+      memcpy (store->sn, ctrl->server_local->search_desc.sn,
+              ctrl->server_local->search_desc.snlen);
+      desc->sn = store->sn;
+    }
+  if (ctrl->server_local->search_desc.name_used)
+    {
+      xfree (store->name);
+      store->name = xtrystrdup (ctrl->server_local->search_desc.u.name);
+      if (!store->name)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (store->sn);
+          store->sn = NULL;
+          return err;
+        }
+      desc->u.name = store->name;
+    }
+  ctrl->server_local->multi_search_desc_len++;
+
+  return 0;
+}
+
+
+/* Read the patterns for SEARCH --multi using an inquiry and store
+ * them as multi search descriptions.  */
+static gpg_error_t
+read_multi_patterns (assuan_context_t ctx, ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *p, *pend, *endp;
+
+  ctrl->server_local->multi_search_desc_len = 0;
+
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  /* The patterns are delimited by LFs; empty lines are ignored.  */
+  for (p = (char*)value, pend = p + valuelen; p < pend; p = endp + 1)
+    {
+      endp = memchr (p, '\n', pend - p);
+      if (!endp)
+        endp = pend;
+      *endp = 0;  /* Note that assuan_inquire appends a Nul.  */
+      if (endp > p && endp[-1] == '\r')
+        endp[-1] = 0;
+      if (!*p)
+        continue;
+      err = classify_user_id (p, &ctrl->server_local->search_desc, 1);
+      if (err)
+        goto leave;
+      err = append_multi_search_desc (ctrl);
+      if (err)
+        goto leave;
+    }
+
+  if (!ctrl->server_local->multi_search_desc_len)
+    err = set_error (GPG_ERR_INV_ARG, "--multi but no pattern");
+
+ leave:
+  xfree (value);
+  return err;
+}
+
+
 static const char hlp_search[] =
   "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH [--no-data] [--openpgp|--x509] --multi\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
-  "command.  With --no-data only the search status is returned but\n"
-  "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "command.  With --multi all patterns are requested by this\n"
+  "function using\n"
+  "  INQUIRE PATTERNS\n"
+  "and are expected as a list of LF delimited patterns.  With\n"
+  "--no-data only the search status is returned but not the actual\n"
+  "data.  With --openpgp or --x509 only the respective keys are\n"
+  "returned.  See also \"NEXT\".";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  int opt_more, opt_multi, opt_no_data, opt_openpgp, opt_x509;
   gpg_error_t err;
-  unsigned int n, k;
 
   opt_no_data = has_option (line, "--no-data");
   opt_more = has_option (line, "--more");
+  opt_multi = has_option (line, "--multi");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
 
-  if (!*line)
+  if (opt_multi)
+    {
+      if (*line || opt_more || ctrl->server_local->search_expecting_more)
+        {
+          err = set_error (GPG_ERR_INV_ARG,
+                           "--multi does not allow a pattern or --more");
+          goto leave;
+        }
+      err = read_multi_patterns (ctx, ctrl);
+      if (err)
+        goto leave;
+      /* Continue with the actual search.  */
+    }
+  else if (!*line)
     {
       if (opt_more)
         {
@@ -376,93 +620,9 @@ cmd_search (assuan_context_t ctx, char *line)
     {
       /* More pattern are expected - store the current one and return
        * success.  */
-      KEYBOX_SEARCH_DESC *desc;
-      struct search_backing_store_s *store;
-
-      if (!ctrl->server_local->multi_search_desc_size)
-        {
-          n = 10;
-          ctrl->server_local->multi_search_desc
-            = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_desc);
-          if (!ctrl->server_local->multi_search_desc)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          ctrl->server_local->multi_search_store
-            = xtrycalloc (n, sizeof *ctrl->server_local->multi_search_store);
-          if (!ctrl->server_local->multi_search_store)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (ctrl->server_local->multi_search_desc);
-              ctrl->server_local->multi_search_desc = NULL;
-              goto leave;
-            }
-          ctrl->server_local->multi_search_desc_size = n;
-        }
-
-      if (ctrl->server_local->multi_search_desc_len
-          == ctrl->server_local->multi_search_desc_size)
-        {
-          n = ctrl->server_local->multi_search_desc_size + 10;
-          desc = xtrycalloc (n, sizeof *desc);
-          if (!desc)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          store = xtrycalloc (n, sizeof *store);
-          if (!store)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (desc);
-              goto leave;
-            }
-          for (k=0; k < ctrl->server_local->multi_search_desc_size; k++)
-            {
-              desc[k] = ctrl->server_local->multi_search_desc[k];
-              store[k] = ctrl->server_local->multi_search_store[k];
-            }
-          xfree (ctrl->server_local->multi_search_desc);
-          xfree (ctrl->server_local->multi_search_store);
-          ctrl->server_local->multi_search_desc = desc;
-          ctrl->server_local->multi_search_store = store;
-          ctrl->server_local->multi_search_desc_size = n;
-        }
-      /* Actually store. We need to fix up the const pointers by
-       * copies from our backing store.  */
-      desc = &(ctrl->server_local->multi_search_desc
-               [ctrl->server_local->multi_search_desc_len]);
-      store = &(ctrl->server_local->multi_search_store
-                [ctrl->server_local->multi_search_desc_len]);
-      *desc = ctrl->server_local->search_desc;
-      if (ctrl->server_local->search_desc.sn)
-        {
-          xfree (store->sn);
-          store->sn = xtrymalloc (ctrl->server_local->search_desc.snlen);
-          if (!store->sn)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          memcpy (store->sn, ctrl->server_local->search_desc.sn,
-                  ctrl->server_local->search_desc.snlen);
-          desc->sn = store->sn;
-        }
-      if (ctrl->server_local->search_desc.name_used)
-        {
-          xfree (store->name);
-          store->name = xtrystrdup (ctrl->server_local->search_desc.u.name);
-          if (!store->name)
-            {
-              err = gpg_error_from_syserror ();
-              xfree (store->sn);
-              store->sn = NULL;
-              goto leave;
-            }
-          desc->u.name = store->name;
-        }
-      ctrl->server_local->multi_search_desc_len++;
+      err = append_multi_search_desc (ctrl);
+      if (err)
+        goto leave;
 
       if (opt_more)
         {
@@ -473,7 +633,7 @@ cmd_search (assuan_context_t ctx, char *line)
       ctrl->server_local->search_expecting_more = 0;
       /* Continue with the actual search.  */
     }
-  else
+  else if (!opt_multi)
     ctrl->server_local->multi_search_desc_len = 0;
 
   ctrl->server_local->inhibit_data_logging = 1;
@@ -567,20 +727,89 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+/* Store the keys from the STORE --batch data (DATA,DATALEN) which
+ * is a sequence of blobs each prefixed with its length as a 4 byte
+ * big endian integer.  */
+static gpg_error_t
+store_batch (assuan_context_t ctx, const unsigned char *data, size_t datalen,
+             enum kbxd_store_modes mode)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  const unsigned char *p;
+  size_t n, len;
+  unsigned int nblobs, idx, nstored, failed;
+  const void **blobs = NULL;
+  size_t *bloblens = NULL;
+
+  /* First pass: Count and check the blobs.  */
+  for (nblobs=0, p=data, n=datalen; n; nblobs++, p += len, n -= len)
+    {
+      if (n < 4)
+        return set_error (GPG_ERR_INV_LENGTH, "truncated blob length");
+      len = buf32_to_size_t (p);
+      p += 4;
+      n -= 4;
+      if (!len || len > n)
+        return set_error (GPG_ERR_INV_LENGTH, "invalid blob length");
+    }
+  if (!nblobs)
+    return gpg_error (GPG_ERR_MISSING_VALUE);
+
+  blobs = xtrycalloc (nblobs, sizeof *blobs);
+  bloblens = xtrycalloc (nblobs, sizeof *bloblens);
+  if (!blobs || !bloblens)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (idx=0, p=data; idx < nblobs; idx++, p += len)
+    {
+      len = buf32_to_size_t (p);
+      p += 4;
+      blobs[idx] = p;
+      bloblens[idx] = len;
+    }
+
+  err = kbxd_store_batch (ctrl, blobs, bloblens, nblobs, mode,
+                          &nstored, &failed);
+  if (err && failed < nblobs)
+    kbxd_status_printf (ctrl, "STORE_FAILED", "%u %u", failed, err);
+  kbxd_status_printf (ctrl, "STORED", "%u", nstored);
+
+ leave:
+  xfree (blobs);
+  xfree (bloblens);
+  return err;
+}
+
+
 static const char hlp_store[] =
-  "STORE [--update|--insert]\n"
+  "STORE [--update|--insert] [--batch]\n"
   "\n"
   "Insert a key into the database.  Whether to insert or update\n"
   "the key is decided by looking at the primary key's fingerprint.\n"
   "With option --update the key must already exist.\n"
   "With option --insert the key must not already exist.\n"
   "The actual key material is requested by this function using\n"
-  "  INQUIRE BLOB";
+  "  INQUIRE BLOB\n"
+  "With option --batch any number of keys are requested using\n"
+  "  INQUIRE BLOBS\n"
+  "and expected as a sequence of blobs, each prefixed with its\n"
+  "length as 4 byte big endian integer.  These keys are stored\n"
+  "in one transaction and the number of stored keys is returned\n"
+  "with the status line\n"
+  "  STORED <n>\n"
+  "If storing a key fails the command returns that error and\n"
+  "the key is indicated by the status line\n"
+  "  STORE_FAILED <index> <errorcode>\n"
+  "with INDEX being the 0-based index of the key in the batch.\n"
+  "Unless a global transaction is active no key is stored then.";
 static gpg_error_t
 cmd_store (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_update, opt_insert;
+  int opt_update, opt_insert, opt_batch;
   enum kbxd_store_modes mode;
   gpg_error_t err;
   unsigned char *value = NULL;
@@ -588,6 +817,7 @@ cmd_store (assuan_context_t ctx, char *line)
 
   opt_update = has_option (line, "--update");
   opt_insert = has_option (line, "--insert");
+  opt_batch = has_option (line, "--batch");
   line = skip_options (line);
   if (*line)
     {
@@ -602,7 +832,8 @@ cmd_store (assuan_context_t ctx, char *line)
     mode = KBXD_STORE_AUTO;
 
   /* Ask for the key material.  */
-  err = assuan_inquire (ctx, "BLOB", &value, &valuelen, 0);
+  err = assuan_inquire (ctx, opt_batch? "BLOBS" : "BLOB",
+                        &value, &valuelen, 0);
   if (err)
     {
       log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
@@ -615,7 +846,10 @@ cmd_store (assuan_context_t ctx, char *line)
       goto leave;
     }
 
-  err = kbxd_store (ctrl, value, valuelen, mode);
+  if (opt_batch)
+    err = store_batch (ctx, value, valuelen, mode);
+  else
+    err = kbxd_store (ctrl, value, valuelen, mode);
 
 
  leave:
@@ -738,6 +972,125 @@ cmd_putkeyflag (assuan_context_t ctx, char *line)
   return leave_cmd (ctx, err);
 }
 
+
+/* Callback for cmd_getsigcache to send one result.  */
+static gpg_error_t
+getsigcache_cb (void *opaque, const unsigned char *sigid, int result,
+                const unsigned char *fpr, size_t fprlen)
+{
+  assuan_context_t ctx = opaque;
+  unsigned char buffer[SIGCACHE_SIGID_LEN + 2 + 255];
+
+  memcpy (buffer, sigid, SIGCACHE_SIGID_LEN);
+  buffer[SIGCACHE_SIGID_LEN] = result;
+  buffer[SIGCACHE_SIGID_LEN+1] = fprlen;
+  memcpy (buffer + SIGCACHE_SIGID_LEN + 2, fpr, fprlen);
+  return assuan_send_data (ctx, buffer, SIGCACHE_SIGID_LEN + 2 + fprlen);
+}
+
+
+static const char hlp_getsigcache[] =
+  "GETSIGCACHE <ubid>\n"
+  "\n"
+  "Return the cached signature verification results for the\n"
+  "signatures of the key identified by UBID.  The results are\n"
+  "returned as data lines with a sequence of records:\n"
+  "  sigid  - 32 bytes as computed by gpg\n"
+  "  result - 1 byte; 0 = bad signature, 1 = good signature\n"
+  "  fprlen - 1 byte\n"
+  "  fpr    - The fingerprint of the signer\n"
+  "The error NOT_SUPPORTED is returned if the database does\n"
+  "not provide a signature cache.";
+static gpg_error_t
+cmd_getsigcache (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int n;
+  unsigned char ubid[UBID_LEN];
+
+  line = skip_options (line);
+  if (!*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "UBID missing");
+      goto leave;
+    }
+
+  /* Skip an optional UBID identifier character.  */
+  if (*line == '^' && line[1])
+    line++;
+  if ((n=hex2bin (line, ubid, UBID_LEN)) < 0)
+    {
+      err = set_error (GPG_ERR_INV_USER_ID, "invalid UBID");
+      goto leave;
+    }
+  if (line[n])
+    {
+      err = set_error (GPG_ERR_INV_ARG, "garbage after UBID");
+      goto leave;
+    }
+
+  err = kbxd_get_sigcache (ctrl, ubid, getsigcache_cb, ctx);
+
+ leave:
+  return leave_cmd (ctx, err);
+}
+
+
+static const char hlp_putsigcache[] =
+  "PUTSIGCACHE\n"
+  "\n"
+  "Store signature verification results in the signature cache.\n"
+  "The results are requested using\n"
+  "  INQUIRE SIGCACHE\n"
+  "and expected as a sequence of records:\n"
+  "  ubid   - 20 bytes with the UBID of the key carrying the signature\n"
+  "  sigid  - 32 bytes as computed by gpg\n"
+  "  result - 1 byte; 0 = bad signature, 1 = good signature\n"
+  "  fprlen - 1 byte\n"
+  "  fpr    - The fingerprint of the signer\n"
+  "The cached results of signatures issued by a key are removed\n"
+  "when that key is updated or deleted.  The number of stored\n"
+  "results is returned with the status line\n"
+  "  STORED <n>";
+static gpg_error_t
+cmd_putsigcache (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  unsigned int nstored;
+
+  line = skip_options (line);
+  if (*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "no args expected");
+      goto leave;
+    }
+
+  err = assuan_inquire (ctx, "SIGCACHE", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+  if (!valuelen) /* No data received. */
+    {
+      err = gpg_error (GPG_ERR_MISSING_VALUE);
+      goto leave;
+    }
+
+  err = kbxd_put_sigcache (ctrl, value, valuelen, &nstored);
+  if (nstored)
+    kbxd_status_printf (ctrl, "STORED", "%u", nstored);
+
+ leave:
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_transaction[] =
   "TRANSACTION [begin|commit|rollback]\n"
   "\n"
@@ -807,6 +1160,25 @@ cmd_transaction (assuan_context_t ctx, char *line)
 
 
 
+/* Return true if the command CMD implements the option CMDOPT.  */
+static int
+command_has_option (const char *cmd, const char *cmdopt)
+{
+  if (!strcmp (cmd, "SEARCH"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
+  else if (!strcmp (cmd, "STORE"))
+    {
+      if (!strcmp (cmdopt, "batch"))
+        return 1;
+    }
+
+  return 0;
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -818,7 +1190,12 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "connections - Return number of active connections.\n"
-  "getenv NAME - Return value of envvar NAME\n";
+  "lockstats   - Return statistics about the database lock.\n"
+  "cachestats  - Return statistics about the key cache.\n"
+  "snapshot    - Return the generation of the published snapshot.\n"
+  "getenv NAME - Return value of envvar NAME\n"
+  "cmd_has_option CMD OPT\n"
+  "            - Returns OK if command CMD has option OPT.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -865,12 +1242,93 @@ cmd_getinfo (assuan_context_t ctx, char *line)
             err = assuan_send_data (ctx, s, strlen (s));
         }
     }
+  else if (!strncmp (line, "cmd_has_option", 14)
+           && (line[14] == ' ' || line[14] == '\t' || !line[14]))
+    {
+      char *cmd, *cmdopt;
+      line += 14;
+      while (*line == ' ' || *line == '\t')
+        line++;
+      if (!*line)
+        err = gpg_error (GPG_ERR_MISSING_VALUE);
+      else
+        {
+          cmd = line;
+          while (*line && (*line != ' ' && *line != '\t'))
+            line++;
+          if (!*line)
+            err = gpg_error (GPG_ERR_MISSING_VALUE);
+          else
+            {
+              *line++ = 0;
+              while (*line == ' ' || *line == '\t')
+                line++;
+              if (!*line)
+                err = gpg_error (GPG_ERR_MISSING_VALUE);
+              else
+                {
+                  cmdopt = line;
+                  if (command_has_option (cmd, cmdopt))
+                    err = 0;
+                  else
+                    err = gpg_error (GPG_ERR_FALSE);
+                }
+            }
+        }
+    }
   else if (!strcmp (line, "connections"))
     {
       snprintf (numbuf, sizeof numbuf, "%d",
                 get_kbxd_active_connection_count ());
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "lockstats"))
+    {
+      struct kbxd_lock_stats_s stats;
+      char *buf;
+
+      kbxd_get_lock_stats (&stats);
+      buf = xtryasprintf ("reads=%lu read_waits=%lu read_wait_ms=%lu"
+                          " writes=%lu write_waits=%lu write_wait_ms=%lu"
+                          " max_wait_ms=%lu",
+                          stats.reads, stats.read_waits, stats.read_wait_ms,
+                          stats.writes, stats.write_waits,
+                          stats.write_wait_ms, stats.max_wait_ms);
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        err = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
+  else if (!strcmp (line, "cachestats"))
+    {
+      struct kbxd_cache_stats_s stats;
+      char *buf;
+
+      kbxd_get_cache_stats (&stats);
+      buf = xtryasprintf ("hits=%lu misses=%lu evictions=%lu"
+                          " blobs=%lu keys=%lu bytes=%zu max_bytes=%zu",
+                          stats.hits, stats.misses, stats.evictions,
+                          stats.blobs, stats.keys,
+                          stats.bytes, stats.max_bytes);
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        err = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
+  else if (!strcmp (line, "snapshot"))
+    {
+      unsigned long long generation;
+
+      if (!kbxd_get_snapshot_info (&generation))
+        err = set_error (GPG_ERR_NOT_FOUND, "no snapshot published");
+      else
+        {
+          snprintf (numbuf, sizeof numbuf, "%llu", generation);
+          err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+        }
+    }
   else
     err = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -935,6 +1393,8 @@ register_commands (assuan_context_t ctx)
     { "STORE",         cmd_store,         hlp_store  },
     { "DELETE",        cmd_delete,        hlp_delete  },
     { "PUTKEYFLAG",    cmd_putkeyflag,    hlp_putkeyflag  },
+    { "GETSIGCACHE",   cmd_getsigcache,   hlp_getsigcache },
+    { "PUTSIGCACHE",   cmd_putsigcache,   hlp_putsigcache },
     { "TRANSACTION",   cmd_transaction,   hlp_transaction },
     { "SETEPHEMERAL",  cmd_setephemeral,  hlp_setephemeral },
     { "GETINFO",       cmd_getinfo,       hlp_getinfo },
@@ -1100,6 +1560,7 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
         }
 #endif
       ctrl->server_local->client_pid = assuan_get_pid (ctx);
+      ctrl->client_pid = ctrl->server_local->client_pid;
 
       rc = assuan_process (ctx);
       if (rc)
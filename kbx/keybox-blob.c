@@ -45,11 +45,12 @@
    - u16  Header flags
           bit 0 - RFU
           bit 1 - Is being or has been used for OpenPGP blobs
+          bit 2 - Contains empty blobs which may be compacted
    - b4   Magic 'KBXf'
    - u32  RFU
    - u32  file_created_at
    - u32  last_maintenance_run
-   - u32  RFU
+   - u32  Change counter; incremented by each update
    - u32  RFU
 
 ** The OpenPGP and X.509 blobs
@@ -137,7 +138,14 @@
    - u32  Latest timestamp in the keyblock (useful for KS synchronization?)
    - u32  Blob created at
    - u32  [NRES] Size of reserved space (not including this field)
-   - bN   Reserved space of size NRES for future use.
+   - bN   Reserved space of size NRES for future use.  If NRES is
+          at least 2 the reserved space may start with:
+          - byte Type of the data (1 = user ID filter)
+          - byte [NBITS] Log2 of the size of the filter in bits
+          - bN   A Bloom filter of 2^NBITS bits over all 3 byte
+                 sequences of all user IDs with ASCII letters mapped
+                 to lowercase.  This is used to quickly skip blobs in
+                 substring and mail searches.
    - bN   Arbitrary space for example used to store data which is not
           part of the keyblock or certificate.  For example the v3 key
           IDs go here.
@@ -179,6 +187,12 @@
 #define get32(a) buf32_to_ulong ((a))
 
 
+/* The user ID filter written to the reserved space.  */
+#define UIDFILTER_TYPE       1
+#define UIDFILTER_MIN_NBITS  8   /* 32 bytes.  */
+#define UIDFILTER_MAX_NBITS  14  /* 2 KiB.  */
+
+
 /* special values of the signature status */
 #define SF_NONE(a)  ( !(a) )
 #define SF_NOKEY(a) ((a) & (1<<0))
@@ -551,11 +565,116 @@ release_kid_list (struct keyid_list *kl)
 }
 
 
+/* Return the two bit numbers of the user ID filter with 2^NBITS bits
+ * for the 3 bytes at P.  */
+static inline void
+uidfilter_bits (const unsigned char *p, unsigned int nbits,
+                u32 *r_bit1, u32 *r_bit2)
+{
+  u32 t;
+
+  t = ((u32)ascii_tolower (p[0]) << 16
+       | (u32)ascii_tolower (p[1]) << 8
+       | (u32)ascii_tolower (p[2]));
+  *r_bit1 = (u32)(t * 0x9e3779b1) >> (32 - nbits);
+  *r_bit2 = (u32)(t * 0xc2b2ae35) >> (32 - nbits);
+}
+
+
+/* Write the user ID filter for BLOB to the reserved space.  IMAGE is
+ * the keyblock for OpenPGP or NULL for X.509.  */
+static void
+put_uid_filter (KEYBOXBLOB blob, const unsigned char *image)
+{
+  struct membuf *a = blob->buf;
+  const unsigned char *name;
+  unsigned char *filter;
+  size_t ntrigrams, j;
+  unsigned int nbits;
+  u32 bit1, bit2;
+  int i;
+
+  ntrigrams = 0;
+  for (i=0; i < blob->nuids; i++)
+    if (blob->uids[i].len > 2)
+      ntrigrams += blob->uids[i].len - 2;
+  if (!ntrigrams)
+    {
+      put32 (a, 0);  /* size of reserved space */
+      return;
+    }
+
+  /* Use about 8 bits per trigram which gives a false positive rate
+   * of 5% per trigram with 2 bits set per trigram.  */
+  for (nbits = UIDFILTER_MIN_NBITS;
+       nbits < UIDFILTER_MAX_NBITS && ((size_t)1 << nbits) < 8 * ntrigrams;
+       nbits++)
+    ;
+  filter = xtrycalloc (1, (1 << nbits) / 8);
+  if (!filter)
+    {
+      put32 (a, 0);
+      return;
+    }
+  for (i=0; i < blob->nuids; i++)
+    {
+      name = image? image + blob->uids[i].off
+                  : (const unsigned char *)blob->uids[i].name;
+      if (!name)
+        continue;
+      for (j=0; j + 2 < blob->uids[i].len; j++)
+        {
+          uidfilter_bits (name + j, nbits, &bit1, &bit2);
+          filter[bit1 / 8] |= 1 << (bit1 % 8);
+          filter[bit2 / 8] |= 1 << (bit2 % 8);
+        }
+    }
+
+  put32 (a, 2 + (1 << nbits) / 8);  /* size of reserved space */
+  put8 (a, UIDFILTER_TYPE);
+  put8 (a, nbits);
+  put_membuf (a, filter, (1 << nbits) / 8);
+  xfree (filter);
+}
+
+
+/* Return false if NAME of length NAMELEN is not a substring of any
+ * user ID of the blob with the user ID filter at FILTER which has a
+ * length of FILTERLEN bytes.  A true return means that NAME may
+ * match; comparison is done case-insensitive.  */
+int
+_keybox_uid_filter_match (const unsigned char *filter, size_t filterlen,
+                          const char *name, size_t namelen)
+{
+  const unsigned char *s = (const unsigned char *)name;
+  unsigned int nbits;
+  u32 bit1, bit2;
+  size_t j;
+
+  if (filterlen < 2 || filter[0] != UIDFILTER_TYPE)
+    return 1; /* No filter.  */
+  nbits = filter[1];
+  if (nbits < UIDFILTER_MIN_NBITS || nbits > UIDFILTER_MAX_NBITS
+      || filterlen < 2 + (1 << nbits) / 8)
+    return 1; /* Unknown parameters.  */
+  filter += 2;
+
+  for (j=0; j + 2 < namelen; j++)
+    {
+      uidfilter_bits (s + j, nbits, &bit1, &bit2);
+      if (!(filter[bit1 / 8] & (1 << (bit1 % 8)))
+          || !(filter[bit2 / 8] & (1 << (bit2 % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
 /* Create a new blob header.  If WANT_FPR32 is set a version 2 blob is
- * created.  */
+ * created.  IMAGE is the OpenPGP keyblock or NULL for X.509.  */
 static int
 create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
-                    int want_fpr32)
+                    int want_fpr32, const unsigned char *image)
 {
   struct membuf *a = blob->buf;
   int i;
@@ -629,8 +748,8 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
   put32 ( a, 0 );  /* time of next recheck */
   put32 ( a, 0 );  /* newest timestamp (none) */
   put32 ( a, make_timestamp() );  /* creation time */
-  put32 ( a, 0 );  /* size of reserved space */
-  /* reserved space (which is currently of size 0) */
+  /* size of reserved space and the user ID filter stored there */
+  put_uid_filter (blob, image);
 
   /* space where we write keyIDs and other stuff so that the
      pointers can actually point to somewhere */
@@ -819,7 +938,7 @@ _keybox_create_openpgp_blob (KEYBOXBLOB *r_blob,
   init_membuf (&blob->bufbuf, 1024);
   blob->buf = &blob->bufbuf;
   err = create_blob_header (blob, KEYBOX_BLOBTYPE_PGP,
-                            as_ephemeral, need_fpr32);
+                            as_ephemeral, need_fpr32, image);
   if (err)
     goto leave;
   err = pgp_create_blob_keyblock (blob, image, imagelen);
@@ -1006,7 +1125,8 @@ _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
   init_membuf (&blob->bufbuf, 1024);
   blob->buf = &blob->bufbuf;
   /* write out what we already have */
-  rc = create_blob_header (blob, KEYBOX_BLOBTYPE_X509, as_ephemeral, 0);
+  rc = create_blob_header (blob, KEYBOX_BLOBTYPE_X509, as_ephemeral, 0,
+                           NULL);
   if (rc)
     goto leave;
   rc = x509_create_blob_cert (blob, cert);
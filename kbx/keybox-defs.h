@@ -36,6 +36,8 @@
 typedef struct keyboxblob *KEYBOXBLOB;
 
 
+typedef struct keybox_index_s *keybox_index_t;
+
 typedef struct keybox_name *KB_NAME;
 struct keybox_name
 {
@@ -61,6 +63,9 @@ struct keybox_name
   /* Not yet used.  */
   int did_full_scan;
 
+  /* The cached side index or NULL.  */
+  keybox_index_t index;
+
   /* The name of the resource file. */
   char fname[1];
 };
@@ -145,6 +150,7 @@ gpg_error_t _keybox_ll_open (estream_t *rfp, const char *fname,
 gpg_error_t _keybox_ll_close (estream_t fp);
 
 void _keybox_close_file (KEYBOX_HANDLE hd);
+int _keybox_get_update_in_place (void);
 
 
 /*-- keybox-blob.c --*/
@@ -167,6 +173,8 @@ void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
 void _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp);
+int _keybox_uid_filter_match (const unsigned char *filter, size_t filterlen,
+                              const char *name, size_t namelen);
 
 /*-- keybox-openpgp.c --*/
 gpg_error_t _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
@@ -199,6 +207,26 @@ blob_get_type (KEYBOXBLOB blob)
 }
 
 
+/*-- keybox-index.c --*/
+gpg_error_t _keybox_index_lookup (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                                  size_t ndesc,
+                                  keybox_blobtype_t want_blobtype,
+                                  off_t **r_offsets, size_t *r_count);
+keybox_index_t _keybox_index_begin (KB_NAME kb);
+void _keybox_index_commit (KB_NAME kb, keybox_index_t idx, gpg_error_t err,
+                           off_t off, size_t oldlen, KEYBOXBLOB blob);
+void _keybox_index_commit_move (KB_NAME kb, keybox_index_t idx,
+                                gpg_error_t err,
+                                off_t start, off_t end, off_t delta);
+void _keybox_index_invalidate (KB_NAME kb);
+void _keybox_index_release (keybox_index_t idx);
+
+
+/*-- keybox-update.c --*/
+extern void (*_keybox_journal_hook) (int point);
+gpg_error_t _keybox_recover (const char *fname);
+
+
 /*-- keybox-dump.c --*/
 int _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp);
 int _keybox_dump_file (const char *filename, int stats_only, FILE *outfp);
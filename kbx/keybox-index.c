@@ -0,0 +1,920 @@
+/* keybox-index.c - Side index for exact searches
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+* The keybox index file format
+
+   For a keybox file FNAME the index is stored in the file FNAME.idx.
+   It maps the exact search keys of all OpenPGP and X.509 blobs to the
+   file offsets of these blobs.  All integers are stored in network
+   byte order.
+
+   - b4   Magic 'KBXi'
+   - byte Version number (2)
+   - b3   RFU
+   - uint64_t  Size of the keybox file
+   - uint64_t  Modification time of the keybox file
+   - uint64_t  Inode number of the keybox file
+   - u32  [NRECORDS] Number of records
+   - u32  Nanoseconds part of the modification time or 0
+   - u32  Change counter from the header blob of the keybox
+   - u32  RFU
+   - NRECORDS times:
+     - byte Record type
+             1 = Long keyid (the 8 bytes matched by LONG_KID searches)
+             2 = Short keyid (the 4 bytes matched by SHORT_KID searches)
+             3 = UBID
+             4 = Keygrip (OpenPGP blobs only)
+     - b20  The key, left aligned and padded with zeroes.
+     - b3   RFU
+     - uint64_t  File offset of the blob
+   - b20  SHA-1 checksum of all the above
+
+   The records are sorted by memcmp order, thus all records with the
+   same key are adjacent and their offsets are ascending.  The index
+   is only used if the size, modification time, inode number and
+   change counter of the keybox match those stored in the header;
+   otherwise it is rebuilt by a full scan of the keybox.  The change
+   counter is incremented by each update of the keybox so that even
+   changes within the resolution of the file time are detected.  Because all candidate blobs
+   are read and matched by the regular search code, a record which
+   refers to a deleted or different blob is harmless; a missing record
+   is not, which is why a stale index is never used.
+*/
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+#define INDEX_MAGIC        "KBXi"
+#define INDEX_VERSION      2
+#define INDEX_HEADER_SIZE  48
+#define INDEX_RECORD_SIZE  32
+#define INDEX_KEY_SIZE     21  /* Type byte plus the padded key.  */
+
+#define INDEX_TYPE_KID     1
+#define INDEX_TYPE_SHORTKID 2
+#define INDEX_TYPE_UBID    3
+#define INDEX_TYPE_GRIP    4
+
+
+/* The identity of the keybox file an index belongs to.  */
+struct index_stamp_s
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+  u32 mtime_ns;
+  u32 counter;
+};
+
+struct keybox_index_s
+{
+  struct index_stamp_s stamp;
+  size_t nrecords;
+  size_t nallocated;
+  unsigned char *records;  /* NRECORDS * INDEX_RECORD_SIZE bytes.  */
+};
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return (((uint64_t)buf32_to_u32 (p)) << 32) | buf32_to_u32 (p + 4);
+}
+
+static void
+put32 (unsigned char *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+static void
+put64 (unsigned char *p, uint64_t a)
+{
+  put32 (p, a >> 32);
+  put32 (p + 4, a);
+}
+
+
+/* Read the change counter from the header blob of the keybox FP.
+ * The file position is restored.  Keyboxes without a header blob
+ * have a counter of 0.  */
+static gpg_error_t
+read_change_counter (estream_t fp, u32 *r_counter)
+{
+  unsigned char hdr[28];
+  off_t savedpos;
+  int okay;
+
+  *r_counter = 0;
+  savedpos = es_ftello (fp);
+  if (savedpos == (off_t)-1 || es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  okay = es_fread (hdr, sizeof hdr, 1, fp) == 1;
+  es_clearerr (fp);
+  if (es_fseeko (fp, savedpos, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (okay && hdr[4] == KEYBOX_BLOBTYPE_HEADER && buf32_to_uint (hdr) >= 28)
+    *r_counter = buf32_to_u32 (hdr + 24);
+  return 0;
+}
+
+
+/* Fill STAMP from the stat information ST and the header blob of the
+ * keybox FP.  */
+static gpg_error_t
+make_stamp (struct index_stamp_s *stamp, const struct stat *st,
+            estream_t fp)
+{
+  stamp->size = st->st_size;
+  stamp->mtime = st->st_mtime;
+  stamp->ino = st->st_ino;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  stamp->mtime_ns = st->st_mtim.tv_nsec;
+#else
+  stamp->mtime_ns = 0;
+#endif
+  return read_change_counter (fp, &stamp->counter);
+}
+
+static int
+same_stamp (const struct index_stamp_s *a, const struct index_stamp_s *b)
+{
+  return (a->size == b->size && a->mtime == b->mtime && a->ino == b->ino
+          && a->mtime_ns == b->mtime_ns && a->counter == b->counter);
+}
+
+
+/* Fill STAMP for the keybox KB.  */
+static gpg_error_t
+stamp_from_file (KB_NAME kb, struct index_stamp_s *stamp)
+{
+  gpg_error_t err;
+  estream_t fp;
+  struct stat st;
+
+  err = _keybox_ll_open (&fp, kb->fname, 0);
+  if (err)
+    return err;
+  if (fstat (es_fileno (fp), &st))
+    err = gpg_error_from_syserror ();
+  else
+    err = make_stamp (stamp, &st, fp);
+  _keybox_ll_close (fp);
+  return err;
+}
+
+
+/* Return a malloced string with the name of the index file for the
+ * keybox KB or NULL on error.  */
+static char *
+index_fname (KB_NAME kb)
+{
+  return strconcat (kb->fname, ".idx", NULL);
+}
+
+
+void
+_keybox_index_release (keybox_index_t idx)
+{
+  if (!idx)
+    return;
+  xfree (idx->records);
+  xfree (idx);
+}
+
+
+static keybox_index_t
+new_index (const struct index_stamp_s *stamp)
+{
+  keybox_index_t idx;
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (idx && stamp)
+    idx->stamp = *stamp;
+  return idx;
+}
+
+
+/* Append a record of TYPE for KEY with length KEYLEN and the blob
+ * offset OFF to IDX.  */
+static gpg_error_t
+add_record (keybox_index_t idx, int type,
+            const unsigned char *key, size_t keylen, off_t off)
+{
+  unsigned char *rec;
+
+  if (idx->nrecords == idx->nallocated)
+    {
+      size_t n = idx->nallocated? 2 * idx->nallocated : 256;
+
+      rec = xtryrealloc (idx->records, n * INDEX_RECORD_SIZE);
+      if (!rec)
+        return gpg_error_from_syserror ();
+      idx->records = rec;
+      idx->nallocated = n;
+    }
+  rec = idx->records + idx->nrecords * INDEX_RECORD_SIZE;
+  memset (rec, 0, INDEX_RECORD_SIZE);
+  rec[0] = type;
+  memcpy (rec + 1, key, keylen);
+  put64 (rec + 24, off);
+  idx->nrecords++;
+  return 0;
+}
+
+
+/* Add the records for the blob image BUFFER of LENGTH bytes which is
+ * stored at file offset OFF.  The key information is taken from the
+ * blob's meta data using the same rules as the search functions; the
+ * keygrips of OpenPGP blobs require to parse the keyblock.  */
+static gpg_error_t
+add_blob_records (keybox_index_t idx, const unsigned char *buffer,
+                  size_t length, off_t off)
+{
+  gpg_error_t err;
+  size_t pos, koff, nkeys, keyinfolen, cert_off, cert_len;
+  int i, fpr32, blobtype;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  if (length < 40)
+    return 0;
+  blobtype = buffer[4];
+  if (blobtype != KEYBOX_BLOBTYPE_PGP && blobtype != KEYBOX_BLOBTYPE_X509)
+    return 0;
+  fpr32 = buffer[5] == 2;
+
+  nkeys = buf16_to_uint (buffer + 16);
+  keyinfolen = buf16_to_uint (buffer + 18);
+  if (!nkeys || keyinfolen < (fpr32?56:28))
+    return 0; /* Invalid blob.  */
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return 0; /* Out of bounds.  */
+
+  err = add_record (idx, INDEX_TYPE_UBID, buffer + pos, UBID_LEN, off);
+  for (i=0; !err && i < nkeys; i++)
+    {
+      koff = pos + i*keyinfolen;
+      if (fpr32 && (buffer[koff + 32 + 1] & 0x80))
+        {
+          /* This (sub)key has a 32 byte fpr.  */
+          err = add_record (idx, INDEX_TYPE_KID, buffer + koff, 8, off);
+          if (!err)
+            err = add_record (idx, INDEX_TYPE_SHORTKID, buffer + koff, 4, off);
+        }
+      else
+        {
+          err = add_record (idx, INDEX_TYPE_KID, buffer + koff + 12, 8, off);
+          if (!err)
+            err = add_record (idx, INDEX_TYPE_SHORTKID,
+                              buffer + koff + 16, 4, off);
+        }
+    }
+  if (err || blobtype != KEYBOX_BLOBTYPE_PGP)
+    return err;
+
+  cert_off = buf32_to_size_t (buffer + 8);
+  cert_len = buf32_to_size_t (buffer + 12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
+    return 0;
+  if (_keybox_parse_openpgp (buffer + cert_off, cert_len, 0, NULL, &info))
+    return 0; /* Such a blob never matches a keygrip search.  */
+
+  err = add_record (idx, INDEX_TYPE_GRIP, info.primary.grip, 20, off);
+  if (!err && info.nsubkeys)
+    for (k = &info.subkeys; k && !err; k = k->next)
+      err = add_record (idx, INDEX_TYPE_GRIP, k->grip, 20, off);
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+static int
+compare_records (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_RECORD_SIZE);
+}
+
+static void
+sort_records (keybox_index_t idx)
+{
+  qsort (idx->records, idx->nrecords, INDEX_RECORD_SIZE, compare_records);
+}
+
+
+/* Build a new index by scanning all blobs of the keybox at FP.  The
+ * file position of FP is restored.  */
+static gpg_error_t
+build_index (estream_t fp, const struct index_stamp_s *stamp,
+             keybox_index_t *r_idx)
+{
+  gpg_error_t err;
+  keybox_index_t idx;
+  KEYBOXBLOB blob;
+  const unsigned char *buffer;
+  size_t length;
+  off_t savedpos;
+  int rc;
+
+  *r_idx = NULL;
+  savedpos = es_ftello (fp);
+  if (savedpos == (off_t)-1 || es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+
+  idx = new_index (stamp);
+  if (!idx)
+    err = gpg_error_from_syserror ();
+  else
+    err = 0;
+  while (!err)
+    {
+      rc = _keybox_read_blob (&blob, fp, NULL);
+      if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+        continue; /* Never returned by a search.  */
+      if (rc == -1)
+        break;
+      if (rc)
+        {
+          err = rc;
+          break;
+        }
+      buffer = _keybox_get_blob_image (blob, &length);
+      err = add_blob_records (idx, buffer, length,
+                              _keybox_get_blob_fileoffset (blob));
+      _keybox_release_blob (blob);
+    }
+
+  es_clearerr (fp);
+  if (es_fseeko (fp, savedpos, SEEK_SET) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      _keybox_index_release (idx);
+      return err;
+    }
+
+  sort_records (idx);
+  *r_idx = idx;
+  return 0;
+}
+
+
+/* Read the index file of KB and return it at R_IDX.  If STAMP is not
+ * NULL, GPG_ERR_NOT_FOUND is returned if the index does not belong to
+ * a keybox with that stamp.  */
+static gpg_error_t
+read_index (KB_NAME kb, const struct index_stamp_s *stamp,
+            keybox_index_t *r_idx)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  unsigned char hdr[INDEX_HEADER_SIZE];
+  unsigned char digest[20], csum[20];
+  struct index_stamp_s filestamp;
+  keybox_index_t idx = NULL;
+  size_t n, nrecords;
+  struct stat st;
+  gcry_md_hd_t md = NULL;
+
+  *r_idx = NULL;
+  fname = index_fname (kb);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (fname, "rb,sysopen");
+  xfree (fname);
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  if (es_fread (hdr, INDEX_HEADER_SIZE, 1, fp) != 1
+      || memcmp (hdr, INDEX_MAGIC, 4) || hdr[4] != INDEX_VERSION)
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+  filestamp.size  = get64 (hdr + 8);
+  filestamp.mtime = get64 (hdr + 16);
+  filestamp.ino   = get64 (hdr + 24);
+  nrecords = buf32_to_size_t (hdr + 32);
+  filestamp.mtime_ns = buf32_to_u32 (hdr + 36);
+  filestamp.counter  = buf32_to_u32 (hdr + 40);
+  if (stamp && !same_stamp (stamp, &filestamp))
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  /* Do not trust the number of records but check it against the
+   * file size before allocating the records.  */
+  if (fstat (es_fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (nrecords > (size_t)(-1) / INDEX_RECORD_SIZE
+      || ((uint64_t)st.st_size
+          != INDEX_HEADER_SIZE + 20 + (uint64_t)nrecords * INDEX_RECORD_SIZE))
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+
+  idx = new_index (&filestamp);
+  if (!idx)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (nrecords)
+    {
+      idx->records = xtrymalloc (nrecords * INDEX_RECORD_SIZE);
+      if (!idx->records)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      idx->nallocated = nrecords;
+      if (es_fread (idx->records, INDEX_RECORD_SIZE, nrecords, fp) != nrecords)
+        {
+          err = gpg_error (GPG_ERR_INV_KEYRING);
+          goto leave;
+        }
+      idx->nrecords = nrecords;
+    }
+  if (es_fread (csum, 20, 1, fp) != 1 || es_getc (fp) != EOF)
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    goto leave;
+  gcry_md_write (md, hdr, INDEX_HEADER_SIZE);
+  gcry_md_write (md, idx->records, nrecords * INDEX_RECORD_SIZE);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  if (memcmp (digest, csum, 20))
+    {
+      err = gpg_error (GPG_ERR_CHECKSUM);
+      goto leave;
+    }
+  for (n=1; n < nrecords; n++)
+    if (compare_records (idx->records + (n-1) * INDEX_RECORD_SIZE,
+                         idx->records + n * INDEX_RECORD_SIZE) > 0)
+      {
+        err = gpg_error (GPG_ERR_INV_KEYRING);
+        goto leave;
+      }
+
+  *r_idx = idx;
+  idx = NULL;
+
+ leave:
+  gcry_md_close (md);
+  _keybox_index_release (idx);
+  es_fclose (fp);
+  return err;
+}
+
+
+/* Write IDX to the index file of KB.  A temporary file is used so
+ * that concurrent readers never see a partial index.  Errors are not
+ * fatal because the index is rebuilt on demand.  */
+static void
+write_index (KB_NAME kb, keybox_index_t idx)
+{
+  gpg_error_t err;
+  char *fname, *tmpfname;
+  estream_t fp;
+  unsigned char hdr[INDEX_HEADER_SIZE];
+  unsigned char digest[20];
+  gcry_md_hd_t md;
+
+  if (kb->secret)
+    return;
+
+  fname = index_fname (kb);
+  if (!fname)
+    return;
+  tmpfname = xtryasprintf ("%s.%lu", fname, (unsigned long)getpid ());
+  if (!tmpfname)
+    {
+      xfree (fname);
+      return;
+    }
+
+  memset (hdr, 0, sizeof hdr);
+  memcpy (hdr, INDEX_MAGIC, 4);
+  hdr[4] = INDEX_VERSION;
+  put64 (hdr + 8, idx->stamp.size);
+  put64 (hdr + 16, idx->stamp.mtime);
+  put64 (hdr + 24, idx->stamp.ino);
+  put32 (hdr + 32, idx->nrecords);
+  put32 (hdr + 36, idx->stamp.mtime_ns);
+  put32 (hdr + 40, idx->stamp.counter);
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    goto leave;
+  gcry_md_write (md, hdr, INDEX_HEADER_SIZE);
+  gcry_md_write (md, idx->records, idx->nrecords * INDEX_RECORD_SIZE);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+
+  fp = es_fopen (tmpfname, "wb,sysopen");
+  if (!fp)
+    goto leave;
+  if (es_fwrite (hdr, INDEX_HEADER_SIZE, 1, fp) != 1
+      || (idx->nrecords
+          && es_fwrite (idx->records, INDEX_RECORD_SIZE, idx->nrecords, fp)
+          != idx->nrecords)
+      || es_fwrite (digest, 20, 1, fp) != 1)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    {
+      log_debug ("keybox: error writing index '%s': %s\n",
+                 fname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Return the index of KB matching STAMP.  The index is taken from the
+ * cache, read from the index file, or, if FP is not NULL, built from
+ * the keybox at FP.  On success the index is owned by KB.  */
+static keybox_index_t
+get_index (KB_NAME kb, const struct index_stamp_s *stamp, estream_t fp)
+{
+  keybox_index_t idx;
+
+  if (kb->index && same_stamp (&kb->index->stamp, stamp))
+    return kb->index;
+
+  if (read_index (kb, stamp, &idx))
+    {
+      if (!fp || build_index (fp, stamp, &idx))
+        return NULL;
+      write_index (kb, idx);
+    }
+
+  _keybox_index_release (kb->index);
+  kb->index = idx;
+  return idx;
+}
+
+
+/* Return the position of the first record in IDX which is not less
+ * than the key part of REC.  */
+static size_t
+lower_bound (keybox_index_t idx, const unsigned char *rec)
+{
+  size_t lo = 0;
+  size_t hi = idx->nrecords;
+  size_t mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (memcmp (idx->records + mid * INDEX_RECORD_SIZE,
+                  rec, INDEX_KEY_SIZE) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+
+static int
+compare_offsets (const void *a, const void *b)
+{
+  off_t x = *(const off_t *)a;
+  off_t y = *(const off_t *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Build the key part of a record for the search description DESC at
+ * REC.  Returns false if DESC can't be resolved by the index.  */
+static int
+desc_to_record (KEYBOX_SEARCH_DESC *desc, keybox_blobtype_t want_blobtype,
+                unsigned char *rec)
+{
+  memset (rec, 0, INDEX_RECORD_SIZE);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      rec[0] = INDEX_TYPE_SHORTKID;
+      put32 (rec + 1, desc->u.kid[1]);
+      break;
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      rec[0] = INDEX_TYPE_KID;
+      put32 (rec + 1, desc->u.kid[0]);
+      put32 (rec + 5, desc->u.kid[1]);
+      break;
+    case KEYDB_SEARCH_MODE_FPR:
+      /* A fingerprint can only match if the keyid part matches.  */
+      rec[0] = INDEX_TYPE_KID;
+      if (desc->fprlen == 20)
+        memcpy (rec + 1, desc->u.fpr + 12, 8);
+      else if (desc->fprlen == 32)
+        memcpy (rec + 1, desc->u.fpr, 8);
+      else
+        return 0;
+      break;
+    case KEYDB_SEARCH_MODE_UBID:
+      rec[0] = INDEX_TYPE_UBID;
+      memcpy (rec + 1, desc->u.ubid, UBID_LEN);
+      break;
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      /* Keygrips are only indexed for OpenPGP blobs.  */
+      if (want_blobtype != KEYBOX_BLOBTYPE_PGP)
+        return 0;
+      rec[0] = INDEX_TYPE_GRIP;
+      memcpy (rec + 1, desc->u.grip, 20);
+      break;
+    default:
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Use the index of the keybox at HD to find the blobs which may match
+ * one of the NDESC descriptions DESC.  On success a malloced and
+ * sorted array with the file offsets of these blobs is stored at
+ * R_OFFSETS and its length at R_COUNT; the caller must read and match
+ * each of these blobs as usual.  GPG_ERR_NOT_SUPPORTED is returned if
+ * the index can't be used for this search; the caller then needs to
+ * scan the entire keybox.  The index is built if it does not exist or
+ * is stale.  */
+gpg_error_t
+_keybox_index_lookup (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                      size_t ndesc, keybox_blobtype_t want_blobtype,
+                      off_t **r_offsets, size_t *r_count)
+{
+  gpg_error_t err;
+  unsigned char rec[INDEX_RECORD_SIZE];
+  struct index_stamp_s stamp;
+  struct stat st;
+  keybox_index_t idx;
+  off_t *offsets = NULL;
+  size_t noffsets = 0;
+  size_t nallocated = 0;
+  size_t n, i, j;
+
+  *r_offsets = NULL;
+  *r_count = 0;
+
+  if (!ndesc || !hd->fp)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (n=0; n < ndesc; n++)
+    if (!desc_to_record (desc + n, want_blobtype, rec))
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (fstat (es_fileno (hd->fp), &st) || make_stamp (&stamp, &st, hd->fp))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  idx = get_index (hd->kb, &stamp, hd->fp);
+  if (!idx)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  for (n=0; n < ndesc; n++)
+    {
+      desc_to_record (desc + n, want_blobtype, rec);
+      for (i = lower_bound (idx, rec); i < idx->nrecords; i++)
+        {
+          const unsigned char *p = idx->records + i * INDEX_RECORD_SIZE;
+
+          if (memcmp (p, rec, INDEX_KEY_SIZE))
+            break;
+          if (noffsets == nallocated)
+            {
+              off_t *tmp;
+
+              nallocated = nallocated? 2 * nallocated : 16;
+              tmp = xtryrealloc (offsets, nallocated * sizeof *offsets);
+              if (!tmp)
+                {
+                  err = gpg_error_from_syserror ();
+                  xfree (offsets);
+                  return err;
+                }
+              offsets = tmp;
+            }
+          offsets[noffsets++] = get64 (p + 24);
+        }
+    }
+
+  /* Sort and remove duplicates.  */
+  if (noffsets > 1)
+    {
+      qsort (offsets, noffsets, sizeof *offsets, compare_offsets);
+      for (i=j=1; i < noffsets; i++)
+        if (offsets[i] != offsets[j-1])
+          offsets[j++] = offsets[i];
+      noffsets = j;
+    }
+
+  *r_offsets = offsets;
+  *r_count = noffsets;
+  return 0;
+}
+
+
+/* Prepare for a modification of the keybox KB.  Returns the current
+ * index of KB or NULL if there is no valid index.  The returned index
+ * is detached from KB and must be passed to _keybox_index_commit.  */
+keybox_index_t
+_keybox_index_begin (KB_NAME kb)
+{
+  struct index_stamp_s stamp;
+  keybox_index_t idx;
+
+  if (stamp_from_file (kb, &stamp))
+    return NULL;
+  idx = get_index (kb, &stamp, NULL);
+  if (idx)
+    kb->index = NULL;
+  return idx;
+}
+
+
+/* Finish a modification of the keybox KB started with
+ * _keybox_index_begin which returned IDX.  ERR is the result of the
+ * modification.  On success the blob of OLDLEN bytes at file offset
+ * OFF has been replaced by BLOB:
+ *
+ *   insert - OFF is -1 to append, OLDLEN is 0.
+ *   update - OFF and OLDLEN describe the old blob.
+ *   delete - BLOB is NULL; the old blob is kept in place.
+ *   flags  - BLOB is NULL and OLDLEN is 0; only the stamp changes.
+ *
+ * If there was no valid index it is removed and rebuilt by the next
+ * search.  */
+void
+_keybox_index_commit (KB_NAME kb, keybox_index_t idx, gpg_error_t err,
+                      off_t off, size_t oldlen, KEYBOXBLOB blob)
+{
+  const unsigned char *buffer = NULL;
+  size_t length = 0;
+  struct index_stamp_s stamp;
+  off_t shift, o;
+  unsigned char *p;
+  size_t i, j;
+
+  if (err)
+    {
+      /* The keybox has not been changed.  */
+      if (idx && !kb->index)
+        kb->index = idx;
+      else
+        _keybox_index_release (idx);
+      return;
+    }
+
+  if (idx && !stamp_from_file (kb, &stamp))
+    {
+      if (off == (off_t)-1)
+        off = idx->stamp.size;
+      if (blob)
+        buffer = _keybox_get_blob_image (blob, &length);
+      else
+        length = oldlen;
+      shift = (off_t)length - (off_t)oldlen;
+
+      for (i=j=0; i < idx->nrecords; i++)
+        {
+          p = idx->records + i * INDEX_RECORD_SIZE;
+          o = get64 (p + 24);
+          if (oldlen && o == off)
+            continue;
+          if (o > off)
+            put64 (p + 24, o + shift);
+          if (i != j)
+            memcpy (idx->records + j * INDEX_RECORD_SIZE, p,
+                    INDEX_RECORD_SIZE);
+          j++;
+        }
+      idx->nrecords = j;
+
+      if (!blob || !add_blob_records (idx, buffer, length, off))
+        {
+          sort_records (idx);
+          idx->stamp = stamp;
+          write_index (kb, idx);
+          _keybox_index_release (kb->index);
+          kb->index = idx;
+          return;
+        }
+    }
+
+  /* Drop the stale index.  */
+  _keybox_index_release (idx);
+  _keybox_index_invalidate (kb);
+}
+
+
+/* Finish a compaction step started with _keybox_index_begin which
+ * returned IDX.  ERR is the result of the step.  On success the blobs
+ * in the file range [START,END) have been moved by DELTA bytes; the
+ * offsets of all other blobs are unchanged.  */
+void
+_keybox_index_commit_move (KB_NAME kb, keybox_index_t idx, gpg_error_t err,
+                           off_t start, off_t end, off_t delta)
+{
+  struct index_stamp_s stamp;
+  off_t o;
+  unsigned char *p;
+  size_t i;
+
+  if (err)
+    {
+      _keybox_index_commit (kb, idx, err, 0, 0, NULL);
+      return;
+    }
+
+  if (idx && !stamp_from_file (kb, &stamp))
+    {
+      for (i=0; i < idx->nrecords; i++)
+        {
+          p = idx->records + i * INDEX_RECORD_SIZE;
+          o = get64 (p + 24);
+          if (o >= start && o < end)
+            put64 (p + 24, o + delta);
+        }
+      sort_records (idx);
+      idx->stamp = stamp;
+      write_index (kb, idx);
+      _keybox_index_release (kb->index);
+      kb->index = idx;
+      return;
+    }
+
+  _keybox_index_release (idx);
+  _keybox_index_invalidate (kb);
+}
+
+
+/* Remove the index of KB.  This is used after the keybox has been
+ * rewritten.  */
+void
+_keybox_index_invalidate (KB_NAME kb)
+{
+  char *fname;
+
+  _keybox_index_release (kb->index);
+  kb->index = NULL;
+  fname = index_fname (kb);
+  if (fname)
+    {
+      gnupg_remove (fname);
+      xfree (fname);
+    }
+}
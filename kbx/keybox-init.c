@@ -36,6 +36,9 @@
 
 static unsigned int ll_buffer_size = DEFAULT_LL_BUFFER_SIZE;
 
+/* If true keyboxes are updated in place; see keybox_set_update_in_place.  */
+static int update_in_place;
+
 static KB_NAME kb_names;
 
 /* This object is used to mahe setvbuf buffers.  We use a short arary
@@ -82,10 +85,16 @@ keybox_register_file (const char *fname, int secret, void **r_token)
   kr->lockhd = NULL;
   kr->is_locked = 0;
   kr->did_full_scan = 0;
+  kr->index = NULL;
   /* keep a list of all issued pointers */
   kr->next = kb_names;
   kb_names = kr;
 
+  /* Roll back an update which has been interrupted by a crash so that
+   * readers don't see a partly written blob.  */
+  if (update_in_place)
+    _keybox_recover (fname);
+
   /* create the offset table the first time a function here is used */
 /*      if (!kb_offtbl) */
 /*        kb_offtbl = new_offset_hash_table (); */
@@ -114,6 +123,28 @@ keybox_set_buffersize (unsigned int kbytes, int reserved)
 }
 
 
+/* Update the keyboxes in place instead of writing a new file and
+ * renaming it.  A reader which does not hold the lock of the keybox
+ * may then see a partly written or moved blob; thus this may only be
+ * used by a process which is the only user of its keyboxes and
+ * which serializes its own readers and writers.  This is the case for
+ * keyboxd.  This function must be called before the first keybox is
+ * registered.  */
+void
+keybox_set_update_in_place (int yes)
+{
+  update_in_place = !!yes;
+}
+
+
+/* Return true if the keyboxes are updated in place.  */
+int
+_keybox_get_update_in_place (void)
+{
+  return update_in_place;
+}
+
+
 static KEYBOX_HANDLE
 do_keybox_new (KB_NAME resource, int secret, int for_openpgp)
 {
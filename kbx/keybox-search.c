@@ -362,6 +362,34 @@ blob_cmp_ubid (KEYBOXBLOB blob, const unsigned char *ubid)
 }
 
 
+/* Return false if NAME of length NAMELEN can't be a substring of any
+ * user ID in the blob BUFFER of LENGTH bytes according to the user ID
+ * filter in the blob's reserved space.  POS is the offset of the
+ * signature information which directly follows the user ID table.  */
+static int
+uid_filter_may_match (const unsigned char *buffer, size_t length,
+                      size_t pos, const char *name, size_t namelen)
+{
+  size_t nsigs, siginfolen, nres;
+
+  if ((uint64_t)pos + 4 > (uint64_t)length)
+    return 1;
+  nsigs = get16 (buffer + pos);
+  siginfolen = get16 (buffer + pos + 2);
+  /* Skip the sig info, the fixed fields and the NRES field.  */
+  if ((uint64_t)pos + 4 + (uint64_t)nsigs*siginfolen + 16 + 4
+      > (uint64_t)length)
+    return 1;
+  pos += 4 + nsigs*siginfolen + 16;
+  nres = get32 (buffer + pos);
+  pos += 4;
+  if ((uint64_t)pos + nres > (uint64_t)length)
+    return 1;
+
+  return _keybox_uid_filter_match (buffer + pos, nres, name, namelen);
+}
+
+
 static int
 blob_cmp_name (KEYBOXBLOB blob, int idx,
                const char *name, size_t namelen, int substr, int x509)
@@ -400,6 +428,10 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
   if (pos + uidinfolen*nuids > length)
     return 0; /* out of bounds */
 
+  if (!uid_filter_may_match (buffer, length, pos + uidinfolen*nuids,
+                             name, namelen))
+    return 0; /* no user ID can match */
+
   if (idx < 0)
     { /* Compare all names.  Note that for X.509 we start with index 1
          so to skip the issuer at index 0.  */
@@ -499,6 +531,10 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
   if (namelen < 1)
     return 0;
 
+  if (!uid_filter_may_match (buffer, length, pos + uidinfolen*nuids,
+                             name, namelen))
+    return 0; /* no user ID can match */
+
   /* Note that for X.509 we start at index 1 because index 0 is used
      for the issuer name.  */
   for (idx=!!x509 ;idx < nuids; idx++)
@@ -922,6 +958,10 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  off_t *candidates = NULL;
+  size_t ncandidates = 0;
+  size_t candidx = 0;
+  int use_index = 0;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1067,6 +1107,11 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* For exact searches the index tells us which blobs may match so
+   * that we only need to read those.  */
+  if (!_keybox_index_lookup (hd, desc, ndesc, want_blobtype,
+                             &candidates, &ncandidates))
+    use_index = 1;
 
   pk_no = uid_no = 0;
   for (;;)
@@ -1075,6 +1120,29 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
+      if (use_index)
+        {
+          /* Seek to the next candidate after the current position.  */
+          off_t curoff = es_ftello (hd->fp);
+
+          if (curoff == (off_t)-1)
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          while (candidx < ncandidates && candidates[candidx] < curoff)
+            candidx++;
+          if (candidx == ncandidates)
+            {
+              rc = -1; /* EOF */
+              break;
+            }
+          if (es_fseeko (hd->fp, candidates[candidx++], SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
       rc = _keybox_read_blob (&blob, hd->fp, NULL);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
@@ -1220,6 +1288,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (candidates);
 
   return rc;
 }
@@ -27,6 +27,7 @@
 #include <assert.h>
 
 #include "keybox-defs.h"
+#include <gcrypt.h>
 #include "../common/sysutils.h"
 #include "../common/host2net.h"
 #include "../common/utilproto.h"
@@ -37,6 +38,48 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* Header flags of the first blob.  */
+#define HEADER_FLAG_OPENPGP    0x02  /* OpenPGP data may be available.  */
+#define HEADER_FLAG_HAS_EMPTY  0x04  /* Empty blobs may be compacted.  */
+
+/* The number of bytes moved by one compaction step and the number of
+ * steps done by a maintenance run.  */
+#define COMPACT_STEP_SIZE  (1024*1024)
+#define COMPACT_MAX_STEPS  8
+
+/* If the keybox is updated in place (see keybox_set_update_in_place),
+ * changes to the blobs are journaled in a file next to the keybox so
+ * that an interrupted change can be rolled back.  The journal is
+ * written and synced before the keybox is changed and removed after
+ * the keybox has been synced:
+ *
+ *   - b4   Magic 'KBXJ'
+ *   - byte Version number (1)
+ *   - b3   RFU
+ *   - u64  Size of the keybox before the change
+ *   - u32  [N] Number of saved regions
+ *   - N times:
+ *     - u64  File offset of the region
+ *     - u32  [LEN] Length of the region
+ *     - bLEN The original content of the region
+ *   - b20  SHA-1 checksum of all the above
+ */
+#define JOURNAL_SUFFIX       ".jnl"
+#define JOURNAL_HEADER_SIZE  20
+#define JOURNAL_MAX_SIZE     (64*1024*1024)
+
+/* A region of the keybox saved in the journal.  */
+struct journal_region_s
+{
+  off_t off;
+  size_t len;
+};
+
+/* A hook for the regression tests.  If set it is called with 1 after
+ * the journal has been written and with 2 after the keybox has been
+ * changed but before the journal is removed.  */
+void (*_keybox_journal_hook) (int point);
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -69,6 +112,388 @@ fseeko (FILE * stream, off_t newpos, int whence)
 #endif /* !defined(HAVE_FSEEKO) && !defined(fseeko) */
 
 
+static void
+put64 (unsigned char *p, uint64_t a)
+{
+  ulongtobuf (p, (u32)(a >> 32));
+  ulongtobuf (p + 4, (u32)a);
+}
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return ((uint64_t)buf32_to_u32 (p) << 32) | buf32_to_u32 (p + 4);
+}
+
+
+/* Flush FP and make sure that its data has been written to disk.  */
+static gpg_error_t
+sync_file (estream_t fp)
+{
+  if (es_fflush (fp))
+    return gpg_error_from_syserror ();
+#if defined(HAVE_FSYNC) && !defined(HAVE_W32_SYSTEM)
+  if (fsync (es_fileno (fp)))
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
+
+
+/* Store the size of the file FP at R_SIZE.  */
+static gpg_error_t
+get_file_size (estream_t fp, off_t *r_size)
+{
+  if (es_fseeko (fp, 0, SEEK_END))
+    return gpg_error_from_syserror ();
+  *r_size = es_ftello (fp);
+  if (*r_size == (off_t)-1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Read LENGTH bytes at offset OFF of FP into BUFFER.  */
+static gpg_error_t
+read_at (estream_t fp, off_t off, void *buffer, size_t length)
+{
+  if (es_fseeko (fp, off, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (length && es_fread (buffer, length, 1, fp) != 1)
+    {
+      if (es_ferror (fp))
+        return gpg_error_from_syserror ();
+      return gpg_error (GPG_ERR_TOO_SHORT);
+    }
+  return 0;
+}
+
+
+/* Write LENGTH bytes from BUFFER at offset OFF of FP.  */
+static gpg_error_t
+write_at (estream_t fp, off_t off, const void *buffer, size_t length)
+{
+  if (es_fseeko (fp, off, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (length && es_fwrite (buffer, length, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Read the length and the type of the blob at offset OFF of FP whose
+ * size is FILESIZE.  */
+static gpg_error_t
+read_blob_header (estream_t fp, off_t off, off_t filesize,
+                  size_t *r_length, int *r_type)
+{
+  gpg_error_t err;
+  unsigned char hdr[5];
+
+  err = read_at (fp, off, hdr, 5);
+  if (err)
+    return err;
+  *r_length = buf32_to_size_t (hdr);
+  *r_type = hdr[4];
+  if (*r_length < 5 || off + (off_t)*r_length > filesize)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  return 0;
+}
+
+
+/* Write the header of an empty blob of LENGTH bytes at offset OFF of
+ * FP.  The content of an empty blob is not used.  */
+static gpg_error_t
+write_empty_blob (estream_t fp, off_t off, size_t length)
+{
+  unsigned char hdr[5];
+
+  ulongtobuf (hdr, length);
+  hdr[4] = KEYBOX_BLOBTYPE_EMPTY;
+  return write_at (fp, off, hdr, 5);
+}
+
+
+/* Set the header flags SET, clear the header flags CLEAR and increment
+ * the change counter of the header blob at BUFFER which has LENGTH
+ * bytes.  Returns false if BUFFER does not start with a header blob.  */
+static int
+update_header_buffer (unsigned char *buffer, size_t length,
+                      unsigned int set, unsigned int clear)
+{
+  u32 counter;
+
+  if (length < 28 || buffer[4] != KEYBOX_BLOBTYPE_HEADER
+      || buf32_to_uint (buffer) < 28)
+    return 0;
+  buffer[7] = (buffer[7] | set) & ~clear;
+  counter = buf32_to_u32 (buffer + 24) + 1;
+  ulongtobuf (buffer + 24, counter);
+  return 1;
+}
+
+
+/* Set the header flags SET, clear the header flags CLEAR and increment
+ * the change counter of the keybox FP.  This must be done for every
+ * change of the keybox so that a stale side index is detected.
+ * Nothing is done if the keybox has no header blob.  */
+static gpg_error_t
+update_header (estream_t fp, unsigned int set, unsigned int clear)
+{
+  gpg_error_t err;
+  unsigned char buffer[28];
+
+  err = read_at (fp, 0, buffer, 28);
+  if (gpg_err_code (err) == GPG_ERR_TOO_SHORT)
+    return 0;
+  if (err)
+    return err;
+  if (!update_header_buffer (buffer, 28, set, clear))
+    return 0;
+  err = write_at (fp, 7, buffer + 7, 1);
+  if (!err)
+    err = write_at (fp, 24, buffer + 24, 4);
+  return err;
+}
+
+
+
+/* Return a malloced string with the name of the journal of the
+ * keybox FNAME or NULL on error.  */
+static char *
+journal_fname (const char *fname)
+{
+  return strconcat (fname, JOURNAL_SUFFIX, NULL);
+}
+
+
+/* Save the NREGIONS REGIONS of the keybox FP to the journal of the
+ * keybox FNAME.  OLDSIZE is the current size of the keybox.  The
+ * keybox may only be changed after this function succeeded.  */
+static gpg_error_t
+journal_write (const char *fname, estream_t fp, off_t oldsize,
+               const struct journal_region_s *regions, int nregions)
+{
+  gpg_error_t err, err2;
+  char *jname;
+  estream_t jfp;
+  unsigned char *buffer, *p;
+  size_t length;
+  int i;
+
+  length = JOURNAL_HEADER_SIZE + 20;
+  for (i=0; i < nregions; i++)
+    length += 12 + regions[i].len;
+  buffer = xtrymalloc (length);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  memcpy (buffer, "KBXJ", 4);
+  buffer[4] = 1;
+  buffer[5] = buffer[6] = buffer[7] = 0;
+  put64 (buffer + 8, oldsize);
+  ulongtobuf (buffer + 16, nregions);
+  p = buffer + JOURNAL_HEADER_SIZE;
+  for (i=0; i < nregions; i++)
+    {
+      put64 (p, regions[i].off);
+      ulongtobuf (p + 8, regions[i].len);
+      err = read_at (fp, regions[i].off, p + 12, regions[i].len);
+      if (err)
+        {
+          xfree (buffer);
+          return err;
+        }
+      p += 12 + regions[i].len;
+    }
+  gcry_md_hash_buffer (GCRY_MD_SHA1, p, buffer, p - buffer);
+
+  jname = journal_fname (fname);
+  if (!jname)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (buffer);
+      return err;
+    }
+  err = _keybox_ll_open (&jfp, jname, KEYBOX_LL_OPEN_CREATE);
+  if (!err)
+    {
+      if (es_fwrite (buffer, length, 1, jfp) != 1)
+        err = gpg_error_from_syserror ();
+      else
+        err = sync_file (jfp);
+      err2 = _keybox_ll_close (jfp);
+      if (!err)
+        err = err2;
+      if (err)
+        gnupg_remove (jname);
+    }
+
+  xfree (jname);
+  xfree (buffer);
+  if (!err && _keybox_journal_hook)
+    _keybox_journal_hook (1);
+  return err;
+}
+
+
+/* Roll back an interrupted change of the keybox FNAME using its
+ * journal.  This must be called with the keybox locked and before
+ * the keybox is changed.  */
+static gpg_error_t
+journal_recover (const char *fname)
+{
+  gpg_error_t err, err2;
+  char *jname;
+  estream_t jfp, fp;
+  unsigned char *buffer = NULL;
+  unsigned char digest[20];
+  const unsigned char *p;
+  off_t jsize, oldsize, cursize, off;
+  size_t length, n, len;
+  unsigned int nregions, i;
+
+  jname = journal_fname (fname);
+  if (!jname)
+    return gpg_error_from_syserror ();
+
+  err = _keybox_ll_open (&jfp, jname, KEYBOX_LL_OPEN_READ);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    {
+      xfree (jname);
+      return 0;  /* No journal - nothing to do.  */
+    }
+  if (err)
+    goto leave;
+  err = get_file_size (jfp, &jsize);
+  if (!err && jsize < JOURNAL_HEADER_SIZE + 20)
+    err = gpg_error (GPG_ERR_TOO_SHORT);
+  else if (!err && jsize > JOURNAL_MAX_SIZE)
+    err = gpg_error (GPG_ERR_INV_OBJ);
+  if (!err)
+    {
+      length = jsize;
+      buffer = xtrymalloc (length);
+      if (!buffer)
+        err = gpg_error_from_syserror ();
+      else
+        err = read_at (jfp, 0, buffer, length);
+    }
+  _keybox_ll_close (jfp);
+  if (err && gpg_err_code (err) != GPG_ERR_TOO_SHORT
+      && gpg_err_code (err) != GPG_ERR_INV_OBJ)
+    goto leave;
+
+  /* Check the journal.  A journal which has not been completely
+   * written is ignored because the keybox is only changed after the
+   * journal has been synced.  */
+  if (!err)
+    {
+      gcry_md_hash_buffer (GCRY_MD_SHA1, digest, buffer, length - 20);
+      if (memcmp (buffer, "KBXJ", 4) || buffer[4] != 1
+          || memcmp (digest, buffer + length - 20, 20))
+        err = gpg_error (GPG_ERR_CHECKSUM);
+    }
+  if (!err)
+    {
+      nregions = buf32_to_uint (buffer + 16);
+      for (i=0, n = JOURNAL_HEADER_SIZE; i < nregions; i++)
+        {
+          if (n + 12 > length - 20)
+            break;
+          n += 12 + buf32_to_size_t (buffer + n + 8);
+        }
+      if (i < nregions || n != length - 20)
+        err = gpg_error (GPG_ERR_INV_OBJ);
+    }
+  if (err)
+    {
+      log_info ("keybox '%s': ignoring incomplete journal: %s\n",
+                fname, gpg_strerror (err));
+      gnupg_remove (jname);
+      err = 0;
+      goto leave;
+    }
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    goto leave;
+  oldsize = get64 (buffer + 8);
+  err = get_file_size (fp, &cursize);
+  if (!err && cursize != oldsize)
+    {
+#if defined(HAVE_FTRUNCATE) && !defined(HAVE_W32_SYSTEM)
+      if (es_fflush (fp) || ftruncate (es_fileno (fp), oldsize))
+        err = gpg_error_from_syserror ();
+#else
+      /* Without truncation we can only hide appended data.  */
+      if (cursize < oldsize + 5)
+        err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      else
+        err = write_empty_blob (fp, oldsize, cursize - oldsize);
+#endif
+    }
+  for (p = buffer + JOURNAL_HEADER_SIZE; !err && p < buffer + length - 20;
+       p += 12 + len)
+    {
+      off = get64 (p);
+      len = buf32_to_size_t (p + 8);
+      err = write_at (fp, off, p + 12, len);
+    }
+  if (!err)
+    err = sync_file (fp);
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  if (!err)
+    {
+      log_info ("keybox '%s': rolled back an interrupted update\n", fname);
+      gnupg_remove (jname);
+    }
+
+ leave:
+  if (err)
+    log_error ("keybox '%s': error recovering from journal: %s\n",
+               fname, gpg_strerror (err));
+  xfree (buffer);
+  xfree (jname);
+  return err;
+}
+
+
+/* Finish a change of the keybox FNAME which has been recorded in its
+ * journal.  ERR is the result of the change; on error the change is
+ * rolled back.  */
+static void
+journal_finish (const char *fname, gpg_error_t err)
+{
+  char *jname;
+
+  if (err)
+    {
+      journal_recover (fname);
+      return;
+    }
+
+  if (_keybox_journal_hook)
+    _keybox_journal_hook (2);
+  jname = journal_fname (fname);
+  if (jname)
+    gnupg_remove (jname);
+  xfree (jname);
+}
+
+
+/* Roll back an interrupted in-place update of the keybox FNAME.  */
+gpg_error_t
+_keybox_recover (const char *fname)
+{
+  return journal_recover (fname);
+}
+
+
+
+
 static int
 create_tmp_file (const char *template,
                  char **r_bakfname, char **r_tmpfname, estream_t *r_fp)
@@ -153,9 +578,10 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
 
 
-/* Perform insert/delete/update operation.  MODE is one of
-   FILECOPY_INSERT, FILECOPY_DELETE, FILECOPY_UPDATE.  FOR_OPENPGP
-   indicates that this is called due to an OpenPGP keyblock change.  */
+/* Perform insert/delete/update operation by writing a new file and
+   renaming it.  MODE is one of FILECOPY_INSERT, FILECOPY_DELETE,
+   FILECOPY_UPDATE.  FOR_OPENPGP indicates that this is called due to
+   an OpenPGP keyblock change.  */
 static int
 blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
                int secret, int for_openpgp, off_t start_offset)
@@ -173,6 +599,11 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   if ((ec = gnupg_access (fname, W_OK)))
     return gpg_error (ec);
 
+  /* A journal may have been left behind by keyboxd.  */
+  rc = journal_recover (fname);
+  if (rc)
+    return rc;
+
   rc = _keybox_ll_open (&fp, fname, 0);
   if (mode == FILECOPY_INSERT && gpg_err_code (rc) == GPG_ERR_ENOENT)
     {
@@ -232,11 +663,11 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
          failsafe the blob type.) */
       while ( (nread = es_fread (buffer, 1, DIM(buffer), fp)) > 0 )
         {
-          if (first_record && for_openpgp
-              && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+          if (first_record)
             {
               first_record = 0;
-              buffer[7] |= 0x02; /* OpenPGP data may be available.  */
+              update_header_buffer ((unsigned char *)buffer, nread,
+                                    for_openpgp? HEADER_FLAG_OPENPGP : 0, 0);
             }
 
           if (es_fwrite (buffer, nread, 1, newfp) != 1)
@@ -270,6 +701,8 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           nread = es_fread (buffer, 1, nbytes, fp);
           if (!nread)
             break;
+          if (!current)
+            update_header_buffer ((unsigned char *)buffer, nread, 0, 0);
           current += nread;
 
           if (es_fwrite (buffer, nread, 1, newfp) != 1)
@@ -352,6 +785,168 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+
+
+/* Create the keybox FNAME with BLOB as its first blob.  FOR_OPENPGP
+ * indicates that this is called due to an OpenPGP keyblock change.  */
+static gpg_error_t
+create_keybox_file (const char *fname, KEYBOXBLOB blob, int for_openpgp)
+{
+  gpg_error_t err;
+  estream_t fp;
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_CREATE);
+  if (err)
+    return err;
+
+  err = _keybox_write_header_blob (fp, for_openpgp);
+  if (!err)
+    err = _keybox_write_blob (blob, fp, NULL);
+  if (err)
+    {
+      _keybox_ll_close (fp);
+      return err;
+    }
+
+/*        if (chmod( fname, S_IRUSR | S_IWUSR )) */
+/*          { */
+/*            log_debug ("%s: chmod failed: %s\n", fname, strerror(errno) ); */
+/*            return KEYBOX_File_Error; */
+/*          } */
+  return _keybox_ll_close (fp);
+}
+
+
+/* Append BLOB to the keybox FNAME.  FOR_OPENPGP indicates that this is
+ * called due to an OpenPGP keyblock change.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int for_openpgp)
+{
+  gpg_error_t err, err2;
+  estream_t fp;
+  off_t size;
+  int journaled = 0;
+
+  err = journal_recover (fname);
+  if (err)
+    return err;
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    return create_keybox_file (fname, blob, for_openpgp);
+  if (err)
+    return err;
+
+  err = get_file_size (fp, &size);
+  if (!err)
+    err = journal_write (fname, fp, size, NULL, 0);
+  if (!err)
+    {
+      journaled = 1;
+      if (es_fseeko (fp, size, SEEK_SET))
+        err = gpg_error_from_syserror ();
+      else
+        err = _keybox_write_blob (blob, fp, NULL);
+    }
+  /* If this is for OpenPGP, we make sure that the openpgp flag is
+   * set in the header.  */
+  if (!err)
+    err = update_header (fp, for_openpgp? HEADER_FLAG_OPENPGP : 0, 0);
+  if (!err)
+    err = sync_file (fp);
+
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  if (journaled)
+    journal_finish (fname, err);
+  return err;
+}
+
+
+/* Replace the blob of OLDLEN bytes at offset OFF of the keybox FNAME
+ * by BLOB.  If BLOB fits into the old slot it is written in place and
+ * the remaining space is turned into an empty blob.  Otherwise the old
+ * blob is marked as deleted and BLOB is appended.  On success the
+ * offset of the new blob is stored at R_NEWOFF.  */
+static gpg_error_t
+blob_replace (const char *fname, KEYBOXBLOB blob, off_t off, size_t oldlen,
+              off_t *r_newoff)
+{
+  gpg_error_t err, err2;
+  estream_t fp;
+  size_t length;
+  off_t size, newoff;
+  struct journal_region_s region;
+  unsigned char type;
+  int journaled = 0;
+
+  _keybox_get_blob_image (blob, &length);
+
+  err = journal_recover (fname);
+  if (err)
+    return err;
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    return err;
+
+  err = get_file_size (fp, &size);
+  if (err)
+    goto leave;
+  if (length == oldlen || (length < oldlen && oldlen - length >= 5))
+    {
+      newoff = off;
+      region.off = off;
+      region.len = oldlen;
+    }
+  else
+    {
+      newoff = size;
+      region.off = off + 4;
+      region.len = 1;
+    }
+  err = journal_write (fname, fp, size, &region, 1);
+  if (err)
+    goto leave;
+  journaled = 1;
+
+  if (newoff == off)
+    {
+      if (es_fseeko (fp, off, SEEK_SET))
+        err = gpg_error_from_syserror ();
+      else
+        err = _keybox_write_blob (blob, fp, NULL);
+      if (!err && length < oldlen)
+        err = write_empty_blob (fp, off + length, oldlen - length);
+    }
+  else
+    {
+      type = KEYBOX_BLOBTYPE_EMPTY;
+      err = write_at (fp, off + 4, &type, 1);
+      if (!err && es_fseeko (fp, newoff, SEEK_SET))
+        err = gpg_error_from_syserror ();
+      if (!err)
+        err = _keybox_write_blob (blob, fp, NULL);
+    }
+  if (!err)
+    err = update_header (fp, length != oldlen? HEADER_FLAG_HAS_EMPTY : 0, 0);
+  if (!err)
+    err = sync_file (fp);
+
+ leave:
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  if (journaled)
+    journal_finish (fname, err);
+  if (!err)
+    *r_newoff = newoff;
+  return err;
+}
+
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD. */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
@@ -361,6 +956,7 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  keybox_index_t idx;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -385,7 +981,12 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      idx = _keybox_index_begin (hd->kb);
+      if (_keybox_get_update_in_place ())
+        err = blob_append (fname, blob, 1);
+      else
+        err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      _keybox_index_commit (hd->kb, idx, err, (off_t)-1, 0, blob);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -403,10 +1004,12 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
 {
   gpg_error_t err;
   const char *fname;
-  off_t off;
+  off_t off, newoff;
+  size_t oldlen, newlen;
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  keybox_index_t idx;
 
   if (!hd || !image || !imagelen)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -421,6 +1024,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
+  _keybox_get_blob_image (hd->found.blob, &oldlen);
 
   /* Close the file so that we do no mess up the position for a
      next search.  */
@@ -436,9 +1040,30 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
 
   /* Update the keyblock.  */
-  if (!err)
+  if (!err && !_keybox_get_update_in_place ())
     {
+      idx = _keybox_index_begin (hd->kb);
       err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      _keybox_index_commit (hd->kb, idx, err, off, oldlen, blob);
+      _keybox_release_blob (blob);
+    }
+  else if (!err)
+    {
+      idx = _keybox_index_begin (hd->kb);
+      err = blob_replace (fname, blob, off, oldlen, &newoff);
+      if (err || newoff == off)
+        {
+          /* Written in place; the rest of the slot is not indexed.  */
+          _keybox_get_blob_image (blob, &newlen);
+          _keybox_index_commit (hd->kb, idx, err, off, newlen, blob);
+        }
+      else
+        {
+          /* The old blob has been deleted and the new one appended.  */
+          _keybox_index_commit (hd->kb, idx, 0, off, oldlen, NULL);
+          idx = _keybox_index_begin (hd->kb);
+          _keybox_index_commit (hd->kb, idx, 0, newoff, 0, blob);
+        }
       _keybox_release_blob (blob);
     }
   return err;
@@ -454,6 +1079,7 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   int rc;
   const char *fname;
   KEYBOXBLOB blob;
+  keybox_index_t idx;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -471,7 +1097,12 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      idx = _keybox_index_begin (hd->kb);
+      if (_keybox_get_update_in_place ())
+        rc = blob_append (fname, blob, 0);
+      else
+        rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      _keybox_index_commit (hd->kb, idx, rc, (off_t)-1, 0, blob);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -508,6 +1139,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  keybox_index_t kbidx;
 
   (void)idx;  /* Not yet used.  */
 
@@ -535,10 +1167,17 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  err = journal_recover (fname);
+  if (err)
+    return err;
 
+  kbidx = _keybox_index_begin (hd->kb);
   err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
   if (err)
-    return err;
+    {
+      _keybox_index_commit (hd->kb, kbidx, err, off, 0, NULL);
+      return err;
+    }
 
   ec = 0;
   if (es_fseeko (fp, off, SEEK_SET))
@@ -565,6 +1204,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
           break;
         }
     }
+  if (!ec)
+    ec = gpg_err_code (update_header (fp, 0, 0));
 
   err = _keybox_ll_close (fp);
   if (err)
@@ -573,6 +1214,9 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code (err);
     }
 
+  /* The flags are not indexed but the file's stamp has changed.  */
+  _keybox_index_commit (hd->kb, kbidx, gpg_error (ec), off, 0, NULL);
+
   return gpg_error (ec);
 }
 
@@ -582,9 +1226,11 @@ int
 keybox_delete (KEYBOX_HANDLE hd)
 {
   off_t off;
+  size_t oldlen;
   const char *fname;
   estream_t fp;
   int rc, rc2;
+  keybox_index_t idx;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -599,19 +1245,26 @@ keybox_delete (KEYBOX_HANDLE hd)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
-  off += 4;
+  _keybox_get_blob_image (hd->found.blob, &oldlen);
 
   _keybox_close_file (hd);
-  rc = _keybox_ll_open (&fp, hd->kb->fname, KEYBOX_LL_OPEN_UPDATE);
+  rc = journal_recover (fname);
   if (rc)
     return rc;
-
-  if (es_fseeko (fp, off, SEEK_SET))
+  idx = _keybox_index_begin (hd->kb);
+  rc = _keybox_ll_open (&fp, hd->kb->fname, KEYBOX_LL_OPEN_UPDATE);
+  if (rc)
+    {
+      _keybox_index_commit (hd->kb, idx, rc, off, oldlen, NULL);
+      return rc;
+    }
+
+  if (es_fseeko (fp, off + 4, SEEK_SET))
     rc = gpg_error_from_syserror ();
   else if (es_fputc (0, fp) == EOF)
     rc = gpg_error_from_syserror ();
   else
-    rc = 0;
+    rc = update_header (fp, HEADER_FLAG_HAS_EMPTY, 0);
 
   rc2 = _keybox_ll_close (fp);
   if (rc2)
@@ -620,74 +1273,247 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = rc2;
     }
 
+  /* The deleted blob stays in place, thus no offsets change.  */
+  _keybox_index_commit (hd->kb, idx, rc, off, oldlen, NULL);
+
   return rc;
 }
 
 
-/* Compress the keybox file, if needed and not used by other
- * process.  */
-void
-keybox_compress_when_no_other_users (void *token, int for_openpgp)
+/* Do one step of the incremental compaction of the keybox at HD.  The
+ * first empty blob is moved to the end of the file by moving up to
+ * BUDGET bytes of the following blobs over it; empty blobs at the end
+ * of the file are cut off.  Each step is journaled so that it can be
+ * rolled back after a crash.  R_DONE is set to true if there is
+ * nothing left to compact.  The caller must hold the lock of the
+ * keybox.  Because blobs are moved this is only supported if the
+ * keybox is updated in place.  */
+gpg_error_t
+keybox_compact_step (KEYBOX_HANDLE hd, size_t budget, int *r_done)
 {
-  KEYBOX_HANDLE hd;
-  gpg_error_t err;
-  int read_rc, rc, rc2;
+  gpg_error_t err, err2;
   const char *fname;
-  estream_t fp, newfp;
-  char *bakfname = NULL;
-  char *tmpfname = NULL;
-  int first_blob;
-  KEYBOXBLOB blob = NULL;
-  u32 cut_time;
-  int any_changes = 0;
-  int skipped_deleted;
-
-  if (for_openpgp)
-    hd = keybox_new_openpgp (token, 0);
-  else
-    hd = keybox_new_x509 (token, 0);
+  estream_t fp;
+  off_t size, pos, hole;
+  off_t start = 0;
+  off_t end = 0;
+  size_t length, mergelen;
+  size_t holelen = 0;
+  int type;
+  unsigned char hdr[8];
+  unsigned char *buffer = NULL;
+  struct journal_region_s *regions = NULL;
+  int nregions = 0;
+  int nallocated = 0;
+  keybox_index_t idx = NULL;
+  int indexing = 0;
+  int journaled = 0;
+
+  *r_done = 0;
   if (!hd || !hd->kb)
-    return;
-
-  if (hd->secret)
-    return;
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!_keybox_get_update_in_place ())
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
   fname = hd->kb->fname;
   if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  _keybox_close_file (hd);
+  err = journal_recover (fname);
+  if (err)
+    return err;
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
     {
-      keybox_fp_close (hd);
-      keybox_release (hd);
-      return;
+      *r_done = 1;
+      return 0;
     }
-
-  if (keybox_lock (hd, 1, 0))
+  if (err)
+    return err;
+  err = get_file_size (fp, &size);
+  if (err || size < 8)
     {
-      keybox_fp_close (hd);
-      keybox_release (hd);
-      return;
+      *r_done = !err;
+      goto leave;
     }
 
-  _keybox_close_file (hd);
-
-  /* Open the source file. Because we do a rename, we have to check the
-     permissions of the file */
-  if ((rc = gnupg_access (fname, W_OK)))
+  /* The header tells us whether there are any empty blobs.  */
+  err = read_at (fp, 0, hdr, 8);
+  if (err)
+    goto leave;
+  if (hdr[4] == KEYBOX_BLOBTYPE_HEADER && !(hdr[7] & HEADER_FLAG_HAS_EMPTY))
     {
-      err = gpg_error (rc);
+      *r_done = 1;
       goto leave;
     }
 
-  rc = _keybox_ll_open (&fp, fname, 0);
-  if (gpg_err_code (rc) == GPG_ERR_ENOENT)
+  /* Find the first empty blob.  */
+  for (pos = 0; pos < size; pos += length)
     {
-      err = 0; /* Ready. File has been deleted right after the access above. */
-      goto leave;
+      err = read_blob_header (fp, pos, size, &length, &type);
+      if (err)
+        goto leave;
+      if (type == KEYBOX_BLOBTYPE_EMPTY)
+        break;
     }
-  if (rc)
+  idx = _keybox_index_begin (hd->kb);
+  indexing = 1;
+  if (pos == size)
     {
-      err = gpg_error (rc);
+      /* Nothing to compact.  */
+      err = update_header (fp, 0, HEADER_FLAG_HAS_EMPTY);
+      *r_done = 1;
       goto leave;
     }
 
+  /* Merge the directly following empty blobs.  Their headers are
+   * overwritten and thus need to be journaled.  */
+  hole = pos;
+  holelen = 0;
+  for (; pos < size; pos += length)
+    {
+      err = read_blob_header (fp, pos, size, &length, &type);
+      if (err)
+        goto leave;
+      if (holelen && (type != KEYBOX_BLOBTYPE_EMPTY
+                      || holelen + length > 0xffffffff))
+        break;
+      if (nregions + 1 >= nallocated)
+        {
+          struct journal_region_s *tmp;
+
+          nallocated += 16;
+          tmp = xtryrealloc (regions, nallocated * sizeof *regions);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          regions = tmp;
+        }
+      regions[nregions].off = pos;
+      regions[nregions].len = 5;
+      nregions++;
+      holelen += length;
+    }
+
+  if (pos == size)
+    {
+      /* Only empty blobs are left: cut them off.  */
+      err = journal_write (fname, fp, size, regions, nregions);
+      if (err)
+        goto leave;
+      journaled = 1;
+#if defined(HAVE_FTRUNCATE) && !defined(HAVE_W32_SYSTEM)
+      if (es_fflush (fp) || ftruncate (es_fileno (fp), hole))
+        err = gpg_error_from_syserror ();
+#else
+      err = write_empty_blob (fp, hole, holelen);
+#endif
+      if (!err)
+        err = update_header (fp, 0, HEADER_FLAG_HAS_EMPTY);
+      *r_done = 1;
+    }
+  else
+    {
+      /* Collect the blobs to move but at least one.  */
+      start = pos;
+      mergelen = 0;
+      for (; pos < size; pos += length)
+        {
+          if (pos > start && (size_t)(pos - start) >= budget)
+            break;
+          err = read_blob_header (fp, pos, size, &length, &type);
+          if (err)
+            goto leave;
+          if (type == KEYBOX_BLOBTYPE_EMPTY)
+            {
+              if (holelen + length <= 0xffffffff)
+                mergelen = length;
+              break;
+            }
+        }
+      end = pos;
+
+      buffer = xtrymalloc (end - start);
+      if (!buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = read_at (fp, start, buffer, end - start);
+      if (err)
+        goto leave;
+
+      regions[nregions].off = start;
+      regions[nregions].len = end - start;
+      nregions++;
+      err = journal_write (fname, fp, size, regions, nregions);
+      if (err)
+        goto leave;
+      journaled = 1;
+
+      /* Move the blobs down and put the merged empty blob behind
+       * them.  */
+      err = write_at (fp, hole, buffer, end - start);
+      if (!err)
+        err = write_empty_blob (fp, hole + (end - start),
+                                holelen + mergelen);
+    }
+  if (!err)
+    err = sync_file (fp);
+
+ leave:
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  if (journaled)
+    journal_finish (fname, err);
+  if (indexing)
+    _keybox_index_commit_move (hd->kb, idx, err, start, end,
+                               -(off_t)holelen);
+  xfree (regions);
+  xfree (buffer);
+  if (err)
+    log_error ("keybox '%s': error compacting: %s\n",
+               fname, gpg_strerror (err));
+  return err;
+}
+
+
+/* Compress the keybox FNAME of HD by writing a new file without the
+ * deleted and expired ephemeral blobs and renaming it.  */
+static gpg_error_t
+compress_by_copy (KEYBOX_HANDLE hd, const char *fname)
+{
+  gpg_error_t err;
+  int read_rc, rc, rc2;
+  estream_t fp, newfp;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  int first_blob;
+  KEYBOXBLOB blob = NULL;
+  u32 cut_time;
+  int any_changes = 0;
+  int skipped_deleted;
+
+  /* Open the source file. Because we do a rename, we have to check the
+     permissions of the file */
+  if ((rc = gnupg_access (fname, W_OK)))
+    return gpg_error (rc);
+
+  /* A journal may have been left behind by keyboxd.  */
+  err = journal_recover (fname);
+  if (err)
+    return err;
+
+  rc = _keybox_ll_open (&fp, fname, 0);
+  if (gpg_err_code (rc) == GPG_ERR_ENOENT)
+    return 0; /* Ready. File has been deleted right after the access above. */
+  if (rc)
+    return gpg_error (rc);
+
   /* A quick test to see if we need to compress the file at all.  We
      schedule a compress run after 3 hours. */
   if ( !_keybox_read_blob (&blob, fp, NULL) )
@@ -704,8 +1530,7 @@ keybox_compress_when_no_other_users (void *token, int for_openpgp)
             {
               _keybox_ll_close (fp);
               _keybox_release_blob (blob);
-              err = 0;
-              goto leave; /* Compress run not yet needed. */
+              return 0; /* Compress run not yet needed. */
             }
         }
       _keybox_release_blob (blob);
@@ -718,8 +1543,7 @@ keybox_compress_when_no_other_users (void *token, int for_openpgp)
   if (rc)
     {
       _keybox_ll_close (fp);
-      err = gpg_error (rc);
-      goto leave;
+      return gpg_error (rc);
     }
 
 
@@ -816,20 +1640,271 @@ keybox_compress_when_no_other_users (void *token, int for_openpgp)
   if (rc || !any_changes)
     gnupg_remove (tmpfname);
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      if (!rc)
+        _keybox_index_invalidate (hd->kb);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
-  if (rc)
-    err = gpg_error (rc);
+  return rc? gpg_error (rc) : 0;
+}
+
+
+/* Compress the keybox FNAME of HD in place: Expired ephemeral blobs
+ * are marked as deleted and a few steps of the incremental compaction
+ * are done.  */
+static gpg_error_t
+compress_in_place (KEYBOX_HANDLE hd, const char *fname)
+{
+  gpg_error_t err, err2;
+  int read_rc;
+  estream_t fp;
+  int first_blob;
+  KEYBOXBLOB blob = NULL;
+  u32 cut_time;
+  int maint_due = 1;
+  int has_empty = 0;
+  int skipped_deleted;
+  struct {
+    off_t off;
+    size_t len;
+  } *dels = NULL;
+  size_t ndels = 0;
+  size_t i;
+  keybox_index_t idx;
+  int done;
+
+  err = journal_recover (fname);
+  if (err)
+    return err;
+
+  err = _keybox_ll_open (&fp, fname, 0);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    return 0; /* Ready. File has been deleted right after the access above. */
+  if (err)
+    return err;
+
+  /* A quick test to see if we need to do a maintenance run at all.
+     We schedule it after 3 hours.  A pending compaction is always
+     continued. */
+  if ( !_keybox_read_blob (&blob, fp, NULL) )
+    {
+      const unsigned char *buffer;
+      size_t length;
+
+      buffer = _keybox_get_blob_image (blob, &length);
+      if (length > 20 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+        {
+          u32 last_maint = buf32_to_u32 (buffer+20);
+
+          if ( (last_maint + 3*3600) > make_timestamp () )
+            maint_due = 0;
+          if ((buffer[7] & HEADER_FLAG_HAS_EMPTY))
+            has_empty = 1;
+        }
+      _keybox_release_blob (blob);
+      blob = NULL;
+      es_fseek (fp, 0, SEEK_SET);
+      es_clearerr (fp);
+    }
+  if (!maint_due)
+    {
+      _keybox_ll_close (fp);
+      goto compact;
+    }
+
+  /* Scanning loop.  By reading using _keybox_read_blob we
+     automagically skip any blobs flagged as deleted.  Thus what we
+     only have to do is to check all ephemeral flagged blocks whether
+     their time has come and to remember them for deletion. */
+  cut_time = make_timestamp () - 86400;
+  first_blob = 1;
+  skipped_deleted = 0;
+  for (; !(read_rc = _keybox_read_blob (&blob, fp, &skipped_deleted));
+       _keybox_release_blob (blob), blob = NULL )
+    {
+      unsigned int blobflags;
+      const unsigned char *buffer;
+      size_t length, pos, size;
+      u32 created_at;
+      int delete_it = 0;
+
+      if (skipped_deleted)
+        has_empty = 1;
+      buffer = _keybox_get_blob_image (blob, &length);
+      if (first_blob)
+        {
+          first_blob = 0;
+          if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+            continue;
+          /* The header blob is missing.  We can't insert it in place
+             but the keybox is usable without it.  */
+          log_info ("keybox '%s': header blob missing\n", fname);
+        }
+      else if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+        {
+          /* Oops: There is another header record - remove it. */
+          delete_it = 1;
+        }
+      else if (_keybox_get_flag_location (buffer, length,
+                                          KEYBOX_FLAG_BLOB, &pos, &size)
+               || size != 2)
+        {
+          read_rc = GPG_ERR_BUG;
+          break;
+        }
+      else
+        {
+          blobflags = buf16_to_uint (buffer+pos);
+          if ((blobflags & KEYBOX_FLAG_BLOB_EPHEMERAL))
+            {
+              /* This is an ephemeral blob. */
+              if (_keybox_get_flag_location (buffer, length,
+                                             KEYBOX_FLAG_CREATED_AT,
+                                             &pos, &size)
+                  || size != 4)
+                created_at = 0; /* oops. */
+              else
+                created_at = buf32_to_u32 (buffer+pos);
+
+              if (created_at && created_at < cut_time)
+                delete_it = 1;
+            }
+        }
+
+      if (delete_it)
+        {
+          void *tmp = xtryrealloc (dels, (ndels + 1) * sizeof *dels);
+          if (!tmp)
+            {
+              read_rc = gpg_err_code_from_syserror ();
+              break;
+            }
+          dels = tmp;
+          dels[ndels].off = _keybox_get_blob_fileoffset (blob);
+          dels[ndels].len = length;
+          ndels++;
+        }
+    }
+  if (skipped_deleted)
+    has_empty = 1;
+  _keybox_release_blob (blob); blob = NULL;
+  _keybox_ll_close (fp);
+  if (read_rc != -1)
+    {
+      err = gpg_error (read_rc);
+      goto leave;
+    }
+
+  /* Mark the blobs as deleted and update the header blob with the
+     maintenance time stamp and if needed (ie. used by gpg) the
+     openpgp flag.  These are single byte or stamp updates which do
+     not need the journal.  */
+  idx = _keybox_index_begin (hd->kb);
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    {
+      _keybox_index_commit (hd->kb, idx, err, 0, 0, NULL);
+      goto leave;
+    }
+  for (i=0; i < ndels && !err; i++)
+    {
+      unsigned char type = KEYBOX_BLOBTYPE_EMPTY;
+
+      err = write_at (fp, dels[i].off + 4, &type, 1);
+    }
+  if (ndels)
+    has_empty = 1;
+  if (!err)
+    {
+      unsigned char hdr[24];
+
+      err = read_at (fp, 0, hdr, 24);
+      if (!err && hdr[4] == KEYBOX_BLOBTYPE_HEADER)
+        {
+          ulongtobuf (hdr+20, make_timestamp ());
+          err = write_at (fp, 20, hdr+20, 4);
+        }
+      if (!err)
+        err = update_header (fp,
+                             ((hd->for_openpgp? HEADER_FLAG_OPENPGP : 0)
+                              | (has_empty? HEADER_FLAG_HAS_EMPTY : 0)),
+                             0);
+    }
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  /* The deleted blobs stay in place, thus no offsets change.  */
+  _keybox_index_commit (hd->kb, idx, err, ndels? dels[0].off : 0,
+                        ndels? dels[0].len : 0, NULL);
+  for (i=1; i < ndels && !err; i++)
+    {
+      idx = _keybox_index_begin (hd->kb);
+      _keybox_index_commit (hd->kb, idx, 0, dels[i].off, dels[i].len, NULL);
+    }
+  if (err)
+    goto leave;
+
+ compact:
+  if (has_empty)
+    {
+      done = 0;
+      for (i=0; i < COMPACT_MAX_STEPS && !done; i++)
+        if (keybox_compact_step (hd, COMPACT_STEP_SIZE, &done))
+          break;
+    }
+
+ leave:
+  xfree (dels);
+  return err;
+}
+
+
+/* Compress the keybox file, if needed and not used by other
+ * process.  */
+void
+keybox_compress_when_no_other_users (void *token, int for_openpgp)
+{
+  KEYBOX_HANDLE hd;
+  gpg_error_t err;
+  const char *fname;
+
+  if (for_openpgp)
+    hd = keybox_new_openpgp (token, 0);
   else
-    err = 0;
+    hd = keybox_new_x509 (token, 0);
+  if (!hd || !hd->kb)
+    return;
+
+  if (hd->secret)
+    return;
+  fname = hd->kb->fname;
+  if (!fname)
+    {
+      keybox_fp_close (hd);
+      keybox_release (hd);
+      return;
+    }
 
+  if (keybox_lock (hd, 1, 0))
+    {
+      keybox_fp_close (hd);
+      keybox_release (hd);
+      return;
+    }
+
+  _keybox_close_file (hd);
+
+  if (_keybox_get_update_in_place ())
+    err = compress_in_place (hd, fname);
+  else
+    err = compress_by_copy (hd, fname);
   if (err)
     log_error ("keybox: error compressing keybox '%s': %s\n",
                fname, gpg_strerror (err));
 
- leave:
   keybox_fp_close (hd);
   keybox_lock (hd, 0, 0);
   keybox_release (hd);
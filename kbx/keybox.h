@@ -66,6 +66,7 @@ typedef enum
 gpg_error_t keybox_register_file (const char *fname, int secret,
                                   void **r_token);
 void keybox_set_buffersize (unsigned int kbytes, int reserved);
+void keybox_set_update_in_place (int yes);
 int keybox_is_writable (void *token);
 
 KEYBOX_HANDLE keybox_new_openpgp (void *token, int secret);
@@ -120,6 +121,8 @@ int keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
 int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
 
 int keybox_delete (KEYBOX_HANDLE hd);
+gpg_error_t keybox_compact_step (KEYBOX_HANDLE hd, size_t budget,
+                                 int *r_done);
 void keybox_compress_when_no_other_users (void *token, int for_openpgp);
 
 
@@ -90,6 +90,8 @@ enum cmd_and_opt_values
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
+    oPublishSnapshot,
 
     oDummy
   };
@@ -123,6 +125,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|use up to N KiB for the key cache")),
+  ARGPARSE_s_n (oPublishSnapshot, "publish-snapshot",
+                N_("publish a snapshot of the keys for clients")),
 
   ARGPARSE_end () /* End of list */
 };
@@ -150,6 +156,12 @@ static struct debug_flags_s debug_flags [] =
 /* CHECK_PROBLEMS_INTERVAL defines how often we check the existence of
  * homedir.  Value is in seconds.  */
 #define CHECK_PROBLEMS_INTERVAL     (4)
+/* SNAPSHOT_INTERVAL defines how often we check whether a new snapshot
+ * of the database needs to be published.  Value is in seconds.  */
+#define SNAPSHOT_INTERVAL           (2)
+/* COMPACT_INTERVAL defines how often we do a compaction step on the
+ * database while no clients are connected.  Value is in seconds.  */
+#define COMPACT_INTERVAL            (30)
 
 /* The list of open file descriptors at startup.  Note that this list
  * has been allocated using the standard malloc.  */
@@ -261,6 +273,8 @@ static int check_for_running_kbxd (int silent);
 static void *check_own_socket_thread (void *arg);
 #endif
 static void *check_others_thread (void *arg);
+static void *snapshot_thread (void *arg);
+static void *compact_thread (void *arg);
 
 /*
  * Functions.
@@ -362,6 +376,8 @@ cleanup (void)
   if (done)
     return;
   done = 1;
+  kbxd_remove_snapshot ();
+  kbxd_close_database ();
   if (!inhibit_socket_removal)
     remove_socket (socket_name);
 }
@@ -587,6 +603,9 @@ main (int argc, char **argv )
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oCacheSize: opt.cache_size = pargs.r.ret_ulong; break;
+        case oPublishSnapshot: opt.publish_snapshot = 1; break;
+
         default:
           if (configname)
             pargs.err = ARGPARSE_PRINT_WARNING;
@@ -1583,6 +1602,23 @@ handle_connections (gnupg_fd_t listen_fd)
         log_error ("error spawning check_others_thread: %s\n", strerror (err));
     }
 
+  if (opt.publish_snapshot)
+    {
+      npth_t thread;
+
+      err = npth_create (&thread, &tattr, snapshot_thread, NULL);
+      if (err)
+        log_error ("error spawning snapshot_thread: %s\n", strerror (err));
+    }
+
+  {
+    npth_t thread;
+
+    err = npth_create (&thread, &tattr, compact_thread, NULL);
+    if (err)
+      log_error ("error spawning compact_thread: %s\n", strerror (err));
+  }
+
   FD_ZERO (&fdset);
   FD_SET (FD2INT (listen_fd), &fdset);
   nfd = FD2NUM (listen_fd);
@@ -1907,6 +1943,41 @@ check_others_thread (void *arg)
 }
 
 
+/* The thread publishing snapshots of the database.  */
+static void *
+snapshot_thread (void *arg)
+{
+  (void)arg;
+
+  while (!shutdown_pending)
+    {
+      kbxd_update_snapshot ();
+      gnupg_sleep (SNAPSHOT_INTERVAL);
+    }
+
+  return NULL;
+}
+
+
+/* The thread doing the incremental compaction of the database.  To
+ * not disturb searches of the clients this is only done while no
+ * clients are connected.  */
+static void *
+compact_thread (void *arg)
+{
+  (void)arg;
+
+  while (!shutdown_pending)
+    {
+      gnupg_sleep (COMPACT_INTERVAL);
+      if (!active_connections && !shutdown_pending)
+        kbxd_compact ();
+    }
+
+  return NULL;
+}
+
+
 /* Figure out whether a keyboxd is available and running.  Prints an
  * error if not.  If SILENT is true, no messages are printed.  Returns
  * 0 if the agent is running. */
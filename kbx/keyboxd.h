@@ -43,6 +43,13 @@ struct
   /* True if we are running detached from the tty. */
   int running_detached;
 
+  /* The size of the cache in KiB or 0 to derive it from the size of
+   * the database.  */
+  unsigned int cache_size;
+
+  /* Publish a snapshot of the OpenPGP keys for use by clients.  */
+  int publish_snapshot;
+
   /*
    * Global state variables.
    */
@@ -127,6 +134,14 @@ struct server_control_s
   unsigned int no_data_return : 1;
   /* Used by SEARCH and STORE.  */
   unsigned int ephemeral : 1;
+
+  /* The database lock held by this connection: 0 = none, 1 = read,
+   * 2 = read and write.  Only used by frontend.c.  */
+  int db_locked;
+
+  /* If set, search results are added to this snapshot instead of
+   * being returned to a client.  Only used by frontend.c.  */
+  struct kbx_snapshot_builder_s *snapshot_builder;
 };
 
 
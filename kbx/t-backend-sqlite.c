@@ -0,0 +1,664 @@
+/* t-backend-sqlite.c - Tests for the SQLite backend of keyboxd
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <npth.h>
+#include <sqlite3.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "keyboxd.h"
+#include "../common/dotlock.h"
+#include "backend.h"
+#include "keybox-defs.h"
+
+#define PGM "t-backend-sqlite"
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+/* The database under test.  */
+static char *dbname;
+static backend_handle_t dbhd;
+static struct server_control_s ctrl;
+static db_request_t store_request;  /* Used for stores and deletes.  */
+
+/* The keyblocks taken from the distribution signing keys and, as
+ * last image, a key with mail addresses.  */
+#define MAX_IMAGES 16
+static struct {
+  unsigned char *data;
+  size_t len;
+  unsigned char ubid[UBID_LEN];
+} images[MAX_IMAGES];
+static int nimages;
+static int mailkey;
+
+
+
+/* Stubs for the parts of keyboxd not used by these tests.  */
+gpg_error_t
+kbxd_status_printf (ctrl_t c, const char *keyword, const char *format, ...)
+{
+  (void)c;
+  (void)keyword;
+  (void)format;
+  return 0;
+}
+
+gpg_error_t
+kbxd_write_data_line (ctrl_t c, const void *buffer, size_t size)
+{
+  (void)c;
+  (void)buffer;
+  (void)size;
+  return 0;
+}
+
+void
+be_kbx_release_resource (ctrl_t c, backend_handle_t hd)
+{
+  (void)c;
+  (void)hd;
+}
+
+void
+be_kbx_release_kbx_hd (KEYBOX_HANDLE kbx_hd)
+{
+  (void)kbx_hd;
+}
+
+gpg_error_t
+be_kbx_init_request_part (backend_handle_t backend_hd, db_request_part_t part)
+{
+  (void)backend_hd;
+  (void)part;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+
+
+/* Return the content of the file FNAME and store its length at
+ * R_LEN.  */
+static unsigned char *
+read_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  struct stat st;
+  unsigned char *buffer;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    fail (0);
+  buffer = xmalloc (st.st_size + 1);
+  if (st.st_size && fread (buffer, st.st_size, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+  *r_len = st.st_size;
+  return buffer;
+}
+
+
+/* Split the OpenPGP keyring FNAME into its keyblocks and append up to
+ * MAXKEYS of them to IMAGES.  */
+static void
+load_images (const char *fname, int maxkeys)
+{
+  unsigned char *buffer;
+  size_t length, off, nparsed;
+  struct _keybox_openpgp_info info;
+  enum pubkey_types pktype;
+
+  buffer = read_file (fname, &length);
+  for (off = 0; off < length && maxkeys && nimages < MAX_IMAGES;
+       off += nparsed, maxkeys--)
+    {
+      if (_keybox_parse_openpgp (buffer + off, length - off, 0,
+                                 &nparsed, &info))
+        fail (0);
+      _keybox_destroy_openpgp_info (&info);
+      images[nimages].data = xmalloc (nparsed);
+      memcpy (images[nimages].data, buffer + off, nparsed);
+      images[nimages].len = nparsed;
+      if (be_ubid_from_blob (images[nimages].data, nparsed, &pktype,
+                             (char *)images[nimages].ubid))
+        fail (0);
+      nimages++;
+    }
+  xfree (buffer);
+}
+
+
+/* Return true if a user id of IMAGES[N] contains PATTERN.  The
+ * comparison ignores the case of ASCII letters as LIKE does.  */
+static int
+image_has_uid (int n, const char *pattern)
+{
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_uid_info *u;
+  size_t plen = strlen (pattern);
+  size_t i, j;
+  int found = 0;
+
+  if (_keybox_parse_openpgp (images[n].data, images[n].len, 0, NULL, &info))
+    fail (n);
+  for (u = info.nuids? &info.uids : NULL; u && !found; u = u->next)
+    for (i = 0; i + plen <= u->len && !found; i++)
+      {
+        for (j = 0; j < plen; j++)
+          if (ascii_tolower (images[n].data[u->off + i + j])
+              != ascii_tolower (pattern[j]))
+            break;
+        found = (j == plen);
+      }
+  _keybox_destroy_openpgp_info (&info);
+  return found;
+}
+
+
+/* Run SQL on the database using a separate connection.  If R_VALUE
+ * is not NULL the first column of the first row is stored there.  */
+static void
+run_sql (const char *sql, char **r_value)
+{
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int res;
+
+  if (sqlite3_open (dbname, &db))
+    fail (0);
+  if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL))
+    {
+      if (verbose)
+        fprintf (stderr, PGM ": %s: %s\n", sql, sqlite3_errmsg (db));
+      fail (0);
+    }
+  res = sqlite3_step (stmt);
+  if (r_value)
+    {
+      if (res != SQLITE_ROW)
+        fail (0);
+      *r_value = xstrdup (sqlite3_column_text (stmt, 0)?
+                          (const char *)sqlite3_column_text (stmt, 0) : "");
+    }
+  else if (res != SQLITE_DONE && res != SQLITE_ROW)
+    fail (0);
+  sqlite3_finalize (stmt);
+  sqlite3_close (db);
+}
+
+
+/* Create a database in the format of version 2 with all keys except
+ * for the mail key.  This does not fill in the fingerprint table
+ * because the searches tested here do not need it.  */
+static void
+create_v2_database (void)
+{
+  static const char *schema[] = {
+    "CREATE TABLE config (name TEXT NOT NULL UNIQUE, value TEXT NOT NULL)",
+    "CREATE TABLE pubkey (ubid BLOB NOT NULL PRIMARY KEY,"
+    " type INTEGER NOT NULL, ephemeral INTEGER NOT NULL DEFAULT 0,"
+    " revoked INTEGER NOT NULL DEFAULT 0, keyblob BLOB NOT NULL)",
+    "CREATE TABLE fingerprint (fpr BLOB NOT NULL, kid BLOB NOT NULL,"
+    " keygrip BLOB NOT NULL, subkey INTEGER NOT NULL,"
+    " ubid BLOB NOT NULL REFERENCES pubkey,"
+    " flags INTEGER NOT NULL DEFAULT 0)",
+    "CREATE TABLE userid (uid TEXT NOT NULL, addrspec TEXT,"
+    " type INTEGER NOT NULL, uidno INTEGER NOT NULL,"
+    " ubid BLOB NOT NULL REFERENCES pubkey)",
+    "CREATE TABLE issuer (sn TEXT NOT NULL, dn TEXT NOT NULL,"
+    " ubid BLOB NOT NULL REFERENCES pubkey)",
+    "INSERT INTO config VALUES ('dbversion','2')"
+  };
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_uid_info *u;
+  int i, uidno;
+
+  if (sqlite3_open (dbname, &db))
+    fail (0);
+  for (i=0; i < DIM (schema); i++)
+    if (sqlite3_exec (db, schema[i], NULL, NULL, NULL))
+      fail (i);
+
+  for (i=0; i < nimages; i++)
+    {
+      if (i == mailkey)
+        continue;
+      if (sqlite3_prepare_v2 (db, "INSERT INTO pubkey (ubid,type,keyblob)"
+                              " VALUES (?1,1,?2)", -1, &stmt, NULL)
+          || sqlite3_bind_blob (stmt, 1, images[i].ubid, UBID_LEN,
+                                SQLITE_STATIC)
+          || sqlite3_bind_blob (stmt, 2, images[i].data, images[i].len,
+                                SQLITE_STATIC)
+          || sqlite3_step (stmt) != SQLITE_DONE)
+        fail (i);
+      sqlite3_finalize (stmt);
+
+      if (_keybox_parse_openpgp (images[i].data, images[i].len, 0,
+                                 NULL, &info))
+        fail (i);
+      uidno = 0;
+      for (u = info.nuids? &info.uids : NULL; u; u = u->next)
+        {
+          if (sqlite3_prepare_v2 (db, "INSERT INTO userid"
+                                  " (uid,type,uidno,ubid)"
+                                  " VALUES (?1,1,?2,?3)", -1, &stmt, NULL)
+              || sqlite3_bind_text (stmt, 1,
+                                    (const char *)images[i].data + u->off,
+                                    u->len, SQLITE_STATIC)
+              || sqlite3_bind_int (stmt, 2, ++uidno)
+              || sqlite3_bind_blob (stmt, 3, images[i].ubid, UBID_LEN,
+                                    SQLITE_STATIC)
+              || sqlite3_step (stmt) != SQLITE_DONE)
+            fail (i);
+          sqlite3_finalize (stmt);
+        }
+      _keybox_destroy_openpgp_info (&info);
+    }
+
+  sqlite3_close (db);
+}
+
+
+/* Return true if the SQLite library supports the userid_fts table.  */
+static int
+have_fts (void)
+{
+  return (sqlite3_libversion_number () >= 3034000
+          && sqlite3_compileoption_used ("ENABLE_FTS5"));
+}
+
+
+/* Search using MODE and PATTERN and return a bit vector with the
+ * indices of the found images.  */
+static unsigned int
+search_images (KeydbSearchMode mode, const char *pattern)
+{
+  gpg_error_t err;
+  db_request_t request;
+  KEYDB_SEARCH_DESC desc;
+  unsigned int found = 0;
+  int i;
+
+  request = xcalloc (1, sizeof *request);
+  ctrl.db_req = request;
+  memset (&desc, 0, sizeof desc);
+  desc.mode = mode;
+  desc.u.name = pattern;
+
+  if (be_sqlite_search (&ctrl, dbhd, request, NULL, 0))
+    fail (0);
+  while (!(err = be_sqlite_search (&ctrl, dbhd, request, &desc, 1)))
+    {
+      if (!request->pending.valid)
+        fail (0);
+      for (i=0; i < nimages; i++)
+        if (!memcmp (request->pending.ubid, images[i].ubid, UBID_LEN))
+          break;
+      if (i == nimages)
+        fail (0);
+      found |= 1 << i;
+      request->pending.valid = 0;
+    }
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    fail (0);
+
+  ctrl.db_req = NULL;
+  be_release_request (request);
+  xfree (request);
+  return found;
+}
+
+
+/* Check that a substring search for PATTERN finds the expected
+ * images out of those in the bit vector STORED.  */
+static void
+check_substr (const char *pattern, unsigned int stored)
+{
+  unsigned int expected = 0;
+  unsigned int found;
+  int i;
+
+  for (i=0; i < nimages; i++)
+    if ((stored & (1 << i)) && image_has_uid (i, pattern))
+      expected |= 1 << i;
+
+  found = search_images (KEYDB_SEARCH_MODE_SUBSTR, pattern);
+  if (verbose)
+    fprintf (stderr, PGM ": '%s': expected %#x found %#x\n",
+             pattern, expected, found);
+  if (found != expected)
+    fail (0);
+}
+
+
+/* Open the version 2 database and check that it has been migrated.
+ * Then check substring searches.  */
+static void
+test_migration (unsigned int stored)
+{
+  char *value;
+
+  /* The first search opens the database.  */
+  check_substr ("dist signing", stored);
+
+  run_sql ("SELECT value FROM config WHERE name = 'dbversion'", &value);
+  if (strcmp (value, "3"))
+    fail (0);
+  xfree (value);
+  run_sql ("SELECT count(*) FROM userid WHERE id IS NULL", &value);
+  if (strcmp (value, "0"))
+    fail (0);
+  xfree (value);
+
+  if (have_fts ())
+    {
+      run_sql ("SELECT value FROM config WHERE name = 'userid-fts'", &value);
+      if (strcmp (value, "1"))
+        fail (0);
+      xfree (value);
+      /* The migration shall have indexed all existing user ids.  */
+      run_sql ("SELECT (SELECT count(*) FROM userid)"
+               " = (SELECT count(*) FROM userid_fts)", &value);
+      if (strcmp (value, "1"))
+        fail (0);
+      xfree (value);
+    }
+  else if (verbose)
+    fprintf (stderr, PGM ": FTS5 trigram not available - using LIKE\n");
+
+  /* Patterns of at least three characters use the index; the case
+   * of ASCII letters does not matter.  */
+  check_substr ("Release", stored);
+  check_substr ("RELEASE SIGNING KEY", stored);
+  check_substr ("ung", stored);
+  check_substr ("No such user id", stored);
+  /* Shorter patterns use LIKE.  */
+  check_substr ("Ko", stored);
+  check_substr ("k", stored);
+}
+
+
+/* Check that the index follows insertions, updates and deletions.  */
+static void
+test_store_and_delete (unsigned int stored)
+{
+  unsigned int bit = 1 << mailkey;
+
+  if (be_sqlite_store (&ctrl, dbhd, store_request, KBXD_STORE_INSERT, PUBKEY_TYPE_OPGP,
+                       images[mailkey].ubid,
+                       images[mailkey].data, images[mailkey].len))
+    fail (0);
+  stored |= bit;
+  check_substr ("Werner", stored);
+  check_substr ("wk@g10code", stored);
+  if (search_images (KEYDB_SEARCH_MODE_MAILSUB, "g10code.com") != bit)
+    fail (0);
+  if (search_images (KEYDB_SEARCH_MODE_MAILSUB, "GNUPG.ORG") != bit)
+    fail (0);
+
+  /* An update replaces the rows of the user ids.  */
+  if (be_sqlite_store (&ctrl, dbhd, store_request, KBXD_STORE_UPDATE, PUBKEY_TYPE_OPGP,
+                       images[mailkey].ubid,
+                       images[mailkey].data, images[mailkey].len))
+    fail (0);
+  check_substr ("Werner", stored);
+  if (search_images (KEYDB_SEARCH_MODE_MAILSUB, "g10code.com") != bit)
+    fail (0);
+  if (have_fts ())
+    {
+      char *value;
+
+      run_sql ("SELECT (SELECT count(*) FROM userid)"
+               " = (SELECT count(*) FROM userid_fts)", &value);
+      if (strcmp (value, "1"))
+        fail (0);
+      xfree (value);
+    }
+
+  if (be_sqlite_delete (&ctrl, dbhd, store_request, images[mailkey].ubid))
+    fail (0);
+  stored &= ~bit;
+  check_substr ("Werner", stored);
+  if (search_images (KEYDB_SEARCH_MODE_MAILSUB, "g10code.com"))
+    fail (0);
+}
+
+
+/* Append a sigcache record for the signature SIGNO on the key UBID
+ * made by the key FPR to BUFFER at offset *R_LEN.  */
+static void
+add_sigcache_record (unsigned char *buffer, size_t *r_len,
+                     const unsigned char *ubid, int signo, int result,
+                     const unsigned char *fpr, int fprlen)
+{
+  unsigned char *p = buffer + *r_len;
+
+  memcpy (p, ubid, UBID_LEN);
+  p += UBID_LEN;
+  memset (p, signo, SIGCACHE_SIGID_LEN);
+  p += SIGCACHE_SIGID_LEN;
+  *p++ = result;
+  *p++ = fprlen;
+  memcpy (p, fpr, fprlen);
+  p += fprlen;
+  *r_len = p - buffer;
+}
+
+
+/* The callback for be_sqlite_get_sigcache.  OPAQUE is an array with
+ * the results indexed by the first byte of the sigid.  */
+static gpg_error_t
+sigcache_cb (void *opaque, const unsigned char *sigid, int result,
+             const unsigned char *fpr, size_t fprlen)
+{
+  int *results = opaque;
+
+  (void)fpr;
+  if (sigid[0] >= 4 || fprlen != 20 || results[sigid[0]] != -1)
+    fail (0);
+  results[sigid[0]] = result;
+  return 0;
+}
+
+
+/* Return the cached results for the key UBID in RESULTS.  */
+static void
+get_sigcache (const unsigned char *ubid, int *results)
+{
+  int i;
+
+  for (i=0; i < 4; i++)
+    results[i] = -1;
+  if (be_sqlite_get_sigcache (&ctrl, dbhd, ubid, sigcache_cb, results))
+    fail (0);
+}
+
+
+/* Check the storing of signature verification results and that they
+ * are invalidated by changes of the signing key.  */
+static void
+test_sigcache (void)
+{
+  unsigned char buffer[4 * (UBID_LEN + SIGCACHE_SIGID_LEN + 2 + 20)];
+  unsigned char signer[20], otherfpr[20];
+  unsigned char *signee;
+  struct _keybox_openpgp_info info;
+  size_t len, nparsed;
+  unsigned int nstored;
+  int results[4];
+
+  if (_keybox_parse_openpgp (images[mailkey].data, images[mailkey].len, 0,
+                             &nparsed, &info))
+    fail (0);
+  if (info.primary.fprlen != 20)
+    fail (0);
+  memcpy (signer, info.primary.fpr, 20);
+  _keybox_destroy_openpgp_info (&info);
+  signee = images[0].ubid;
+  memset (otherfpr, 0xaa, sizeof otherfpr);
+
+  if (be_sqlite_store (&ctrl, dbhd, store_request, KBXD_STORE_INSERT,
+                       PUBKEY_TYPE_OPGP, images[mailkey].ubid,
+                       images[mailkey].data, images[mailkey].len))
+    fail (0);
+
+  len = 0;
+  add_sigcache_record (buffer, &len, signee, 0, 1, signer, 20);
+  add_sigcache_record (buffer, &len, signee, 1, 0, otherfpr, 20);
+  add_sigcache_record (buffer, &len, images[mailkey].ubid, 2, 1, otherfpr, 20);
+  if (be_sqlite_put_sigcache (&ctrl, dbhd, buffer, len, &nstored)
+      || nstored != 3)
+    fail (0);
+  get_sigcache (signee, results);
+  if (results[0] != 1 || results[1] != 0 || results[2] != -1)
+    fail (0);
+  get_sigcache (images[mailkey].ubid, results);
+  if (results[0] != -1 || results[2] != 1)
+    fail (0);
+
+  /* Existing rows are replaced.  */
+  len = 0;
+  add_sigcache_record (buffer, &len, signee, 1, 1, otherfpr, 20);
+  if (be_sqlite_put_sigcache (&ctrl, dbhd, buffer, len, &nstored)
+      || nstored != 1)
+    fail (0);
+  get_sigcache (signee, results);
+  if (results[0] != 1 || results[1] != 1)
+    fail (0);
+
+  /* Invalid records are rejected without storing any record.  */
+  len = 0;
+  add_sigcache_record (buffer, &len, signee, 3, 1, otherfpr, 20);
+  if (gpg_err_code (be_sqlite_put_sigcache (&ctrl, dbhd, buffer, len - 1,
+                                            &nstored)) != GPG_ERR_INV_LENGTH)
+    fail (0);
+  buffer[UBID_LEN + SIGCACHE_SIGID_LEN + 1] = 0;
+  if (gpg_err_code (be_sqlite_put_sigcache (&ctrl, dbhd, buffer, len,
+                                            &nstored)) != GPG_ERR_INV_LENGTH)
+    fail (0);
+  len = 0;
+  add_sigcache_record (buffer, &len, signee, 3, 1, otherfpr, 20);
+  add_sigcache_record (buffer, &len, signee, 3, 2, otherfpr, 20);
+  if (gpg_err_code (be_sqlite_put_sigcache (&ctrl, dbhd, buffer, len,
+                                            &nstored)) != GPG_ERR_INV_VALUE)
+    fail (0);
+  get_sigcache (signee, results);
+  if (results[3] != -1)
+    fail (0);
+
+  /* An update of the signing key forgets the results of its
+   * signatures.  */
+  if (be_sqlite_store (&ctrl, dbhd, store_request, KBXD_STORE_UPDATE,
+                       PUBKEY_TYPE_OPGP, images[mailkey].ubid,
+                       images[mailkey].data, images[mailkey].len))
+    fail (0);
+  get_sigcache (signee, results);
+  if (results[0] != -1 || results[1] != 1)
+    fail (0);
+  get_sigcache (images[mailkey].ubid, results);
+  if (results[2] != 1)
+    fail (0);
+
+  /* A deletion also forgets the results of the signatures on the
+   * key.  */
+  if (be_sqlite_delete (&ctrl, dbhd, store_request, images[mailkey].ubid))
+    fail (0);
+  get_sigcache (images[mailkey].ubid, results);
+  if (results[2] != -1)
+    fail (0);
+  get_sigcache (signee, results);
+  if (results[1] != 1)
+    fail (0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char *fname;
+  unsigned int stored;
+  int i;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+  opt.quiet = !verbose;
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  fname = xstrconcat (srcdir, "/g10/distsigkey.gpg", NULL);
+  load_images (fname, MAX_IMAGES - 1);
+  xfree (fname);
+  fname = xstrconcat (srcdir, "/g10/t-keydb-get-keyblock.gpg", NULL);
+  mailkey = nimages;
+  load_images (fname, 1);
+  xfree (fname);
+  if (nimages < 4 || mailkey != nimages - 1)
+    fail (0);
+  for (stored = 0, i = 0; i < mailkey; i++)
+    stored |= 1 << i;
+
+  dbname = xasprintf ("t-backend-sqlite-%d.db", (int)getpid ());
+  create_v2_database ();
+
+  if (be_cache_initialize (0))
+    fail (0);
+  memset (&ctrl, 0, sizeof ctrl);
+  ctrl.magic = SERVER_CONTROL_MAGIC;
+  if (be_sqlite_add_resource (&ctrl, &dbhd, dbname, 0))
+    fail (0);
+  store_request = xcalloc (1, sizeof *store_request);
+
+  test_migration (stored);
+  test_store_and_delete (stored);
+  test_sigcache ();
+
+  be_release_request (store_request);
+  xfree (store_request);
+  be_sqlite_release_resource (&ctrl, dbhd);
+  be_sqlite_close_readers ();
+  dotlock_remove_lockfiles ();
+  remove (dbname);
+  fname = xstrconcat (dbname, "-wal", NULL);
+  remove (fname);
+  xfree (fname);
+  fname = xstrconcat (dbname, "-shm", NULL);
+  remove (fname);
+  xfree (fname);
+  xfree (dbname);
+  while (nimages)
+    xfree (images[--nimages].data);
+  if (verbose)
+    fprintf (stderr, PGM ": okay\n");
+  return 0;
+}
@@ -0,0 +1,215 @@
+/* t-kbx-rwlock.c - Tests for the reader/writer lock of keyboxd
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "keyboxd.h"
+#include "kbx-rwlock.h"
+
+#define PGM "t-kbx-rwlock"
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+static struct kbx_rwlock_s the_lock = KBX_RWLOCK_INITIALIZER;
+
+/* The threads append 'r' or 'w' to this string once they got the
+ * lock.  */
+static char order[8];
+static int norder;
+
+
+static void *
+reader_thread (void *arg)
+{
+  (void)arg;
+
+  kbx_rwlock_read (&the_lock);
+  order[norder++] = 'r';
+  kbx_rwlock_release (&the_lock, 0);
+  return NULL;
+}
+
+
+static void *
+writer_thread (void *arg)
+{
+  (void)arg;
+
+  kbx_rwlock_write (&the_lock);
+  order[norder++] = 'w';
+  kbx_rwlock_release (&the_lock, 1);
+  return NULL;
+}
+
+
+static npth_t
+start_thread (void *(*func)(void *))
+{
+  npth_attr_t tattr;
+  npth_t thd;
+
+  if (npth_attr_init (&tattr))
+    fail (0);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  if (npth_create (&thd, &tattr, func, NULL))
+    fail (0);
+  npth_attr_destroy (&tattr);
+  return thd;
+}
+
+
+/* Give the other threads some time to run.  */
+static void
+let_run (void)
+{
+  npth_usleep (50000);
+}
+
+
+/* Return the number of writers waiting for THE_LOCK.  */
+static unsigned int
+waiting_writers (void)
+{
+  unsigned int n;
+
+  npth_mutex_lock (&the_lock.mutex);
+  n = the_lock.waiting_writers;
+  npth_mutex_unlock (&the_lock.mutex);
+  return n;
+}
+
+
+static void
+reset (void)
+{
+  memset (order, 0, sizeof order);
+  norder = 0;
+  memset (&the_lock.stats, 0, sizeof the_lock.stats);
+}
+
+
+/* Readers share the lock.  */
+static void
+test_shared_read (void)
+{
+  struct kbxd_lock_stats_s stats;
+  npth_t thd;
+
+  reset ();
+  kbx_rwlock_read (&the_lock);
+  thd = start_thread (reader_thread);
+  npth_join (thd, NULL);
+  if (strcmp (order, "r"))
+    fail (1);
+  kbx_rwlock_release (&the_lock, 0);
+
+  kbx_rwlock_get_stats (&the_lock, &stats);
+  if (stats.reads != 2 || stats.read_waits || stats.writes)
+    fail (2);
+}
+
+
+/* A writer waits for the readers and blocks new readers.  */
+static void
+test_writer_preferred (void)
+{
+  struct kbxd_lock_stats_s stats;
+  npth_t wthd, rthd;
+  int i;
+
+  reset ();
+  kbx_rwlock_read (&the_lock);
+  wthd = start_thread (writer_thread);
+  for (i=0; i < 100 && !waiting_writers (); i++)
+    let_run ();
+  if (waiting_writers () != 1)
+    fail (1);
+
+  rthd = start_thread (reader_thread);
+  let_run ();
+  if (norder)
+    fail (2);  /* The writer or the second reader got the lock.  */
+
+  kbx_rwlock_release (&the_lock, 0);
+  npth_join (wthd, NULL);
+  npth_join (rthd, NULL);
+  if (strcmp (order, "wr"))
+    fail (3);
+
+  kbx_rwlock_get_stats (&the_lock, &stats);
+  if (stats.reads != 2 || stats.read_waits != 1
+      || stats.writes != 1 || stats.write_waits != 1)
+    fail (4);
+  if (stats.write_wait_ms < 10 || stats.max_wait_ms < stats.write_wait_ms)
+    fail (5);
+}
+
+
+/* A writer excludes readers and other writers.  */
+static void
+test_exclusive_write (void)
+{
+  struct kbxd_lock_stats_s stats;
+  npth_t rthd, wthd;
+
+  reset ();
+  kbx_rwlock_write (&the_lock);
+  rthd = start_thread (reader_thread);
+  wthd = start_thread (writer_thread);
+  let_run ();
+  if (norder)
+    fail (1);
+  kbx_rwlock_release (&the_lock, 1);
+  npth_join (rthd, NULL);
+  npth_join (wthd, NULL);
+  if (norder != 2)
+    fail (2);
+
+  kbx_rwlock_get_stats (&the_lock, &stats);
+  if (stats.writes != 2 || stats.write_waits != 1
+      || stats.reads != 1 || stats.read_waits != 1)
+    fail (3);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+
+  test_shared_read ();
+  test_writer_preferred ();
+  test_exclusive_write ();
+
+  if (verbose)
+    fprintf (stderr, PGM ": okay\n");
+  return 0;
+}
@@ -0,0 +1,371 @@
+/* t-kbx-snapshot.c - Tests for the key snapshots of keyboxd
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+#include "kbx-snapshot.h"
+
+#define PGM "t-kbx-snapshot"
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+/* The snapshot under test.  */
+static char *snapname;
+
+/* The keyblocks taken from the distribution signing keys and a key
+ * with subkeys.  */
+#define MAX_IMAGES 16
+static struct {
+  unsigned char *data;
+  size_t len;
+  unsigned char ubid[UBID_LEN];
+} images[MAX_IMAGES];
+static int nimages;
+
+
+/* Return the content of the file FNAME and store its length at
+ * R_LEN.  */
+static unsigned char *
+read_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  struct stat st;
+  unsigned char *buffer;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    fail (0);
+  buffer = xmalloc (st.st_size + 1);
+  if (st.st_size && fread (buffer, st.st_size, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+  *r_len = st.st_size;
+  return buffer;
+}
+
+
+/* Split the OpenPGP keyring FNAME into its keyblocks and append up to
+ * MAXKEYS of them to IMAGES.  The UBID of a keyblock is the
+ * fingerprint of its primary key truncated to UBID_LEN bytes.  */
+static void
+load_images (const char *fname, int maxkeys)
+{
+  unsigned char *buffer;
+  size_t length, off, nparsed;
+  struct _keybox_openpgp_info info;
+
+  buffer = read_file (fname, &length);
+  for (off = 0; off < length && maxkeys && nimages < MAX_IMAGES;
+       off += nparsed, maxkeys--)
+    {
+      if (_keybox_parse_openpgp (buffer + off, length - off, 0,
+                                 &nparsed, &info))
+        fail (0);
+      memcpy (images[nimages].ubid, info.primary.fpr, UBID_LEN);
+      _keybox_destroy_openpgp_info (&info);
+      images[nimages].data = xmalloc (nparsed);
+      memcpy (images[nimages].data, buffer + off, nparsed);
+      images[nimages].len = nparsed;
+      nimages++;
+    }
+  xfree (buffer);
+}
+
+
+/* Write a snapshot with the first N images and GENERATION.  If
+ * DUPLICATE is set the first image is added twice.  */
+static void
+write_snapshot (int n, unsigned long long generation, int duplicate)
+{
+  kbx_snapshot_builder_t builder;
+  int i;
+
+  if (kbx_snapshot_builder_new (&builder))
+    fail (0);
+  for (i=0; i < n; i++)
+    if (kbx_snapshot_builder_add (builder, images[i].ubid,
+                                  images[i].data, images[i].len))
+      fail (i);
+  if (duplicate
+      && kbx_snapshot_builder_add (builder, images[0].ubid,
+                                   images[0].data, images[0].len))
+    fail (0);
+  if (kbx_snapshot_builder_write (builder, snapname, generation))
+    fail (0);
+  kbx_snapshot_builder_release (builder);
+}
+
+
+/* Search SNAP for DESC and check that exactly the image N is found
+ * with the key PK_NO.  If N is -1 check that nothing is found.  */
+static void
+check_search (kbx_snapshot_t snap, struct keydb_search_desc *desc,
+              int n, int pk_no)
+{
+  struct kbx_snapshot_cursor_s cursor;
+  struct kbx_snapshot_result_s result;
+  gpg_error_t err;
+
+  memset (&cursor, 0, sizeof cursor);
+  if (n != -1)
+    {
+      if (kbx_snapshot_search (snap, desc, &cursor, &result))
+        fail (n);
+      if (memcmp (result.ubid, images[n].ubid, UBID_LEN)
+          || result.bloblen != images[n].len
+          || memcmp (result.blob, images[n].data, result.bloblen)
+          || result.pk_no != pk_no)
+        fail (n);
+    }
+  err = kbx_snapshot_search (snap, desc, &cursor, &result);
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    fail (n);
+}
+
+
+/* Check the searches by fingerprint and long keyid for the key KINFO
+ * which is the key PK_NO of image N.  If N is -1 the key must not be
+ * found.  */
+static void
+check_key (kbx_snapshot_t snap, struct _keybox_openpgp_key_info *kinfo,
+           int n, int pk_no)
+{
+  struct keydb_search_desc desc;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, kinfo->fpr, kinfo->fprlen);
+  desc.fprlen = kinfo->fprlen;
+  check_search (snap, &desc, n, pk_no);
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+  desc.u.kid[0] = buf32_to_u32 (kinfo->keyid);
+  desc.u.kid[1] = buf32_to_u32 (kinfo->keyid + 4);
+  check_search (snap, &desc, n, pk_no);
+}
+
+
+/* Check that all keys of the first NFOUND images are found and those
+ * of the others are not.  */
+static void
+check_images (kbx_snapshot_t snap, int nfound)
+{
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *kinfo;
+  size_t nparsed;
+  int i, pk_no;
+
+  for (i=0; i < nimages; i++)
+    {
+      if (_keybox_parse_openpgp (images[i].data, images[i].len, 0,
+                                 &nparsed, &info))
+        fail (i);
+      check_key (snap, &info.primary, i < nfound? i : -1, 0);
+      pk_no = 1;
+      if (info.nsubkeys)
+        for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
+          check_key (snap, kinfo, i < nfound? i : -1, pk_no++);
+      _keybox_destroy_openpgp_info (&info);
+    }
+}
+
+
+static void
+test_search (void)
+{
+  kbx_snapshot_t snap;
+  struct keydb_search_desc desc;
+  struct kbx_snapshot_cursor_s cursor;
+  struct kbx_snapshot_result_s result;
+
+  write_snapshot (nimages - 1, 1, 1);
+  if (kbx_snapshot_open (snapname, &snap))
+    fail (0);
+  if (kbx_snapshot_generation (snap) != 1
+      || kbx_snapshot_is_stale (snap)
+      || kbx_snapshot_is_replaced (snap))
+    fail (0);
+
+  /* The first image, which has been added twice, is also returned
+   * only once.  */
+  check_images (snap, nimages - 1);
+
+  /* An unknown fingerprint with a known keyid is not found.  */
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, images[0].ubid, UBID_LEN);
+  desc.u.fpr[0] ^= 1;
+  desc.fprlen = 20;
+  check_search (snap, &desc, -1, 0);
+
+  /* Other search modes are left to keyboxd.  */
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_SUBSTR;
+  desc.u.name = "Werner";
+  memset (&cursor, 0, sizeof cursor);
+  if (gpg_err_code (kbx_snapshot_search (snap, &desc, &cursor, &result))
+      != GPG_ERR_NOT_SUPPORTED)
+    fail (0);
+
+  kbx_snapshot_release (snap);
+}
+
+
+/* Check that a mapped snapshot sees the stale flag and stays usable
+ * after it has been replaced.  */
+static void
+test_update (void)
+{
+  kbx_snapshot_t snap, snap2;
+
+  write_snapshot (1, 2, 0);
+  if (kbx_snapshot_open (snapname, &snap))
+    fail (0);
+  if (kbx_snapshot_ref (snap) != snap)
+    fail (0);
+  kbx_snapshot_release (snap);
+
+  if (kbx_snapshot_mark_stale (snapname))
+    fail (0);
+  if (!kbx_snapshot_is_stale (snap) || kbx_snapshot_is_replaced (snap))
+    fail (0);
+
+  write_snapshot (nimages, 3, 0);
+  if (!kbx_snapshot_is_replaced (snap))
+    fail (0);
+  check_images (snap, 1);
+
+  if (kbx_snapshot_open (snapname, &snap2))
+    fail (0);
+  if (kbx_snapshot_generation (snap2) != 3 || kbx_snapshot_is_stale (snap2))
+    fail (0);
+  check_images (snap2, nimages);
+  kbx_snapshot_release (snap2);
+  kbx_snapshot_release (snap);
+
+  /* Marking a removed snapshot is not an error.  */
+  remove (snapname);
+  if (kbx_snapshot_mark_stale (snapname))
+    fail (0);
+}
+
+
+/* Check that damaged files are rejected.  */
+static void
+test_damaged (void)
+{
+  kbx_snapshot_t snap;
+  unsigned char *buffer;
+  size_t length;
+  FILE *fp;
+
+  write_snapshot (2, 4, 0);
+  buffer = read_file (snapname, &length);
+
+  /* A truncated file.  */
+  fp = fopen (snapname, "wb");
+  if (!fp || fwrite (buffer, length - 1, 1, fp) != 1 || fclose (fp))
+    fail (0);
+  if (gpg_err_code (kbx_snapshot_open (snapname, &snap))
+      != GPG_ERR_INV_KEYRING || snap)
+    fail (0);
+
+  /* A wrong magic.  */
+  buffer[0] ^= 1;
+  fp = fopen (snapname, "wb");
+  if (!fp || fwrite (buffer, length, 1, fp) != 1 || fclose (fp))
+    fail (0);
+  if (gpg_err_code (kbx_snapshot_open (snapname, &snap))
+      != GPG_ERR_INV_KEYRING)
+    fail (0);
+
+  /* Too many index records.  */
+  buffer[0] ^= 1;
+  buffer[12] = 0xff;
+  fp = fopen (snapname, "wb");
+  if (!fp || fwrite (buffer, length, 1, fp) != 1 || fclose (fp))
+    fail (0);
+  if (gpg_err_code (kbx_snapshot_open (snapname, &snap))
+      != GPG_ERR_INV_KEYRING)
+    fail (0);
+
+  xfree (buffer);
+  remove (snapname);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char *fname;
+  kbx_snapshot_t snap;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  fname = xstrconcat (srcdir, "/g10/distsigkey.gpg", NULL);
+  load_images (fname, MAX_IMAGES - 1);
+  xfree (fname);
+  fname = xstrconcat (srcdir, "/g10/t-keydb-get-keyblock.gpg", NULL);
+  load_images (fname, 1);
+  xfree (fname);
+  if (nimages < 4)
+    fail (0);
+
+  snapname = xasprintf ("t-kbx-snapshot-%d.snap", (int)getpid ());
+
+  /* Without mmap there is nothing to test.  */
+  write_snapshot (1, 0, 0);
+  if (gpg_err_code (kbx_snapshot_open (snapname, &snap))
+      == GPG_ERR_NOT_SUPPORTED)
+    {
+      remove (snapname);
+      xfree (snapname);
+      return 77;
+    }
+  kbx_snapshot_release (snap);
+
+  test_search ();
+  test_update ();
+  test_damaged ();
+
+  xfree (snapname);
+  while (nimages)
+    xfree (images[--nimages].data);
+  if (verbose)
+    fprintf (stderr, PGM ": okay\n");
+  return 0;
+}
@@ -0,0 +1,293 @@
+/* t-keybox-index.c - Tests for the keybox side index
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+
+#define PGM "t-keybox-index"
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+/* The keybox and its index used by the tests.  */
+static char *kbxname;
+static char *idxname;
+
+
+/* Copy the test keyring of the g10 tests to KBXNAME.  */
+static void
+copy_keyring (void)
+{
+  const char *srcdir;
+  char *srcname;
+  FILE *src, *dst;
+  char buffer[4096];
+  size_t n;
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  srcname = xstrconcat (srcdir, "/g10/t-keydb-keyring.kbx", NULL);
+  src = fopen (srcname, "rb");
+  if (!src)
+    {
+      fprintf (stderr, PGM ": can't open '%s': %s\n", srcname,
+               strerror (errno));
+      exit (1);
+    }
+  dst = fopen (kbxname, "wb");
+  if (!dst)
+    fail (0);
+  while ((n = fread (buffer, 1, sizeof buffer, src)))
+    if (fwrite (buffer, n, 1, dst) != 1)
+      fail (0);
+  if (ferror (src) || fclose (dst))
+    fail (0);
+  fclose (src);
+  xfree (srcname);
+}
+
+
+/* Read the u32 at offset OFF of the file FNAME.  */
+static u32
+read_u32_at (const char *fname, off_t off)
+{
+  unsigned char buf[4];
+  int fd;
+
+  fd = open (fname, O_RDONLY);
+  if (fd == -1 || pread (fd, buf, 4, off) != 4)
+    fail (0);
+  close (fd);
+  return buf32_to_u32 (buf);
+}
+
+
+/* Write A as u32 at offset OFF of the file FNAME.  The modification
+ * time of the file is not changed.  */
+static void
+write_u32_at (const char *fname, off_t off, u32 a)
+{
+  unsigned char buf[4];
+  struct stat st;
+  struct timespec ts[2];
+  int fd;
+
+  ulongtobuf (buf, a);
+  fd = open (fname, O_RDWR);
+  if (fd == -1 || fstat (fd, &st) || pwrite (fd, buf, 4, off) != 4)
+    fail (0);
+  ts[0] = st.st_atim;
+  ts[1] = st.st_mtim;
+  if (futimens (fd, ts))
+    fail (0);
+  close (fd);
+}
+
+
+/* Search for the key with the fingerprint HEXFPR in the keybox at
+ * TOKEN and return true if it has been found.  Every second call
+ * uses the long keyid instead of the fingerprint.  */
+static int
+find_key (void *token, const char *hexfpr)
+{
+  static int use_kid;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  gpg_error_t err;
+
+  memset (&desc, 0, sizeof desc);
+  if (hex2bin (hexfpr, desc.u.fpr, 20) < 0)
+    fail (0);
+  desc.fprlen = 20;
+  if (use_kid)
+    {
+      desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+      desc.u.kid[0] = buf32_to_u32 (desc.u.fpr + 12);
+      desc.u.kid[1] = buf32_to_u32 (desc.u.fpr + 16);
+    }
+  else
+    desc.mode = KEYDB_SEARCH_MODE_FPR;
+  use_kid = !use_kid;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  err = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  keybox_release (hd);
+  if (err && err != -1 && gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      fprintf (stderr, PGM ": search failed: %s\n", gpg_strerror (err));
+      exit (1);
+    }
+  return !err;
+}
+
+
+/* Check that an index is built by an exact search and that it is
+ * used to find the keys.  */
+static void
+test_build_and_lookup (void *token)
+{
+  struct stat st;
+
+  if (!find_key (token, "26895E25E8446D44A26D8FAF2F7998F3DBFC6AD9"))
+    fail (1);
+  if (stat (idxname, &st))
+    fail (2);
+  if (!find_key (token, "26895E25E8446D44A26D8FAF2F7998F3DBFC6AD9"))
+    fail (3);
+  if (!find_key (token, "80615870F5BAD690333686D0F2AD85AC1E42B367"))
+    fail (4);
+  if (!find_key (token, "80615870F5BAD690333686D0F2AD85AC1E42B367"))
+    fail (5);
+  if (find_key (token, "0123456789ABCDEF0123456789ABCDEF01234567"))
+    fail (6);
+  if (find_key (token, "0123456789ABCDEF0123456789ABCDEF01234567"))
+    fail (7);
+}
+
+
+/* Check that a change of the keybox which keeps its size and
+ * modification time is detected by means of the change counter.  */
+static void
+test_staleness (void *token)
+{
+  u32 counter;
+
+  counter = read_u32_at (kbxname, 24);
+  if (read_u32_at (idxname, 40) != counter)
+    fail (1);
+
+  write_u32_at (kbxname, 24, counter + 1);
+  if (!find_key (token, "26895E25E8446D44A26D8FAF2F7998F3DBFC6AD9"))
+    fail (2);
+  /* The index has been rebuilt for the new counter.  */
+  if (read_u32_at (idxname, 40) != counter + 1)
+    fail (3);
+}
+
+
+/* Check that an index with a bogus number of records is rejected
+ * and rebuilt.  */
+static void
+test_bogus_nrecords (void *token)
+{
+  u32 counter, nrecords;
+
+  counter = read_u32_at (kbxname, 24) + 1;
+  nrecords = read_u32_at (idxname, 32);
+  if (!nrecords)
+    fail (1);
+
+  /* Make the index look valid for the next state of the keybox but
+   * claim a huge number of records.  */
+  write_u32_at (idxname, 32, 0x7ffffff0);
+  write_u32_at (idxname, 40, counter);
+  write_u32_at (kbxname, 24, counter);
+  if (!find_key (token, "80615870F5BAD690333686D0F2AD85AC1E42B367"))
+    fail (2);
+  if (read_u32_at (idxname, 32) != nrecords)
+    fail (3);
+  if (read_u32_at (idxname, 40) != counter)
+    fail (4);
+}
+
+
+/* Check that an update of the keybox increments the change counter
+ * and keeps the index valid.  */
+static void
+test_update (void *token)
+{
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  u32 counter;
+
+  counter = read_u32_at (kbxname, 24);
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  hex2bin ("80615870F5BAD690333686D0F2AD85AC1E42B367", desc.u.fpr, 20);
+  desc.fprlen = 20;
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (1);
+  if (keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL))
+    fail (2);
+  if (keybox_set_flags (hd, KEYBOX_FLAG_BLOB, 0, 0))
+    fail (3);
+  keybox_release (hd);
+
+  if (read_u32_at (kbxname, 24) != counter + 1)
+    fail (4);
+  if (read_u32_at (idxname, 40) != counter + 1)
+    fail (5);
+  if (!find_key (token, "80615870F5BAD690333686D0F2AD85AC1E42B367"))
+    fail (6);
+  if (!find_key (token, "26895E25E8446D44A26D8FAF2F7998F3DBFC6AD9"))
+    fail (7);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  void *token;
+  gpg_error_t err;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  kbxname = xasprintf ("t-keybox-index-%d.kbx", (int)getpid ());
+  idxname = xstrconcat (kbxname, ".idx", NULL);
+  copy_keyring ();
+
+  err = keybox_register_file (kbxname, 0, &token);
+  if (err)
+    {
+      fprintf (stderr, PGM ": error registering '%s': %s\n",
+               kbxname, gpg_strerror (err));
+      exit (1);
+    }
+
+  test_build_and_lookup (token);
+  test_staleness (token);
+  test_bogus_nrecords (token);
+  test_update (token);
+
+  remove (idxname);
+  remove (kbxname);
+  xfree (idxname);
+  xfree (kbxname);
+  if (verbose)
+    fprintf (stderr, PGM ": okay\n");
+  return 0;
+}
@@ -0,0 +1,291 @@
+/* t-keybox-uid-filter.c - Tests for the user ID filter of keybox blobs
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+
+#define PGM "t-keybox-uid-filter"
+
+#define get32(a) buf32_to_ulong ((a))
+#define get16(a) buf16_to_ulong ((a))
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+
+/* Return the content of the file FNAME and store its length at
+ * R_LEN.  */
+static unsigned char *
+read_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  struct stat st;
+  unsigned char *buffer;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    fail (0);
+  buffer = xmalloc (st.st_size + 1);
+  if (st.st_size && fread (buffer, st.st_size, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+  *r_len = st.st_size;
+  return buffer;
+}
+
+
+/* Return the user ID filter of the blob BUFFER with LENGTH bytes and
+ * store its length at R_LEN.  This follows uid_filter_may_match.  */
+static const unsigned char *
+get_uid_filter (const unsigned char *buffer, size_t length, size_t *r_len)
+{
+  size_t pos, nres;
+
+  if (length < 40)
+    fail (0);
+  pos = 20 + get16 (buffer + 18) * get16 (buffer + 16);
+  pos += 2 + get16 (buffer + pos);
+  pos += 4 + get16 (buffer + pos) * get16 (buffer + pos + 2);
+  pos += 4 + get16 (buffer + pos) * get16 (buffer + pos + 2) + 16;
+  if (pos + 4 > length)
+    fail (0);
+  nres = get32 (buffer + pos);
+  pos += 4;
+  if (pos + nres > length)
+    fail (0);
+  *r_len = nres;
+  return buffer + pos;
+}
+
+
+/* Check that all substrings of NAME with NAMELEN bytes pass FILTER,
+ * also with a changed case.  */
+static void
+check_substrings (const unsigned char *filter, size_t filterlen,
+                  const unsigned char *name, size_t namelen)
+{
+  char *flipped;
+  size_t off, len, i;
+
+  flipped = xmalloc (namelen + 1);
+  for (i=0; i < namelen; i++)
+    flipped[i] = (i & 1)? ascii_toupper (name[i]) : ascii_tolower (name[i]);
+
+  for (off=0; off < namelen; off++)
+    for (len=1; off + len <= namelen; len++)
+      {
+        if (!_keybox_uid_filter_match (filter, filterlen,
+                                       (const char *)name + off, len))
+          fail (off);
+        if (!_keybox_uid_filter_match (filter, filterlen,
+                                       flipped + off, len))
+          fail (off);
+      }
+  xfree (flipped);
+}
+
+
+/* Check that the mail address of the user ID NAME with NAMELEN bytes
+ * passes FILTER.  Returns true if the user ID has a mail address.  */
+static int
+check_mail (const unsigned char *filter, size_t filterlen,
+            const unsigned char *name, size_t namelen)
+{
+  const unsigned char *s, *e;
+
+  s = memchr (name, '<', namelen);
+  if (!s)
+    return 0;
+  s++;
+  e = memchr (s, '>', namelen - (s - name));
+  if (!e || e == s)
+    return 0;
+  if (!_keybox_uid_filter_match (filter, filterlen,
+                                 (const char *)s, e - s))
+    fail (0);
+  return 1;
+}
+
+
+/* Create the blobs for the keyblocks of the OpenPGP keyring FNAME and
+ * check their user ID filters.  The number of checked user
+ * IDs and of those with a mail address are added to R_NUIDS and
+ * R_NMAILS.  */
+static void
+check_keyring (const char *fname, int *r_nuids, int *r_nmails)
+{
+  unsigned char *buffer;
+  size_t length, off, nparsed, bloblen, filterlen;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_uid_info *u;
+  KEYBOXBLOB blob;
+  const unsigned char *image, *filter;
+
+  buffer = read_file (fname, &length);
+  for (off = 0; off < length; off += nparsed)
+    {
+      if (_keybox_parse_openpgp (buffer + off, length - off, 0,
+                                 &nparsed, &info))
+        fail (0);
+      if (_keybox_create_openpgp_blob (&blob, &info, buffer + off, nparsed, 0))
+        fail (0);
+      image = _keybox_get_blob_image (blob, &bloblen);
+      filter = get_uid_filter (image, bloblen, &filterlen);
+      if (filterlen < 2 || filter[0] != 1 /* UIDFILTER_TYPE */)
+        fail (0);
+
+      /* Make sure that the filter rejects at least something.  */
+      if (_keybox_uid_filter_match (filter, filterlen, "#~#~#~#~#~#~", 12))
+        fail (0);
+
+      if (info.nuids)
+        for (u = &info.uids; u; u = u->next)
+          {
+            check_substrings (filter, filterlen, buffer + off + u->off,
+                              u->len);
+            if (check_mail (filter, filterlen, buffer + off + u->off,
+                            u->len))
+              (*r_nmails)++;
+            (*r_nuids)++;
+          }
+
+      _keybox_release_blob (blob);
+      _keybox_destroy_openpgp_info (&info);
+    }
+  xfree (buffer);
+}
+
+
+/* The plain implementation of ascii_memcasemem.  */
+static const char *
+memcasemem_ref (const char *haystack, size_t nhaystack,
+                const char *needle, size_t nneedle)
+{
+  size_t i;
+
+  if (!nneedle)
+    return haystack;
+  for (i=0; i + nneedle <= nhaystack; i++)
+    if (!ascii_memcasecmp (haystack + i, needle, nneedle))
+      return haystack + i;
+  return NULL;
+}
+
+
+/* Compare ascii_memcasemem with memcasemem_ref for haystacks around
+ * multiples of the vector width.  The few characters make for many
+ * candidates; the non-letters next to the letter ranges and the
+ * letters with the high bit set must not be folded.  */
+static void
+test_memcasemem (void)
+{
+  static const char chars[] = "aAbB@[`{\xc1\xe1";
+  unsigned int seed = 1;
+  char *haystack, *needle;
+  size_t nhaystack, nneedle, i, pos;
+  const char *p, *q;
+  int round;
+
+  for (nhaystack=0; nhaystack <= 80; nhaystack++)
+    for (nneedle=1; nneedle <= 24 && nneedle <= nhaystack + 1; nneedle++)
+      for (round=0; round < 20; round++)
+        {
+          /* Exactly sized buffers to detect overreads.  */
+          haystack = xmalloc (nhaystack? nhaystack : 1);
+          needle = xmalloc (nneedle);
+          for (i=0; i < nhaystack; i++)
+            {
+              seed = seed * 1103515245 + 12345;
+              haystack[i] = chars[(seed >> 16) % (sizeof chars - 1)];
+            }
+          seed = seed * 1103515245 + 12345;
+          if ((round & 1) && nneedle <= nhaystack)
+            {
+              /* Take the needle from the haystack and flip its case.  */
+              pos = (seed >> 16) % (nhaystack - nneedle + 1);
+              for (i=0; i < nneedle; i++)
+                needle[i] = (i & 1)? ascii_toupper (haystack[pos + i])
+                                   : ascii_tolower (haystack[pos + i]);
+            }
+          else
+            for (i=0; i < nneedle; i++)
+              {
+                seed = seed * 1103515245 + 12345;
+                needle[i] = chars[(seed >> 16) % (sizeof chars - 1)];
+              }
+
+          p = ascii_memcasemem (haystack, nhaystack, needle, nneedle);
+          q = memcasemem_ref (haystack, nhaystack, needle, nneedle);
+          if (p != q)
+            {
+              if (verbose)
+                fprintf (stderr, PGM ": nhaystack=%zu nneedle=%zu"
+                         " got %ld expected %ld\n", nhaystack, nneedle,
+                         p? (long)(p - haystack) : -1L,
+                         q? (long)(q - haystack) : -1L);
+              fail (round);
+            }
+          xfree (needle);
+          xfree (haystack);
+        }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char *fname;
+  int nuids = 0;
+  int nmails = 0;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  fname = xstrconcat (srcdir, "/g10/distsigkey.gpg", NULL);
+  check_keyring (fname, &nuids, &nmails);
+  xfree (fname);
+  fname = xstrconcat (srcdir, "/g10/t-keydb-get-keyblock.gpg", NULL);
+  check_keyring (fname, &nuids, &nmails);
+  xfree (fname);
+  /* The dist keys have 5 user IDs without a mail address and the
+   * two keys of the other keyring 12 user IDs with one.  */
+  if (nuids != 17 || nmails != 12)
+    fail (0);
+
+  test_memcasemem ();
+
+  if (verbose)
+    fprintf (stderr, PGM ": %d user ids and %d mail addresses checked\n",
+             nuids, nmails);
+  return 0;
+}
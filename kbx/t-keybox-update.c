@@ -0,0 +1,514 @@
+/* t-keybox-update.c - Tests for the in-place keybox updates
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+
+#define PGM "t-keybox-update"
+
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                      exit (1);                                  \
+                   } while(0)
+
+static int verbose;
+
+/* The keybox under test and its journal.  */
+static char *kbxname;
+static char *jnlname;
+static void *token;
+
+/* The keyblocks taken from the distribution signing keys.  */
+#define MAX_IMAGES 16
+static struct {
+  void *data;
+  size_t len;
+} images[MAX_IMAGES];
+static int nimages;
+
+/* The point at which the journal hook terminates the process.  */
+static int crash_point;
+
+
+static void
+crash_hook (int point)
+{
+  if (point == crash_point)
+    _exit (0);
+}
+
+
+/* Return the content of the file FNAME and store its length at
+ * R_LEN.  */
+static unsigned char *
+read_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  struct stat st;
+  unsigned char *buffer;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    fail (0);
+  buffer = xmalloc (st.st_size + 1);
+  if (st.st_size && fread (buffer, st.st_size, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+  *r_len = st.st_size;
+  return buffer;
+}
+
+
+/* Split the OpenPGP keyring FNAME into its keyblocks.  */
+static void
+load_images (const char *fname)
+{
+  unsigned char *buffer;
+  size_t length, off, nparsed;
+  struct _keybox_openpgp_info info;
+
+  buffer = read_file (fname, &length);
+  for (off = 0; off < length && nimages < MAX_IMAGES; off += nparsed)
+    {
+      if (_keybox_parse_openpgp (buffer + off, length - off, 0,
+                                 &nparsed, &info))
+        fail (0);
+      _keybox_destroy_openpgp_info (&info);
+      images[nimages].data = xmalloc (nparsed);
+      memcpy (images[nimages].data, buffer + off, nparsed);
+      images[nimages].len = nparsed;
+      nimages++;
+    }
+  xfree (buffer);
+  if (nimages < 4)
+    fail (0);
+}
+
+
+/* Search the keybox for the keyblock IMAGES[N].  On success the
+ * handle positioned at the first match is returned; the caller must
+ * release it.  If R_COUNT is not NULL the number of matches is stored
+ * there and NULL is returned.  */
+static KEYBOX_HANDLE
+find_image (int n, int *r_count)
+{
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  void *data;
+  size_t len;
+  int count = 0;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL))
+    {
+      if (keybox_get_data (hd, &data, &len, NULL, NULL))
+        fail (0);
+      if (len == images[n].len && !memcmp (data, images[n].data, len))
+        {
+          count++;
+          if (!r_count)
+            {
+              xfree (data);
+              return hd;
+            }
+        }
+      xfree (data);
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+    }
+  keybox_release (hd);
+  if (r_count)
+    *r_count = count;
+  return NULL;
+}
+
+
+static int
+count_image (int n)
+{
+  int count;
+
+  find_image (n, &count);
+  return count;
+}
+
+
+/* Return the number of empty blobs in the keybox.  */
+static int
+count_empty_blobs (void)
+{
+  unsigned char *buffer;
+  size_t length, off, bloblen;
+  int count = 0;
+
+  buffer = read_file (kbxname, &length);
+  for (off = 0; off + 5 <= length; off += bloblen)
+    {
+      bloblen = buf32_to_size_t (buffer + off);
+      if (bloblen < 5 || off + bloblen > length)
+        fail (0);
+      if (buffer[off + 4] == KEYBOX_BLOBTYPE_EMPTY)
+        count++;
+    }
+  if (off != length)
+    fail (0);
+  xfree (buffer);
+  return count;
+}
+
+
+/* Return true if the keyboxes at A and B, both of LENGTH bytes, have
+ * the same blobs at the same offsets.  The flags and the change
+ * counter in the header blob and the content of empty blobs are not
+ * journaled and thus not compared.  */
+static int
+same_blobs (const unsigned char *a, const unsigned char *b, size_t length)
+{
+  size_t off, bloblen;
+
+  for (off = 0; off + 5 <= length; off += bloblen)
+    {
+      bloblen = buf32_to_size_t (a + off);
+      if (bloblen < 5 || off + bloblen > length
+          || memcmp (a + off, b + off, 5))
+        return 0;
+      if (a[off + 4] != KEYBOX_BLOBTYPE_EMPTY
+          && a[off + 4] != KEYBOX_BLOBTYPE_HEADER
+          && memcmp (a + off, b + off, bloblen))
+        return 0;
+    }
+  return off == length;
+}
+
+
+/* Run FUNC with argument N in a child process which is terminated by
+ * the journal hook at POINT.  Then check that the journal is left
+ * behind and that a recovery restores the keybox.  */
+static void
+crash_and_recover (void (*func) (int n), int n, int point)
+{
+  unsigned char *before, *after;
+  size_t beforelen, afterlen;
+  struct stat st;
+  pid_t pid;
+  int status;
+
+  before = read_file (kbxname, &beforelen);
+
+  fflush (NULL);
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    fail (0);
+  if (!pid)
+    {
+      crash_point = point;
+      _keybox_journal_hook = crash_hook;
+      func (n);
+      _exit (1);  /* The hook has not been called.  */
+    }
+  if (waitpid (pid, &status, 0) != pid
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    fail (1);
+  if (stat (jnlname, &st))
+    fail (2);
+
+  if (_keybox_recover (kbxname))
+    fail (3);
+  if (!stat (jnlname, &st))
+    fail (4);
+
+  after = read_file (kbxname, &afterlen);
+  if (afterlen != beforelen || !same_blobs (before, after, beforelen))
+    fail (5);
+  xfree (before);
+  xfree (after);
+}
+
+
+static void
+do_insert (int n)
+{
+  KEYBOX_HANDLE hd;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  if (keybox_insert_keyblock (hd, images[n].data, images[n].len))
+    fail (0);
+  keybox_release (hd);
+}
+
+
+/* Replace the keyblock IMAGES[N] by IMAGES[N+1].  */
+static void
+do_replace (int n)
+{
+  KEYBOX_HANDLE hd;
+
+  hd = find_image (n, NULL);
+  if (!hd)
+    fail (0);
+  if (keybox_update_keyblock (hd, images[n+1].data, images[n+1].len))
+    fail (0);
+  keybox_release (hd);
+}
+
+
+static void
+do_delete (int n)
+{
+  KEYBOX_HANDLE hd;
+
+  hd = find_image (n, NULL);
+  if (!hd)
+    fail (0);
+  if (keybox_delete (hd))
+    fail (0);
+  keybox_release (hd);
+}
+
+
+/* Do one compaction step which moves at most one blob.  */
+static void
+do_compact_step (int n)
+{
+  KEYBOX_HANDLE hd;
+  int done;
+
+  (void)n;
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  if (keybox_compact_step (hd, 1, &done))
+    fail (0);
+  keybox_release (hd);
+}
+
+
+/* Compact the keybox completely.  */
+static void
+compact_all (void)
+{
+  KEYBOX_HANDLE hd;
+  int done = 0;
+  int i;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  for (i=0; !done; i++)
+    if (i > 100 || keybox_compact_step (hd, 1, &done))
+      fail (0);
+  keybox_release (hd);
+}
+
+
+/* Check that IMAGES[N] is COUNT times in the keybox.  */
+static void
+check_count (int n, int count)
+{
+  if (count_image (n) != count)
+    {
+      fprintf (stderr, PGM ": key %d found %d times; expected %d\n",
+               n, count_image (n), count);
+      fail (0);
+    }
+}
+
+
+static void
+test_append (void)
+{
+  int i;
+
+  for (i=0; i < nimages; i++)
+    do_insert (i);
+  for (i=0; i < nimages; i++)
+    check_count (i, 1);
+  if (count_empty_blobs ())
+    fail (1);
+}
+
+
+/* Replace a keyblock by a shorter one and by a longer one.  */
+static void
+test_replace (void)
+{
+  int i;
+
+  /* Make sure that the first two keyblocks differ in length by at
+   * least the size of an empty blob so that the first replacement is
+   * done in place.  */
+  for (i=1; i < nimages; i++)
+    if (images[i].len + 5 <= images[0].len || images[0].len + 5 <= images[i].len)
+      break;
+  if (i == nimages)
+    fail (1);
+  if (i != 1)
+    {
+      void *data = images[1].data;
+      size_t len = images[1].len;
+
+      images[1].data = images[i].data;
+      images[1].len = images[i].len;
+      images[i].data = data;
+      images[i].len = len;
+    }
+  if (images[0].len < images[1].len)
+    {
+      void *data = images[0].data;
+      size_t len = images[0].len;
+
+      images[0].data = images[1].data;
+      images[0].len = images[1].len;
+      images[1].data = data;
+      images[1].len = len;
+    }
+
+  /* Shorter: written in place followed by an empty blob.  */
+  do_replace (0);
+  check_count (0, 0);
+  check_count (1, 2);
+  if (count_empty_blobs () != 1)
+    fail (2);
+
+  /* Longer: the old blob is deleted and the new one appended.  Note
+   * that images[1] is now stored twice; we replace the first one
+   * which is the original slot of images[0].  */
+  {
+    void *data = images[1].data;
+    size_t len = images[1].len;
+
+    images[1].data = images[0].data;
+    images[1].len = images[0].len;
+    images[0].data = data;
+    images[0].len = len;
+  }
+  do_replace (0);
+  check_count (0, 1);
+  check_count (1, 1);
+  if (count_empty_blobs () != 2)
+    fail (3);
+  for (i=2; i < nimages; i++)
+    check_count (i, 1);
+}
+
+
+/* Terminate the process within updates and check the rollback.  */
+static void
+test_rollback (void)
+{
+  int i;
+
+  /* Delete the last key so that we can insert it again.  */
+  do_delete (nimages - 1);
+  check_count (nimages - 1, 0);
+
+  crash_and_recover (do_insert, nimages - 1, 1);
+  check_count (nimages - 1, 0);
+  crash_and_recover (do_insert, nimages - 1, 2);
+  check_count (nimages - 1, 0);
+
+  crash_and_recover (do_replace, 2, 1);
+  check_count (2, 1);
+  check_count (3, 1);
+  crash_and_recover (do_replace, 2, 2);
+  check_count (2, 1);
+  check_count (3, 1);
+
+  crash_and_recover (do_compact_step, 0, 1);
+  crash_and_recover (do_compact_step, 0, 2);
+
+  for (i=0; i < nimages - 1; i++)
+    check_count (i, 1);
+}
+
+
+static void
+test_compaction (void)
+{
+  int i;
+
+  do_delete (1);
+  compact_all ();
+  if (count_empty_blobs ())
+    fail (1);
+  check_count (1, 0);
+  check_count (nimages - 1, 0);
+  for (i=0; i < nimages - 1; i++)
+    if (i != 1)
+      check_count (i, 1);
+
+  /* The keybox is still usable after the compaction.  */
+  do_insert (1);
+  check_count (1, 1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char *srcname;
+  gpg_error_t err;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  keybox_set_update_in_place (1);
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  srcname = xstrconcat (srcdir, "/g10/distsigkey.gpg", NULL);
+  load_images (srcname);
+  xfree (srcname);
+
+  kbxname = xasprintf ("t-keybox-update-%d.kbx", (int)getpid ());
+  jnlname = xstrconcat (kbxname, ".jnl", NULL);
+  err = keybox_register_file (kbxname, 0, &token);
+  if (err)
+    fail (0);
+
+  test_append ();
+  test_replace ();
+  test_rollback ();
+  test_compaction ();
+
+  remove (jnlname);
+  remove (kbxname);
+  xfree (jnlname);
+  xfree (kbxname);
+  while (nimages)
+    xfree (images[--nimages].data);
+  if (verbose)
+    fprintf (stderr, PGM ": okay\n");
+  return 0;
+}
@@ -34,6 +34,7 @@
 #include "../common/i18n.h"
 #include "../common/asshelp.h"
 #include "../common/comopt.h"
+#include "../common/membuf.h"
 #include "../kbx/kbx-client-util.h"
 
 
@@ -84,6 +85,11 @@ struct keydb_local_s
 
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
+
+  /* Flags telling whether the keyboxd supports SEARCH --multi and
+   * whether we already asked for it.  */
+  unsigned int multi_search_checked : 1;
+  unsigned int multi_search : 1;
 };
 
 
@@ -1605,6 +1611,162 @@ search_status_cb (void *opaque, const char *line)
   return err;
 }
 
+/* Return true if the keyboxd connected via KBL supports SEARCH
+ * --multi.  */
+static int
+have_multi_search (keydb_local_t kbl)
+{
+  if (!kbl->multi_search_checked)
+    {
+      kbl->multi_search = !assuan_transact (kbl->ctx,
+                                            "GETINFO cmd_has_option"
+                                            " SEARCH multi",
+                                            NULL, NULL, NULL, NULL,
+                                            NULL, NULL);
+      kbl->multi_search_checked = 1;
+    }
+  return kbl->multi_search;
+}
+
+
+/* Communication object for SEARCH --multi.  */
+struct search_parm_s
+{
+  assuan_context_t ctx;
+  const char *patterns;  /* LF delimited list of patterns.  */
+  size_t patternslen;    /* The length of PATTERNS.  */
+};
+
+
+/* Handle the inquiries from the SEARCH command.  */
+static gpg_error_t
+search_inq_cb (void *opaque, const char *line)
+{
+  struct search_parm_s *parm = opaque;
+  gpg_error_t err = 0;
+
+  if (has_leading_keyword (line, "PATTERNS"))
+    {
+      if (parm->patterns)
+        err = assuan_send_data (parm->ctx, parm->patterns, parm->patternslen);
+    }
+  else
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  return err;
+}
+
+
+/* Format the search description DESC as a keyboxd search pattern and
+ * store it as a malloced string at R_PATTERN.  */
+static gpg_error_t
+format_search_pattern (KEYDB_SEARCH_DESC *desc, char **r_pattern)
+{
+  char *pattern;
+
+  *r_pattern = NULL;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+      pattern = strconcat ("=", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBSTR:
+      pattern = strconcat ("*", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      pattern = strconcat ("<", desc->u.name + (desc->u.name[0] == '<'),
+                           NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      pattern = strconcat ("@", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
+      pattern = strconcat (".", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_WORDS:
+      pattern = strconcat ("+", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      pattern = xtryasprintf ("0x%08lX", (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      pattern = xtryasprintf ("0x%08lX%08lX",
+                              (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      {
+        unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
+        log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+        bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
+        pattern = strconcat ("0x", (char *)hexfpr, NULL);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+      pattern = strconcat ("#/", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+      if (desc->snhex)
+        pattern = xtryasprintf ("#%.*s/%s",
+                                (int)desc->snlen, desc->sn, desc->u.name);
+      else
+        {
+          char *hexsn = bin2hex (desc->sn, desc->snlen, NULL);
+          if (!hexsn)
+            return gpg_error_from_syserror ();
+          pattern = strconcat ("#", hexsn, "/", desc->u.name, NULL);
+          xfree (hexsn);
+        }
+      break;
+
+    case KEYDB_SEARCH_MODE_SN:
+      pattern = strconcat ("#", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      pattern = strconcat ("/", desc->u.name, NULL);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      {
+        unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
+        bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
+        pattern = strconcat ("&", (char *)hexgrip, NULL);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      {
+        unsigned char hexubid[UBID_LEN * 2 + 1];
+        bin2hex (desc->u.ubid, UBID_LEN, hexubid);
+        pattern = strconcat ("^", (char *)hexubid, NULL);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_FIRST:
+      log_debug ("%s: mode first - we should not get to here!\n", __func__);
+      /*fallthru*/
+    default:
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  if (!pattern)
+    return gpg_error_from_syserror ();
+  *r_pattern = pattern;
+  return 0;
+}
+
+
 /* Search through all keydb resources, starting at the current
  * position, for a keyblock which contains one of the keys described
  * in the DESC array.  In keyboxd mode the search is instead delegated
@@ -1632,6 +1794,9 @@ keydb_search (ctrl_t ctrl, KEYDB_HANDLE hd,
   gpg_error_t err = gpg_error (GPG_ERR_EOF);
   unsigned long skipped = 0;
   int i;
+  struct search_parm_s parm = {NULL};
+  char *pattern = NULL;
+  char *multi_patterns = NULL;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1701,124 +1866,55 @@ keydb_search (ctrl_t ctrl, KEYDB_HANDLE hd,
             goto do_search;
           }
 
-      for (i=0 ; i < ndesc; i++)
+      if (ndesc > 1 && have_multi_search (hd->kbl))
         {
-          int moretocome = (i + 1 < ndesc);
-          const char *more = moretocome? "--x509 --more" : "--x509";
+          /* Send all patterns at once.  */
+          membuf_t mb;
 
-          switch (desc->mode)
+          init_membuf (&mb, 1024);
+          for (i=0; i < ndesc; i++)
             {
-            case KEYDB_SEARCH_MODE_EXACT:
-              snprintf (line, sizeof line, "SEARCH %s =%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_SUBSTR:
-              snprintf (line, sizeof line, "SEARCH %s *%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_MAIL:
-              snprintf (line, sizeof line, "SEARCH %s <%s",
-                        more, desc[i].u.name + (desc[i].u.name[i] == '<'));
-              break;
-
-            case KEYDB_SEARCH_MODE_MAILSUB:
-              snprintf (line, sizeof line, "SEARCH %s @%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_MAILEND:
-              snprintf (line, sizeof line, "SEARCH %s .%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_WORDS:
-              snprintf (line, sizeof line, "SEARCH %s +%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_SHORT_KID:
-              snprintf (line, sizeof line, "SEARCH %s 0x%08lX", more,
-                        (ulong)desc[i].u.kid[1]);
-              break;
-
-            case KEYDB_SEARCH_MODE_LONG_KID:
-              snprintf (line, sizeof line, "SEARCH %s 0x%08lX%08lX", more,
-                        (ulong)desc[i].u.kid[0], (ulong)desc[i].u.kid[1]);
-              break;
-
-            case KEYDB_SEARCH_MODE_FPR:
-              {
-                unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
-                log_assert (desc[i].fprlen <= MAX_FINGERPRINT_LEN);
-                bin2hex (desc[i].u.fpr, desc[i].fprlen, hexfpr);
-                snprintf (line, sizeof line, "SEARCH %s 0x%s", more, hexfpr);
-              }
-              break;
-
-            case KEYDB_SEARCH_MODE_ISSUER:
-              snprintf (line, sizeof line, "SEARCH %s #/%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_ISSUER_SN:
-              if (desc[i].snhex)
-                snprintf (line, sizeof line, "SEARCH %s #%.*s/%s", more,
-                          (int)desc[i].snlen, desc[i].sn, desc[i].u.name);
-              else
+              err = format_search_pattern (desc + i, &pattern);
+              if (err)
                 {
-                  char *hexsn = bin2hex (desc[i].sn, desc[i].snlen, NULL);
-                  if (!hexsn)
-                    {
-                      err = gpg_error_from_syserror ();
-                      goto leave;
-                    }
-                  snprintf (line, sizeof line, "SEARCH %s #%s/%s",
-                            more, hexsn, desc[i].u.name);
-                  xfree (hexsn);
+                  xfree (get_membuf (&mb, NULL));
+                  goto leave;
                 }
-              break;
-
-            case KEYDB_SEARCH_MODE_SN:
-              snprintf (line, sizeof line, "SEARCH %s #%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_SUBJECT:
-              snprintf (line, sizeof line, "SEARCH %s /%s",
-                        more, desc[i].u.name);
-              break;
-
-            case KEYDB_SEARCH_MODE_KEYGRIP:
-              {
-                unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
-                bin2hex (desc[i].u.grip, KEYGRIP_LEN, hexgrip);
-                snprintf (line, sizeof line, "SEARCH %s &%s", more, hexgrip);
-              }
-              break;
+              put_membuf_str (&mb, pattern);
+              put_membuf (&mb, "\n", 1);
+              xfree (pattern);
+              pattern = NULL;
+            }
+          multi_patterns = get_membuf (&mb, &parm.patternslen);
+          if (!multi_patterns)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          parm.patterns = multi_patterns;
+          snprintf (line, sizeof line, "SEARCH --x509 --multi");
+          goto do_search;
+        }
 
-            case KEYDB_SEARCH_MODE_UBID:
-              {
-                unsigned char hexubid[UBID_LEN * 2 + 1];
-                bin2hex (desc[i].u.ubid, UBID_LEN, hexubid);
-                snprintf (line, sizeof line, "SEARCH %s ^%s", more, hexubid);
-              }
-              break;
+      for (i=0 ; i < ndesc; i++)
+        {
+          int moretocome = (i + 1 < ndesc);
+          const char *more = moretocome? "--x509 --more" : "--x509";
 
-            case KEYDB_SEARCH_MODE_NEXT:
+          if (desc[i].mode == KEYDB_SEARCH_MODE_NEXT)
+            {
               log_debug ("%s: mode next - we should not get to here!\n",
                          __func__);
               snprintf (line, sizeof line, "NEXT --x509");
-              break;
-
-            case KEYDB_SEARCH_MODE_FIRST:
-              log_debug ("%s: mode first - we should not get to here!\n",
-                         __func__);
-              /*fallthru*/
-            default:
-              err = gpg_error (GPG_ERR_INV_ARG);
-              goto leave;
+            }
+          else
+            {
+              err = format_search_pattern (desc + i, &pattern);
+              if (err)
+                goto leave;
+              snprintf (line, sizeof line, "SEARCH %s %s", more, pattern);
+              xfree (pattern);
+              pattern = NULL;
             }
 
           if (moretocome)
@@ -1839,7 +1935,11 @@ keydb_search (ctrl_t ctrl, KEYDB_HANDLE hd,
       if (strlen (line) + 5 >= sizeof line)
         err = gpg_error (GPG_ERR_ASS_LINE_TOO_LONG);
       else
-        err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
+        {
+          parm.ctx = hd->kbl->ctx;
+          err = kbx_client_data_cmd (hd->kbl->kcd, line, search_inq_cb, &parm,
+                                     search_status_cb, hd);
+        }
       if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd,
                                                 &hd->kbl->search_result.buf,
                                                 &hd->kbl->search_result.len)))
@@ -1886,6 +1986,8 @@ keydb_search (ctrl_t ctrl, KEYDB_HANDLE hd,
     }
 
  leave:
+  xfree (pattern);
+  xfree (multi_patterns);
   /* The NOTHING_FOUND error is triggered by a NEXT command.  */
   if (gpg_err_code (err) == GPG_ERR_EOF
       || gpg_err_code (err) == GPG_ERR_NOTHING_FOUND)
@@ -0,0 +1,80 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-environment)
+
+;; The keyboxd would not store the damaged keyblock and ignores
+;; --keyring.
+(when (flag "--use-keyboxd" *args*)
+      (skip "keyboxd is used"))
+
+(setenv "PINENTRY_USER_DATA" "test" #t)
+
+(define (uid n)
+  (string-append "Uid " (number->string n)
+		 " <u" (number->string n) "@invalid.example.net>"))
+
+;; Each user id adds a self-signature; a batch needs at least 8.
+(define nuids 12)
+
+(info "Creating a key with" nuids "user ids...")
+(call-check `(,@GPG --quick-generate-key ,(uid 0) ed25519 cert never))
+(let loop ((n 1))
+  (when (< n nuids)
+	(call-check `(,@GPG --quick-add-uid ,(uid 0) ,(uid n)))
+	(loop (+ n 1))))
+
+;; Damage the last byte of the keyblock, which belongs to the value of
+;; the signature of the last user id.
+(call-check `(,@GPG --output "damaged.gpg" --export ,(uid 0)))
+(let* ((data (call-with-binary-input-file "damaged.gpg" read-all))
+       (last (- (string-length data) 1)))
+  (string-set! data last (if (char=? (string-ref data last) #\a) #\b #\a))
+  (catch '() (unlink "damaged.gpg"))
+  (call-with-binary-output-file "damaged.gpg"
+				(lambda (port) (display data port))))
+
+;; Return the validity flags of the signatures listed by --check-sigs
+;; and the output on stderr.
+(define (check-sigs . args)
+  (let ((result (call-with-io `(,@GPG --no-default-keyring
+				      --keyring ./damaged.gpg
+				      --with-colons --check-sigs
+				      ,@args)
+			      "")))
+    (unless (= 0 (:retcode result))
+	    (fail "--check-sigs failed:" (:stderr result)))
+    (list (map (lambda (line) (list-ref (string-split line #\:) 1))
+	       (filter (lambda (line) (string-prefix? line "sig:"))
+		       (string-split-newlines (:stdout result))))
+	  (:stderr result))))
+
+(info "Checking the signatures serially and in parallel...")
+(let ((serial (car (check-sigs)))
+      (parallel (check-sigs '--compatibility-flags 'parallelized
+			    '--debug 'crypto)))
+  (unless (and (= nuids (length serial))
+	       (equal? (reverse serial)
+		       (cons "-" (map (lambda (x) "!") (cdr serial)))))
+	  (fail "Unexpected result of the serial check:" serial))
+  (unless (equal? serial (car parallel))
+	  (fail "Parallel check differs:" (car parallel) "expected:" serial))
+  (unless (string-contains? (cadr parallel) "sig-check: verifying")
+	  (skip "Signatures have not been verified in parallel")))
@@ -34,3 +34,70 @@
        (tr:assert-identity source)))
     (append plain-files data-files)))
  (force all-compression-algos))
+
+;; Check that incompressible data is stored uncompressed and that
+;; this decision is reported only if the sample was large enough.
+(define random-file "compression-random")
+(call-with-binary-output-file
+ random-file
+ (lambda (port)
+   (display (make-random-string 200000) port)))
+
+(for-each-p
+ "Checking the compression decision"
+ (lambda (test)
+   (let ((source (car test))
+	 (expected (cadr test)))
+     (tr:do
+      (tr:open source)
+      (tr:gpgstatus "" `(--yes --encrypt --recipient ,usrname2
+			       --compress-algo zip))
+      (tr:call-with-content
+       (lambda (c)
+	 (if expected
+	     (unless (string-contains? c expected)
+		     (fail (string-append "Unexpected status: " c)))
+	     (when (string-contains? c "[GNUPG:] COMPRESSION_INFO")
+		   (fail (string-append "Unexpected status: " c)))))))
+     (tr:do
+      (tr:open source)
+      (tr:gpg "" `(--yes --encrypt --recipient ,usrname2
+			 --compress-algo zip))
+      (tr:gpg "" '(--yes --decrypt))
+      (tr:assert-identity source))))
+ `((,random-file "[GNUPG:] COMPRESSION_INFO 1 0 ")
+   ("plain-large" "[GNUPG:] COMPRESSION_INFO 1 1 ")
+   ("plain-1" #f)))
+
+;; Parallel compression splits the data into blocks of 128k, thus use
+;; a larger compressible file as well.  Note that random data is not
+;; compressed at all.
+(define large-file "compression-large")
+(call-with-binary-output-file
+ large-file
+ (lambda (port)
+   (let loop ((i 0))
+     (if (< i 3000)
+	 (begin
+	   (display (make-random-string (modulo (* i 37) 16)) port)
+	   (for-each (lambda (line) (display line port) (newline port))
+		     (list "The quick brown fox jumps over the lazy dog"
+			   "Pack my box with five dozen liquor jugs"
+			   (number->string (* i 7919))))
+	   (loop (+ i 1)))))))
+
+(for-each-p
+ "Checking encryption using parallel compression"
+ (lambda (compression)
+   (for-each-p
+    ""
+    (lambda (source)
+      (tr:do
+       (tr:open source)
+       (tr:gpg "" `(--yes --encrypt --recipient ,usrname2
+			  --compress-algo ,compression
+			  --compatibility-flags parallelized))
+       (tr:gpg "" '(--yes --decrypt))
+       (tr:assert-identity source)))
+    (append plain-files (list large-file))))
+ '("zip" "zlib"))
@@ -80,6 +80,27 @@
     (tr:assert-identity source)))
  all-files)
 
+(for-each-p
+ "Checking OCB mode with parallelized chunk encryption"
+ (lambda (source)
+   (tr:do
+    (tr:open source)
+    (tr:gpg "" `(--yes -er ,"patrice.lumumba" --chunk-size 10
+                 --compatibility-flags parallelized))
+    (tr:gpg "" '(--yes -d))
+    (tr:assert-identity source)))
+ all-files)
+
+(for-each-p
+ "Checking OCB mode with parallelized chunk decryption"
+ (lambda (source)
+   (tr:do
+    (tr:open source)
+    (tr:gpg "" `(--yes -er ,"patrice.lumumba" --chunk-size 10))
+    (tr:gpg "" '(--yes -d --compatibility-flags parallelized))
+    (tr:assert-identity source)))
+ all-files)
+
 ;; For reference:
 ;;   BEGIN_ENCRYPTION  <mdc_method> <sym_algo> [<aead_algo>]
 
@@ -0,0 +1,186 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(unless (flag "--use-keyboxd" *args*)
+	(skip "keyboxd is not used"))
+
+;; Send the command LINES to the keyboxd and return its responses.
+(define (keyboxd-transact . lines)
+  (call-popen `(,(tool 'gpg-connect-agent) --keyboxd
+		--keyboxd-program ,(tool 'keyboxd))
+	      (apply string-append
+		     (map (lambda (l) (string-append l "\n"))
+			  (append lines '("/bye"))))))
+
+;; Return the lines of the response C starting with PREFIX.
+(define (response-lines c prefix)
+  (filter (lambda (line) (string-prefix? line prefix))
+	  (string-split-newlines c)))
+
+;; Return the UBIDs of the PUBKEY_INFO lines of the response C.
+(define (pubkey-info-ubids c)
+  (map (lambda (line) (list-ref (string-split line #\space) 3))
+       (response-lines c "S PUBKEY_INFO ")))
+
+;; Write the length prefixed keyblocks of FILES to NAME.
+(define (write-blobs name files)
+  (call-with-binary-output-file
+   name
+   (lambda (port)
+     (for-each
+      (lambda (file)
+	(let* ((data (call-with-binary-input-file file read-all))
+	       (len (string-length data)))
+	  (for-each
+	   (lambda (div)
+	     (write-char (integer->char (remainder (quotient len div) 256))
+			 port))
+	   '(16777216 65536 256 1))
+	  (display data port)))
+      files))))
+
+(define (have-key? fpr)
+  (= 0 (call `(,@gpg --list-keys ,fpr))))
+
+
+(info "Checking that the keyboxd supports the new options.")
+(let ((c (keyboxd-transact "GETINFO cmd_has_option SEARCH multi"
+			   "GETINFO cmd_has_option STORE batch")))
+  (unless (= 2 (length (response-lines c "OK")))
+	  (fail "Options not supported:" c)))
+
+(info "Checking SEARCH --multi.")
+(call-with-output-file "patterns"
+  (lambda (port)
+    (display (string-append "0x" keys::alfa::fpr "\n"
+			    "0x" keys::one::fpr "\n")
+	     port)))
+(let* ((c (keyboxd-transact "/definqfile PATTERNS patterns"
+			    "SEARCH --no-data --openpgp --multi"
+			    "NEXT --no-data"
+			    "NEXT --no-data"))
+       (ubids (pubkey-info-ubids c)))
+  (unless (and (= 2 (length ubids))
+	       (member keys::alfa::fpr ubids)
+	       (member keys::one::fpr ubids))
+	  (fail "Unexpected result of SEARCH --multi:" c))
+  (unless (= 1 (length (response-lines c "ERR ")))
+	  (fail "Missing end of search:" c)))
+
+;; The first search puts the key into the cache; the second must not
+;; return it from there despite the key type filter.
+(info "Checking SEARCH by UBID with a key type filter.")
+(let ((c (keyboxd-transact (string-append "SEARCH --no-data ^" keys::alfa::fpr)
+			   (string-append "SEARCH --no-data --x509 ^"
+					  keys::alfa::fpr))))
+  (unless (equal? (list keys::alfa::fpr) (pubkey-info-ubids c))
+	  (fail "Unexpected result of SEARCH --x509 by UBID:" c)))
+
+(info "Checking SEARCH --multi with a pattern longer than a line.")
+(call-with-output-file "patterns"
+  (lambda (port)
+    (display (string-append "=" (make-string 2000 #\x) "\n") port)))
+(let ((c (keyboxd-transact "/definqfile PATTERNS patterns"
+			   "SEARCH --no-data --openpgp --multi")))
+  (unless (and (null? (pubkey-info-ubids c))
+	       (string-contains? c "Not found"))
+	  (fail "Unexpected result for a long pattern:" c)))
+
+(define fpr1 "9E669861368BCA0BE42DAF7DDDA252EBB8EBE1AF")
+(define fpr2 "A55120427374F3F7AA5F1166DDA252EBB8EBE1AF")
+(call-check `(,@gpg --import
+		    ,(in-srcdir "tests" "openpgp" "samplekeys/dda252ebb8ebe1af-1.asc")
+		    ,(in-srcdir "tests" "openpgp" "samplekeys/dda252ebb8ebe1af-2.asc")))
+(call-check `(,@gpg --output "key1" --export ,fpr1))
+(call-check `(,@gpg --output "key2" --export ,fpr2))
+
+(info "Checking STORE --batch.")
+(call-check `(,@gpg --batch --yes --delete-keys ,fpr1 ,fpr2))
+(write-blobs "blobs" '("key1" "key2"))
+(let ((c (keyboxd-transact "/definqfile BLOBS blobs"
+			   "STORE --insert --batch")))
+  (unless (and (member "S STORED 2" (response-lines c "S STORED"))
+	       (= 1 (length (response-lines c "OK"))))
+	  (fail "Unexpected result of STORE --batch:" c)))
+(unless (and (have-key? fpr1) (have-key? fpr2))
+	(fail "Keys not stored by STORE --batch"))
+
+(info "Checking STORE --batch with a failing key.")
+(call-check `(,@gpg --batch --yes --delete-keys ,fpr2))
+(write-blobs "blobs" '("key2" "key1"))
+(let ((c (keyboxd-transact "/definqfile BLOBS blobs"
+			   "STORE --insert --batch")))
+  (unless (and (= 1 (length (response-lines c "S STORE_FAILED 1 ")))
+	       (= 1 (length (response-lines c "ERR "))))
+	  (fail "Failing key not reported by STORE --batch:" c)))
+
+(info "Checking a bulk import.")
+(call-check `(,@gpg --batch --yes --delete-keys ,fpr1))
+(call-check `(,@gpg --import-options bulk-import --import "key1" "key2"))
+(unless (and (have-key? fpr1) (have-key? fpr2))
+	(fail "Keys not stored by the bulk import"))
+
+;; Return the binary string for the hex string HEX.
+(define (hex->string hex)
+  (let loop ((i 0) (acc '()))
+    (if (>= i (string-length hex))
+	(list->string (reverse acc))
+	(loop (+ i 2)
+	      (cons (integer->char
+		     (string->number (substring hex i (+ i 2)) 16))
+		    acc)))))
+
+(info "Checking PUTSIGCACHE and GETSIGCACHE.")
+(call-with-binary-output-file
+ "sigcache"
+ (lambda (port)
+   (display (string-append (hex->string fpr1)
+			   (make-string 32 #\x)
+			   (string (integer->char 1) (integer->char 20))
+			   (hex->string fpr2))
+	    port)))
+(let ((c (keyboxd-transact "/definqfile SIGCACHE sigcache"
+			   "PUTSIGCACHE"
+			   (string-append "GETSIGCACHE " fpr1))))
+  (unless (and (member "S STORED 1" (response-lines c "S STORED"))
+	       (= 1 (length (response-lines c "D "))))
+	  (fail "Unexpected result of PUTSIGCACHE:" c)))
+;; Deleting the signer forgets the result.
+(call-check `(,@gpg --batch --yes --delete-keys ,fpr2))
+(let ((c (keyboxd-transact (string-append "GETSIGCACHE " fpr1))))
+  (unless (null? (response-lines c "D "))
+	  (fail "Result of a deleted signer still cached:" c)))
+
+(info "Checking the transfer of a large keyblock.")
+;; This keyblock is larger than the threshold for passing it as file
+;; descriptor instead of through the data pipe.
+(define fpr3 "80615870F5BAD690333686D0F2AD85AC1E42B367")
+(call-check `(,@gpg --import ,(in-srcdir "g10" "t-keydb-get-keyblock.gpg")))
+(call-check `(,@gpg --output "key3" --export ,fpr3))
+(unless (> (string-length (call-with-binary-input-file "key3" read-all))
+	   65536)
+	(fail "Exported keyblock unexpectedly small"))
+(call-check `(,@gpg --batch --yes --delete-keys ,fpr3))
+(call-check `(,@gpg --import "key3"))
+(call-check `(,@gpg --output "key3-again" --export ,fpr3))
+(unless (file=? "key3" "key3-again")
+	(fail "Large keyblock changed by a round trip"))
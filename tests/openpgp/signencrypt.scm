@@ -30,6 +30,17 @@
     (tr:assert-identity source)))
  (append plain-files data-files))
 
+(for-each-p
+ "Checking signing and encryption using worker threads"
+ (lambda (source)
+   (tr:do
+    (tr:open source)
+    (tr:gpg usrpass1 `(--yes --passphrase-fd "0" -se --recipient ,usrname2
+			     --compatibility-flags parallelized))
+    (tr:gpg "" '(--yes --decrypt))
+    (tr:assert-identity source)))
+ (append plain-files data-files))
+
 (info "Checking bug 537: MDC problem with old style compressed packets.")
 (lettmp (tmp)
   (call-popen `(,@GPG --yes --passphrase-fd "0"
@@ -31,6 +31,7 @@
       (all-tests (append
 		  (load-tests-with-log "common")
 		  (load-tests-with-log "g10")
+		  (load-tests-with-log "kbx")
 		  (load-tests-with-log "g13")
 		  (load-tests-with-log "agent")
 		  (load-tests-with-log "tests" "openpgp")
@@ -537,6 +537,8 @@ static known_option_t known_options_keyboxd[] =
    { "quiet",             GC_OPT_FLAG_NONE, GC_LEVEL_BASIC },
    { "log-file",          GC_OPT_FLAG_NONE, GC_LEVEL_ADVANCED,
                           GC_ARG_TYPE_FILENAME },
+   { "cache-size",        GC_OPT_FLAG_NONE, GC_LEVEL_EXPERT },
+   { "publish-snapshot",  GC_OPT_FLAG_NONE, GC_LEVEL_EXPERT },
    { "faked-system-time", GC_OPT_FLAG_NONE, GC_LEVEL_INVISIBLE },
 
    { NULL }